@@ -0,0 +1,11 @@
+// Tight loop: one assign and one loop condition per iteration.
+#include <stdio.h>
+
+int main() {
+    long sum = 0;
+    for (int i = 0; i < 200000; i++) {
+        sum += i % 7;
+    }
+    printf("%ld\n", sum);
+    return 0;
+}
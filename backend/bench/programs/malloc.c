@@ -0,0 +1,16 @@
+// Malloc churn: allocate, write and free a block per iteration.
+#include <stdio.h>
+#include <stdlib.h>
+
+int main() {
+    long sum = 0;
+    for (int i = 0; i < 50000; i++) {
+        int *p;
+        p = (int*)malloc(4 * sizeof(int));
+        p[0] = i;
+        sum += p[0];
+        free(p);
+    }
+    printf("%ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,15 @@
+// Matrix fill: 2-D element writes.
+#include <stdio.h>
+
+int main() {
+    int m[100][100];
+    for (int pass = 0; pass < 5; pass++) {
+        for (int i = 0; i < 100; i++) {
+            for (int j = 0; j < 100; j++) {
+                m[i][j] = i * j + pass;
+            }
+        }
+    }
+    printf("%d\n", m[99][99]);
+    return 0;
+}
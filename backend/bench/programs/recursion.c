@@ -0,0 +1,19 @@
+// Deep recursion: function enter/exit per frame, 5000 frames deep.
+#include <stdio.h>
+
+int calls = 0;
+
+void descend(int n) {
+    calls++;
+    if (n > 0) {
+        descend(n - 1);
+    }
+}
+
+int main() {
+    for (int r = 0; r < 20; r++) {
+        descend(5000);
+    }
+    printf("%d\n", calls);
+    return 0;
+}
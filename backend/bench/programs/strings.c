@@ -0,0 +1,22 @@
+// String init: a char array initialized from a literal on every call.
+#include <stdio.h>
+
+int count(int seed) {
+    char text[] = "the quick brown fox jumps over the lazy dog";
+    int n = 0;
+    for (int i = 0; i < 43; i++) {
+        if (text[i] == ' ') {
+            n++;
+        }
+    }
+    return n + seed;
+}
+
+int main() {
+    int total = 0;
+    for (int k = 0; k < 5000; k++) {
+        total += count(k % 3);
+    }
+    printf("%d\n", total);
+    return 0;
+}
@@ -0,0 +1,248 @@
+// backend/bench/tracer.bench.mjs
+//
+// Tracer overhead benchmark.
+//
+//   npm run bench -- [--runs N] [--out file] [--baseline file] [--tolerance 0.15] [program...]
+//
+// For every program in bench/programs (or the ones named) it measures:
+//   - the uninstrumented build's run time (the baseline)
+//   - the instrumented build under each trace format with no event budget and
+//     no loop sampling: events/sec, ns of overhead per event, slowdown against
+//     the baseline and trace bytes per event
+//   - end-to-end generateTrace latency with the configured budget, split into
+//     compile, run, parse and convert
+//
+// Times are medians over --runs runs.  Results are written as JSON (default
+// temp/tracer-bench.json).  With --baseline the run is compared against an
+// earlier results file and exits 1 when ns/event, bytes/event or
+// generateTrace latency grew by more than --tolerance.
+import { spawn } from 'child_process';
+import { readFile, readdir, writeFile, stat, mkdir, rm } from 'fs/promises';
+import os from 'os';
+import path from 'path';
+import { fileURLToPath } from 'url';
+
+const benchDir = path.dirname(fileURLToPath(import.meta.url));
+const programsDir = path.join(benchDir, 'programs');
+
+const backendDir = path.dirname(benchDir);
+
+// The services resolve src/ and temp/ against the working directory.
+process.chdir(backendDir);
+const { default: tracer } = await import('../src/services/instrumentation-tracer.service.js');
+const { default: tracerRuntime, USER_COMPILE_FLAGS } = await import('../src/services/tracer-runtime.service.js');
+const { BinaryTraceDecoder } = await import('../src/parsers/trace-reader.js');
+const { default: config } = await import('../src/config/index.js');
+
+// Repeated generateTrace runs would otherwise measure the trace cache.
+config.traceCache.enabled = false;
+
+const FORMATS = ['bin', 'json'];
+
+// Metrics compared against --baseline; all of them are lower-is-better.
+const GUARDED = ['nsPerEvent', 'bytesPerEvent'];
+
+function parseArgs(argv) {
+    const args = { runs: 5, out: path.join('temp', 'tracer-bench.json'), baseline: null, tolerance: 0.15, programs: [] };
+    for (let i = 0; i < argv.length; i++) {
+        const a = argv[i];
+        if (a === '--runs') args.runs = Math.max(1, parseInt(argv[++i], 10));
+        else if (a === '--out') args.out = argv[++i];
+        else if (a === '--baseline') args.baseline = argv[++i];
+        else if (a === '--tolerance') args.tolerance = parseFloat(argv[++i]);
+        else args.programs.push(a.replace(/\.c$/, ''));
+    }
+    return args;
+}
+
+function run(command, args, env = {}) {
+    return new Promise((resolve, reject) => {
+        const started = performance.now();
+        const p = spawn(command, args, { env: { ...process.env, ...env }, stdio: ['ignore', 'ignore', 'pipe'] });
+        let err = '';
+        p.stderr.on('data', d => err += d.toString());
+        p.on('close', code => code === 0
+            ? resolve(performance.now() - started)
+            : reject(new Error(`${command} ${args.join(' ')} failed (${code}):\n${err}`)));
+        p.on('error', reject);
+    });
+}
+
+const median = (values) => {
+    const sorted = [...values].sort((a, b) => a - b);
+    const mid = sorted.length >> 1;
+    return sorted.length % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2;
+};
+
+async function timeRuns(runs, fn) {
+    const times = [];
+    for (let i = 0; i < runs; i++) times.push(await fn());
+    return median(times);
+}
+
+async function countEvents(binaryTrace) {
+    const decoder = new BinaryTraceDecoder();
+    decoder.push(await readFile(binaryTrace));
+    return decoder.end().total_events;
+}
+
+async function benchProgram(name, code, runs) {
+    const scratch = path.join(tracer.tempDir, `bench_${name}`);
+    await mkdir(scratch, { recursive: true });
+    const source = path.join(scratch, `${name}.c`);
+    const baselineExe = path.join(scratch, `${name}.baseline`);
+    await writeFile(source, code, 'utf-8');
+
+    try {
+        // Same code generation as the traced build, minus the instrumentation.
+        const baselineFlags = USER_COMPILE_FLAGS.filter(f => f !== '-finstrument-functions');
+        await run('g++', [...baselineFlags, source, '-o', baselineExe]);
+        const baselineMs = await timeRuns(runs, () => run(baselineExe, []));
+
+        const { executable, sourceFile, headerCopy } = await tracer.compile(code, 'c');
+        const formats = {};
+        let events = 0;
+        try {
+            for (const format of FORMATS) {
+                const output = path.join(scratch, `trace.${format}`);
+                const env = {
+                    TRACE_OUTPUT: output, TRACE_FORMAT: format, TRACE_MAX_EVENTS: '0',
+                    TRACE_LOOP_HEAD: '0', TRACE_LOOP_TAIL: '0', TRACE_LOOP_STRIDE: '0'
+                };
+                const runMs = await timeRuns(runs, () => run(executable, [], env));
+                if (format === 'bin') events = await countEvents(output);
+                const bytes = (await stat(output)).size;
+                formats[format] = {
+                    runMs,
+                    events,
+                    bytes,
+                    eventsPerSec: events / (runMs / 1000),
+                    nsPerEvent: Math.max(0, runMs - baselineMs) * 1e6 / Math.max(1, events),
+                    slowdown: runMs / baselineMs,
+                    bytesPerEvent: bytes / Math.max(1, events)
+                };
+            }
+        } finally {
+            await tracer.cleanup([executable, sourceFile, headerCopy]);
+        }
+
+        const traces = [];
+        for (let i = 0; i < runs; i++) {
+            const started = performance.now();
+            const result = await tracer.generateTrace(code, 'c');
+            traces.push({ totalMs: performance.now() - started, steps: result.totalSteps, ...result.metadata.timings });
+        }
+        const generateTrace = { steps: traces[0].steps };
+        for (const key of ['compileMs', 'runMs', 'parseMs', 'convertMs', 'totalMs']) {
+            generateTrace[key] = median(traces.map(t => t[key]));
+        }
+
+        return { baselineMs, formats, generateTrace };
+    } finally {
+        await rm(scratch, { recursive: true, force: true });
+    }
+}
+
+function compare(results, baseline, tolerance) {
+    const regressions = [];
+    const check = (label, now, before) => {
+        if (typeof now === 'number' && typeof before === 'number' && before > 0 && now > before * (1 + tolerance)) {
+            regressions.push(`${label}: ${before.toFixed(2)} -> ${now.toFixed(2)} (+${((now / before - 1) * 100).toFixed(0)}%)`);
+        }
+    };
+    for (const [name, program] of Object.entries(results.programs)) {
+        const previous = baseline.programs?.[name];
+        if (!previous) continue;
+        for (const format of FORMATS) {
+            for (const metric of GUARDED) {
+                check(`${name} ${format} ${metric}`, program.formats[format]?.[metric], previous.formats?.[format]?.[metric]);
+            }
+        }
+        check(`${name} generateTrace totalMs`, program.generateTrace.totalMs, previous.generateTrace?.totalMs);
+    }
+    return regressions;
+}
+
+function report(results) {
+    const rows = [];
+    for (const [name, p] of Object.entries(results.programs)) {
+        for (const format of FORMATS) {
+            const f = p.formats[format];
+            rows.push({
+                program: name, format, events: f.events,
+                'Mev/s': (f.eventsPerSec / 1e6).toFixed(2),
+                'ns/event': f.nsPerEvent.toFixed(1),
+                slowdown: `${f.slowdown.toFixed(1)}x`,
+                'B/event': f.bytesPerEvent.toFixed(1)
+            });
+        }
+    }
+    console.table(rows);
+    console.table(Object.fromEntries(Object.entries(results.programs).map(([name, p]) => [name, {
+        steps: p.generateTrace.steps,
+        compile: p.generateTrace.compileMs.toFixed(0),
+        run: p.generateTrace.runMs.toFixed(0),
+        parse: p.generateTrace.parseMs.toFixed(0),
+        convert: p.generateTrace.convertMs.toFixed(0),
+        total: p.generateTrace.totalMs.toFixed(0)
+    }])));
+}
+
+async function main() {
+    const args = parseArgs(process.argv.slice(2));
+    const available = (await readdir(programsDir)).filter(f => f.endsWith('.c')).map(f => f.slice(0, -2)).sort();
+    const selected = args.programs.length ? args.programs : available;
+    for (const name of selected) {
+        if (!available.includes(name)) throw new Error(`Unknown benchmark program: ${name}`);
+    }
+
+    await tracerRuntime.ensureBuilt();
+    // executeInstrumented launches ./exec_* from the working directory.
+    await mkdir(tracer.tempDir, { recursive: true });
+    process.chdir(tracer.tempDir);
+
+    // Keep the services' per-step logging out of the report.
+    const log = console.log;
+    const results = {
+        timestamp: new Date().toISOString(),
+        host: {
+            node: process.version,
+            platform: `${process.platform}-${process.arch}`,
+            cpu: os.cpus()[0]?.model ?? 'unknown',
+            cpus: os.cpus().length
+        },
+        runs: args.runs,
+        programs: {}
+    };
+    for (const name of selected) {
+        log(`⏱️  ${name}`);
+        const code = await readFile(path.join(programsDir, `${name}.c`), 'utf-8');
+        console.log = () => {};
+        try {
+            results.programs[name] = await benchProgram(name, code, args.runs);
+        } finally {
+            console.log = log;
+        }
+    }
+
+    report(results);
+    const out = path.resolve(backendDir, args.out);
+    await mkdir(path.dirname(out), { recursive: true });
+    await writeFile(out, JSON.stringify(results, null, 2));
+    log(`📄 Results written to ${args.out}`);
+
+    if (args.baseline) {
+        const regressions = compare(results, JSON.parse(await readFile(path.resolve(backendDir, args.baseline), 'utf-8')), args.tolerance);
+        if (regressions.length) {
+            console.error(`❌ ${regressions.length} regression(s) beyond ${(args.tolerance * 100).toFixed(0)}%:`);
+            for (const r of regressions) console.error(`   ${r}`);
+            process.exit(1);
+        }
+        log(`✅ No regressions against ${args.baseline}`);
+    }
+}
+
+main().catch(e => {
+    console.error('❌ Benchmark failed:', e.message);
+    process.exit(1);
+});
@@ -11,9 +11,16 @@ const dockerConfig = {
   maxPoolSize: parseInt(process.env.DOCKER_MAX_POOL_SIZE, 10) || 20,
   busyThreshold: parseFloat(process.env.DOCKER_BUSY_THRESHOLD) || 0.8,
   healthCheckInterval: parseInt(process.env.DOCKER_HEALTH_CHECK_INTERVAL, 10) || 30000,
+  // Concurrent jobs per worker; jobs go to the least loaded worker
+  slotsPerWorker: parseInt(process.env.DOCKER_SLOTS_PER_WORKER, 10) || 1,
+  // Jobs waiting for a slot before new requests are turned away (0 = unbounded)
+  maxQueue: parseInt(process.env.DOCKER_MAX_QUEUE ?? 100, 10),
   container: {
     cpu: parseInt(process.env.DOCKER_CONTAINER_CPU_SHARES, 10) || 1024,
     memory: parseInt(process.env.DOCKER_CONTAINER_MEMORY_MB, 10) || 512,
+    // tmpfs for the worker's temp/ (the root filesystem is read-only): the
+    // sources and executables of the jobs it runs live here
+    tmpfsMb: parseInt(process.env.DOCKER_CONTAINER_TMPFS_MB, 10) || 256,
   }
 };
 
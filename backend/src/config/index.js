@@ -1,4 +1,5 @@
 import dotenv from 'dotenv';
+import { LIMITS } from '../constants/limits.js';
 
 dotenv.config();
 
@@ -24,7 +25,53 @@ export const config = {
   // Limits
   maxCodeSize: 1000000, // 1MB
   maxExecutionTime: 30000, // 30s
-  
+
+  // Tracer runtime output: 'json' or 'bin' (compact varint stream)
+  traceFormat: process.env.TRACE_FORMAT === 'bin' ? 'bin' : 'json',
+
+  // How the trace reaches the backend: 'pipe' streams it over an inherited fd
+  // while the program runs (always binary, POSIX only), 'file' goes through
+  // TRACE_OUTPUT after exit
+  traceTransport: process.platform !== 'win32' && process.env.TRACE_TRANSPORT !== 'file' ? 'pipe' : 'file',
+
+  // Prebuilt tracer runtime: 'static' (libtracer.a) or 'shared' (libtracer.so)
+  tracerRuntimeLink: process.env.TRACER_RUNTIME_LINK === 'shared' ? 'shared' : 'static',
+
+  // Enforced inside the runtime: the event cap and how many iterations of
+  // each loop are recorded (first N, last N, every Nth in between; 0 = off)
+  traceBudget: {
+    maxEvents: parseInt(process.env.TRACE_MAX_EVENTS, 10) || LIMITS.MAX_TRACE_EVENTS,
+    loopHead: parseInt(process.env.TRACE_LOOP_HEAD ?? LIMITS.MAX_LOOP_ITERATIONS_SHOWN, 10),
+    loopTail: parseInt(process.env.TRACE_LOOP_TAIL ?? LIMITS.MAX_LOOP_ITERATIONS_SHOWN, 10),
+    loopStride: parseInt(process.env.TRACE_LOOP_STRIDE ?? 0, 10),
+    // Skip assigns/element writes that leave the value unchanged
+    dedup: process.env.TRACE_DEDUP === 'true',
+    // Events between full state snapshots (0 = none)
+    keyframeInterval: parseInt(process.env.TRACE_KEYFRAME_INTERVAL ?? 0, 10),
+  },
+
+  // Event timestamp source: 'monotonic' (clock_gettime) or 'tsc' (x86 cycle
+  // counter, calibrated at startup; falls back to monotonic elsewhere)
+  traceClock: process.env.TRACE_CLOCK === 'tsc' ? 'tsc' : 'monotonic',
+
+  // Run the instrumented program without address randomization where the
+  // kernel allows it, so its addresses repeat from run to run
+  traceFixedAddresses: process.env.TRACE_FIXED_ADDRESSES !== 'false',
+
+  // Wall-clock limit for one run of the instrumented program (ms)
+  traceTimeoutMs: parseInt(process.env.TRACE_TIMEOUT_MS, 10) || 10000,
+
+  // Compile-and-trace cache: finished traces of deterministic programs in
+  // Redis, linked executables on local disk
+  traceCache: {
+    enabled: process.env.TRACE_CACHE !== 'false',
+    ttl: parseInt(process.env.TRACE_CACHE_TTL, 10) || 86400, // seconds
+    maxResultBytes: parseInt(process.env.TRACE_CACHE_MAX_RESULT_BYTES, 10) || 32 * 1024 * 1024, // compressed
+    maxBinaries: parseInt(process.env.TRACE_CACHE_MAX_BINARIES, 10) || 256,
+    // Precompiled include preludes per tracer runtime (tens of MB each)
+    maxPreludes: parseInt(process.env.TRACE_CACHE_MAX_PRELUDES, 10) || 16,
+  },
+
   // Features
   enableGCCDownload: process.env.ENABLE_GCC_DOWNLOAD !== 'false',
   enableOptimization: process.env.ENABLE_OPTIMIZATION !== 'false',
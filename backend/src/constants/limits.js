@@ -10,7 +10,12 @@ export const LIMITS = {
   // Trace limits
   MAX_EXECUTION_STEPS: 10000, // Maximum execution steps
   TRACE_CHUNK_SIZE: 100, // Steps per chunk when sending to frontend
+  TRACE_COMPRESSED_CHUNK_SIZE: 5000, // Steps per gzip'd chunk (socket and trace cache)
   MAX_LOOP_ITERATIONS_SHOWN: 10, // Show first/last N iterations
+  MAX_TRACE_EVENTS: 1000000, // Runtime stops recording after this many events
+  TRACE_KEYFRAME_INTERVAL: 100, // Steps between state snapshots for seeking
+  TRACE_LIVE_EVENTS: 256, // Most recent events forwarded per live update while the program runs
+  TRACE_LIVE_INTERVAL_MS: 100, // Time between live updates
   
   // Memory limits
   MAX_STACK_DEPTH: 100,
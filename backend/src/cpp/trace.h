@@ -1,224 +1,212 @@
 // backend/src/cpp/trace.h
+//
+// C++ only: instrumented programs, C ones included, are compiled as C++17
+// (see instrumentation-tracer.service.js), and the typed hooks below are
+// templates.
 #pragma once
 
+#ifndef __cplusplus
+#error "trace.h is C++ only; compile instrumented programs with g++ -std=c++17"
+#endif
+
 #include <cstdio>
 #include <cstdlib>
+#include <type_traits>
+
+// Element encodings for __trace_array_init_loc.
+#define TRACE_ELEM_UNSIGNED 0
+#define TRACE_ELEM_SIGNED   1
+#define TRACE_ELEM_FLOAT    2
+#define TRACE_ELEM_CHAR     3   // plain char, decoded as characters
+
+// Value kinds of a declared variable, reported once with its declaration.
+// Assigns are then traced through the hook for that kind (float and double
+// as double, char as signed); a variable of any other type has no traced
+// value.
+#define TRACE_VALUE_OTHER    0
+#define TRACE_VALUE_SIGNED   1
+#define TRACE_VALUE_UNSIGNED 2
+#define TRACE_VALUE_FLOAT    3
+#define TRACE_VALUE_CHAR     4
+#define TRACE_VALUE_POINTER  5
+
+// Hook categories.  Compile with -DTRACE_CATEGORIES=<mask> to keep only some
+// of them: the hooks of a disabled category compile to nothing (see
+// __TRACE_IF).
+#define TRACE_CAT_VARIABLES 0x01  // declare, assign, TRACE_INT and friends
+#define TRACE_CAT_ARRAYS    0x02
+#define TRACE_CAT_POINTERS  0x04
+#define TRACE_CAT_CONTROL   0x08  // conditions, branches, break/continue
+#define TRACE_CAT_LOOPS     0x10
+#define TRACE_CAT_BLOCKS    0x20
+#define TRACE_CAT_FUNCTIONS 0x40  // returns; enter/exit come from -finstrument-functions
+#define TRACE_CAT_OUTPUT    0x80
+#define TRACE_CAT_ALL       0xff
+
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES TRACE_CAT_ALL
+#endif
+
+// Set by the runtime while it is recording.  Enabled hooks test it inline and
+// skip the call entirely before start-up and after shutdown.
+extern "C" int __trace_on;
+
+// Force-inlined and never instrumented, so the wrappers and typed dispatch
+// below add no call and no func_enter of their own.
+#define __TRACE_INLINE static inline __attribute__((always_inline, no_instrument_function))
+
+// Every runtime entry point as X(category, function, (parameters),
+// (arguments)).  From it come the extern "C" prototypes, which the runtime
+// includes too, so its definitions are checked against the same list; an
+// inline wrapper in __trace_hooks that forwards the arguments once the
+// runtime is recording; and __trace_enabled::function, whether the hook's
+// TRACE_CAT_<category> is compiled in.
+#define TRACE_RUNTIME_HOOKS(X) \
+    X(VARIABLES, trace_var_int_loc, (const char* name, int value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, trace_var_long_loc, (const char* name, long long value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, trace_var_double_loc, (const char* name, double value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, trace_var_ptr_loc, (const char* name, void* value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, trace_var_str_loc, (const char* name, const char* value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, trace_var_int, (const char* name, int value), (name, value)) \
+    X(VARIABLES, trace_var_long, (const char* name, long long value), (name, value)) \
+    X(VARIABLES, trace_var_double, (const char* name, double value), (name, value)) \
+    X(VARIABLES, trace_var_ptr, (const char* name, void* value), (name, value)) \
+    X(VARIABLES, trace_var_str, (const char* name, const char* value), (name, value)) \
+    X(VARIABLES, __trace_declare_loc, (const char* name, const char* type, void* address, int valueKind, const char* file, int line), (name, type, address, valueKind, file, line)) \
+    X(VARIABLES, __trace_assign_loc, (const char* name, long long value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, __trace_assign_unsigned_loc, (const char* name, unsigned long long value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, __trace_assign_double_loc, (const char* name, double value, const char* file, int line), (name, value, file, line)) \
+    X(VARIABLES, __trace_assign_ptr_loc, (const char* name, const void* value, const char* file, int line), (name, value, file, line)) \
+    X(ARRAYS, __trace_array_create_loc, (const char* name, const char* baseType, void* address, int dim1, int dim2, int dim3, bool isStack, const char* file, int line), (name, baseType, address, dim1, dim2, dim3, isStack, file, line)) \
+    X(ARRAYS, __trace_array_init_loc, (const char* name, const void* values, int count, int elemSize, int elemKind, const char* file, int line), (name, values, count, elemSize, elemKind, file, line)) \
+    X(ARRAYS, __trace_array_init_string_loc, (const char* name, const char* str_literal, const char* file, int line), (name, str_literal, file, line)) \
+    X(ARRAYS, __trace_array_index_assign_loc, (const char* name, int idx1, int idx2, int idx3, long long value, const char* file, int line), (name, idx1, idx2, idx3, value, file, line)) \
+    X(ARRAYS, __trace_array_index_assign_unsigned_loc, (const char* name, int idx1, int idx2, int idx3, unsigned long long value, const char* file, int line), (name, idx1, idx2, idx3, value, file, line)) \
+    X(ARRAYS, __trace_array_index_assign_double_loc, (const char* name, int idx1, int idx2, int idx3, double value, const char* file, int line), (name, idx1, idx2, idx3, value, file, line)) \
+    X(POINTERS, __trace_pointer_alias_loc, (const char* name, void* aliasedAddress, bool decayedFromArray, const char* file, int line), (name, aliasedAddress, decayedFromArray, file, line)) \
+    X(POINTERS, __trace_pointer_deref_write_loc, (const char* ptrName, long long value, const char* file, int line), (ptrName, value, file, line)) \
+    X(POINTERS, __trace_pointer_heap_init_loc, (const char* ptrName, void* heapAddr, const char* file, int line), (ptrName, heapAddr, file, line)) \
+    X(CONTROL, __trace_control_flow_loc, (const char* controlType, const char* file, int line), (controlType, file, line)) \
+    X(LOOPS, __trace_loop_start_loc, (int loopId, const char* loopType, const char* file, int line), (loopId, loopType, file, line)) \
+    X(LOOPS, __trace_loop_body_start_loc, (int loopId, const char* file, int line), (loopId, file, line)) \
+    X(LOOPS, __trace_loop_iteration_end_loc, (int loopId, const char* file, int line), (loopId, file, line)) \
+    X(LOOPS, __trace_loop_end_loc, (int loopId, const char* file, int line), (loopId, file, line)) \
+    X(LOOPS, __trace_loop_condition_loc, (int loopId, int result, const char* file, int line), (loopId, result, file, line)) \
+    X(FUNCTIONS, __trace_return_loc, (long long value, const char* returnType, const char* destinationSymbol, const char* file, int line), (value, returnType, destinationSymbol, file, line)) \
+    X(BLOCKS, __trace_block_enter_loc, (int blockDepth, const char* file, int line), (blockDepth, file, line)) \
+    X(BLOCKS, __trace_block_exit_loc, (int blockDepth, const char* file, int line), (blockDepth, file, line)) \
+    X(OUTPUT, __trace_output_flush_loc, (const char* file, int line), (file, line)) \
+    X(CONTROL, __trace_condition_eval_loc, (int conditionId, const char* expression, int result, const char* file, int line), (conditionId, expression, result, file, line)) \
+    X(CONTROL, __trace_branch_taken_loc, (int conditionId, const char* branchType, const char* file, int line), (conditionId, branchType, file, line))
 
-#ifdef _WIN32
-#ifdef __cplusplus
 extern "C" {
-#endif
+#define __TRACE_DECLARE_HOOK(category, function, params, args) void function params;
+TRACE_RUNTIME_HOOKS(__TRACE_DECLARE_HOOK)
+#undef __TRACE_DECLARE_HOOK
+}
 
-void trace_var_int_loc(const char* name, int value, const char* file, int line);
-void trace_var_long_loc(const char* name, long long value, const char* file, int line);
-void trace_var_double_loc(const char* name, double value, const char* file, int line);
-void trace_var_ptr_loc(const char* name, void* value, const char* file, int line);
-void trace_var_str_loc(const char* name, const char* value, const char* file, int line);
-
-void trace_var_int(const char* name, int value);
-void trace_var_long(const char* name, long long value);
-void trace_var_double(const char* name, double value);
-void trace_var_ptr(const char* name, void* value);
-void trace_var_str(const char* name, const char* value);
-
-void __trace_declare_loc(const char* name, const char* type, void* address, const char* file, int line);
-void __trace_assign_loc(const char* name, long long value, const char* file, int line);
-
-void __trace_array_create_loc(const char* name, const char* baseType, void* address,
-                               int dim1, int dim2, int dim3, bool isStack,
-                               const char* file, int line);
-void __trace_array_init_loc(const char* name, void* values, int count,
-                             const char* file, int line);
-void __trace_array_init_string_loc(const char* name, const char* str_literal,
-                                    const char* file, int line);
-void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                     long long value, const char* file, int line);
-
-void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
-                                const char* file, int line);
-void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
-                                      const char* file, int line);
-void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
-                                    const char* file, int line);
-
-void __trace_control_flow_loc(const char* controlType, const char* file, int line);
-void __trace_loop_start_loc(int loopId, const char* loopType, const char* file, int line);
-void __trace_loop_body_start_loc(int loopId, const char* file, int line);
-void __trace_loop_iteration_end_loc(int loopId, const char* file, int line);
-void __trace_loop_end_loc(int loopId, const char* file, int line);
-void __trace_loop_condition_loc(int loopId, int result, const char* file, int line);
-void __trace_return_loc(long long value, const char* returnType, const char* destinationSymbol, const char* file, int line);
-void __trace_block_enter_loc(int blockDepth, const char* file, int line);
-void __trace_block_exit_loc(int blockDepth, const char* file, int line);
-void __trace_output_flush_loc(const char* file, int line);
-void __trace_condition_eval_loc(int conditionId, const char* expression, int result, const char* file, int line);
-void __trace_branch_taken_loc(int conditionId, const char* branchType, const char* file, int line);
-
-#ifdef __cplusplus
+namespace __trace_hooks {
+#define __TRACE_DEFINE_HOOK(category, function, params, args) \
+    __TRACE_INLINE void function params { \
+        if (__builtin_expect(__atomic_load_n(&__trace_on, __ATOMIC_RELAXED), 1)) ::function args; \
+    }
+TRACE_RUNTIME_HOOKS(__TRACE_DEFINE_HOOK)
+#undef __TRACE_DEFINE_HOOK
 }
-#endif
 
-#define TRACE_INT(var)    trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__)
-#define TRACE_LONG(var)   trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__)
-#define TRACE_DOUBLE(var) trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__)
-#define TRACE_PTR(var)    trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__)
-#define TRACE_STR(var)    trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__)
-#define TRACE_VAR(var)    TRACE_INT(var)
+namespace __trace_enabled {
+#define __TRACE_HOOK_ENABLED(category, function, params, args) \
+    constexpr bool function = (TRACE_CATEGORIES & TRACE_CAT_##category) != 0;
+TRACE_RUNTIME_HOOKS(__TRACE_HOOK_ENABLED)
+#undef __TRACE_HOOK_ENABLED
+}
 
-#define __trace_declare(name, type, line) \
-    __trace_declare_loc(#name, #type, (void*)&(name), __FILE__, line)
-#define __trace_assign(name, value, line) \
-    __trace_assign_loc(#name, (long long)(value), __FILE__, line)
-#define __trace_array_create(name, baseType, dim1, dim2, dim3, line) \
-    __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, __FILE__, line)
-#define __trace_array_init(name, values, count, line) \
-    __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line)
-#define __trace_array_init_string(name, str_literal, line) \
-    __trace_array_init_string_loc(#name, str_literal, __FILE__, line)
-#define __trace_array_index_assign_1d(name, idx, value, line) \
-    __trace_array_index_assign_loc(#name, idx, -1, -1, (long long)(value), __FILE__, line)
-#define __trace_array_index_assign_2d(name, idx1, idx2, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, -1, (long long)(value), __FILE__, line)
-#define __trace_array_index_assign_3d(name, idx1, idx2, idx3, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, idx3, (long long)(value), __FILE__, line)
-#define __trace_pointer_alias(name, value, decayed, line) \
-    __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line)
-#define __trace_pointer_deref_write(ptrName, value, line) \
-    __trace_pointer_deref_write_loc(#ptrName, (long long)(value), __FILE__, line)
-#define __trace_pointer_heap_init(ptrName, heapAddr, line) \
-    __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line)
-#define __trace_control_flow(controlType, line) \
-    __trace_control_flow_loc(controlType, __FILE__, line)
-#define __trace_loop_start(loopId, loopType, line) \
-    __trace_loop_start_loc(loopId, loopType, __FILE__, line)
-#define __trace_loop_body_start(loopId, line) \
-    __trace_loop_body_start_loc(loopId, __FILE__, line)
-#define __trace_loop_iteration_end(loopId, line) \
-    __trace_loop_iteration_end_loc(loopId, __FILE__, line)
-#define __trace_loop_end(loopId, line) \
-    __trace_loop_end_loc(loopId, __FILE__, line)
-#define __trace_loop_condition(loopId, result, line) \
-    __trace_loop_condition_loc(loopId, result, __FILE__, line)
-#define __trace_return(value, returnType, destinationSymbol, line) \
-    __trace_return_loc((long long)(value), returnType, destinationSymbol, __FILE__, line)
-#define __trace_block_enter(blockDepth, line) \
-    __trace_block_enter_loc(blockDepth, __FILE__, line)
-#define __trace_block_exit(blockDepth, line) \
-    __trace_block_exit_loc(blockDepth, __FILE__, line)
-#define __trace_output_flush(line) \
-    __trace_output_flush_loc(__FILE__, line)
-#define __trace_condition_eval(conditionId, expression, result, line) \
-    __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line)
-#define __trace_branch_taken(conditionId, branchType, line) \
-    __trace_branch_taken_loc(conditionId, branchType, __FILE__, line)
-
-#else
-
-#ifdef __cplusplus
-extern "C" {
-#endif
+// `call` when the category of `function` is compiled in.  The condition is a
+// constant, so for a disabled one neither the call nor its argument
+// expressions are left in the program.
+#define __TRACE_IF(function, call) (__trace_enabled::function ? (void)(call) : (void)0)
+#define __TRACE_CALL(function, args) __TRACE_IF(function, __trace_hooks::function args)
+
+// A variable template rather than a function, so even at -O0 the kind is a
+// constant and not an instrumented call.
+template <typename T, typename U = typename std::remove_cv<typename std::remove_reference<T>::type>::type>
+constexpr int __trace_value_kind =
+    std::is_pointer<U>::value ? TRACE_VALUE_POINTER :
+    std::is_floating_point<U>::value ? TRACE_VALUE_FLOAT :
+    std::is_same<U, char>::value ? TRACE_VALUE_CHAR :
+    std::is_unsigned<U>::value ? TRACE_VALUE_UNSIGNED :
+    std::is_integral<U>::value || std::is_enum<U>::value ? TRACE_VALUE_SIGNED :
+    TRACE_VALUE_OTHER;
+
+// An array element's encoding, by the same classification.
+template <typename T, int kind = __trace_value_kind<T>>
+constexpr int __trace_elem_kind =
+    kind == TRACE_VALUE_FLOAT ? TRACE_ELEM_FLOAT :
+    kind == TRACE_VALUE_CHAR ? TRACE_ELEM_CHAR :
+    kind == TRACE_VALUE_SIGNED ? TRACE_ELEM_SIGNED :
+    TRACE_ELEM_UNSIGNED;
+
+// Typed dispatch for assigns, through the wrappers above.
+template <typename T>
+__TRACE_INLINE void __trace_assign_value(const char* name, const T& value, const char* file, int line) {
+    constexpr int kind = __trace_value_kind<T>;
+    if constexpr (kind == TRACE_VALUE_FLOAT) {
+        __trace_hooks::__trace_assign_double_loc(name, (double)value, file, line);
+    } else if constexpr (kind == TRACE_VALUE_UNSIGNED) {
+        __trace_hooks::__trace_assign_unsigned_loc(name, (unsigned long long)value, file, line);
+    } else if constexpr (kind == TRACE_VALUE_POINTER) {
+        __trace_hooks::__trace_assign_ptr_loc(name, (const void*)value, file, line);
+    } else if constexpr (kind != TRACE_VALUE_OTHER) {
+        __trace_hooks::__trace_assign_loc(name, (long long)value, file, line);
+    }
+}
 
-void trace_var_int_loc(const char* name, int value, const char* file, int line);
-void trace_var_long_loc(const char* name, long long value, const char* file, int line);
-void trace_var_double_loc(const char* name, double value, const char* file, int line);
-void trace_var_ptr_loc(const char* name, void* value, const char* file, int line);
-void trace_var_str_loc(const char* name, const char* value, const char* file, int line);
-
-void trace_var_int(const char* name, int value);
-void trace_var_long(const char* name, long long value);
-void trace_var_double(const char* name, double value);
-void trace_var_ptr(const char* name, void* value);
-void trace_var_str(const char* name, const char* value);
-
-void __trace_declare_loc(const char* name, const char* type, void* address, const char* file, int line);
-void __trace_assign_loc(const char* name, long long value, const char* file, int line);
-
-void __trace_array_create_loc(const char* name, const char* baseType, void* address,
-                               int dim1, int dim2, int dim3, bool isStack,
-                               const char* file, int line);
-void __trace_array_init_loc(const char* name, void* values, int count,
-                             const char* file, int line);
-void __trace_array_init_string_loc(const char* name, const char* str_literal,
-                                    const char* file, int line);
-void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                     long long value, const char* file, int line);
-
-void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
-                                const char* file, int line);
-void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
-                                      const char* file, int line);
-void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
-                                    const char* file, int line);
-
-void __trace_control_flow_loc(const char* controlType, const char* file, int line);
-void __trace_loop_start_loc(int loopId, const char* loopType, const char* file, int line);
-void __trace_loop_body_start_loc(int loopId, const char* file, int line);
-void __trace_loop_iteration_end_loc(int loopId, const char* file, int line);
-void __trace_loop_end_loc(int loopId, const char* file, int line);
-void __trace_loop_condition_loc(int loopId, int result, const char* file, int line);
-void __trace_return_loc(long long value, const char* returnType, const char* destinationSymbol, const char* file, int line);
-void __trace_block_enter_loc(int blockDepth, const char* file, int line);
-void __trace_block_exit_loc(int blockDepth, const char* file, int line);
-void __trace_output_flush_loc(const char* file, int line);
-void __trace_condition_eval_loc(int conditionId, const char* expression, int result, const char* file, int line);
-void __trace_branch_taken_loc(int conditionId, const char* branchType, const char* file, int line);
-
-#ifdef __cplusplus
+// Pointer elements are traced as their address.
+template <typename T>
+__TRACE_INLINE void __trace_array_index_assign_value(const char* name, int idx1, int idx2, int idx3,
+                                                     const T& value, const char* file, int line) {
+    constexpr int kind = __trace_value_kind<T>;
+    if constexpr (kind == TRACE_VALUE_FLOAT) {
+        __trace_hooks::__trace_array_index_assign_double_loc(name, idx1, idx2, idx3, (double)value, file, line);
+    } else if constexpr (kind == TRACE_VALUE_UNSIGNED) {
+        __trace_hooks::__trace_array_index_assign_unsigned_loc(name, idx1, idx2, idx3, (unsigned long long)value, file, line);
+    } else if constexpr (kind == TRACE_VALUE_POINTER) {
+        __trace_hooks::__trace_array_index_assign_unsigned_loc(name, idx1, idx2, idx3,
+                                                (unsigned long long)(__UINTPTR_TYPE__)value, file, line);
+    } else if constexpr (kind != TRACE_VALUE_OTHER) {
+        __trace_hooks::__trace_array_index_assign_loc(name, idx1, idx2, idx3, (long long)value, file, line);
+    }
 }
-#endif
 
-#define TRACE_INT(var)    trace_var_int_loc(#var, (int)(var), __FILE__, __LINE__)
-#define TRACE_LONG(var)   trace_var_long_loc(#var, (long long)(var), __FILE__, __LINE__)
-#define TRACE_DOUBLE(var) trace_var_double_loc(#var, (double)(var), __FILE__, __LINE__)
-#define TRACE_PTR(var)    trace_var_ptr_loc(#var, (void*)(var), __FILE__, __LINE__)
-#define TRACE_STR(var)    trace_var_str_loc(#var, (const char*)(var), __FILE__, __LINE__)
+// What instrumented code calls: each hook with its names stringized and its
+// source file added.
+#define TRACE_INT(var)    __TRACE_CALL(trace_var_int_loc, (#var, (int)(var), __FILE__, __LINE__))
+#define TRACE_LONG(var)   __TRACE_CALL(trace_var_long_loc, (#var, (long long)(var), __FILE__, __LINE__))
+#define TRACE_DOUBLE(var) __TRACE_CALL(trace_var_double_loc, (#var, (double)(var), __FILE__, __LINE__))
+#define TRACE_PTR(var)    __TRACE_CALL(trace_var_ptr_loc, (#var, (void*)(var), __FILE__, __LINE__))
+#define TRACE_STR(var)    __TRACE_CALL(trace_var_str_loc, (#var, (const char*)(var), __FILE__, __LINE__))
 #define TRACE_VAR(var)    TRACE_INT(var)
 
-#define __trace_declare(name, type, line) \
-    __trace_declare_loc(#name, #type, (void*)&(name), __FILE__, line)
-#define __trace_assign(name, value, line) \
-    __trace_assign_loc(#name, (long long)(value), __FILE__, line)
-#define __trace_array_create(name, baseType, dim1, dim2, dim3, line) \
-    __trace_array_create_loc(#name, #baseType, (void*)(name), dim1, dim2, dim3, true, __FILE__, line)
-#define __trace_array_init(name, values, count, line) \
-    __trace_array_init_loc(#name, (void*)(values), count, __FILE__, line)
-#define __trace_array_init_string(name, str_literal, line) \
-    __trace_array_init_string_loc(#name, str_literal, __FILE__, line)
-#define __trace_array_index_assign_1d(name, idx, value, line) \
-    __trace_array_index_assign_loc(#name, idx, -1, -1, (long long)(value), __FILE__, line)
-#define __trace_array_index_assign_2d(name, idx1, idx2, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, -1, (long long)(value), __FILE__, line)
-#define __trace_array_index_assign_3d(name, idx1, idx2, idx3, value, line) \
-    __trace_array_index_assign_loc(#name, idx1, idx2, idx3, (long long)(value), __FILE__, line)
-#define __trace_pointer_alias(name, value, decayed, line) \
-    __trace_pointer_alias_loc(#name, (void*)(value), decayed, __FILE__, line)
-#define __trace_pointer_deref_write(ptrName, value, line) \
-    __trace_pointer_deref_write_loc(#ptrName, (long long)(value), __FILE__, line)
-#define __trace_pointer_heap_init(ptrName, heapAddr, line) \
-    __trace_pointer_heap_init_loc(#ptrName, heapAddr, __FILE__, line)
-#define __trace_control_flow(controlType, line) \
-    __trace_control_flow_loc(controlType, __FILE__, line)
-#define __trace_loop_start(loopId, loopType, line) \
-    __trace_loop_start_loc(loopId, loopType, __FILE__, line)
-#define __trace_loop_body_start(loopId, line) \
-    __trace_loop_body_start_loc(loopId, __FILE__, line)
-#define __trace_loop_iteration_end(loopId, line) \
-    __trace_loop_iteration_end_loc(loopId, __FILE__, line)
-#define __trace_loop_end(loopId, line) \
-    __trace_loop_end_loc(loopId, __FILE__, line)
-#define __trace_loop_condition(loopId, result, line) \
-    __trace_loop_condition_loc(loopId, result, __FILE__, line)
-#define __trace_return(value, returnType, destinationSymbol, line) \
-    __trace_return_loc((long long)(value), returnType, destinationSymbol, __FILE__, line)
-#define __trace_block_enter(blockDepth, line) \
-    __trace_block_enter_loc(blockDepth, __FILE__, line)
-#define __trace_block_exit(blockDepth, line) \
-    __trace_block_exit_loc(blockDepth, __FILE__, line)
-#define __trace_output_flush(line) \
-    __trace_output_flush_loc(__FILE__, line)
-#define __trace_condition_eval(conditionId, expression, result, line) \
-    __trace_condition_eval_loc(conditionId, expression, result, __FILE__, line)
-#define __trace_branch_taken(conditionId, branchType, line) \
-    __trace_branch_taken_loc(conditionId, branchType, __FILE__, line)
-
-#endif
\ No newline at end of file
+#define __trace_declare(name, type, line) __TRACE_CALL(__trace_declare_loc, (#name, #type, (void*)&(name), __trace_value_kind<decltype(name)>, __FILE__, line))
+#define __trace_assign(name, value, line) __TRACE_IF(__trace_assign_loc, __trace_assign_value(#name, (value), __FILE__, line))
+#define __trace_array_create(name, baseType, dim1, dim2, dim3, line) __TRACE_CALL(__trace_array_create_loc, (#name, #baseType, (void*)(name), dim1, dim2, dim3, true, __FILE__, line))
+#define __trace_array_init(name, values, count, line) __TRACE_CALL(__trace_array_init_loc, (#name, (const void*)(values), count, (int)sizeof((values)[0]), __trace_elem_kind<decltype((values)[0])>, __FILE__, line))
+#define __trace_array_init_string(name, str_literal, line) __TRACE_CALL(__trace_array_init_string_loc, (#name, str_literal, __FILE__, line))
+#define __trace_array_index_assign_1d(name, idx, value, line) __TRACE_IF(__trace_array_index_assign_loc, __trace_array_index_assign_value(#name, idx, -1, -1, (value), __FILE__, line))
+#define __trace_array_index_assign_2d(name, idx1, idx2, value, line) __TRACE_IF(__trace_array_index_assign_loc, __trace_array_index_assign_value(#name, idx1, idx2, -1, (value), __FILE__, line))
+#define __trace_array_index_assign_3d(name, idx1, idx2, idx3, value, line) __TRACE_IF(__trace_array_index_assign_loc, __trace_array_index_assign_value(#name, idx1, idx2, idx3, (value), __FILE__, line))
+#define __trace_pointer_alias(name, value, decayed, line) __TRACE_CALL(__trace_pointer_alias_loc, (#name, (void*)(value), decayed, __FILE__, line))
+#define __trace_pointer_deref_write(ptrName, value, line) __TRACE_CALL(__trace_pointer_deref_write_loc, (#ptrName, (long long)(value), __FILE__, line))
+#define __trace_pointer_heap_init(ptrName, heapAddr, line) __TRACE_CALL(__trace_pointer_heap_init_loc, (#ptrName, heapAddr, __FILE__, line))
+#define __trace_control_flow(controlType, line) __TRACE_CALL(__trace_control_flow_loc, (controlType, __FILE__, line))
+#define __trace_loop_start(loopId, loopType, line) __TRACE_CALL(__trace_loop_start_loc, (loopId, loopType, __FILE__, line))
+#define __trace_loop_body_start(loopId, line) __TRACE_CALL(__trace_loop_body_start_loc, (loopId, __FILE__, line))
+#define __trace_loop_iteration_end(loopId, line) __TRACE_CALL(__trace_loop_iteration_end_loc, (loopId, __FILE__, line))
+#define __trace_loop_end(loopId, line) __TRACE_CALL(__trace_loop_end_loc, (loopId, __FILE__, line))
+#define __trace_loop_condition(loopId, result, line) __TRACE_CALL(__trace_loop_condition_loc, (loopId, result, __FILE__, line))
+#define __trace_return(value, returnType, destinationSymbol, line) __TRACE_CALL(__trace_return_loc, ((long long)(value), returnType, destinationSymbol, __FILE__, line))
+#define __trace_block_enter(blockDepth, line) __TRACE_CALL(__trace_block_enter_loc, (blockDepth, __FILE__, line))
+#define __trace_block_exit(blockDepth, line) __TRACE_CALL(__trace_block_exit_loc, (blockDepth, __FILE__, line))
+#define __trace_output_flush(line) __TRACE_CALL(__trace_output_flush_loc, (__FILE__, line))
+#define __trace_condition_eval(conditionId, expression, result, line) __TRACE_CALL(__trace_condition_eval_loc, (conditionId, expression, result, __FILE__, line))
+#define __trace_branch_taken(conditionId, branchType, line) __TRACE_CALL(__trace_branch_taken_loc, (conditionId, branchType, __FILE__, line))
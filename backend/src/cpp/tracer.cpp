@@ -1,47 +1,161 @@
 // backend/src/cpp/tracer.cpp
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <cstddef>
+#include <cstdint>
+#include <cmath>
 #include <algorithm>
+#include <atomic>
 #include <string>
+#include <deque>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <set>
 #include <vector>
+#include <initializer_list>
+#include <new>
 
 #ifdef _WIN32
     #include <windows.h>
 #else
     #include <dlfcn.h>
     #include <cxxabi.h>
-    #include <sys/time.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <signal.h>
     #include <unistd.h>
-    #include <mutex>
+    #if defined(__linux__)
+        #include <elf.h>
+        #include <link.h>
+        #include <stdio_ext.h>
+        #include <sys/stat.h>
+        #include <iostream>
+        #include <ext/stdio_sync_filebuf.h>
+    #endif
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SIZEOF_INT128__)
+    #include <x86intrin.h>
+    #define TRACE_HAVE_TSC 1
 #endif
 
 #include "trace.h"
 
 static FILE* g_trace_file = nullptr;
-static int g_depth = 0;
-static unsigned long g_event_counter = 0;
+static bool g_trace_streaming = false;      // g_trace_file is a TRACE_FD pipe
+static std::atomic<unsigned long> g_event_counter{0};
+static std::atomic<bool> g_tracing{false};
+int __trace_on = 0;                         // g_tracing, read inline by the trace.h hooks
 
-#ifndef _WIN32
-static std::mutex g_trace_mutex;
-#endif
+static void set_tracing(bool on) {
+    g_tracing.store(on, std::memory_order_release);
+    __atomic_store_n(&__trace_on, on ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+typedef unsigned SymbolId;
+
+static const SymbolId SYM_NONE = 0;
+static const SymbolId SYM_UNKNOWN = 1;
+static const SymbolId SYM_MAIN = 2;
+
+// ---------------------------------------------------------------------------
+// Arena
+//
+// The tracer's own bookkeeping never goes through the malloc the hooks
+// interpose: containers take an ArenaAllocator, which carves blocks out of
+// private mmap'd chunks.  So the program's heap, and the addresses it is
+// shown, look the same traced or not, and no bookkeeping can recurse into
+// the hooks.  Freed small blocks go on a free list per size class, which
+// hands a returning frame's loop and value vectors to the next call.  Big
+// blocks are mapped on their own.
+// ---------------------------------------------------------------------------
+
+static void* arena_alloc(std::size_t size);
+static void arena_free(void* p, std::size_t size);
+
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator() noexcept = default;
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        void* p = arena_alloc(n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t n) noexcept { arena_free(p, n * sizeof(T)); }
+
+    template <typename U> bool operator==(const ArenaAllocator<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+template <typename T>
+using ArenaDeque = std::deque<T, ArenaAllocator<T>>;
+template <typename T, typename Less = std::less<T>>
+using ArenaSet = std::set<T, Less, ArenaAllocator<T>>;
+template <typename K, typename V, typename Less = std::less<K>>
+using ArenaMap = std::map<K, V, Less, ArenaAllocator<std::pair<const K, V>>>;
+template <typename K, typename V, typename Hash = std::hash<K>>
+using ArenaHashMap = std::unordered_map<K, V, Hash, std::equal_to<K>, ArenaAllocator<std::pair<const K, V>>>;
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+// Objects the tracer keeps for the whole run.
+template <typename T, typename... Args>
+static T* arena_new(Args&&... args) {
+    void* p = arena_alloc(sizeof(T));
+    return p ? new (p) T{std::forward<Args>(args)...} : nullptr;
+}
+
+template <typename T>
+static void arena_delete(T* p) {
+    if (!p) return;
+    p->~T();
+    arena_free(p, sizeof(T));
+}
+
+// A run of an array's shadow, allocated at the first write into it.
+static const std::size_t ARRAY_PAGE_SLOTS = 64;
+
+struct ArrayPage {
+    long long values[ARRAY_PAGE_SLOTS];
+    unsigned long long known;       // bit k: values[k] written since the array was created
+};
 
 struct ArrayInfo {
-    std::string name;
-    std::string baseType;
+    SymbolId name;
+    SymbolId baseType;
     void* address;
     int dim1, dim2, dim3;
     bool isStack;
+    std::size_t count;              // shadowed elements, 0 past MAX_ARRAY_SHADOW
+    ArenaVector<ArrayPage*> pages;  // row-major, nullptr until written
+    bool floating;                  // values hold double bit patterns
+};
+
+// A stack array registered in a frame, released when the frame returns.
+// `shadowed` is the array the name resolved to before, restored if it is
+// still registered under that name.
+struct StackArray {
+    void* address;
+    void* shadowed;
 };
 
+// Elements with no dense shadow: writes through an unregistered name or past
+// the declared extent.
 struct ArrayElementKey {
-    std::string arrayName;
+    SymbolId arrayName;
     int idx1, idx2, idx3;
-    
+
     bool operator<(const ArrayElementKey& other) const {
         if (arrayName != other.arrayName) return arrayName < other.arrayName;
         if (idx1 != other.idx1) return idx1 < other.idx1;
@@ -51,29 +165,299 @@ struct ArrayElementKey {
 };
 
 struct PointerInfo {
-    std::string pointerName;
+    SymbolId pointerName;
     void* aliasedAddress;
     bool isHeap;
     void* heapAddress;
 };
 
+// Iterations dropped by loop sampling since the last loop_skipped record.
+struct SkipRange {
+    int first;
+    int last;
+    int count;
+    unsigned long droppedEvents;
+};
+
+struct LoopState {
+    int loopId;
+    int iteration;
+    bool skipping;              // current iteration is being dropped
+    unsigned long droppedMark;  // the thread's sampledOut when the current skip began
+    SkipRange skipped;
+    SymbolId file;
+    int line;
+};
+
+// Pointer aliases are shallow-bound: a thread's aliasStack holds every binding
+// made by its live frames, and aliasHead maps a name to its innermost binding.  A
+// binding remembers the one it shadows, so a frame sees its callers' aliases
+// without copying them, and returning unwinds only the frame's own bindings.
+struct AliasBinding {
+    SymbolId name;
+    PointerInfo info;
+    int shadowed;               // index of the outer binding, or -1
+};
+
+// How the 64 bits of a traced value are read back: integers are stored as
+// themselves, doubles and pointers as their bit patterns.
+enum ValueEncoding : unsigned char { VAL_SIGNED, VAL_UNSIGNED, VAL_DOUBLE, VAL_POINTER };
+
+struct VarValue {
+    SymbolId name;
+    long long value;
+    ValueEncoding encoding;
+};
+
+// A block or loop iteration open in a frame, with the names declared in it:
+// closing it reports them destroyed.
+struct Scope {
+    int loopId;                 // -1 for a block
+    ArenaVector<SymbolId> names;
+};
+
 struct CallFrame {
-    std::string functionName;
-    std::map<std::string, PointerInfo> pointerAliases;
-    std::vector<int> activeLoops;
-    std::map<int, int> loopIterations;
-};
-
-static std::map<std::string, long long> g_variable_values;
-static std::map<void*, ArrayInfo> g_array_registry;
-static std::map<void*, std::string> g_address_to_name;
-static std::map<ArrayElementKey, long long> g_array_element_values;
-static std::set<std::string> g_tracked_functions;
-static std::string g_current_function = "main";
-static std::map<std::string, PointerInfo> g_pointer_registry;
-static std::vector<CallFrame> g_call_stack;
-
-static inline unsigned long get_timestamp_us() {
+    SymbolId functionName;
+    unsigned long serial;       // frame number shared by all threads, from 1
+    std::size_t aliasBase;      // aliasStack size at entry
+    std::size_t arrayBase;      // stackArrays size at entry
+    ArenaVector<LoopState> activeLoops;
+    ArenaVector<VarValue> values;   // last assigned value of each local
+    ArenaVector<Scope> scopes;
+};
+
+// TRACE_MODE=profile aggregates: per thread, summed at exit.  Loops and
+// conditions are indexed by their instrumenter id, functions by SymbolId.
+struct LineHits {
+    const char* file;           // nullptr marks a free slot
+    int line;
+    unsigned long long hits;
+};
+
+struct LoopProfile {
+    unsigned long long entries;
+    unsigned long long iterations;
+    unsigned long long timeNs;  // outermost activations only, so recursion counts once
+    int active;
+    const char* file;
+    int line;
+};
+
+struct BranchProfile {
+    unsigned long long evaluations;
+    unsigned long long taken;   // evaluations with a nonzero result
+    const char* expression;
+    const char* file;
+    int line;
+};
+
+struct FunctionProfile {
+    unsigned long long calls;
+    unsigned long long inclusiveNs;     // outermost activations only
+    unsigned long long exclusiveNs;
+    int active;
+};
+
+struct OpenLoop {
+    int loopId;
+    int depth;
+    unsigned long long start;
+};
+
+struct OpenCall {
+    SymbolId function;
+    unsigned long long start;
+    unsigned long long childNs;
+};
+
+struct ProfileState {
+    const char* lastFile;       // the line last counted
+    int lastLine;
+    LineHits* lines;            // open-addressed, at most half full
+    std::size_t lineCapacity;
+    std::size_t lineCount;
+    ArenaVector<LoopProfile> loops;
+    ArenaVector<BranchProfile> branches;
+    ArenaVector<FunctionProfile> functions;
+    ArenaVector<OpenLoop> openLoops;
+    ArenaVector<OpenCall> calls;
+};
+
+// Shared by every thread and only touched under a RegistryLock.
+static ArenaMap<SymbolId, VarValue> g_variable_values;      // assigns outside any frame
+static ArenaMap<void*, ArrayInfo> g_array_registry;
+static ArenaHashMap<SymbolId, ArrayInfo*> g_array_by_name;
+static ArenaMap<void*, SymbolId> g_address_to_name;
+static ArenaMap<ArrayElementKey, long long> g_array_element_values;
+static ArenaMap<SymbolId, PointerInfo> g_pointer_registry;
+
+// What follows one thread's calls.  Each thread traces its own call stack,
+// depth and pointer aliases, and loop sampling keeps its state per thread.
+// States are reused after their thread exits (see acquire_thread_state).
+struct ThreadState {
+    unsigned tid = 0;                   // 0 for the thread that started tracing
+    int depth = 0;
+    SymbolId currentFunction = SYM_MAIN;
+    ArenaVector<CallFrame> callStack;
+    ArenaVector<AliasBinding> aliasStack;
+    ArenaHashMap<SymbolId, int> aliasHead;
+    ArenaVector<StackArray> stackArrays;
+    int suppressDepth = 0;              // active loops in a skipped iteration
+    bool capturing = false;             // owns g_capture
+    unsigned long sampledOut = 0;       // events dropped by loop sampling
+    unsigned long deduped = 0;          // no-op writes dropped by TRACE_DEDUP
+    ProfileState* profile = nullptr;    // TRACE_MODE=profile, allocated at the first hook
+    std::atomic<bool> retired{false};
+    ThreadState* next = nullptr;
+};
+
+// Numbers CallFrame::serial; 0 stands for no frame.
+static std::atomic<unsigned long> g_frame_serial{0};
+
+// Function names are kept alive until the footer is written, which happens
+// after static destructors have run.  They view interned symbol text.
+static ArenaSet<std::string_view>& tracked_functions() {
+    static ArenaSet<std::string_view>* names = arena_new<ArenaSet<std::string_view>>();
+    return *names;
+}
+
+// ---------------------------------------------------------------------------
+// Event records
+//
+// Hooks fill a fixed-size record in the calling thread's ring; the drain
+// thread formats records and writes them to g_trace_file in batches.  String
+// fields are SymbolIds.
+// ---------------------------------------------------------------------------
+
+// Every event the runtime records as X(kind, type, fields...).
+// The EventKind enum and k_event_specs, which both encoders and the binary
+// schema dictionary walk, are generated from this one list.
+#define TRACE_EVENT_KINDS(X) \
+    X(EV_CONDITION_EVAL,      "condition_eval", {"conditionId", F_INT, 0, nullptr}, {"expression", F_STR, 0, nullptr}, {"result", F_INT, 1, nullptr}, LOC) \
+    X(EV_BRANCH_TAKEN,        "branch_taken", {"conditionId", F_INT, 0, nullptr}, {"branchType", F_STR, 0, nullptr}, LOC) \
+    X(EV_ARRAY_CREATE,        "array_create", {"name", F_STR, 0, nullptr}, {"baseType", F_STR, 1, nullptr}, {"dimensions", F_DIMS, 0, nullptr}, {"isStack", F_BOOL, 3, nullptr}, LOC) \
+    X(EV_ARRAY_INDEX_ASSIGN,  "array_index_assign", {"name", F_STR, 0, nullptr}, {"indices", F_INDICES, 0, nullptr}, {"value", F_INT, 3, nullptr}, LOC) \
+    X(EV_ARRAY_INDEX_ASSIGN_UNSIGNED, "array_index_assign", {"name", F_STR, 0, nullptr}, {"indices", F_INDICES, 0, nullptr}, {"value", F_UINT, 3, nullptr}, LOC) \
+    X(EV_ARRAY_INDEX_ASSIGN_DOUBLE, "array_index_assign", {"name", F_STR, 0, nullptr}, {"indices", F_INDICES, 0, nullptr}, {"value", F_DOUBLE, 0, nullptr}, LOC) \
+    X(EV_ARRAY_INIT_BULK,     "array_init_bulk", {"name", F_STR, 0, nullptr}, {"elemType", F_STR, 1, nullptr}, {"offset", F_INT, 0, nullptr}, {"count", F_INT, 1, nullptr}, {"data", F_BYTES, 0, nullptr}, LOC) \
+    X(EV_POINTER_ALIAS,       "pointer_alias", {"name", F_STR, 0, nullptr}, {"aliasOf", F_STR, 1, nullptr}, {"aliasedAddress", F_PTR, 0, nullptr}, {"decayedFromArray", F_BOOL, 0, nullptr}, LOC) \
+    X(EV_POINTER_DEREF_WRITE, "pointer_deref_write", {"pointerName", F_STR, 0, nullptr}, {"value", F_INT, 0, nullptr}, {"targetName", F_STR, 1, nullptr}, {"isHeap", F_BOOL, 1, nullptr}, LOC) \
+    X(EV_HEAP_WRITE,          "heap_write", {"address", F_PTR, 0, nullptr}, {"value", F_INT, 0, nullptr}, LOC) \
+    X(EV_DECLARE,             "declare", {"name", F_STR, 0, nullptr}, {"varType", F_STR, 1, nullptr}, {"value", F_NULL, 0, nullptr}, {"address", F_PTR, 0, nullptr}, {"valueKind", F_STR, 2, nullptr}, LOC) \
+    X(EV_ASSIGN,              "assign", {"name", F_STR, 0, nullptr}, {"value", F_INT, 0, nullptr}, LOC) \
+    X(EV_ASSIGN_UNSIGNED,     "assign", {"name", F_STR, 0, nullptr}, {"value", F_UINT, 0, nullptr}, LOC) \
+    X(EV_ASSIGN_DOUBLE,       "assign", {"name", F_STR, 0, nullptr}, {"value", F_DOUBLE, 0, nullptr}, LOC) \
+    X(EV_ASSIGN_PTR,          "assign", {"name", F_STR, 0, nullptr}, {"value", F_PTR, 0, nullptr}, LOC) \
+    X(EV_CONTROL_FLOW,        "control_flow", {"controlType", F_STR, 0, nullptr}, LOC) \
+    X(EV_LOOP_START,          "loop_start", {"loopId", F_INT, 0, nullptr}, {"loopType", F_STR, 0, nullptr}, LOC) \
+    X(EV_LOOP_BODY_START,     "loop_body_start", {"loopId", F_INT, 0, nullptr}, {"iteration", F_INT, 1, nullptr}, LOC) \
+    X(EV_LOOP_ITERATION_END,  "loop_iteration_end", {"loopId", F_INT, 0, nullptr}, {"iteration", F_INT, 1, nullptr}, {"destroyed", F_TEXT, 0, nullptr}, LOC) \
+    X(EV_LOOP_END,            "loop_end", {"loopId", F_INT, 0, nullptr}, LOC) \
+    X(EV_LOOP_CONDITION,      "loop_condition", {"loopId", F_INT, 0, nullptr}, {"result", F_INT, 1, nullptr}, LOC) \
+    X(EV_RETURN,              "return", {"value", F_INT, 0, nullptr}, {"returnType", F_STR, 0, nullptr}, {"destinationSymbol", F_OPT_STR, 1, nullptr}, LOC) \
+    X(EV_BLOCK_ENTER,         "block_enter", {"blockDepth", F_INT, 0, nullptr}, LOC) \
+    X(EV_BLOCK_EXIT,          "block_exit", {"blockDepth", F_INT, 0, nullptr}, {"destroyed", F_TEXT, 0, nullptr}, LOC) \
+    X(EV_VAR_INT,             "var", {"name", F_STR, 0, nullptr}, {"value", F_INT, 0, nullptr}, {"type", F_CONST, 0, "int"}, LOC) \
+    X(EV_VAR_LONG,            "var", {"name", F_STR, 0, nullptr}, {"value", F_INT, 0, nullptr}, {"type", F_CONST, 0, "long"}, LOC) \
+    X(EV_VAR_DOUBLE,          "var", {"name", F_STR, 0, nullptr}, {"value", F_DOUBLE, 0, nullptr}, {"type", F_CONST, 0, "double"}, LOC) \
+    X(EV_VAR_PTR,             "var", {"name", F_STR, 0, nullptr}, {"value", F_PTR, 0, nullptr}, {"type", F_CONST, 0, "pointer"}, LOC) \
+    X(EV_VAR_STR,             "var", {"name", F_STR, 0, nullptr}, {"value", F_TEXT, 0, nullptr}, {"type", F_CONST, 0, "string"}, LOC) \
+    X(EV_FUNC_ENTER,          "func_enter", {"caller", F_PTR, 0, nullptr}, {"invocation", F_INT, 0, nullptr}, {"frame", F_UINT, 1, nullptr}, {"parentFrame", F_UINT, 2, nullptr}) \
+    X(EV_FUNC_EXIT,           "func_exit", {"frame", F_UINT, 0, nullptr}, {"destroyed", F_TEXT, 0, nullptr}) \
+    X(EV_HEAP_ALLOC,          "heap_alloc", {"size", F_INT, 0, nullptr}, {"isHeap", F_TRUE, 0, nullptr}) \
+    X(EV_HEAP_FREE,           "heap_free") \
+    X(EV_OUTPUT,              "output", {"start", F_UINT, 0, nullptr}, {"end", F_UINT, 1, nullptr}) \
+    X(EV_LOOP_SKIPPED,        "loop_skipped", {"loopId", F_INT, 0, nullptr}, {"firstIteration", F_INT, 1, nullptr}, {"lastIteration", F_INT, 2, nullptr}, {"skippedIterations", F_INT, 3, nullptr}, {"droppedEvents", F_INT, 4, nullptr}, LOC) \
+    X(EV_TRACE_TRUNCATED,     "trace_truncated", {"maxEvents", F_INT, 0, nullptr}) \
+    X(EV_TRACE_START,         "trace_start", {"loadBias", F_PTR, 0, nullptr}, {"clock", F_STR, 0, nullptr}, {"startTime", F_INT, 0, nullptr}) \
+    X(EV_HEAP_SUMMARY,        "heap_summary", {"liveBlocks", F_INT, 0, nullptr}, {"liveBytes", F_INT, 1, nullptr}, {"peakBytes", F_INT, 2, nullptr}, {"totalAllocations", F_INT, 3, nullptr}, {"totalBytes", F_INT, 4, nullptr}) \
+    X(EV_HEAP_LEAK,           "heap_leak", {"size", F_INT, 0, nullptr}) \
+    X(EV_KEYFRAME,            "keyframe", {"seq", F_INT, 0, nullptr}, {"frames", F_INT, 1, nullptr}, {"variables", F_INT, 2, nullptr}, {"arrays", F_INT, 3, nullptr}) \
+    X(EV_KEYFRAME_VAR,        "keyframe_var", {"name", F_STR, 0, nullptr}, {"value", F_INT, 0, nullptr}, {"frame", F_INT, 1, nullptr}) \
+    X(EV_KEYFRAME_VAR_UNSIGNED, "keyframe_var", {"name", F_STR, 0, nullptr}, {"value", F_UINT, 0, nullptr}, {"frame", F_INT, 1, nullptr}) \
+    X(EV_KEYFRAME_VAR_DOUBLE, "keyframe_var", {"name", F_STR, 0, nullptr}, {"value", F_DOUBLE, 0, nullptr}, {"frame", F_INT, 1, nullptr}) \
+    X(EV_KEYFRAME_VAR_PTR,    "keyframe_var", {"name", F_STR, 0, nullptr}, {"value", F_PTR, 0, nullptr}, {"frame", F_INT, 1, nullptr}) \
+    X(EV_KEYFRAME_ARRAY,      "keyframe_array", {"name", F_STR, 0, nullptr}, {"elemType", F_STR, 1, nullptr}, {"offset", F_INT, 0, nullptr}, {"count", F_INT, 1, nullptr}, {"data", F_BYTES, 0, nullptr}) \
+    X(EV_THREAD_CREATE,       "thread_create", {"thread", F_UINT, 0, nullptr}, {"startRoutine", F_PTR, 0, nullptr}) \
+    X(EV_THREAD_JOIN,         "thread_join", {"thread", F_UINT, 0, nullptr}) \
+    X(EV_THREAD_EXIT,         "thread_exit") \
+    X(EV_CRASH,               "crash", {"signal", F_INT, 0, nullptr}) \
+    X(EV_PROFILE_LINE,        "profile_line", {"hits", F_UINT, 0, nullptr}, LOC) \
+    X(EV_PROFILE_LOOP,        "profile_loop", {"loopId", F_INT, 0, nullptr}, {"entries", F_UINT, 1, nullptr}, {"iterations", F_UINT, 2, nullptr}, {"timeNs", F_UINT, 3, nullptr}, LOC) \
+    X(EV_PROFILE_BRANCH,      "profile_branch", {"conditionId", F_INT, 0, nullptr}, {"expression", F_STR, 0, nullptr}, {"evaluations", F_UINT, 1, nullptr}, {"taken", F_UINT, 2, nullptr}, LOC) \
+    X(EV_PROFILE_FUNCTION,    "profile_function", {"calls", F_UINT, 0, nullptr}, {"inclusiveNs", F_UINT, 1, nullptr}, {"exclusiveNs", F_UINT, 2, nullptr})
+
+enum EventKind : unsigned short {
+#define TRACE_EVENT_KIND(kind, ...) kind,
+    TRACE_EVENT_KINDS(TRACE_EVENT_KIND)
+#undef TRACE_EVENT_KIND
+};
+
+static const unsigned TRACE_TEXT_CAPACITY = 256;
+static const unsigned long long TRACE_RING_CAPACITY = 8192;   // power of two
+static const unsigned TRACE_DRAIN_IDLE_US = 200;
+
+struct EventRecord {
+    unsigned long id;
+    unsigned long long ts;      // ns since trace start
+    void* addr;
+    SymbolId func;
+    SymbolId file;
+    SymbolId s[3];
+    const void* p;
+    long long i[5];
+    double d;
+    int depth;
+    int line;
+    unsigned tid;               // ThreadState::tid of the recording thread
+    EventKind kind;
+    unsigned short textLen;
+    char text[TRACE_TEXT_CAPACITY];
+};
+
+// Counted by whichever thread owns the ring, so they stay plain; the footer
+// sums them over all rings.
+struct RingStats {
+    unsigned long internHits;
+    unsigned long functionHits;
+    unsigned long stalls;       // reserve_slot found the ring full
+};
+
+struct EventRing {
+    std::atomic<unsigned long long> head;
+    std::atomic<unsigned long long> tail;
+    std::atomic<bool> retired;
+    EventRing* next;
+    RingStats stats;
+    EventRecord slots[TRACE_RING_CAPACITY];
+};
+
+static std::atomic<EventRing*> g_rings{nullptr};
+static std::atomic<bool> g_drain_stop{false};
+static std::atomic<bool> g_drain_running{false};
+static std::atomic_flag g_drain_lock = ATOMIC_FLAG_INIT;
+static unsigned long g_events_written = 0;
+
+// Set on threads (and call paths) that belong to the tracer itself so the
+// allocation hooks do not feed the tracer's own work back into the trace.
+static thread_local bool t_in_tracer = false;
+static thread_local EventRing* t_ring = nullptr;
+
+static inline bool tracing_active() {
+    return g_tracing.load(std::memory_order_relaxed) && !t_in_tracer;
+}
+
+// Event timestamps are nanoseconds since init_tracer.  The default clock is
+// the monotonic system clock (a vDSO read on Linux); TRACE_CLOCK=tsc reads the
+// x86 cycle counter instead, scaled to nanoseconds by a calibration against
+// the monotonic clock at startup.
+enum TraceClock { TRACE_CLOCK_MONOTONIC, TRACE_CLOCK_TSC };
+
+static TraceClock g_clock = TRACE_CLOCK_MONOTONIC;
+static unsigned long long g_clock_origin = 0;   // clock reading at trace start
+static unsigned long long g_tsc_scale = 0;      // nanoseconds per cycle, 32.32 fixed point
+
+static inline unsigned long long monotonic_ns() {
 #ifdef _WIN32
     static LARGE_INTEGER freq{};
     static BOOL initialized = FALSE;
@@ -83,540 +467,3213 @@ static inline unsigned long get_timestamp_us() {
     }
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
-    return static_cast<unsigned long>((now.QuadPart * 1000000ULL) / freq.QuadPart);
+    const unsigned long long ticks = now.QuadPart, hz = freq.QuadPart;
+    return (ticks / hz) * 1000000000ULL + (ticks % hz) * 1000000000ULL / hz;
 #else
-    struct timeval tv{};
-    gettimeofday(&tv, nullptr);
-    return static_cast<unsigned long>(tv.tv_sec * 1000000UL + tv.tv_usec);
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
 #endif
 }
 
-static void lock_trace() {
-#ifndef _WIN32
-    g_trace_mutex.lock();
+static unsigned long long wall_clock_us() {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    const unsigned long long ticks = (static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return ticks / 10 - 11644473600000000ULL;   // 100ns since 1601 -> us since 1970
+#else
+    struct timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
 #endif
 }
 
-static void unlock_trace() {
-#ifndef _WIN32
-    g_trace_mutex.unlock();
+static inline unsigned long long get_timestamp_ns() {
+#ifdef TRACE_HAVE_TSC
+    if (g_clock == TRACE_CLOCK_TSC) {
+        const unsigned long long cycles = __rdtsc() - g_clock_origin;
+        return static_cast<unsigned long long>((static_cast<unsigned __int128>(cycles) * g_tsc_scale) >> 32);
+    }
 #endif
+    return monotonic_ns() - g_clock_origin;
 }
 
-static const char* demangle(const char* name) {
-#ifndef _WIN32
-    if (!name) return "unknown";
-    int status = 0;
-    char* real = abi::__cxa_demangle(name, nullptr, nullptr, &status);
-    if (status == 0 && real) {
-        static __thread char buffer[512];
-        strncpy(buffer, real, sizeof(buffer) - 1);
-        buffer[sizeof(buffer) - 1] = '\0';
-        free(real);
-        return buffer;
+// Spins for ~2ms to measure the cycle counter against the monotonic clock;
+// short enough not to matter next to process startup, long enough that the
+// clock read jitter stays well under 0.1%.
+static void init_clock() {
+    const char* requested = std::getenv("TRACE_CLOCK");
+#ifdef TRACE_HAVE_TSC
+    if (requested && std::strcmp(requested, "tsc") == 0) {
+        const unsigned long long ns0 = monotonic_ns();
+        const unsigned long long tsc0 = __rdtsc();
+        unsigned long long ns1 = ns0;
+        while (ns1 - ns0 < 2000000ULL) ns1 = monotonic_ns();
+        const unsigned long long tsc1 = __rdtsc();
+        if (tsc1 > tsc0) {
+            g_tsc_scale = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+            g_clock_origin = __rdtsc();
+            g_clock = TRACE_CLOCK_TSC;
+            return;
+        }
     }
-    return name;
 #else
-    return name;
+    (void)requested;
 #endif
+    g_clock_origin = monotonic_ns();
 }
 
-static std::string json_safe_path(const char* raw) {
-    if (!raw) return "";
-    std::string s(raw);
-    std::replace(s.begin(), s.end(), '\\', '/');
-    return s;
+static void* alloc_pages(std::size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+#endif
 }
 
-static std::string normalize_function_name(const char* name) {
-    if (!name) return "unknown";
-    std::string s(name);
-    s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
-    s.erase(std::remove(s.begin(), s.end(), '\n'), s.end());
-    return s;
+static void free_pages(void* p, std::size_t size) {
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
 }
 
-static void write_json_event(const char* type, void* addr,
-                             const char* func_name, int depth,
-                             const char* extra = nullptr) {
-    lock_trace();
+static void cpu_relax() {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
 
-    if (!g_trace_file) { unlock_trace(); return; }
+static const std::size_t ARENA_CHUNK_SIZE = 1 << 20;
+static const std::size_t ARENA_GRAIN = 16;
+static const std::size_t ARENA_CLASS_COUNT = 64;     // blocks up to 1 KiB are pooled
 
-    if (g_event_counter > 0) fputs(",\n", g_trace_file);
+struct ArenaBlock {
+    ArenaBlock* next;
+};
 
-    fprintf(g_trace_file,
-            "  {\"id\":%lu,\"type\":\"%s\",\"addr\":\"%p\",\"func\":\"%s\",\"depth\":%d,\"ts\":%lu",
-            g_event_counter++, type, addr,
-            func_name ? func_name : "unknown",
-            depth, get_timestamp_us());
+struct Arena {
+    char* cursor;
+    char* end;
+    ArenaBlock* free[ARENA_CLASS_COUNT];
+    unsigned long long mappedBytes;
+    unsigned long long peakBytes;   // reported in the footer, after destructors have unmapped
+};
 
-    if (extra) fprintf(g_trace_file, ",%s", extra);
-    fputs("}", g_trace_file);
-    fflush(g_trace_file);
-    fflush(stdout);
+static Arena g_arena = {};
+static std::atomic_flag g_arena_lock = ATOMIC_FLAG_INIT;
 
-    unlock_trace();
+static void arena_mapped(std::size_t size) {
+    const unsigned long long mapped = __atomic_add_fetch(&g_arena.mappedBytes, size, __ATOMIC_RELAXED);
+    unsigned long long peak = __atomic_load_n(&g_arena.peakBytes, __ATOMIC_RELAXED);
+    while (mapped > peak &&
+           !__atomic_compare_exchange_n(&g_arena.peakBytes, &peak, mapped, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
 }
 
-static PointerInfo* findPointerInfo(const std::string& ptrName) {
-    for (auto it = g_call_stack.rbegin(); it != g_call_stack.rend(); ++it) {
-        auto pit = it->pointerAliases.find(ptrName);
-        if (pit != it->pointerAliases.end()) {
-            return &(pit->second);
+static void* arena_alloc(std::size_t size) {
+    if (size > ARENA_GRAIN * ARENA_CLASS_COUNT) {
+        void* p = alloc_pages(size);
+        if (p) arena_mapped(size);
+        return p;
+    }
+    const std::size_t cls = size ? (size - 1) / ARENA_GRAIN : 0;
+    const std::size_t bytes = (cls + 1) * ARENA_GRAIN;
+
+    while (g_arena_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+    void* p = g_arena.free[cls];
+    if (p) {
+        g_arena.free[cls] = g_arena.free[cls]->next;
+    } else {
+        // The tail of a used-up chunk is abandoned.
+        if ((std::size_t)(g_arena.end - g_arena.cursor) < bytes) {
+            char* chunk = static_cast<char*>(alloc_pages(ARENA_CHUNK_SIZE));
+            if (chunk) {
+                g_arena.cursor = chunk;
+                g_arena.end = chunk + ARENA_CHUNK_SIZE;
+                arena_mapped(ARENA_CHUNK_SIZE);
+            }
+        }
+        if ((std::size_t)(g_arena.end - g_arena.cursor) >= bytes) {
+            p = g_arena.cursor;
+            g_arena.cursor += bytes;
         }
     }
-    
-    auto git = g_pointer_registry.find(ptrName);
-    if (git != g_pointer_registry.end()) {
-        return &(git->second);
+    g_arena_lock.clear(std::memory_order_release);
+    return p;
+}
+
+static void arena_free(void* p, std::size_t size) {
+    if (!p) return;
+    if (size > ARENA_GRAIN * ARENA_CLASS_COUNT) {
+        free_pages(p, size);
+        __atomic_fetch_sub(&g_arena.mappedBytes, size, __ATOMIC_RELAXED);
+        return;
     }
-    
-    return nullptr;
+    const std::size_t cls = size ? (size - 1) / ARENA_GRAIN : 0;
+    ArenaBlock* block = static_cast<ArenaBlock*>(p);
+    while (g_arena_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+    block->next = g_arena.free[cls];
+    g_arena.free[cls] = block;
+    g_arena_lock.clear(std::memory_order_release);
 }
 
-extern "C" void __trace_output_flush_loc(const char* file, int line) {
-    fflush(stdout);
-    fflush(stderr);
-    fflush(g_trace_file);
+static void drain_sleep() {
+#ifdef _WIN32
+    Sleep(1);
+#else
+    usleep(TRACE_DRAIN_IDLE_US);
+#endif
 }
 
-extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
-                                           const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"conditionId\":%d,\"expression\":\"%s\",\"result\":%d,\"file\":\"%s\",\"line\":%d",
-             conditionId, expression, result, f.c_str(), line);
-    write_json_event("condition_eval", nullptr, g_current_function.c_str(), g_depth, extra);
+static void lock_drain() {
+    while (g_drain_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
 }
 
-extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
-                                         const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"conditionId\":%d,\"branchType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             conditionId, branchType, f.c_str(), line);
-    write_json_event("branch_taken", nullptr, g_current_function.c_str(), g_depth, extra);
+static void unlock_drain() {
+    g_drain_lock.clear(std::memory_order_release);
 }
 
-extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
-                                         void* address, int dim1, int dim2, int dim3,
-                                         bool isStack, const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    g_address_to_name[address] = name;
-
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    
-    char dims[64];
-    if (dim3 > 0) {
-        snprintf(dims, sizeof(dims), "[%d,%d,%d]", dim1, dim2, dim3);
-    } else if (dim2 > 0) {
-        snprintf(dims, sizeof(dims), "[%d,%d]", dim1, dim2);
+struct RingOwner {
+    ~RingOwner() {
+        if (t_ring) {
+            t_ring->retired.store(true, std::memory_order_release);
+            t_ring = nullptr;
+        }
+    }
+};
+
+static EventRing* acquire_ring() {
+    for (EventRing* r = g_rings.load(std::memory_order_acquire); r; r = r->next) {
+        bool expected = true;
+        if (r->tail.load(std::memory_order_acquire) == r->head.load(std::memory_order_acquire) &&
+            r->retired.compare_exchange_strong(expected, false)) {
+            return r;
+        }
+    }
+
+    EventRing* r = static_cast<EventRing*>(alloc_pages(sizeof(EventRing)));
+    if (!r) return nullptr;
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    r->retired.store(false, std::memory_order_relaxed);
+    r->next = g_rings.load(std::memory_order_relaxed);
+    while (!g_rings.compare_exchange_weak(r->next, r, std::memory_order_release)) {}
+    return r;
+}
+
+static EventRing* thread_ring() {
+    if (t_ring) return t_ring;
+    t_in_tracer = true;
+    static thread_local RingOwner owner;
+    (void)owner;
+    t_ring = acquire_ring();
+    t_in_tracer = false;
+    return t_ring;
+}
+
+// ---------------------------------------------------------------------------
+// Threads
+//
+// A thread gets its ThreadState on its first event, or before its start
+// routine runs when the pthread_create hook launched it.  Thread ids are
+// handed out in that order and never reused, unlike the states themselves.
+// The shared registries need no lock until a second thread exists.
+// ---------------------------------------------------------------------------
+
+static std::atomic<ThreadState*> g_threads{nullptr};
+static std::atomic<unsigned> g_next_tid{0};
+static std::atomic<bool> g_threaded{false};
+static thread_local ThreadState* t_thread = nullptr;
+static std::atomic_flag g_registry_lock = ATOMIC_FLAG_INIT;
+
+struct RegistryLock {
+    const bool held;
+    RegistryLock() : held(g_threaded.load(std::memory_order_acquire)) {
+        if (held) while (g_registry_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+    }
+    ~RegistryLock() {
+        if (held) g_registry_lock.clear(std::memory_order_release);
+    }
+};
+
+// Thread 0 is the main thread, which goes on to run finish_tracer after its
+// thread_locals are destroyed; its state is never handed to another thread.
+struct ThreadOwner {
+    ~ThreadOwner() {
+        if (t_thread && t_thread->tid != 0) {
+            t_thread->retired.store(true, std::memory_order_release);
+            t_thread = nullptr;
+        }
+    }
+};
+
+// A reused state keeps its counters, which the footer sums over all states.
+static ThreadState* acquire_thread_state(unsigned tid) {
+    ThreadState* ts = nullptr;
+    for (ThreadState* s = g_threads.load(std::memory_order_acquire); s && !ts; s = s->next) {
+        bool expected = true;
+        if (s->retired.compare_exchange_strong(expected, false)) ts = s;
+    }
+    if (ts) {
+        ts->callStack.clear();
+        ts->aliasStack.clear();
+        ts->aliasHead.clear();
+        ts->stackArrays.clear();
+        if (ts->profile) {
+            ts->profile->openLoops.clear();
+            ts->profile->calls.clear();
+            ts->profile->lastFile = nullptr;
+        }
     } else {
-        snprintf(dims, sizeof(dims), "[%d]", dim1);
-    }
-    
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"baseType\":\"%s\",\"dimensions\":%s,\"isStack\":%s,\"file\":\"%s\",\"line\":%d",
-             name, baseType, dims, isStack ? "true" : "false", f.c_str(), line);
-    
-    write_json_event("array_create", address, g_current_function.c_str(), g_depth, extra);
-    
-    ArrayInfo info;
-    info.name = name;
-    info.baseType = baseType;
-    info.address = address;
-    info.dim1 = dim1;
-    info.dim2 = dim2;
-    info.dim3 = dim3;
-    info.isStack = isStack;
-    
-    g_array_registry[address] = info;
+        ts = arena_new<ThreadState>();
+        ts->next = g_threads.load(std::memory_order_relaxed);
+        while (!g_threads.compare_exchange_weak(ts->next, ts, std::memory_order_release)) {}
+    }
+    ts->tid = tid;
+    ts->depth = 0;
+    ts->currentFunction = SYM_MAIN;
+    ts->suppressDepth = 0;
+    ts->capturing = false;
+    return ts;
 }
 
-extern "C" void __trace_array_init_string_loc(const char* name, const char* str_literal,
-                                               const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    const std::string f = json_safe_path(file);
-    const int len = str_literal ? strlen(str_literal) : 0;
-    
-    for (int i = 0; i <= len; i++) {
-        char c = (i < len) ? str_literal[i] : '\0';
-        char extra[256];
-        snprintf(extra, sizeof(extra),
-                 "\"name\":\"%s\",\"indices\":[%d],\"value\":%d,\"char\":\"\\u%04x\",\"file\":\"%s\",\"line\":%d",
-                 name, i, (int)c, (unsigned char)c, f.c_str(), line);
-        
-        write_json_event("array_index_assign", nullptr, g_current_function.c_str(), g_depth, extra);
-        
-        ArrayElementKey key;
-        key.arrayName = name;
-        key.idx1 = i;
-        key.idx2 = -1;
-        key.idx3 = -1;
-        g_array_element_values[key] = (long long)c;
-    }
-}
-
-extern "C" void __trace_array_init_loc(const char* name, void* values, int count,
-                                       const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    const std::string f = json_safe_path(file);
-    int* intValues = static_cast<int*>(values);
-    
-    for (int i = 0; i < count; i++) {
-        char extra[256];
-        snprintf(extra, sizeof(extra),
-                 "\"name\":\"%s\",\"indices\":[%d],\"value\":%d,\"file\":\"%s\",\"line\":%d",
-                 name, i, intValues[i], f.c_str(), line);
-        
-        write_json_event("array_index_assign", nullptr, g_current_function.c_str(), g_depth, extra);
-        
-        ArrayElementKey key;
-        key.arrayName = name;
-        key.idx1 = i;
-        key.idx2 = -1;
-        key.idx3 = -1;
-        g_array_element_values[key] = (long long)intValues[i];
+static ThreadState& start_thread_state(unsigned tid) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    static thread_local ThreadOwner owner;
+    (void)owner;
+    if (tid > 0) g_threaded.store(true, std::memory_order_release);
+    t_thread = acquire_thread_state(tid);
+    t_in_tracer = guard;
+    return *t_thread;
+}
+
+static inline ThreadState& thread_state() {
+    if (t_thread) return *t_thread;
+    return start_thread_state(g_next_tid.fetch_add(1, std::memory_order_relaxed));
+}
+
+// ---------------------------------------------------------------------------
+// Symbol table
+//
+// Names, types and file paths reach the hooks as string literals from the
+// trace.h macros, so their address identifies them.  Each distinct text is
+// interned once and referred to by a SymbolId from then on, both in event
+// records and in the bookkeeping maps.  Paths are stored normalized.
+// ---------------------------------------------------------------------------
+
+struct Symbol {
+    const char* text;
+    unsigned len;
+    bool tracked;   // recorded in tracked_functions()
+    bool emitted;   // definition written to the binary trace (drain side)
+    unsigned calls; // func_enter count when the symbol names a function
+};
+
+static const unsigned SYMBOL_CHUNK_SIZE = 1024;
+static const unsigned SYMBOL_CHUNK_COUNT = 1024;
+static const unsigned INTERN_CACHE_SIZE = 256;   // power of two
+
+// Chunks are never moved, so the drain thread can resolve ids without the
+// lock: a record only carries ids that were published before it.
+struct SymbolTable {
+    Symbol* chunks[SYMBOL_CHUNK_COUNT] = {};
+    SymbolId count = 1;
+    ArenaHashMap<std::string_view, SymbolId> byText;
+    ArenaHashMap<const void*, SymbolId> byName;
+    ArenaHashMap<const void*, SymbolId> byPath;
+};
+
+struct InternCacheEntry {
+    const void* key;
+    SymbolId id;
+};
+
+static std::atomic_flag g_symbol_lock = ATOMIC_FLAG_INIT;
+static thread_local InternCacheEntry t_intern_cache[2 * INTERN_CACHE_SIZE];
+static unsigned long g_intern_misses = 0;   // under g_symbol_lock
+
+static inline Symbol& symbol(SymbolId id);
+
+static SymbolId intern_view(SymbolTable& table, std::string_view text) {
+    auto it = table.byText.find(text);
+    if (it != table.byText.end()) return it->second;
+
+    const SymbolId id = table.count;
+    if (id >= SYMBOL_CHUNK_SIZE * SYMBOL_CHUNK_COUNT) return SYM_UNKNOWN;
+    Symbol*& chunk = table.chunks[id / SYMBOL_CHUNK_SIZE];
+    if (!chunk) {
+        chunk = static_cast<Symbol*>(alloc_pages(sizeof(Symbol) * SYMBOL_CHUNK_SIZE));
+        if (!chunk) return SYM_UNKNOWN;
     }
+
+    char* copy = static_cast<char*>(arena_alloc(text.size() + 1));
+    if (!copy) return SYM_UNKNOWN;
+    memcpy(copy, text.data(), text.size());
+    copy[text.size()] = '\0';
+    chunk[id % SYMBOL_CHUNK_SIZE] = Symbol{copy, (unsigned)text.size(), false, false, 0};
+    table.byText.emplace(std::string_view(copy, text.size()), id);
+    table.count = id + 1;
+    return id;
 }
 
-extern "C" void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
-                                                long long value, const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    ArrayElementKey key;
-    key.arrayName = name;
-    key.idx1 = idx1;
-    key.idx2 = idx2;
-    key.idx3 = idx3;
-    
-    g_array_element_values[key] = value;
-    
-    const std::string f = json_safe_path(file);
-    
-    char indices[64];
-    if (idx3 >= 0) {
-        snprintf(indices, sizeof(indices), "[%d,%d,%d]", idx1, idx2, idx3);
-    } else if (idx2 >= 0) {
-        snprintf(indices, sizeof(indices), "[%d,%d]", idx1, idx2);
+// Leaked for the same reason as tracked_functions().
+static SymbolTable& symbols() {
+    static SymbolTable* table = [] {
+        SymbolTable* t = arena_new<SymbolTable>();
+        intern_view(*t, "unknown");
+        intern_view(*t, "main");
+        return t;
+    }();
+    return *table;
+}
+
+static inline Symbol& symbol(SymbolId id) {
+    return symbols().chunks[id / SYMBOL_CHUNK_SIZE][id % SYMBOL_CHUNK_SIZE];
+}
+
+static inline const char* symbol_text(SymbolId id) {
+    return id ? symbol(id).text : "";
+}
+
+static void lock_symbols() {
+    while (g_symbol_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+}
+
+static void unlock_symbols() {
+    g_symbol_lock.clear(std::memory_order_release);
+}
+
+static SymbolId intern_slow(const char* s, bool path) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    lock_symbols();
+
+    SymbolTable& table = symbols();
+    auto& byPointer = path ? table.byPath : table.byName;
+    SymbolId id;
+    ++g_intern_misses;
+    auto it = byPointer.find(s);
+    if (it != byPointer.end()) {
+        id = it->second;
     } else {
-        snprintf(indices, sizeof(indices), "[%d]", idx1);
+        if (path && strchr(s, '\\')) {
+            ArenaString normalized(s);
+            std::replace(normalized.begin(), normalized.end(), '\\', '/');
+            id = intern_view(table, std::string_view(normalized.data(), normalized.size()));
+        } else {
+            id = intern_view(table, s);
+        }
+        byPointer.emplace(s, id);
+    }
+
+    unlock_symbols();
+    t_in_tracer = guard;
+    return id;
+}
+
+static inline SymbolId intern_cached(const char* s, bool path) {
+    if (!s) return SYM_NONE;
+    const uintptr_t key = (uintptr_t)s;
+    InternCacheEntry& entry = t_intern_cache[(((key >> 3) ^ (key >> 12)) & (INTERN_CACHE_SIZE - 1)) +
+                                             (path ? INTERN_CACHE_SIZE : 0)];
+    if (entry.key != s) {
+        entry.id = intern_slow(s, path);
+        entry.key = s;
+    } else if (t_ring) {
+        ++t_ring->stats.internHits;
+    }
+    return entry.id;
+}
+
+static inline SymbolId intern(const char* s) { return intern_cached(s, false); }
+static inline SymbolId intern_path(const char* file) { return intern_cached(file, true); }
+
+// For text without a stable address, e.g. names in the demangle buffer.
+static SymbolId intern_text(const char* s) {
+    if (!s) return SYM_NONE;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    lock_symbols();
+    const SymbolId id = intern_view(symbols(), s);
+    unlock_symbols();
+    t_in_tracer = guard;
+    return id;
+}
+
+// ---------------------------------------------------------------------------
+// Event schema
+//
+// One spec per EventKind drives both encoders.  The binary format writes the
+// specs into the file header so the reader needs no copy of this table.
+// ---------------------------------------------------------------------------
+
+enum FieldType : unsigned char {
+    F_INT = 1,      // i[slot], signed
+    F_BOOL,         // i[slot] != 0
+    F_STR,          // s[slot]
+    F_OPT_STR,      // s[slot], omitted when null or empty
+    F_PATH,         // file, backslashes normalized
+    F_LINE,         // line
+    F_PTR,          // p
+    F_DIMS,         // i[0..2], trailing entries <= 0 dropped
+    F_INDICES,      // i[0..2], trailing entries < 0 dropped
+    F_CHAR,         // i[slot] as a one-character string
+    F_DOUBLE,       // d
+    F_TEXT,         // text[0..textLen)
+    F_NULL,         // constant null
+    F_TRUE,         // constant true
+    F_CONST,        // constant string
+    F_BYTES,        // text[0..textLen), raw; base64 in JSON
+    F_UINT          // i[slot], unsigned
+};
+
+struct FieldSpec {
+    const char* name;
+    FieldType type;
+    unsigned char slot;
+    const char* constant;
+};
+
+struct EventSpec {
+    const char* type;
+    unsigned char count;
+    FieldSpec fields[7];
+};
+
+#define LOC {"file", F_PATH, 0, nullptr}, {"line", F_LINE, 0, nullptr}
+#define TRACE_EVENT_SPEC(kind, type, ...) \
+    {type, (unsigned char)std::initializer_list<FieldSpec>{__VA_ARGS__}.size(), {__VA_ARGS__}},
+
+static const EventSpec k_event_specs[] = {
+    TRACE_EVENT_KINDS(TRACE_EVENT_SPEC)
+};
+
+#undef TRACE_EVENT_SPEC
+#undef LOC
+
+static const unsigned k_event_kind_count = sizeof(k_event_specs) / sizeof(k_event_specs[0]);
+
+enum TraceFormat { TRACE_FORMAT_JSON, TRACE_FORMAT_BINARY };
+static TraceFormat g_trace_format = TRACE_FORMAT_JSON;
+
+// ---------------------------------------------------------------------------
+// Self-profiling
+//
+// Counters that say where tracing time went, written next to total_events in
+// the footer: records written by type, trace bytes, time spent encoding, hit
+// counts of the intern and function caches, ring stalls, events dropped by
+// the budget, loop sampling and dedup, the number of threads traced and the
+// memory mapped for the tracer's own bookkeeping.  The writer-side counters
+// are only touched under the drain lock; the producer-side ones live in
+// RingStats and ThreadState.
+// ---------------------------------------------------------------------------
+
+static unsigned long g_written_by_kind[k_event_kind_count] = {};
+static unsigned long long g_writer_ns = 0;      // timed per drained batch
+static unsigned long long g_binary_bytes = 0;   // flushed by ByteBuffer
+
+struct TraceStat {
+    const char* name;
+    unsigned long long value;
+};
+
+static const unsigned k_trace_stat_count = 12;
+static void collect_stats(TraceStat (&stats)[k_trace_stat_count]);
+
+// Written records per event type; kinds that share a type (the typed assigns)
+// are reported together.  Calls `emit` for each type with a non-zero count.
+template <typename Emit>
+static void for_each_type_count(Emit emit) {
+    for (unsigned kind = 0; kind < k_event_kind_count; ++kind) {
+        const char* type = k_event_specs[kind].type;
+        bool first = true;
+        for (unsigned k = 0; k < kind && first; ++k) first = std::strcmp(k_event_specs[k].type, type) != 0;
+        if (!first) continue;
+
+        unsigned long count = 0;
+        for (unsigned k = kind; k < k_event_kind_count; ++k) {
+            if (std::strcmp(k_event_specs[k].type, type) == 0) count += g_written_by_kind[k];
+        }
+        if (count) emit(type, count);
+    }
+}
+
+static inline int trailing_dims(const long long* d, bool indices) {
+    if (indices ? d[2] >= 0 : d[2] > 0) return 3;
+    if (indices ? d[1] >= 0 : d[1] > 0) return 2;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// JSON encoder
+// ---------------------------------------------------------------------------
+
+static void json_write_string(FILE* out, const char* s, std::size_t len) {
+    for (std::size_t k = 0; k < len; ++k) {
+        const unsigned char c = (unsigned char)s[k];
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+static void json_write_base64(FILE* out, const char* data, std::size_t len) {
+    static const char k_alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    for (std::size_t k = 0; k < len; k += 3) {
+        const unsigned v = (unsigned)p[k] << 16 |
+                           (k + 1 < len ? (unsigned)p[k + 1] << 8 : 0) |
+                           (k + 2 < len ? (unsigned)p[k + 2] : 0);
+        fputc(k_alphabet[v >> 18 & 63], out);
+        fputc(k_alphabet[v >> 12 & 63], out);
+        fputc(k + 1 < len ? k_alphabet[v >> 6 & 63] : '=', out);
+        fputc(k + 2 < len ? k_alphabet[v & 63] : '=', out);
+    }
+}
+
+// Shortest of %.15g / %.17g that reads back as the same double; JSON has no
+// NaN or infinity, so those are written as null.
+static void json_write_double(FILE* out, double v) {
+    if (!std::isfinite(v)) {
+        fputs("null", out);
+        return;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", v);
+    if (std::strtod(buf, nullptr) != v) snprintf(buf, sizeof(buf), "%.17g", v);
+    fputs(buf, out);
+}
+
+static inline void json_write_symbol(FILE* out, SymbolId id) {
+    if (!id) return;
+    const Symbol& sym = symbol(id);
+    json_write_string(out, sym.text, sym.len);
+}
+
+static void write_json_record(FILE* out, const EventRecord& r) {
+    const EventSpec& spec = k_event_specs[r.kind];
+    if (g_events_written++ > 0) fputs(",\n", out);
+
+    fprintf(out, "  {\"id\":%lu,\"type\":\"%s\",\"addr\":\"%p\",\"func\":\"",
+            r.id, spec.type, r.addr);
+    json_write_symbol(out, r.func);
+    fprintf(out, "\",\"depth\":%d,\"ts\":%llu,\"tid\":%u", r.depth, r.ts, r.tid);
+
+    for (unsigned f = 0; f < spec.count; ++f) {
+        const FieldSpec& field = spec.fields[f];
+        const SymbolId s = r.s[field.slot];
+        if (field.type == F_OPT_STR && (!s || symbol(s).len == 0)) continue;
+
+        fprintf(out, ",\"%s\":", field.name);
+        switch (field.type) {
+            case F_INT:
+                fprintf(out, "%lld", r.i[field.slot]);
+                break;
+            case F_UINT:
+                fprintf(out, "%llu", (unsigned long long)r.i[field.slot]);
+                break;
+            case F_BOOL:
+                fputs(r.i[field.slot] ? "true" : "false", out);
+                break;
+            case F_STR:
+            case F_OPT_STR:
+                fputc('"', out);
+                json_write_symbol(out, s);
+                fputc('"', out);
+                break;
+            case F_PATH:
+                fputc('"', out);
+                json_write_symbol(out, r.file);
+                fputc('"', out);
+                break;
+            case F_LINE:
+                fprintf(out, "%d", r.line);
+                break;
+            case F_PTR:
+                fprintf(out, "\"%p\"", r.p);
+                break;
+            case F_DIMS:
+            case F_INDICES: {
+                const int n = trailing_dims(r.i, field.type == F_INDICES);
+                fprintf(out, "[%lld", r.i[0]);
+                for (int k = 1; k < n; ++k) fprintf(out, ",%lld", r.i[k]);
+                fputc(']', out);
+                break;
+            }
+            case F_CHAR:
+                fprintf(out, "\"\\u%04x\"", (unsigned)(unsigned char)r.i[field.slot]);
+                break;
+            case F_DOUBLE:
+                json_write_double(out, r.d);
+                break;
+            case F_TEXT:
+                fputc('"', out);
+                json_write_string(out, r.text, r.textLen);
+                fputc('"', out);
+                break;
+            case F_NULL:
+                fputs("null", out);
+                break;
+            case F_TRUE:
+                fputs("true", out);
+                break;
+            case F_CONST:
+                fprintf(out, "\"%s\"", field.constant);
+                break;
+            case F_BYTES:
+                fputc('"', out);
+                json_write_base64(out, r.text, r.textLen);
+                fputc('"', out);
+                break;
+        }
+    }
+
+    fputs("}", out);
+}
+
+static void write_json_stats(FILE* out) {
+    TraceStat stats[k_trace_stat_count];
+    collect_stats(stats);
+
+    fputs(",\"stats\":{\"events\":{", out);
+    bool first = true;
+    for_each_type_count([&](const char* type, unsigned long count) {
+        fprintf(out, "%s\"%s\":%lu", first ? "" : ",", type, count);
+        first = false;
+    });
+    fputs("}", out);
+    for (const TraceStat& stat : stats) fprintf(out, ",\"%s\":%llu", stat.name, stat.value);
+    fputs("}", out);
+}
+
+// ---------------------------------------------------------------------------
+// Binary encoder (TRACE_FORMAT=bin)
+//
+//   file    := "VTRB" varint(version) record* 0*
+//   record  := varint(tag) payload
+//   SCHEMA  := kind str(type) varint(n) (str(name) varint(fieldType) str(constant))*
+//   STRING  := varint(id) str(bytes)            ids start at 1, 0 is null
+//   EVENT   := kind zz(id - prevId) zz(ts - prevTs) varint(addr) varint(func)
+//              zz(depth) varint(tid) field*
+//   FOOTER  := varint(total_events) varint(dropped_events) varint(n)
+//              varint(function string id)*
+//              varint(n) (varint(kind) varint(written))*
+//              varint(n) (str(stat) varint(value))*
+//
+// Integers are LEB128 varints, signed ones zigzag encoded; doubles are 8
+// little-endian bytes.  Strings are defined once, right before first use.
+// No tag is zero, so the zeros after the last record of a mapped trace file
+// that was never finished end the trace.  The reader (trace-reader.js)
+// accepts only k_binary_version, so any change to the layout bumps it there
+// and here together.
+// ---------------------------------------------------------------------------
+
+static const unsigned k_binary_version = 6;
+
+enum BinaryTag : unsigned char {
+    TAG_SCHEMA = 1,
+    TAG_STRING = 2,
+    TAG_EVENT = 3,
+    TAG_FOOTER = 4
+};
+
+struct ByteBuffer {
+    unsigned char data[2048];
+    std::size_t len = 0;
+
+    void byte(unsigned char b) { if (len < sizeof(data)) data[len++] = b; }
+    void varint(unsigned long long v) {
+        while (v >= 0x80) { byte((unsigned char)(v | 0x80)); v >>= 7; }
+        byte((unsigned char)v);
+    }
+    void zigzag(long long v) {
+        varint(((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+    }
+    void bytes(const char* s, std::size_t n) {
+        varint(n);
+        for (std::size_t k = 0; k < n; ++k) byte((unsigned char)s[k]);
+    }
+    void str(const char* s) { bytes(s ? s : "", s ? strlen(s) : 0); }
+    void flush(FILE* out) {
+        fwrite(data, 1, len, out);
+        g_binary_bytes += len;
+        len = 0;
+    }
+};
+
+static unsigned long g_binary_prev_id = 0;
+static unsigned long long g_binary_prev_ts = 0;
+
+// Definitions are written the first time a symbol is referenced, so they
+// always precede the event that uses them.
+static SymbolId binary_symbol(FILE* out, SymbolId id) {
+    if (!id) return id;
+    Symbol& sym = symbol(id);
+    if (sym.emitted) return id;
+    sym.emitted = true;
+
+    ByteBuffer def;
+    def.varint(TAG_STRING);
+    def.varint(id);
+    def.bytes(sym.text, std::min<std::size_t>(sym.len, sizeof(def.data) - 16));
+    def.flush(out);
+    return id;
+}
+
+static void write_binary_header(FILE* out) {
+    fwrite("VTRB", 1, 4, out);
+    g_binary_bytes += 4;
+    ByteBuffer buf;
+    buf.varint(k_binary_version);
+    buf.flush(out);
+
+    for (unsigned kind = 0; kind < k_event_kind_count; ++kind) {
+        const EventSpec& spec = k_event_specs[kind];
+        buf.varint(TAG_SCHEMA);
+        buf.varint(kind);
+        buf.str(spec.type);
+        buf.varint(spec.count);
+        for (unsigned f = 0; f < spec.count; ++f) {
+            buf.str(spec.fields[f].name);
+            buf.varint(spec.fields[f].type);
+            buf.str(spec.fields[f].constant);
+        }
+        buf.flush(out);
+    }
+}
+
+static void write_binary_record(FILE* out, const EventRecord& r) {
+    const EventSpec& spec = k_event_specs[r.kind];
+    ++g_events_written;
+
+    const SymbolId funcId = binary_symbol(out, r.func);
+    for (unsigned f = 0; f < spec.count; ++f) {
+        const FieldSpec& field = spec.fields[f];
+        if (field.type == F_STR || field.type == F_OPT_STR) binary_symbol(out, r.s[field.slot]);
+        else if (field.type == F_PATH) binary_symbol(out, r.file);
+    }
+
+    ByteBuffer buf;
+    buf.varint(TAG_EVENT);
+    buf.varint(r.kind);
+    buf.zigzag((long long)r.id - (long long)g_binary_prev_id);
+    buf.zigzag((long long)r.ts - (long long)g_binary_prev_ts);
+    buf.varint((unsigned long long)(uintptr_t)r.addr);
+    buf.varint(funcId);
+    buf.zigzag(r.depth);
+    buf.varint(r.tid);
+    g_binary_prev_id = r.id;
+    g_binary_prev_ts = r.ts;
+
+    for (unsigned f = 0; f < spec.count; ++f) {
+        const FieldSpec& field = spec.fields[f];
+        switch (field.type) {
+            case F_INT:
+                buf.zigzag(r.i[field.slot]);
+                break;
+            case F_UINT:
+                buf.varint((unsigned long long)r.i[field.slot]);
+                break;
+            case F_BOOL:
+                buf.varint(r.i[field.slot] ? 1 : 0);
+                break;
+            case F_STR:
+            case F_OPT_STR:
+                buf.varint(r.s[field.slot]);
+                break;
+            case F_PATH:
+                buf.varint(r.file);
+                break;
+            case F_LINE:
+                buf.zigzag(r.line);
+                break;
+            case F_PTR:
+                buf.varint((unsigned long long)(uintptr_t)r.p);
+                break;
+            case F_DIMS:
+            case F_INDICES: {
+                const int n = trailing_dims(r.i, field.type == F_INDICES);
+                buf.varint(n);
+                for (int k = 0; k < n; ++k) buf.zigzag(r.i[k]);
+                break;
+            }
+            case F_CHAR:
+                buf.varint((unsigned char)r.i[field.slot]);
+                break;
+            case F_DOUBLE: {
+                unsigned long long bits;
+                memcpy(&bits, &r.d, sizeof(bits));
+                for (int k = 0; k < 8; ++k) buf.byte((unsigned char)(bits >> (8 * k)));
+                break;
+            }
+            case F_TEXT:
+            case F_BYTES:
+                buf.bytes(r.text, r.textLen);
+                break;
+            case F_NULL:
+            case F_TRUE:
+            case F_CONST:
+                break;
+        }
+    }
+    buf.flush(out);
+}
+
+static unsigned long dropped_events();
+
+static void write_binary_footer(FILE* out) {
+    std::vector<SymbolId> ids;
+    for (const auto& fn : tracked_functions()) {
+        ids.push_back(binary_symbol(out, intern_text(fn.data())));
+    }
+
+    ByteBuffer buf;
+    buf.varint(TAG_FOOTER);
+    buf.varint(g_event_counter.load());
+    buf.varint(dropped_events());
+    buf.varint(ids.size());
+    for (SymbolId id : ids) {
+        buf.varint(id);
+        if (buf.len > sizeof(buf.data) - 16) buf.flush(out);
+    }
+
+    unsigned kinds = 0;
+    for (unsigned long count : g_written_by_kind) kinds += count != 0;
+    buf.varint(kinds);
+    for (unsigned kind = 0; kind < k_event_kind_count; ++kind) {
+        if (!g_written_by_kind[kind]) continue;
+        buf.varint(kind);
+        buf.varint(g_written_by_kind[kind]);
+        if (buf.len > sizeof(buf.data) - 32) buf.flush(out);
+    }
+
+    TraceStat stats[k_trace_stat_count];
+    collect_stats(stats);
+    buf.varint(k_trace_stat_count);
+    for (const TraceStat& stat : stats) {
+        buf.str(stat.name);
+        buf.varint(stat.value);
+    }
+    buf.flush(out);
+}
+
+static inline void write_record(FILE* out, const EventRecord& r) {
+    ++g_written_by_kind[r.kind];
+    if (g_trace_format == TRACE_FORMAT_BINARY) write_binary_record(out, r);
+    else write_json_record(out, r);
+}
+
+// ---------------------------------------------------------------------------
+// Mapped trace file
+//
+// A TRACE_OUTPUT file is written through a cookie stream into a shared
+// mapping of the file, allocated and grown as needed.  Bytes copied into it
+// belong to the page cache at once, so they outlive the process however it
+// ends.  The drain thread hands each batch over, then publishes it by writing
+// its first byte last.  Until then that byte is still zero, so a file whose
+// process was killed holds whole batches followed by zeros.  Neither format
+// starts a record with a zero byte, which is how readers find the end.
+// finish_tracer trims the file to its length.
+// ---------------------------------------------------------------------------
+
+#if defined(__linux__)
+// The file is allocated and its pages faulted in a step at a time: a fault on
+// a fresh page of a shared file mapping costs more than the copy into it.
+static const std::size_t TRACE_MAP_STEP = (std::size_t)4 << 20;
+
+struct MappedTrace {
+    int fd;
+    char* base;
+    std::size_t capacity;
+    std::size_t length;         // bytes handed over by the stream
+    std::size_t published;      // bytes a reader may use; base[published] is 0
+    char held;                  // the first unpublished byte, written last
+};
+
+static MappedTrace g_mapped = {-1, nullptr, 0, 0, 0, 0};
+
+// Sparse where the filesystem cannot allocate ahead.
+static bool allocate_trace_file(int fd, std::size_t size) {
+    return fallocate(fd, 0, 0, (off_t)size) == 0 || ftruncate(fd, (off_t)size) == 0;
+}
+
+static bool mapped_reserve(std::size_t size) {
+    if (size <= g_mapped.capacity) return true;
+    std::size_t capacity = g_mapped.capacity;
+    while (capacity < size) capacity += TRACE_MAP_STEP;
+    if (!allocate_trace_file(g_mapped.fd, capacity)) return false;
+    void* p = mremap(g_mapped.base, g_mapped.capacity, capacity, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) return false;
+#ifdef MADV_POPULATE_WRITE
+    madvise(static_cast<char*>(p) + g_mapped.capacity, capacity - g_mapped.capacity, MADV_POPULATE_WRITE);
+#endif
+    g_mapped.base = static_cast<char*>(p);
+    g_mapped.capacity = capacity;
+    return true;
+}
+
+static ssize_t mapped_write(void*, const char* data, std::size_t size) {
+    if (size == 0) return 0;
+    if (!mapped_reserve(g_mapped.length + size)) return -1;
+    std::size_t skip = 0;
+    if (g_mapped.length == g_mapped.published) {
+        g_mapped.held = data[0];
+        skip = 1;
+    }
+    memcpy(g_mapped.base + g_mapped.length + skip, data + skip, size - skip);
+    g_mapped.length += size;
+    return (ssize_t)size;
+}
+
+// ftell: the stream asks for the current position only.
+static int mapped_seek(void*, off64_t* offset, int whence) {
+    if (whence != SEEK_CUR || *offset != 0) return -1;
+    *offset = (off64_t)g_mapped.length;
+    return 0;
+}
+
+static void mapped_publish() {
+    if (!g_mapped.base || g_mapped.length == g_mapped.published) return;
+    __atomic_store_n(g_mapped.base + g_mapped.published, g_mapped.held, __ATOMIC_RELEASE);
+    g_mapped.published = g_mapped.length;
+}
+
+static int mapped_close(void*) {
+    mapped_publish();
+    munmap(g_mapped.base, g_mapped.capacity);
+    const int rc = ftruncate(g_mapped.fd, (off_t)g_mapped.length);
+    close(g_mapped.fd);
+    g_mapped = MappedTrace{-1, nullptr, 0, 0, 0, 0};
+    return rc;
+}
+
+static FILE* open_mapped_trace(const char* path, const char* mode) {
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return nullptr;
+    void* p = MAP_FAILED;
+    if (allocate_trace_file(fd, TRACE_MAP_STEP)) {
+        p = mmap(nullptr, TRACE_MAP_STEP, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    if (p == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    g_mapped = MappedTrace{fd, static_cast<char*>(p), TRACE_MAP_STEP, 0, 0, 0};
+
+    cookie_io_functions_t io{};
+    io.write = mapped_write;
+    io.seek = mapped_seek;
+    io.close = mapped_close;
+    FILE* stream = fopencookie(nullptr, mode, io);
+    if (!stream) {
+        munmap(p, TRACE_MAP_STEP);
+        close(fd);
+        g_mapped = MappedTrace{-1, nullptr, 0, 0, 0, 0};
+    }
+    return stream;
+}
+
+static inline bool trace_mapped() { return g_mapped.base != nullptr; }
+#else
+static FILE* open_mapped_trace(const char*, const char*) { return nullptr; }
+static inline bool trace_mapped() { return false; }
+static void mapped_publish() {}
+#endif
+
+// Merges the per-thread rings by sequence number.  Ids are handed out before
+// the record is filled in, so a later id can be committed on one ring while
+// an earlier one is still being written on another; g_drain_next is the id
+// the file is waiting for, and nothing past it is written until it arrives.
+// Every reserved id is committed, so the wait is only for the producer to
+// finish its record.  The final drain, once the producers have stopped,
+// skips any id an interrupted hook left uncommitted.
+static unsigned long g_drain_next = 0;
+
+static unsigned long drain_rings(bool final = false) {
+    if (!g_trace_file) return 0;
+    unsigned long written = 0;
+
+    for (;;) {
+        EventRing* best = nullptr;
+        unsigned long bestId = ~0UL;
+
+        for (EventRing* r = g_rings.load(std::memory_order_acquire); r; r = r->next) {
+            unsigned long long tail = r->tail.load(std::memory_order_relaxed);
+            if (tail == r->head.load(std::memory_order_acquire)) continue;
+            unsigned long id = r->slots[tail & (TRACE_RING_CAPACITY - 1)].id;
+            if (id < bestId) {
+                bestId = id;
+                best = r;
+            }
+        }
+        if (!best) break;
+        if (bestId != g_drain_next) {
+            if (!final) break;
+            g_drain_next = bestId;
+        }
+
+        unsigned long long tail = best->tail.load(std::memory_order_relaxed);
+        const unsigned long long head = best->head.load(std::memory_order_acquire);
+        const unsigned long long started = get_timestamp_ns();
+        while (tail != head) {
+            const EventRecord& rec = best->slots[tail & (TRACE_RING_CAPACITY - 1)];
+            if (rec.id != g_drain_next) break;
+            write_record(g_trace_file, rec);
+            ++g_drain_next;
+            ++tail;
+            ++written;
+        }
+        g_writer_ns += get_timestamp_ns() - started;
+        best->tail.store(tail, std::memory_order_release);
+    }
+    return written;
+}
+
+#ifdef _WIN32
+static HANDLE g_drain_thread = nullptr;
+static DWORD WINAPI drain_main(LPVOID)
+#else
+static pthread_t g_drain_thread;
+static pid_t g_drain_pid = 0;
+static std::atomic<int> g_terminate_signal{0};
+static void seal_terminated();
+static void* drain_main(void*)
+#endif
+{
+    t_in_tracer = true;
+#ifndef _WIN32
+    // Termination is handled here (see on_terminate), never by this thread.
+    sigset_t term;
+    sigemptyset(&term);
+    sigaddset(&term, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &term, nullptr);
+#endif
+    bool unflushed = false;
+    while (!g_drain_stop.load(std::memory_order_acquire)) {
+#ifndef _WIN32
+        if (g_terminate_signal.load(std::memory_order_acquire)) seal_terminated();
+#endif
+        lock_drain();
+        unsigned long n = drain_rings();
+        // A streamed trace is pushed to the reader whenever the producers
+        // go idle; full stdio buffers flush on their own in between.  A
+        // mapped one takes every batch, which costs a copy and no syscall.
+        if (n && trace_mapped()) {
+            fflush(g_trace_file);
+            mapped_publish();
+        } else if (n) {
+            unflushed = g_trace_streaming;
+        } else if (unflushed) {
+            fflush(g_trace_file);
+            unflushed = false;
+        }
+        unlock_drain();
+        if (n == 0) drain_sleep();
+    }
+    return 0;
+}
+
+static bool start_drain_thread() {
+#ifdef _WIN32
+    g_drain_thread = CreateThread(nullptr, 0, drain_main, nullptr, 0, nullptr);
+    if (!g_drain_thread) return false;
+#else
+    if (pthread_create(&g_drain_thread, nullptr, drain_main, nullptr) != 0) return false;
+    g_drain_pid = getpid();
+#endif
+    g_drain_running.store(true, std::memory_order_release);
+    return true;
+}
+
+static void stop_drain_thread() {
+    if (!g_drain_running.exchange(false)) return;
+    g_drain_stop.store(true, std::memory_order_release);
+#ifdef _WIN32
+    WaitForSingleObject(g_drain_thread, INFINITE);
+    CloseHandle(g_drain_thread);
+#else
+    if (g_drain_pid == getpid() && !pthread_equal(pthread_self(), g_drain_thread)) {
+        pthread_join(g_drain_thread, nullptr);
+    }
+#endif
+}
+
+#ifndef _WIN32
+// A forked child inherits the rings but not the drain thread, and shares the
+// parent's trace file; it stops tracing instead of interleaving into it.
+static void drain_prepare_fork() {
+    fflush(stdout);
+    lock_drain();
+    if (g_trace_file) fflush(g_trace_file);
+}
+static void drain_parent_fork() { unlock_drain(); }
+static void drain_child_fork() {
+    set_tracing(false);
+    g_drain_running.store(false, std::memory_order_relaxed);
+    g_trace_file = nullptr;
+    unlock_drain();
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Event budget and loop sampling
+//
+// TRACE_MAX_EVENTS caps the number of records written; the first record over
+// the cap is replaced by a single trace_truncated marker.  TRACE_LOOP_HEAD,
+// TRACE_LOOP_TAIL and TRACE_LOOP_STRIDE keep the first N iterations, the last
+// M iterations and every Nth iteration in between of each loop; runs of
+// dropped iterations are replaced by a loop_skipped record.  An iteration
+// spans from its loop_body_start to the next one (or the loop's end).
+//
+// The end of a loop is not known in advance, so iterations past the head are
+// buffered in a per-process capture and only the last M survive.  Only one
+// loop captures at a time, owned by one thread; other loops, nested or on
+// other threads, fall back to head/stride.
+// ---------------------------------------------------------------------------
+
+struct TraceBudget {
+    unsigned long maxEvents;    // 0 = unlimited
+    int loopHead;
+    int loopTail;
+    int loopStride;
+    std::size_t captureLimit;   // records buffered for the tail window
+    bool dedup;                 // drop assigns and element writes that change nothing
+    unsigned long keyframeInterval;     // events between keyframes, 0 = off
+};
+
+struct CapturedIteration {
+    int iteration;
+    std::size_t count;
+    bool keep;                  // stride iteration, survives the tail window
+};
+
+struct LoopCapture {
+    std::size_t frame;          // owner: index into its thread's callStack and loop id
+    int loopId;
+    SymbolId file;
+    int line;
+    SkipRange skipped;
+    ArenaDeque<EventRecord> records;
+    ArenaDeque<CapturedIteration> iterations;
+};
+
+static TraceBudget g_budget = {0, 0, 0, 0, 1 << 16, false, 0};
+static bool g_loop_sampling = false;
+static std::atomic<bool> g_budget_exhausted{false};
+static std::atomic<unsigned long> g_dropped_events{0};
+
+static LoopCapture* g_capture = nullptr;    // leaked: flushed from finish_tracer
+static std::atomic<ThreadState*> g_capture_owner{nullptr};
+static thread_local bool t_event_captured = false;
+
+static unsigned long sampled_out() {
+    unsigned long n = 0;
+    for (ThreadState* s = g_threads.load(std::memory_order_acquire); s; s = s->next) n += s->sampledOut;
+    return n;
+}
+
+static unsigned long dropped_events() {
+    return g_dropped_events.load(std::memory_order_relaxed) + sampled_out();
+}
+
+static inline void init_record(EventRecord* rec, EventKind kind, void* addr, SymbolId func, int depth) {
+    rec->ts = get_timestamp_ns();
+    rec->kind = kind;
+    rec->addr = addr;
+    rec->func = func ? func : SYM_UNKNOWN;
+    rec->depth = depth;
+    rec->tid = thread_state().tid;
+    rec->file = SYM_NONE;
+    rec->line = 0;
+    rec->textLen = 0;
+}
+
+static inline long long double_bits(double v) {
+    long long bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+// Stores a traced value where its field reads it: i[slot] for integers, d for
+// doubles and p for pointers.
+static inline void set_value(EventRecord* rec, int slot, long long value, ValueEncoding encoding) {
+    switch (encoding) {
+        case VAL_DOUBLE:
+            memcpy(&rec->d, &value, sizeof(rec->d));
+            break;
+        case VAL_POINTER:
+            rec->p = reinterpret_cast<const void*>((uintptr_t)value);
+            break;
+        default:
+            rec->i[slot] = value;
+            break;
+    }
+}
+
+static EventRecord* reserve_slot(EventKind kind, void* addr, SymbolId func, int depth) {
+    EventRing* ring = thread_ring();
+    if (!ring) return nullptr;
+
+    const unsigned long long head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_CAPACITY) ++ring->stats.stalls;
+    while (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_CAPACITY) {
+        if (!g_drain_running.load(std::memory_order_acquire)) {
+            lock_drain();
+            drain_rings();
+            unlock_drain();
+        } else {
+            cpu_relax();
+        }
+    }
+
+    EventRecord* rec = &ring->slots[head & (TRACE_RING_CAPACITY - 1)];
+    rec->id = g_event_counter.fetch_add(1, std::memory_order_relaxed);
+    init_record(rec, kind, addr, func, depth);
+    return rec;
+}
+
+static inline void commit_ring_event(EventRecord* rec) {
+    EventRing* ring = t_ring;
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    (void)rec;
+}
+
+static EventRecord* begin_ring_event(EventKind kind, void* addr, SymbolId func, int depth) {
+    if (g_budget.maxEvents &&
+        g_event_counter.load(std::memory_order_relaxed) >= g_budget.maxEvents) {
+        g_dropped_events.fetch_add(1, std::memory_order_relaxed);
+        if (!g_budget_exhausted.exchange(true)) {
+            const ThreadState& ts = thread_state();
+            EventRecord* rec = reserve_slot(EV_TRACE_TRUNCATED, nullptr, ts.currentFunction, ts.depth);
+            if (rec) {
+                rec->i[0] = (long long)g_budget.maxEvents;
+                commit_ring_event(rec);
+            }
+        }
+        return nullptr;
+    }
+    return reserve_slot(kind, addr, func, depth);
+}
+
+static void replay_record(const EventRecord& src) {
+    EventRecord* rec = begin_ring_event(src.kind, src.addr, src.func, src.depth);
+    if (!rec) return;
+    const unsigned long id = rec->id;
+    *rec = src;
+    rec->id = id;
+    commit_ring_event(rec);
+}
+
+static void note_skipped(SkipRange& range, int iteration, unsigned long events) {
+    if (range.count == 0) range.first = iteration;
+    range.last = iteration;
+    range.count++;
+    range.droppedEvents += events;
+}
+
+static EventRecord* begin_event(EventKind kind, void* addr, SymbolId func, int depth);
+static inline void commit_event(EventRecord* rec);
+
+// `direct` bypasses the capture; used when flushing it.
+static void emit_loop_skipped(const ThreadState& ts, int loopId, SkipRange& range, SymbolId file, int line,
+                              bool direct) {
+    if (range.count == 0) return;
+    EventRecord* rec = direct
+        ? begin_ring_event(EV_LOOP_SKIPPED, nullptr, ts.currentFunction, ts.depth)
+        : begin_event(EV_LOOP_SKIPPED, nullptr, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->i[0] = loopId;
+        rec->i[1] = range.first;
+        rec->i[2] = range.last;
+        rec->i[3] = range.count;
+        rec->i[4] = (long long)range.droppedEvents;
+        rec->file = file;
+        rec->line = line;
+        if (direct) commit_ring_event(rec);
+        else commit_event(rec);
+    }
+    range = SkipRange{0, 0, 0, 0};
+}
+
+// The capture's deques allocate and free through the heap hooks, so every
+// mutation runs with the tracer guard held.
+static void push_captured_iteration(int iteration, bool keep) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    g_capture->iterations.push_back(CapturedIteration{iteration, 0, keep});
+    t_in_tracer = guard;
+}
+
+static void evict_captured_iteration(ThreadState& ts) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    LoopCapture& c = *g_capture;
+    const CapturedIteration front = c.iterations.front();
+    c.iterations.pop_front();
+
+    if (front.keep) {
+        emit_loop_skipped(ts, c.loopId, c.skipped, c.file, c.line, true);
+        for (std::size_t k = 0; k < front.count; ++k) replay_record(c.records[k]);
+    } else {
+        note_skipped(c.skipped, front.iteration, front.count);
+        ts.sampledOut += front.count;
+    }
+    c.records.erase(c.records.begin(), c.records.begin() + front.count);
+    t_in_tracer = guard;
+}
+
+// The capture is released only once replayed, so no other thread claims it
+// half flushed.
+static void flush_capture(ThreadState& ts) {
+    if (!ts.capturing) return;
+    ts.capturing = false;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    LoopCapture& c = *g_capture;
+    emit_loop_skipped(ts, c.loopId, c.skipped, c.file, c.line, true);
+    for (const EventRecord& rec : c.records) replay_record(rec);
+    c.records.clear();
+    c.iterations.clear();
+    t_in_tracer = guard;
+    g_capture_owner.store(nullptr, std::memory_order_release);
+}
+
+static EventRecord* capture_event(ThreadState& ts, EventKind kind, void* addr, SymbolId func, int depth) {
+    LoopCapture& c = *g_capture;
+    while (c.records.size() >= g_budget.captureLimit && c.iterations.size() > 1) {
+        evict_captured_iteration(ts);
+    }
+    if (c.records.size() >= g_budget.captureLimit) {
+        c.skipped.droppedEvents++;
+        ++ts.sampledOut;
+        return nullptr;
+    }
+
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    c.records.emplace_back();
+    t_in_tracer = guard;
+
+    EventRecord* rec = &c.records.back();
+    rec->id = 0;
+    init_record(rec, kind, addr, func, depth);
+    c.iterations.back().count++;
+    t_event_captured = true;
+    return rec;
+}
+
+// ---------------------------------------------------------------------------
+// Program output
+//
+// stdout is swapped for a fully buffered cookie stream that forwards to fd 1
+// and counts what it writes, so the bytes the program has produced so far are
+// the bytes written plus those pending in the buffer.  Whenever an event
+// begins with new output behind it, an output record carrying that output's
+// [start, end) byte range in the program's stdout is written first: output is
+// attributed by sequence number, without a flush per printf or per function.
+// Where the stream cannot be swapped stdout stays unbuffered and is flushed at
+// function exits as before.
+// ---------------------------------------------------------------------------
+
+static FILE* g_output = nullptr;                    // the cookie stream while capturing
+static unsigned long long g_output_written = 0;     // forwarded to fd 1, under the stream's lock
+static std::atomic<unsigned long long> g_output_mark{0};   // end of the last output record
+
+#if defined(__linux__)
+static ssize_t output_write(void*, const char* data, std::size_t size) {
+    std::size_t done = 0;
+    while (done < size) {
+        const ssize_t n = ::write(STDOUT_FILENO, data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (std::size_t)n;
+    }
+    g_output_written += done;
+    return done ? (ssize_t)done : -1;
+}
+
+static void capture_output() {
+    cookie_io_functions_t io{};
+    io.write = output_write;
+    FILE* stream = fopencookie(nullptr, "w", io);
+    if (!stream) return;
+    // A buffer of our own, or stdio would malloc one on the program's first write.
+    static char buffer[1 << 16];
+    setvbuf(stream, buffer, _IOFBF, sizeof(buffer));
+#ifdef __GLIBC__
+    // fileno(stdout) keeps working, e.g. for sync_with_stdio(false), whose
+    // writes then bypass the buffer and go unattributed.
+    stream->_fileno = STDOUT_FILENO;
+#endif
+    fflush(stdout);
+    stdout = stream;
+    g_output = stream;
+
+    // std::cout was bound to the original stream by ios_base::Init.
+    static __gnu_cxx::stdio_sync_filebuf<char>* cout_buf = arena_new<__gnu_cxx::stdio_sync_filebuf<char>>(stream);
+    if (cout_buf) std::cout.rdbuf(cout_buf);
+}
+
+static inline unsigned long long output_produced() {
+    return g_output_written + __fpending(g_output);
+}
+#else
+static void capture_output() {}
+static inline unsigned long long output_produced() { return g_output_written; }
+#endif
+
+static inline bool output_pending() {
+    return output_produced() != g_output_mark.load(std::memory_order_relaxed);
+}
+
+// Threads race to claim the new output; each range goes to whichever of them
+// moves the mark past it.
+static void emit_output() {
+    const unsigned long long end = output_produced();
+    unsigned long long start = g_output_mark.load(std::memory_order_relaxed);
+    do {
+        if (end <= start) return;
+    } while (!g_output_mark.compare_exchange_weak(start, end, std::memory_order_relaxed));
+
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_OUTPUT, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = (long long)start;
+    rec->i[1] = (long long)end;
+    commit_event(rec);
+}
+
+static EventRecord* begin_event(EventKind kind, void* addr, SymbolId func, int depth) {
+    if (g_output && output_pending()) emit_output();
+    if (g_budget_exhausted.load(std::memory_order_relaxed)) {
+        g_dropped_events.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    ThreadState& ts = thread_state();
+    if (ts.suppressDepth > 0) {
+        ++ts.sampledOut;
+        return nullptr;
+    }
+    if (ts.capturing) return capture_event(ts, kind, addr, func, depth);
+    return begin_ring_event(kind, addr, func, depth);
+}
+
+static void emit_keyframe();
+static unsigned long g_keyframe_mark = 0;   // first event id after the last keyframe
+
+static inline void commit_event(EventRecord* rec) {
+    if (t_event_captured) {
+        t_event_captured = false;
+        return;
+    }
+    commit_ring_event(rec);
+
+    // Deferred while loop sampling holds back events: a keyframe describes
+    // the state after every record before it.
+    if (g_budget.keyframeInterval && rec->id - g_keyframe_mark >= g_budget.keyframeInterval &&
+        !g_threaded.load(std::memory_order_relaxed)) {
+        const ThreadState& ts = thread_state();
+        if (ts.capturing || ts.suppressDepth > 0) return;
+        emit_keyframe();
+        g_keyframe_mark = g_event_counter.load(std::memory_order_relaxed);
+    }
+}
+
+static void set_skipping(ThreadState& ts, LoopState& loop, bool on) {
+    if (loop.skipping == on) return;
+    loop.skipping = on;
+    if (on) {
+        ++ts.suppressDepth;
+        loop.droppedMark = ts.sampledOut;
+    } else {
+        --ts.suppressDepth;
+        loop.skipped.droppedEvents += ts.sampledOut - loop.droppedMark;
+    }
+}
+
+static inline bool owns_capture(const ThreadState& ts, std::size_t frame, const LoopState& loop) {
+    return ts.capturing && g_capture->frame == frame && g_capture->loopId == loop.loopId;
+}
+
+static bool claim_capture(ThreadState& ts) {
+    ThreadState* expected = nullptr;
+    if (!g_capture_owner.compare_exchange_strong(expected, &ts, std::memory_order_acquire)) return false;
+    ts.capturing = true;
+    return true;
+}
+
+// Called at each loop_body_start, before its record is emitted.
+static void sample_iteration(ThreadState& ts, std::size_t frame, LoopState& loop) {
+    if (!g_loop_sampling) return;
+
+    const int it = loop.iteration;
+    const bool head = it <= g_budget.loopHead;
+    const bool keep = !head && g_budget.loopStride > 0 &&
+                      (it - g_budget.loopHead) % g_budget.loopStride == 0;
+
+    if (owns_capture(ts, frame, loop)) {
+        push_captured_iteration(it, keep);
+        while (g_capture->iterations.size() > (std::size_t)g_budget.loopTail) {
+            evict_captured_iteration(ts);
+        }
+        return;
+    }
+
+    if (!head && g_budget.loopTail > 0 && g_capture && !g_capture_owner.load(std::memory_order_relaxed)) {
+        set_skipping(ts, loop, false);
+        if (ts.suppressDepth == 0) {
+            emit_loop_skipped(ts, loop.loopId, loop.skipped, loop.file, loop.line, false);
+            if (claim_capture(ts)) {
+                g_capture->frame = frame;
+                g_capture->loopId = loop.loopId;
+                g_capture->file = loop.file;
+                g_capture->line = loop.line;
+                g_capture->skipped = SkipRange{0, 0, 0, 0};
+                push_captured_iteration(it, keep);
+                return;
+            }
+        }
+    }
+
+    if (!head && !keep) {
+        set_skipping(ts, loop, true);
+        note_skipped(loop.skipped, it, 0);
+    } else {
+        set_skipping(ts, loop, false);
+        emit_loop_skipped(ts, loop.loopId, loop.skipped, loop.file, loop.line, false);
+    }
+}
+
+// Called when a loop stops being active, before its loop_end record.
+static void finish_loop_sampling(ThreadState& ts, std::size_t frame, LoopState& loop) {
+    if (!g_loop_sampling) return;
+    if (owns_capture(ts, frame, loop)) {
+        flush_capture(ts);
+        return;
+    }
+    set_skipping(ts, loop, false);
+    emit_loop_skipped(ts, loop.loopId, loop.skipped, loop.file, loop.line, false);
+}
+
+static LoopState* find_loop(CallFrame& frame, int loopId) {
+    for (auto it = frame.activeLoops.rbegin(); it != frame.activeLoops.rend(); ++it) {
+        if (it->loopId == loopId) return &*it;
+    }
+    return nullptr;
+}
+
+// Scopes are only tracked inside a frame; a name declared outside any block
+// or loop body goes with its frame.
+static void open_scope(ThreadState& ts, int loopId) {
+    if (ts.callStack.empty()) return;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    ts.callStack.back().scopes.push_back(Scope{loopId, {}});
+    t_in_tracer = guard;
+}
+
+static void declare_in_scope(ThreadState& ts, SymbolId name) {
+    if (ts.callStack.empty() || ts.callStack.back().scopes.empty()) return;
+    ArenaVector<SymbolId>& names = ts.callStack.back().scopes.back().names;
+    if (std::find(names.begin(), names.end(), name) != names.end()) return;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    names.push_back(name);
+    t_in_tracer = guard;
+}
+
+// The record's `destroyed`: the scopes' names, outermost first and comma
+// separated, as many whole names as the text holds.
+static void set_destroyed(EventRecord* rec, const Scope* scopes, std::size_t count) {
+    unsigned len = 0;
+    for (std::size_t k = 0; k < count; ++k) {
+        for (const SymbolId name : scopes[k].names) {
+            bool seen = false;
+            for (std::size_t outer = 0; outer < k && !seen; ++outer) {
+                const ArenaVector<SymbolId>& names = scopes[outer].names;
+                seen = std::find(names.begin(), names.end(), name) != names.end();
+            }
+            const Symbol& sym = symbol(name);
+            if (seen || len + (len > 0) + sym.len > TRACE_TEXT_CAPACITY) continue;
+            if (len > 0) rec->text[len++] = ',';
+            std::memcpy(rec->text + len, sym.text, sym.len);
+            len += sym.len;
+        }
+    }
+    rec->textLen = (unsigned short)len;
+}
+
+// The innermost scope when it is of that kind: a block for -1, else that
+// loop's iteration.  A break leaves its iteration open, so an exit may find
+// none; the names then go with the frame.
+static Scope* innermost_scope(ThreadState& ts, int loopId) {
+    if (ts.callStack.empty() || ts.callStack.back().scopes.empty()) return nullptr;
+    Scope& scope = ts.callStack.back().scopes.back();
+    return scope.loopId == loopId ? &scope : nullptr;
+}
+
+static void read_budget() {
+    if (const char* v = std::getenv("TRACE_MAX_EVENTS")) g_budget.maxEvents = std::strtoul(v, nullptr, 10);
+    if (const char* v = std::getenv("TRACE_LOOP_HEAD")) g_budget.loopHead = std::atoi(v);
+    if (const char* v = std::getenv("TRACE_LOOP_TAIL")) g_budget.loopTail = std::atoi(v);
+    if (const char* v = std::getenv("TRACE_LOOP_STRIDE")) g_budget.loopStride = std::atoi(v);
+    if (const char* v = std::getenv("TRACE_CAPTURE_LIMIT")) g_budget.captureLimit = std::strtoul(v, nullptr, 10);
+    if (const char* v = std::getenv("TRACE_DEDUP")) g_budget.dedup = std::strcmp(v, "1") == 0;
+    if (const char* v = std::getenv("TRACE_KEYFRAME_INTERVAL")) g_budget.keyframeInterval = std::strtoul(v, nullptr, 10);
+
+    if (g_budget.loopHead < 0) g_budget.loopHead = 0;
+    if (g_budget.loopTail < 0) g_budget.loopTail = 0;
+    if (g_budget.loopStride < 0) g_budget.loopStride = 0;
+    if (g_budget.captureLimit == 0) g_budget.captureLimit = 1;
+
+    g_loop_sampling = g_budget.loopHead > 0 || g_budget.loopTail > 0 || g_budget.loopStride > 0;
+    if (g_loop_sampling && g_budget.loopTail > 0) g_capture = arena_new<LoopCapture>();
+}
+
+static inline void set_location(EventRecord* rec, const char* file, int line) {
+    rec->file = intern_path(file);
+    rec->line = line;
+}
+
+static const char* demangle(const char* name) {
+#ifndef _WIN32
+    if (!name) return "unknown";
+    if (strncmp(name, "_Z", 2) != 0) return name;     // C names are not mangled
+    // One buffer per thread, grown by __cxa_demangle as needed, instead of a
+    // malloc and free per symbol.
+    static __thread char* buffer = nullptr;
+    static __thread std::size_t size = 0;
+    int status = 0;
+    char* real = abi::__cxa_demangle(name, buffer, &size, &status);
+    if (status == 0 && real) {
+        buffer = real;
+        return buffer;
+    }
+    return name;
+#else
+    return name;
+#endif
+}
+
+static SymbolId function_symbol(const char* name) {
+    if (!name) return SYM_UNKNOWN;
+
+    SymbolId id;
+    if (strpbrk(name, "\r\n")) {
+        char clean[512];
+        std::size_t n = 0;
+        for (const char* c = name; *c && n + 1 < sizeof(clean); ++c) {
+            if (*c != '\r' && *c != '\n') clean[n++] = *c;
+        }
+        clean[n] = '\0';
+        id = intern_text(clean);
+    } else {
+        id = intern_text(name);
+    }
+    return id;
+}
+
+// Records a function for the footer the first time it is entered.
+static void track_function(SymbolId id) {
+    Symbol& sym = symbol(id);
+    if (sym.tracked) return;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    lock_symbols();
+    if (!sym.tracked) {
+        sym.tracked = true;
+        tracked_functions().insert(sym.text);
+    }
+    unlock_symbols();
+    t_in_tracer = guard;
+}
+
+// ---------------------------------------------------------------------------
+// Function cache
+//
+// The profile hooks run on every call, so the dladdr/demangle lookup and the
+// skip filters are resolved once per function address.  Entries are
+// published by storing the address last; readers never take the lock.  On
+// Linux the table is pre-warmed from the executable's symbol table, which
+// also names the non-exported functions dladdr cannot see.
+// ---------------------------------------------------------------------------
+
+struct FunctionInfo {
+    SymbolId name;
+    bool skip;
+};
+
+struct FunctionEntry {
+    std::atomic<void*> address;
+    FunctionInfo info;
+};
+
+static const unsigned FUNCTION_CACHE_SIZE = 1 << 14;   // power of two
+
+static FunctionEntry* g_function_cache = nullptr;
+static std::atomic_flag g_function_lock = ATOMIC_FLAG_INIT;
+static std::atomic<unsigned long> g_function_misses{0};
+static const void* g_executable_base = nullptr;
+// Subtracted from a code address to get the address in the executable file,
+// which is what addr2line expects for a position-independent executable.
+static uintptr_t g_executable_bias = 0;
+
+static bool is_internal_function(const char* name) {
+    return strstr(name, "GLOBAL__sub") ||
+           strstr(name, "_static_initialization_and_destruction") ||
+           strncmp(name, "std::", 5) == 0 ||
+           strncmp(name, "__gnu_cxx::", 11) == 0;
+}
+
+static inline unsigned function_slot(const void* func) {
+    const uintptr_t key = (uintptr_t)func;
+    return (unsigned)((key >> 4) ^ (key >> 18)) & (FUNCTION_CACHE_SIZE - 1);
+}
+
+// Caller holds g_function_lock.
+static void cache_function(void* func, FunctionInfo info) {
+    for (unsigned n = 0, slot = function_slot(func); n < FUNCTION_CACHE_SIZE;
+         ++n, slot = (slot + 1) & (FUNCTION_CACHE_SIZE - 1)) {
+        FunctionEntry& entry = g_function_cache[slot];
+        void* current = entry.address.load(std::memory_order_relaxed);
+        if (current == func) return;
+        if (current) continue;
+        entry.info = info;
+        entry.address.store(func, std::memory_order_release);
+        return;
+    }
+}
+
+static FunctionInfo resolve_function(void* func) {
+    FunctionInfo resolved{SYM_UNKNOWN, false};
+    const char* func_name = "unknown";
+
+#ifndef _WIN32
+    Dl_info dlinfo{};
+    if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
+        func_name = demangle(dlinfo.dli_sname);
+
+        // The executable itself may live under /usr (e.g. in a container).
+        resolved.skip = is_internal_function(func_name) ||
+            (dlinfo.dli_fbase != g_executable_base && dlinfo.dli_fname &&
+             (strstr(dlinfo.dli_fname, "/usr/") ||
+              strstr(dlinfo.dli_fname, "/lib/") ||
+              strstr(dlinfo.dli_fname, "libc") ||
+              strstr(dlinfo.dli_fname, "libstdc++")));
+    }
+#endif
+
+    resolved.name = function_symbol(func_name);
+    return resolved;
+}
+
+static FunctionInfo lookup_function(void* func) {
+    if (g_function_cache) {
+        for (unsigned n = 0, slot = function_slot(func); n < FUNCTION_CACHE_SIZE;
+             ++n, slot = (slot + 1) & (FUNCTION_CACHE_SIZE - 1)) {
+            const FunctionEntry& entry = g_function_cache[slot];
+            void* current = entry.address.load(std::memory_order_acquire);
+            if (current == func) {
+                if (t_ring) ++t_ring->stats.functionHits;
+                return entry.info;
+            }
+            if (!current) break;
+        }
+    }
+
+    g_function_misses.fetch_add(1, std::memory_order_relaxed);
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    const FunctionInfo resolved = resolve_function(func);
+    if (g_function_cache) {
+        while (g_function_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+        cache_function(func, resolved);
+        g_function_lock.clear(std::memory_order_release);
+    }
+    t_in_tracer = guard;
+    return resolved;
+}
+
+#if defined(__linux__)
+// The first object reported is the executable.  Its load bias relocates
+// symbol values; the start of its first segment is what dladdr reports as
+// dli_fbase.
+static int find_executable(struct dl_phdr_info* info, std::size_t, void* data) {
+    *static_cast<uintptr_t*>(data) = info->dlpi_addr;
+    for (unsigned i = 0; i < info->dlpi_phnum; ++i) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+            g_executable_base = reinterpret_cast<const void*>(
+                (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr) & ~(page - 1));
+            break;
+        }
+    }
+    return 1;
+}
+
+static void prewarm_function_cache() {
+    dl_iterate_phdr(find_executable, &g_executable_bias);
+    const uintptr_t bias = g_executable_bias;
+
+    const int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) return;
+    struct stat st{};
+    void* image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(ElfW(Ehdr))) {
+        image = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (image == MAP_FAILED) return;
+
+    const unsigned char* base = static_cast<const unsigned char*>(image);
+    const ElfW(Ehdr)* ehdr = reinterpret_cast<const ElfW(Ehdr)*>(base);
+    const bool valid = memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+        ehdr->e_shoff + (std::size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) <= (std::size_t)st.st_size;
+
+    if (valid) {
+        const ElfW(Shdr)* sections = reinterpret_cast<const ElfW(Shdr)*>(base + ehdr->e_shoff);
+        for (unsigned i = 0; i < ehdr->e_shnum; ++i) {
+            const ElfW(Shdr)& symtab = sections[i];
+            if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= ehdr->e_shnum) continue;
+            const ElfW(Shdr)& strtab = sections[symtab.sh_link];
+            if (symtab.sh_offset + symtab.sh_size > (std::size_t)st.st_size ||
+                strtab.sh_offset + strtab.sh_size > (std::size_t)st.st_size) continue;
+
+            const ElfW(Sym)* syms = reinterpret_cast<const ElfW(Sym)*>(base + symtab.sh_offset);
+            const char* names = reinterpret_cast<const char*>(base + strtab.sh_offset);
+            const std::size_t count = symtab.sh_size / sizeof(ElfW(Sym));
+
+            for (std::size_t k = 0; k < count; ++k) {
+                const ElfW(Sym)& sym = syms[k];
+                if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_value == 0 ||
+                    sym.st_shndx == SHN_UNDEF || sym.st_name >= strtab.sh_size) continue;
+                const char* func_name = demangle(names + sym.st_name);
+                cache_function(reinterpret_cast<void*>(bias + sym.st_value),
+                               FunctionInfo{function_symbol(func_name), is_internal_function(func_name)});
+            }
+        }
+    }
+    munmap(image, st.st_size);
+}
+#endif
+
+static void init_function_cache() {
+    g_function_cache = static_cast<FunctionEntry*>(alloc_pages(sizeof(FunctionEntry) * FUNCTION_CACHE_SIZE));
+#if defined(__linux__)
+    if (g_function_cache) prewarm_function_cache();
+#endif
+}
+
+
+static void bind_pointer_alias(ThreadState& ts, const PointerInfo& pinfo) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+
+    auto head = ts.aliasHead.find(pinfo.pointerName);
+    if (head != ts.aliasHead.end() && (std::size_t)head->second >= ts.callStack.back().aliasBase) {
+        ts.aliasStack[head->second].info = pinfo;
+    } else {
+        const int shadowed = head != ts.aliasHead.end() ? head->second : -1;
+        ts.aliasStack.push_back(AliasBinding{pinfo.pointerName, pinfo, shadowed});
+        ts.aliasHead[pinfo.pointerName] = (int)ts.aliasStack.size() - 1;
+    }
+
+    t_in_tracer = guard;
+}
+
+static void unwind_pointer_aliases(ThreadState& ts, std::size_t base) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+
+    while (ts.aliasStack.size() > base) {
+        const AliasBinding& b = ts.aliasStack.back();
+        if (b.shadowed >= 0) ts.aliasHead[b.name] = b.shadowed;
+        else ts.aliasHead.erase(b.name);
+        ts.aliasStack.pop_back();
+    }
+
+    t_in_tracer = guard;
+}
+
+// The thread's own bindings first, then pointers bound outside any frame.
+// Copied out: the registry entry may change as soon as the lock drops.
+static bool findPointerInfo(const ThreadState& ts, SymbolId ptrName, PointerInfo& out) {
+    auto head = ts.aliasHead.find(ptrName);
+    if (head != ts.aliasHead.end()) {
+        out = ts.aliasStack[head->second].info;
+        return true;
+    }
+
+    RegistryLock lock;
+    auto git = g_pointer_registry.find(ptrName);
+    if (git != g_pointer_registry.end()) {
+        out = git->second;
+        return true;
+    }
+
+    return false;
+}
+
+static SymbolId name_at(void* address) {
+    RegistryLock lock;
+    auto it = g_address_to_name.find(address);
+    return it != g_address_to_name.end() ? it->second : SYM_UNKNOWN;
+}
+
+// ---------------------------------------------------------------------------
+// Profile mode
+//
+// With TRACE_MODE=profile the hooks record nothing.  Each one counts its
+// line, and the loop, condition and function hooks also update their own
+// aggregates: all of it is per thread, needs no lock, and is summed into a
+// few summary records at exit (emit_profile).  Consecutive hooks on the same
+// line count as one hit, so a line counts roughly the times control reached
+// it; a call or a return always starts a new one.  Loop and function times
+// come from one clock read at each loop start and end and at each call and
+// return.
+// ---------------------------------------------------------------------------
+
+static bool g_profile = false;
+static const long PROFILE_MAX_ID = 1 << 16;    // loop and condition ids past it only count lines
+static const long PROFILE_MAX_SYMBOL = (long)SYMBOL_CHUNK_SIZE * SYMBOL_CHUNK_COUNT;
+
+static ProfileState& profile_state(ThreadState& ts) {
+    if (ts.profile) return *ts.profile;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    ts.profile = arena_new<ProfileState>();
+    t_in_tracer = guard;
+    return *ts.profile;
+}
+
+static inline std::size_t line_slot(const char* file, int line, std::size_t mask) {
+    uintptr_t h = (uintptr_t)file ^ ((uintptr_t)(unsigned)line * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 29;
+    return h & mask;
+}
+
+static void grow_lines(ProfileState& p) {
+    const std::size_t capacity = p.lineCapacity ? p.lineCapacity * 2 : 256;
+    LineHits* lines = static_cast<LineHits*>(arena_alloc(capacity * sizeof(LineHits)));
+    if (!lines) return;
+    memset(lines, 0, capacity * sizeof(LineHits));
+    for (std::size_t i = 0; i < p.lineCapacity; i++) {
+        const LineHits& old = p.lines[i];
+        if (!old.file) continue;
+        std::size_t slot = line_slot(old.file, old.line, capacity - 1);
+        while (lines[slot].file) slot = (slot + 1) & (capacity - 1);
+        lines[slot] = old;
+    }
+    if (p.lines) arena_free(p.lines, p.lineCapacity * sizeof(LineHits));
+    p.lines = lines;
+    p.lineCapacity = capacity;
+}
+
+static inline void count_line(ProfileState& p, const char* file, int line) {
+    if (file == p.lastFile && line == p.lastLine) return;
+    p.lastFile = file;
+    p.lastLine = line;
+    if (line <= 0 || !file) return;
+
+    if ((p.lineCount + 1) * 2 > p.lineCapacity) {
+        grow_lines(p);
+        if ((p.lineCount + 1) * 2 > p.lineCapacity) return;
+    }
+    const std::size_t mask = p.lineCapacity - 1;
+    std::size_t slot = line_slot(file, line, mask);
+    while (p.lines[slot].file) {
+        if (p.lines[slot].file == file && p.lines[slot].line == line) {
+            ++p.lines[slot].hits;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    p.lines[slot] = LineHits{file, line, 1};
+    ++p.lineCount;
+}
+
+// In profile mode counts the hook's line and returns true: the hook has
+// nothing else to do.
+static inline bool profiled(const char* file, int line) {
+    if (!g_profile) return false;
+    count_line(profile_state(thread_state()), file, line);
+    return true;
+}
+
+// Entry `id` of a table indexed by id, grown as ids appear.
+template <typename T>
+static T* profile_entry(ArenaVector<T>& table, long id, long limit = PROFILE_MAX_ID) {
+    if (id < 0 || id >= limit) return nullptr;
+    if ((std::size_t)id >= table.size()) {
+        const bool guard = t_in_tracer;
+        t_in_tracer = true;
+        table.resize(id + 1, T{});
+        t_in_tracer = guard;
+    }
+    return &table[id];
+}
+
+static void open_loop(ThreadState& ts, ProfileState& p, LoopProfile& loop, int loopId) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    p.openLoops.push_back(OpenLoop{loopId, ts.depth, get_timestamp_ns()});
+    t_in_tracer = guard;
+    ++loop.active;
+}
+
+// Closes the open loops from index `from` on, innermost first.
+static void close_loops(ProfileState& p, std::size_t from, unsigned long long now) {
+    while (p.openLoops.size() > from) {
+        const OpenLoop& open = p.openLoops.back();
+        if (LoopProfile* loop = profile_entry(p.loops, open.loopId)) {
+            if (--loop->active == 0) loop->timeNs += now - open.start;
+        }
+        p.openLoops.pop_back();
+    }
+}
+
+// The innermost open loop `loopId` of the frame at `depth`, or -1.
+static long find_open_loop(const ProfileState& p, int loopId, int depth) {
+    for (std::size_t i = p.openLoops.size(); i-- > 0;) {
+        const OpenLoop& open = p.openLoops[i];
+        if (open.depth < depth) break;
+        if (open.loopId == loopId && open.depth == depth) return (long)i;
+    }
+    return -1;
+}
+
+static void profile_loop_start(int loopId, const char* file, int line) {
+    ThreadState& ts = thread_state();
+    ProfileState& p = profile_state(ts);
+    count_line(p, file, line);
+    LoopProfile* loop = profile_entry(p.loops, loopId);
+    if (!loop) return;
+    if (!loop->file) {
+        loop->file = file;
+        loop->line = line;
+    }
+    ++loop->entries;
+    open_loop(ts, p, *loop, loopId);
+}
+
+// A body with no open loop (its loop_end already fired) reopens it, as
+// __trace_loop_body_start_loc restarts the count.
+static void profile_loop_body(int loopId, const char* file, int line) {
+    ThreadState& ts = thread_state();
+    ProfileState& p = profile_state(ts);
+    count_line(p, file, line);
+    LoopProfile* loop = profile_entry(p.loops, loopId);
+    if (!loop) return;
+    ++loop->iterations;
+    if (find_open_loop(p, loopId, ts.depth) < 0) open_loop(ts, p, *loop, loopId);
+}
+
+// Loops nested in it that never reached their loop_end close with it.
+static void profile_loop_end(int loopId, const char* file, int line) {
+    ThreadState& ts = thread_state();
+    ProfileState& p = profile_state(ts);
+    count_line(p, file, line);
+    const long open = find_open_loop(p, loopId, ts.depth);
+    if (open >= 0) close_loops(p, (std::size_t)open, get_timestamp_ns());
+}
+
+static void profile_condition(int conditionId, const char* expression, int result, const char* file, int line) {
+    ProfileState& p = profile_state(thread_state());
+    count_line(p, file, line);
+    BranchProfile* branch = profile_entry(p.branches, conditionId);
+    if (!branch) return;
+    if (!branch->file) {
+        branch->expression = expression;
+        branch->file = file;
+        branch->line = line;
+    }
+    ++branch->evaluations;
+    if (result) ++branch->taken;
+}
+
+static void profile_call(SymbolId fn) {
+    ThreadState& ts = thread_state();
+    ProfileState& p = profile_state(ts);
+    ts.currentFunction = fn;
+    ++ts.depth;
+    p.lastFile = nullptr;
+    if (FunctionProfile* f = profile_entry(p.functions, fn, PROFILE_MAX_SYMBOL)) {
+        ++f->calls;
+        ++f->active;
+    }
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    p.calls.push_back(OpenCall{fn, get_timestamp_ns(), 0});
+    t_in_tracer = guard;
+}
+
+// Also closes the frame's loops still open, like __cyg_profile_func_exit.
+static void finish_call(ThreadState& ts, ProfileState& p, unsigned long long now) {
+    std::size_t from = p.openLoops.size();
+    while (from > 0 && p.openLoops[from - 1].depth >= ts.depth) --from;
+    close_loops(p, from, now);
+
+    const OpenCall call = p.calls.back();
+    p.calls.pop_back();
+    const unsigned long long elapsed = now - call.start;
+    if (FunctionProfile* f = profile_entry(p.functions, call.function, PROFILE_MAX_SYMBOL)) {
+        f->exclusiveNs += elapsed - call.childNs;
+        if (--f->active == 0) f->inclusiveNs += elapsed;
+    }
+    if (!p.calls.empty()) p.calls.back().childNs += elapsed;
+    ts.currentFunction = p.calls.empty() ? SYM_MAIN : p.calls.back().function;
+    --ts.depth;
+    p.lastFile = nullptr;
+}
+
+static void profile_return() {
+    ThreadState& ts = thread_state();
+    ProfileState& p = profile_state(ts);
+    if (p.calls.empty()) return;
+    finish_call(ts, p, get_timestamp_ns());
+}
+
+// From finish_tracer.  Calls and loops still open (exit() deep in the
+// program, a crash, the timeout) end now.
+static void emit_profile() {
+    typedef std::pair<SymbolId, int> LineKey;
+    ArenaMap<LineKey, unsigned long long> lines;
+    ArenaMap<long, LoopProfile> loops;
+    ArenaMap<long, BranchProfile> branches;
+    ArenaMap<SymbolId, FunctionProfile> functions;
+
+    const unsigned long long now = get_timestamp_ns();
+    for (ThreadState* s = g_threads.load(std::memory_order_acquire); s; s = s->next) {
+        ProfileState* p = s->profile;
+        if (!p) continue;
+        while (!p->calls.empty()) finish_call(*s, *p, now);
+        close_loops(*p, 0, now);
+
+        for (std::size_t i = 0; i < p->lineCapacity; i++) {
+            const LineHits& hits = p->lines[i];
+            if (hits.file) lines[LineKey(intern_path(hits.file), hits.line)] += hits.hits;
+        }
+        for (std::size_t id = 0; id < p->loops.size(); id++) {
+            const LoopProfile& loop = p->loops[id];
+            if (!loop.file && !loop.iterations) continue;
+            LoopProfile& total = loops[(long)id];
+            if (!total.file) {
+                total.file = loop.file;
+                total.line = loop.line;
+            }
+            total.entries += loop.entries;
+            total.iterations += loop.iterations;
+            total.timeNs += loop.timeNs;
+        }
+        for (std::size_t id = 0; id < p->branches.size(); id++) {
+            const BranchProfile& branch = p->branches[id];
+            if (!branch.evaluations) continue;
+            BranchProfile& total = branches[(long)id];
+            if (!total.file) {
+                total.expression = branch.expression;
+                total.file = branch.file;
+                total.line = branch.line;
+            }
+            total.evaluations += branch.evaluations;
+            total.taken += branch.taken;
+        }
+        for (std::size_t fn = 0; fn < p->functions.size(); fn++) {
+            const FunctionProfile& f = p->functions[fn];
+            if (!f.calls) continue;
+            FunctionProfile& total = functions[(SymbolId)fn];
+            total.calls += f.calls;
+            total.inclusiveNs += f.inclusiveNs;
+            total.exclusiveNs += f.exclusiveNs;
+        }
+    }
+
+    // Written past the event budget, like heap_summary.
+    for (const auto& entry : lines) {
+        EventRecord* rec = reserve_slot(EV_PROFILE_LINE, nullptr, SYM_MAIN, 0);
+        if (!rec) return;
+        rec->i[0] = (long long)entry.second;
+        rec->file = entry.first.first;
+        rec->line = entry.first.second;
+        commit_ring_event(rec);
+    }
+    for (const auto& entry : loops) {
+        const LoopProfile& loop = entry.second;
+        EventRecord* rec = reserve_slot(EV_PROFILE_LOOP, nullptr, SYM_MAIN, 0);
+        if (!rec) return;
+        rec->i[0] = entry.first;
+        rec->i[1] = (long long)loop.entries;
+        rec->i[2] = (long long)loop.iterations;
+        rec->i[3] = (long long)loop.timeNs;
+        set_location(rec, loop.file ? loop.file : "unknown", loop.line);
+        commit_ring_event(rec);
+    }
+    for (const auto& entry : branches) {
+        const BranchProfile& branch = entry.second;
+        EventRecord* rec = reserve_slot(EV_PROFILE_BRANCH, nullptr, SYM_MAIN, 0);
+        if (!rec) return;
+        rec->i[0] = entry.first;
+        rec->s[0] = intern(branch.expression);
+        rec->i[1] = (long long)branch.evaluations;
+        rec->i[2] = (long long)branch.taken;
+        set_location(rec, branch.file, branch.line);
+        commit_ring_event(rec);
+    }
+    for (const auto& entry : functions) {
+        const FunctionProfile& f = entry.second;
+        EventRecord* rec = reserve_slot(EV_PROFILE_FUNCTION, nullptr, entry.first, 0);
+        if (!rec) return;
+        rec->i[0] = (long long)f.calls;
+        rec->i[1] = (long long)f.inclusiveNs;
+        rec->i[2] = (long long)f.exclusiveNs;
+        commit_ring_event(rec);
+    }
+}
+
+extern "C" void __trace_output_flush_loc(const char* file, int line) {
+    if (tracing_active() && profiled(file, line)) return;
+    if (!g_output) {
+        fflush(stdout);
+        fflush(stderr);
+    } else if (tracing_active() && output_pending()) {
+        emit_output();
+    }
+}
+
+extern "C" void __trace_condition_eval_loc(int conditionId, const char* expression, int result,
+                                           const char* file, int line) {
+    if (!tracing_active()) return;
+    if (g_profile) {
+        profile_condition(conditionId, expression, result, file, line);
+        return;
+    }
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_CONDITION_EVAL, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = conditionId;
+    rec->s[0] = intern(expression);
+    rec->i[1] = result;
+    set_location(rec, file, line);
+    commit_event(rec);
+}
+
+extern "C" void __trace_branch_taken_loc(int conditionId, const char* branchType,
+                                         const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_BRANCH_TAKEN, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = conditionId;
+    rec->s[0] = intern(branchType);
+    set_location(rec, file, line);
+    commit_event(rec);
+}
+
+// ---------------------------------------------------------------------------
+// Array shadow values
+//
+// Each registered array shadows dim1*dim2*dim3 slots (unused dimensions
+// count as 1), found through g_array_by_name, so an element write is one hash
+// lookup and an indexed store.  The slots live in pages allocated at the
+// first write into them: creating an array costs its page table, and a large
+// array that is only partly written only holds the pages it touched.  The
+// newest array registered under a name wins, matching how the hooks identify
+// arrays.  A stack array is released when the frame that created it returns,
+// and the name falls back to the array it shadowed.
+// ---------------------------------------------------------------------------
+
+static const std::size_t MAX_ARRAY_SHADOW = 1 << 22;
+
+static void release_array_pages(ArrayInfo& info) {
+    for (ArrayPage* page : info.pages) arena_delete(page);
+    info.pages.clear();
+    info.count = 0;
+}
+
+// Unwritten slots read as 0.
+static inline long long array_value(const ArrayInfo& a, std::size_t slot) {
+    const ArrayPage* page = a.pages[slot / ARRAY_PAGE_SLOTS];
+    return page ? page->values[slot % ARRAY_PAGE_SLOTS] : 0;
+}
+
+static inline std::size_t array_extent(int dim) {
+    return dim > 0 ? (std::size_t)dim : 1;
+}
+
+// -1 marks an index the access does not use.
+static inline bool array_slot(const ArrayInfo& a, int idx1, int idx2, int idx3, std::size_t& slot) {
+    const std::size_t e1 = array_extent(a.dim1), e2 = array_extent(a.dim2), e3 = array_extent(a.dim3);
+    const std::size_t i1 = idx1 < 0 ? 0 : (std::size_t)idx1;
+    const std::size_t i2 = idx2 < 0 ? 0 : (std::size_t)idx2;
+    const std::size_t i3 = idx3 < 0 ? 0 : (std::size_t)idx3;
+    if (idx1 < -1 || idx2 < -1 || idx3 < -1 || i1 >= e1 || i2 >= e2 || i3 >= e3) return false;
+    slot = (i1 * e2 + i2) * e3 + i3;
+    return slot < a.count;
+}
+
+// False when the element already held `value`.
+static bool store_array_element(SymbolId name, int idx1, int idx2, int idx3, long long value,
+                                ValueEncoding encoding) {
+    RegistryLock lock;
+    auto it = g_array_by_name.find(name);
+    std::size_t slot;
+    const bool guard = t_in_tracer;
+    if (it != g_array_by_name.end() && array_slot(*it->second, idx1, idx2, idx3, slot)) {
+        ArrayInfo& info = *it->second;
+        ArrayPage*& page = info.pages[slot / ARRAY_PAGE_SLOTS];
+        if (!page) {
+            t_in_tracer = true;
+            page = arena_new<ArrayPage>();
+            t_in_tracer = guard;
+        }
+        if (page) {
+            const std::size_t k = slot % ARRAY_PAGE_SLOTS;
+            const unsigned long long bit = 1ULL << k;
+            const bool changed = !(page->known & bit) || page->values[k] != value;
+            page->values[k] = value;
+            page->known |= bit;
+            info.floating = encoding == VAL_DOUBLE;
+            return changed;
+        }
+    }
+
+    t_in_tracer = true;
+    auto stored = g_array_element_values.emplace(ArrayElementKey{name, idx1, idx2, idx3}, value);
+    const bool changed = stored.second || stored.first->second != value;
+    stored.first->second = value;
+    t_in_tracer = guard;
+    return changed;
+}
+
+extern "C" void __trace_array_create_loc(const char* name, const char* baseType,
+                                         void* address, int dim1, int dim2, int dim3,
+                                         bool isStack, const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    const SymbolId typeSym = intern(baseType);
+
+    ThreadState& ts = thread_state();
+    declare_in_scope(ts, sym);
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    {
+        RegistryLock lock;
+        g_address_to_name[address] = sym;
+        auto slot = g_array_registry.emplace(address, ArrayInfo{});
+        ArrayInfo& info = slot.first->second;
+        auto named = g_array_by_name.find(info.name);
+        if (named != g_array_by_name.end() && named->second == &info) g_array_by_name.erase(named);
+
+        info.name = sym;
+        info.baseType = typeSym;
+        info.address = address;
+        info.dim1 = dim1;
+        info.dim2 = dim2;
+        info.dim3 = dim3;
+        info.isStack = isStack;
+        info.floating = false;
+
+        release_array_pages(info);
+        const std::size_t count = array_extent(dim1) * array_extent(dim2) * array_extent(dim3);
+        if (count <= MAX_ARRAY_SHADOW) {
+            info.count = count;
+            info.pages.assign((count + ARRAY_PAGE_SLOTS - 1) / ARRAY_PAGE_SLOTS, nullptr);
+        }
+
+        // Re-created at the same address, e.g. in a loop body, it is still
+        // the frame's one array.
+        ArrayInfo*& current = g_array_by_name[sym];
+        if (slot.second && isStack && !ts.callStack.empty()) {
+            ts.stackArrays.push_back(StackArray{address, current ? current->address : nullptr});
+        }
+        current = &info;
+    }
+
+    t_in_tracer = guard;
+
+    EventRecord* rec = begin_event(EV_ARRAY_CREATE, address, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->s[0] = sym;
+        rec->s[1] = typeSym;
+        rec->i[0] = dim1;
+        rec->i[1] = dim2;
+        rec->i[2] = dim3;
+        rec->i[3] = isStack ? 1 : 0;
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+}
+
+static void release_stack_arrays(ThreadState& ts, std::size_t base) {
+    if (ts.stackArrays.size() <= base) return;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    {
+        RegistryLock lock;
+        while (ts.stackArrays.size() > base) {
+            const StackArray released = ts.stackArrays.back();
+            ts.stackArrays.pop_back();
+            auto it = g_array_registry.find(released.address);
+            if (it == g_array_registry.end()) continue;
+            ArrayInfo& info = it->second;
+
+            auto named = g_array_by_name.find(info.name);
+            if (named != g_array_by_name.end() && named->second == &info) {
+                auto prev = released.shadowed ? g_array_registry.find(released.shadowed) : g_array_registry.end();
+                if (prev != g_array_registry.end() && prev->second.name == info.name) named->second = &prev->second;
+                else g_array_by_name.erase(named);
+            }
+            auto addressed = g_address_to_name.find(released.address);
+            if (addressed != g_address_to_name.end() && addressed->second == info.name) g_address_to_name.erase(addressed);
+            release_array_pages(info);
+            g_array_registry.erase(it);
+        }
+    }
+
+    t_in_tracer = guard;
+}
+
+// Initializers go out as array_init_bulk records carrying the raw element
+// bytes, as many elements per record as fit in the text payload.  `base` is
+// the index of bytes[0] within the array.
+static void emit_array_init(SymbolId sym, SymbolId elemType, const unsigned char* bytes, int base,
+                            int count, int elemSize, const char* file, int line) {
+    const int perRecord = (int)sizeof(EventRecord::text) / elemSize;
+    const ThreadState& ts = thread_state();
+    for (int offset = 0; offset < count; offset += perRecord) {
+        const int n = count - offset < perRecord ? count - offset : perRecord;
+        EventRecord* rec = begin_event(EV_ARRAY_INIT_BULK, nullptr, ts.currentFunction, ts.depth);
+        if (!rec) continue;
+        rec->s[0] = sym;
+        rec->s[1] = elemType;
+        rec->i[0] = base + offset;
+        rec->i[1] = n;
+        memcpy(rec->text, bytes + (std::size_t)offset * elemSize, (std::size_t)n * elemSize);
+        rec->textLen = (unsigned short)(n * elemSize);
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+}
+
+static SymbolId element_type(int elemKind, int elemSize) {
+    switch (elemKind) {
+        case TRACE_ELEM_FLOAT:
+            return intern(elemSize == 4 ? "f32" : "f64");
+        case TRACE_ELEM_CHAR:
+            return intern("char");
+        case TRACE_ELEM_SIGNED:
+            return intern(elemSize == 1 ? "i8" : elemSize == 2 ? "i16" : elemSize == 4 ? "i32" : "i64");
+        default:
+            return intern(elemSize == 1 ? "u8" : elemSize == 2 ? "u16" : elemSize == 4 ? "u32" : "u64");
+    }
+}
+
+// An element as store_array_element keeps it: floats widened to double bits.
+static long long element_value(const unsigned char* p, int elemKind, int elemSize) {
+    if (elemKind == TRACE_ELEM_FLOAT) {
+        if (elemSize == 4) { float v; memcpy(&v, p, 4); return double_bits(v); }
+        double v; memcpy(&v, p, 8); return double_bits(v);
+    }
+    const bool sign = elemKind == TRACE_ELEM_SIGNED || elemKind == TRACE_ELEM_CHAR;
+    switch (elemSize) {
+        case 1: return sign ? (long long)*(const signed char*)p : (long long)*p;
+        case 2: { short v; memcpy(&v, p, 2); return sign ? v : (unsigned short)v; }
+        case 4: { int v; memcpy(&v, p, 4); return sign ? v : (unsigned)v; }
+        default: { long long v; memcpy(&v, p, 8); return v; }
+    }
+}
+
+extern "C" void __trace_array_init_string_loc(const char* name, const char* str_literal,
+                                               const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    const int len = str_literal ? strlen(str_literal) : 0;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(str_literal ? str_literal : "");
+
+    emit_array_init(sym, intern("char"), bytes, 0, len + 1, 1, file, line);
+    for (int i = 0; i <= len; i++) {
+        store_array_element(sym, i, -1, -1, (long long)(char)bytes[i], VAL_SIGNED);
+    }
+}
+
+extern "C" void __trace_array_init_loc(const char* name, const void* values, int count,
+                                       int elemSize, int elemKind, const char* file, int line) {
+    if (!tracing_active() || !values || count <= 0) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    const unsigned char* bytes = static_cast<const unsigned char*>(values);
+
+    if (elemKind == TRACE_ELEM_FLOAT && elemSize == (int)sizeof(long double) && elemSize != 8) {
+        // long double is narrowed to double so the reader can decode it.
+        double chunk[sizeof(EventRecord::text) / sizeof(double)];
+        const int perChunk = (int)(sizeof(chunk) / sizeof(double));
+        for (int offset = 0; offset < count; offset += perChunk) {
+            const int n = count - offset < perChunk ? count - offset : perChunk;
+            for (int k = 0; k < n; k++) {
+                long double v;
+                memcpy(&v, bytes + (std::size_t)(offset + k) * elemSize, sizeof(v));
+                chunk[k] = (double)v;
+                store_array_element(sym, offset + k, -1, -1, double_bits(chunk[k]), VAL_DOUBLE);
+            }
+            emit_array_init(sym, intern("f64"), reinterpret_cast<const unsigned char*>(chunk),
+                            offset, n, sizeof(double), file, line);
+        }
+        return;
+    }
+    if (elemSize != 1 && elemSize != 2 && elemSize != 4 && elemSize != 8) return;
+
+    const ValueEncoding encoding = elemKind == TRACE_ELEM_FLOAT ? VAL_DOUBLE
+        : elemKind == TRACE_ELEM_UNSIGNED ? VAL_UNSIGNED : VAL_SIGNED;
+    emit_array_init(sym, element_type(elemKind, elemSize), bytes, 0, count, elemSize, file, line);
+    for (int i = 0; i < count; i++) {
+        store_array_element(sym, i, -1, -1, element_value(bytes + (std::size_t)i * elemSize, elemKind, elemSize),
+                            encoding);
+    }
+}
+
+static const EventKind k_array_assign_events[] = {
+    EV_ARRAY_INDEX_ASSIGN, EV_ARRAY_INDEX_ASSIGN_UNSIGNED, EV_ARRAY_INDEX_ASSIGN_DOUBLE, EV_ARRAY_INDEX_ASSIGN_UNSIGNED
+};
+
+static void emit_array_index_assign(const char* name, int idx1, int idx2, int idx3, long long value,
+                                    ValueEncoding encoding, const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    ThreadState& ts = thread_state();
+    if (!store_array_element(sym, idx1, idx2, idx3, value, encoding) && g_budget.dedup) {
+        ++ts.deduped;
+        return;
+    }
+
+    EventRecord* rec = begin_event(k_array_assign_events[encoding], nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->i[0] = idx1;
+    rec->i[1] = idx2;
+    rec->i[2] = idx3;
+    set_value(rec, 3, value, encoding);
+    set_location(rec, file, line);
+    commit_event(rec);
+}
+
+extern "C" void __trace_array_index_assign_loc(const char* name, int idx1, int idx2, int idx3,
+                                                long long value, const char* file, int line) {
+    emit_array_index_assign(name, idx1, idx2, idx3, value, VAL_SIGNED, file, line);
+}
+
+extern "C" void __trace_array_index_assign_unsigned_loc(const char* name, int idx1, int idx2, int idx3,
+                                                         unsigned long long value, const char* file, int line) {
+    emit_array_index_assign(name, idx1, idx2, idx3, (long long)value, VAL_UNSIGNED, file, line);
+}
+
+extern "C" void __trace_array_index_assign_double_loc(const char* name, int idx1, int idx2, int idx3,
+                                                       double value, const char* file, int line) {
+    emit_array_index_assign(name, idx1, idx2, idx3, double_bits(value), VAL_DOUBLE, file, line);
+}
+
+extern "C" void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
+                                          const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    ThreadState& ts = thread_state();
+    declare_in_scope(ts, sym);
+
+    EventRecord* rec = begin_event(EV_POINTER_ALIAS, aliasedAddress, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->s[0] = sym;
+        rec->s[1] = name_at(aliasedAddress);
+        rec->p = aliasedAddress;
+        rec->i[0] = decayedFromArray ? 1 : 0;
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+
+    PointerInfo pinfo;
+    pinfo.pointerName = sym;
+    pinfo.aliasedAddress = aliasedAddress;
+    pinfo.isHeap = false;
+    pinfo.heapAddress = nullptr;
+
+    if (!ts.callStack.empty()) {
+        bind_pointer_alias(ts, pinfo);
+    } else {
+        const bool guard = t_in_tracer;
+        t_in_tracer = true;
+        RegistryLock lock;
+        g_pointer_registry[sym] = pinfo;
+        t_in_tracer = guard;
+    }
+}
+
+extern "C" void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
+                                                const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(ptrName);
+    const ThreadState& ts = thread_state();
+    PointerInfo pinfo;
+
+    SymbolId targetName = SYM_UNKNOWN;
+    bool isHeap = false;
+    void* targetAddress = nullptr;
+
+    if (findPointerInfo(ts, sym, pinfo)) {
+        isHeap = pinfo.isHeap;
+        targetAddress = pinfo.aliasedAddress;
+        targetName = name_at(targetAddress);
+    }
+
+    EventRecord* rec = begin_event(EV_POINTER_DEREF_WRITE, targetAddress, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->s[0] = sym;
+        rec->s[1] = targetName;
+        rec->i[0] = value;
+        rec->i[1] = isHeap ? 1 : 0;
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+
+    if (isHeap) {
+        rec = begin_event(EV_HEAP_WRITE, targetAddress, ts.currentFunction, ts.depth);
+        if (!rec) return;
+        rec->p = targetAddress;
+        rec->i[0] = value;
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Variable shadow values
+//
+// The last value assigned to each local lives in its call frame, so a
+// recursive call's `n` never compares against its caller's.  With
+// TRACE_DEDUP=1 an assign (or element write) that leaves the value unchanged
+// is not emitted; a declaration forgets the value so the first assign of a
+// new instance always is.
+// ---------------------------------------------------------------------------
+
+static VarValue* find_value(ArenaVector<VarValue>& values, SymbolId sym) {
+    for (VarValue& v : values) {
+        if (v.name == sym) return &v;
+    }
+    return nullptr;
+}
+
+// False when `sym` already held `value`.
+static bool record_value(SymbolId sym, long long value, ValueEncoding encoding) {
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    const VarValue stored = {sym, value, encoding};
+    bool changed = true;
+    ArenaVector<CallFrame>& stack = thread_state().callStack;
+    if (stack.empty()) {
+        RegistryLock lock;
+        auto entry = g_variable_values.emplace(sym, stored);
+        if (!entry.second) {
+            VarValue& v = entry.first->second;
+            changed = v.value != value || v.encoding != encoding;
+            v = stored;
+        }
+    } else if (VarValue* v = find_value(stack.back().values, sym)) {
+        changed = v->value != value || v->encoding != encoding;
+        *v = stored;
+    } else {
+        stack.back().values.push_back(stored);
+    }
+    t_in_tracer = guard;
+    return changed;
+}
+
+static void forget_value(SymbolId sym) {
+    ArenaVector<CallFrame>& stack = thread_state().callStack;
+    if (stack.empty()) {
+        RegistryLock lock;
+        g_variable_values.erase(sym);
+        return;
+    }
+    ArenaVector<VarValue>& values = stack.back().values;
+    if (VarValue* v = find_value(values, sym)) {
+        *v = values.back();
+        values.pop_back();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Keyframes (TRACE_KEYFRAME_INTERVAL=N)
+//
+// Every N events the runtime writes its whole shadow state: a keyframe record
+// counting what follows, one keyframe_var per known local (frame -1 for
+// values assigned outside any frame) and the dense buffer of every array as
+// keyframe_array records laid out like array_init_bulk.  A reader seeking to
+// an event applies the nearest keyframe before it and replays from there.
+// Keyframes stop once a second thread exists, as other threads' call stacks
+// cannot be read safely from the one writing the keyframe.
+// ---------------------------------------------------------------------------
+
+static const std::size_t MAX_KEYFRAME_ELEMENTS = 1 << 16;   // larger arrays are left out
+static unsigned long g_keyframe_seq = 0;
+
+static bool fits_i32(const ArrayInfo& info) {
+    for (const ArrayPage* page : info.pages) {
+        if (!page) continue;
+        for (long long v : page->values) {
+            if (v < INT32_MIN || v > INT32_MAX) return false;
+        }
     }
-    
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"indices\":%s,\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-             name, indices, value, f.c_str(), line);
-    
-    write_json_event("array_index_assign", nullptr, g_current_function.c_str(), g_depth, extra);
+    return true;
 }
 
-extern "C" void __trace_pointer_alias_loc(const char* name, void* aliasedAddress, bool decayedFromArray,
-                                          const char* file, int line) {
-    if (!g_trace_file) return;
-
-    std::string aliasOfName = "unknown";
-    if (g_address_to_name.count(aliasedAddress)) {
-        aliasOfName = g_address_to_name[aliasedAddress];
-    }
-    
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"aliasOf\":\"%s\",\"aliasedAddress\":\"%p\",\"decayedFromArray\":%s,\"file\":\"%s\",\"line\":%d",
-             name, aliasOfName.c_str(), aliasedAddress, decayedFromArray ? "true" : "false", f.c_str(), line);
-    
-    write_json_event("pointer_alias", aliasedAddress, g_current_function.c_str(), g_depth, extra);
-    
-    PointerInfo pinfo;
-    pinfo.pointerName = name;
-    pinfo.aliasedAddress = aliasedAddress;
-    pinfo.isHeap = false;
-    pinfo.heapAddress = nullptr;
-    
-    if (!g_call_stack.empty()) {
-        g_call_stack.back().pointerAliases[name] = pinfo;
-    } else {
-        g_pointer_registry[name] = pinfo;
+// Floating arrays go out as f64, which is exactly their shadow's bytes.
+static void emit_keyframe_array(const ThreadState& ts, const ArrayInfo& info) {
+    const bool narrow = !info.floating && fits_i32(info);
+    const int elemSize = narrow ? 4 : 8;
+    const SymbolId elemType = intern(info.floating ? "f64" : narrow ? "i32" : "i64");
+    const int perRecord = (int)sizeof(EventRecord::text) / elemSize;
+    const int count = (int)info.count;
+
+    for (int offset = 0; offset < count; offset += perRecord) {
+        const int n = count - offset < perRecord ? count - offset : perRecord;
+        EventRecord* rec = begin_ring_event(EV_KEYFRAME_ARRAY, info.address, ts.currentFunction, ts.depth);
+        if (!rec) return;
+        rec->s[0] = info.name;
+        rec->s[1] = elemType;
+        rec->i[0] = offset;
+        rec->i[1] = n;
+        for (int k = 0; k < n; k++) {
+            const long long v = array_value(info, (std::size_t)(offset + k));
+            if (narrow) {
+                const int32_t v32 = (int32_t)v;
+                memcpy(rec->text + k * 4, &v32, 4);
+            } else {
+                memcpy(rec->text + k * 8, &v, 8);
+            }
+        }
+        rec->textLen = (unsigned short)(n * elemSize);
+        commit_ring_event(rec);
     }
 }
 
-extern "C" void __trace_pointer_deref_write_loc(const char* ptrName, long long value,
-                                                const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    const std::string f = json_safe_path(file);
+static const EventKind k_keyframe_var_events[] = {
+    EV_KEYFRAME_VAR, EV_KEYFRAME_VAR_UNSIGNED, EV_KEYFRAME_VAR_DOUBLE, EV_KEYFRAME_VAR_PTR
+};
 
-    PointerInfo* pinfo = findPointerInfo(ptrName);
+static void emit_keyframe() {
+    const ThreadState& ts = thread_state();
+    long long variables = (long long)g_variable_values.size();
+    for (const CallFrame& frame : ts.callStack) variables += (long long)frame.values.size();
+    long long arrays = 0;
+    for (const auto& entry : g_array_registry) {
+        if (entry.second.count && entry.second.count <= MAX_KEYFRAME_ELEMENTS) arrays++;
+    }
 
-    std::string targetName = "unknown";
-    bool isHeap = false;
-    void* targetAddress = nullptr;
+    EventRecord* rec = begin_ring_event(EV_KEYFRAME, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = (long long)g_keyframe_seq++;
+    rec->i[1] = (long long)ts.callStack.size();
+    rec->i[2] = variables;
+    rec->i[3] = arrays;
+    commit_ring_event(rec);
 
-    if (pinfo) {
-        isHeap = pinfo->isHeap;
-        targetAddress = pinfo->aliasedAddress;
-        if (g_address_to_name.count(targetAddress)) {
-            targetName = g_address_to_name[targetAddress];
+    for (const auto& entry : g_variable_values) {
+        const VarValue& v = entry.second;
+        EventRecord* var = begin_ring_event(k_keyframe_var_events[v.encoding], nullptr, SYM_MAIN, 0);
+        if (!var) return;
+        var->s[0] = v.name;
+        set_value(var, 0, v.value, v.encoding);
+        var->i[1] = -1;
+        commit_ring_event(var);
+    }
+    for (std::size_t f = 0; f < ts.callStack.size(); f++) {
+        const CallFrame& frame = ts.callStack[f];
+        for (const VarValue& v : frame.values) {
+            EventRecord* var = begin_ring_event(k_keyframe_var_events[v.encoding], nullptr, frame.functionName, (int)f);
+            if (!var) return;
+            var->s[0] = v.name;
+            set_value(var, 0, v.value, v.encoding);
+            var->i[1] = (long long)f;
+            commit_ring_event(var);
         }
     }
-    
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"pointerName\":\"%s\",\"value\":%lld,\"targetName\":\"%s\",\"isHeap\":%s,\"file\":\"%s\",\"line\":%d",
-             ptrName, value, targetName.c_str(), isHeap ? "true" : "false", f.c_str(), line);
-    write_json_event("pointer_deref_write", targetAddress, g_current_function.c_str(), g_depth, extra);
-    
-    if (isHeap) {
-        char heap_extra[512];
-        snprintf(heap_extra, sizeof(heap_extra),
-                 "\"address\":\"%p\",\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-                 targetAddress, value, f.c_str(), line);
-        write_json_event("heap_write", targetAddress, g_current_function.c_str(), g_depth, heap_extra);
+    for (const auto& entry : g_array_registry) {
+        const ArrayInfo& info = entry.second;
+        if (!info.count || info.count > MAX_KEYFRAME_ELEMENTS) continue;
+        emit_keyframe_array(ts, info);
+    }
+}
+
+static const char* value_kind_name(int valueKind) {
+    switch (valueKind) {
+        case TRACE_VALUE_SIGNED: return "signed";
+        case TRACE_VALUE_UNSIGNED: return "unsigned";
+        case TRACE_VALUE_FLOAT: return "float";
+        case TRACE_VALUE_CHAR: return "char";
+        case TRACE_VALUE_POINTER: return "pointer";
+        default: return "other";
     }
 }
 
 extern "C" void __trace_declare_loc(const char* name, const char* type, void* address,
-                                    const char* file, int line) {
-    if (!g_trace_file) return;
+                                    int valueKind, const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    {
+        RegistryLock lock;
+        g_address_to_name[address] = sym;
+    }
+    t_in_tracer = guard;
+    forget_value(sym);
+
+    ThreadState& ts = thread_state();
+    declare_in_scope(ts, sym);
+    EventRecord* rec = begin_event(EV_DECLARE, address, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->s[1] = intern(type);
+    rec->s[2] = intern(value_kind_name(valueKind));
+    rec->p = address;
+    set_location(rec, file, line);
+    commit_event(rec);
+}
+
+static const EventKind k_assign_events[] = {EV_ASSIGN, EV_ASSIGN_UNSIGNED, EV_ASSIGN_DOUBLE, EV_ASSIGN_PTR};
 
-    g_address_to_name[address] = name;
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"varType\":\"%s\",\"value\":null,\"address\":\"%p\",\"file\":\"%s\",\"line\":%d",
-             name, type, address, f.c_str(), line);
-    write_json_event("declare", address, name, g_depth, extra);
+static void emit_assign(const char* name, long long value, ValueEncoding encoding,
+                        const char* file, int line) {
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(name);
+    ThreadState& ts = thread_state();
+    if (!record_value(sym, value, encoding) && g_budget.dedup) {
+        ++ts.deduped;
+        return;
+    }
+
+    EventRecord* rec = begin_event(k_assign_events[encoding], nullptr, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    set_value(rec, 0, value, encoding);
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_assign_loc(const char* name, long long value,
                                    const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    g_variable_values[name] = value;
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%lld,\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("assign", nullptr, name, g_depth, extra);
+    emit_assign(name, value, VAL_SIGNED, file, line);
+}
+
+extern "C" void __trace_assign_unsigned_loc(const char* name, unsigned long long value,
+                                            const char* file, int line) {
+    emit_assign(name, (long long)value, VAL_UNSIGNED, file, line);
+}
+
+extern "C" void __trace_assign_double_loc(const char* name, double value,
+                                          const char* file, int line) {
+    emit_assign(name, double_bits(value), VAL_DOUBLE, file, line);
+}
+
+extern "C" void __trace_assign_ptr_loc(const char* name, const void* value,
+                                       const char* file, int line) {
+    emit_assign(name, (long long)(uintptr_t)value, VAL_POINTER, file, line);
 }
 
 extern "C" void __trace_pointer_heap_init_loc(const char* ptrName, void* heapAddr,
                                                const char* file, int line) {
-    if (!g_trace_file) return;
-    
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
+    const SymbolId sym = intern(ptrName);
+
     PointerInfo pinfo;
-    pinfo.pointerName = ptrName;
+    pinfo.pointerName = sym;
     pinfo.aliasedAddress = heapAddr;
     pinfo.isHeap = true;
     pinfo.heapAddress = heapAddr;
-    
-    if (!g_call_stack.empty()) {
-        g_call_stack.back().pointerAliases[ptrName] = pinfo;
+
+    ThreadState& ts = thread_state();
+    if (!ts.callStack.empty()) {
+        bind_pointer_alias(ts, pinfo);
+    }
+
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    {
+        RegistryLock lock;
+        g_pointer_registry[sym] = pinfo;
     }
-    
-    g_pointer_registry[ptrName] = pinfo;
+    t_in_tracer = guard;
 }
 
 extern "C" void __trace_control_flow_loc(const char* controlType, const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"controlType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             controlType, f.c_str(), line);
-    write_json_event("control_flow", nullptr, g_current_function.c_str(), g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_CONTROL_FLOW, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->s[0] = intern(controlType);
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_loop_start_loc(int loopId, const char* loopType, const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    if (!g_call_stack.empty()) {
-        g_call_stack.back().activeLoops.push_back(loopId);
-        g_call_stack.back().loopIterations[loopId] = 0;
+    if (!tracing_active()) return;
+    if (g_profile) {
+        profile_loop_start(loopId, file, line);
+        return;
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"loopType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-             loopId, loopType, f.c_str(), line);
-    write_json_event("loop_start", nullptr, g_current_function.c_str(), g_depth, extra);
+
+    ThreadState& ts = thread_state();
+    if (!ts.callStack.empty()) {
+        const bool guard = t_in_tracer;
+        t_in_tracer = true;
+        ts.callStack.back().activeLoops.push_back(
+            LoopState{loopId, 0, false, 0, SkipRange{0, 0, 0, 0}, intern_path(file), line});
+        t_in_tracer = guard;
+    }
+
+    EventRecord* rec = begin_event(EV_LOOP_START, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = loopId;
+    rec->s[0] = intern(loopType);
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_loop_body_start_loc(int loopId, const char* file, int line) {
-    if (!g_trace_file) return;
-    
+    if (!tracing_active()) return;
+    if (g_profile) {
+        profile_loop_body(loopId, file, line);
+        return;
+    }
+
     int iteration = 0;
-    if (!g_call_stack.empty()) {
-        iteration = ++g_call_stack.back().loopIterations[loopId];
+    ThreadState& ts = thread_state();
+    if (!ts.callStack.empty()) {
+        // A body without an active loop (its loop_end already fired) restarts
+        // the count, as the instrumenter can place loop_end inside the body.
+        LoopState* loop = find_loop(ts.callStack.back(), loopId);
+        if (!loop) {
+            const bool guard = t_in_tracer;
+            t_in_tracer = true;
+            ts.callStack.back().activeLoops.push_back(
+                LoopState{loopId, 0, false, 0, SkipRange{0, 0, 0, 0}, intern_path(file), line});
+            t_in_tracer = guard;
+            loop = &ts.callStack.back().activeLoops.back();
+        }
+        iteration = ++loop->iteration;
+        sample_iteration(ts, ts.callStack.size() - 1, *loop);
+        open_scope(ts, loopId);
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, iteration, f.c_str(), line);
-    write_json_event("loop_body_start", nullptr, g_current_function.c_str(), g_depth, extra);
+
+    EventRecord* rec = begin_event(EV_LOOP_BODY_START, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = loopId;
+    rec->i[1] = iteration;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_loop_iteration_end_loc(int loopId, const char* file, int line) {
-    if (!g_trace_file) return;
-    
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+
     int iteration = 0;
-    if (!g_call_stack.empty()) {
-        iteration = g_call_stack.back().loopIterations[loopId];
+    ThreadState& ts = thread_state();
+    if (!ts.callStack.empty()) {
+        if (LoopState* loop = find_loop(ts.callStack.back(), loopId)) iteration = loop->iteration;
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"iteration\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, iteration, f.c_str(), line);
-    write_json_event("loop_iteration_end", nullptr, g_current_function.c_str(), g_depth, extra);
+
+    Scope* scope = innermost_scope(ts, loopId);
+    EventRecord* rec = begin_event(EV_LOOP_ITERATION_END, nullptr, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->i[0] = loopId;
+        rec->i[1] = iteration;
+        if (scope) set_destroyed(rec, scope, 1);
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+    if (scope) ts.callStack.back().scopes.pop_back();
 }
 
 extern "C" void __trace_loop_end_loc(int loopId, const char* file, int line) {
-    if (!g_trace_file) return;
-    
-    if (!g_call_stack.empty()) {
-        auto& loops = g_call_stack.back().activeLoops;
-        auto it = std::find(loops.begin(), loops.end(), loopId);
-        if (it != loops.end()) {
-            loops.erase(it);
+    if (!tracing_active()) return;
+    if (g_profile) {
+        profile_loop_end(loopId, file, line);
+        return;
+    }
+
+    ThreadState& ts = thread_state();
+    if (!ts.callStack.empty()) {
+        auto& loops = ts.callStack.back().activeLoops;
+        for (auto it = loops.rbegin(); it != loops.rend(); ++it) {
+            if (it->loopId != loopId) continue;
+            finish_loop_sampling(ts, ts.callStack.size() - 1, *it);
+            loops.erase(std::next(it).base());
+            break;
         }
-        g_call_stack.back().loopIterations.erase(loopId);
     }
-    
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, f.c_str(), line);
-    write_json_event("loop_end", nullptr, g_current_function.c_str(), g_depth, extra);
+
+    EventRecord* rec = begin_event(EV_LOOP_END, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = loopId;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_loop_condition_loc(int loopId, int result, const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"loopId\":%d,\"result\":%d,\"file\":\"%s\",\"line\":%d",
-             loopId, result, f.c_str(), line);
-    write_json_event("loop_condition", nullptr, g_current_function.c_str(), g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_LOOP_CONDITION, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = loopId;
+    rec->i[1] = result;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
-extern "C" void __trace_return_loc(long long value, const char* returnType, 
+extern "C" void __trace_return_loc(long long value, const char* returnType,
                                     const char* destinationSymbol, const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[512];
-    
-    if (destinationSymbol && destinationSymbol[0] != '\0') {
-        snprintf(extra, sizeof(extra),
-                 "\"value\":%lld,\"returnType\":\"%s\",\"destinationSymbol\":\"%s\",\"file\":\"%s\",\"line\":%d",
-                 value, returnType ? returnType : "auto", destinationSymbol, f.c_str(), line);
-    } else {
-        snprintf(extra, sizeof(extra),
-                 "\"value\":%lld,\"returnType\":\"%s\",\"file\":\"%s\",\"line\":%d",
-                 value, returnType ? returnType : "auto", f.c_str(), line);
-    }
-    
-    write_json_event("return", nullptr, g_current_function.c_str(), g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_RETURN, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = value;
+    rec->s[0] = intern(returnType ? returnType : "auto");
+    rec->s[1] = intern(destinationSymbol);
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_block_enter_loc(int blockDepth, const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d",
-             blockDepth, f.c_str(), line);
-    write_json_event("block_enter", nullptr, g_current_function.c_str(), g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    ThreadState& ts = thread_state();
+    open_scope(ts, -1);
+    EventRecord* rec = begin_event(EV_BLOCK_ENTER, nullptr, ts.currentFunction, ts.depth);
+    if (!rec) return;
+    rec->i[0] = blockDepth;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void __trace_block_exit_loc(int blockDepth, const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"blockDepth\":%d,\"file\":\"%s\",\"line\":%d",
-             blockDepth, f.c_str(), line);
-    write_json_event("block_exit", nullptr, g_current_function.c_str(), g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    ThreadState& ts = thread_state();
+    Scope* scope = innermost_scope(ts, -1);
+    EventRecord* rec = begin_event(EV_BLOCK_EXIT, nullptr, ts.currentFunction, ts.depth);
+    if (rec) {
+        rec->i[0] = blockDepth;
+        if (scope) set_destroyed(rec, scope, 1);
+        set_location(rec, file, line);
+        commit_event(rec);
+    }
+    if (scope) ts.callStack.back().scopes.pop_back();
 }
 
 extern "C" void trace_var_int_loc(const char* name, int value,
                                    const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%d,\"type\":\"int\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const SymbolId sym = intern(name);
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_VAR_INT, nullptr, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->i[0] = value;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void trace_var_long_loc(const char* name, long long value,
                                     const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%lld,\"type\":\"long\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const SymbolId sym = intern(name);
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_VAR_LONG, nullptr, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->i[0] = value;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void trace_var_double_loc(const char* name, double value,
                                       const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":%f,\"type\":\"double\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const SymbolId sym = intern(name);
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_VAR_DOUBLE, nullptr, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->d = value;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void trace_var_ptr_loc(const char* name, void* value,
                                   const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char extra[256];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":\"%p\",\"type\":\"pointer\",\"file\":\"%s\",\"line\":%d",
-             name, value, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const SymbolId sym = intern(name);
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_VAR_PTR, nullptr, sym, ts.depth);
+    if (!rec) return;
+    rec->s[0] = sym;
+    rec->p = value;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void trace_var_str_loc(const char* name, const char* value,
                                   const char* file, int line) {
-    if (!g_trace_file) return;
-    const std::string f = json_safe_path(file);
-    char escaped[256];
-    int j = 0;
-    for (int i = 0; value && value[i] && i < 250; ++i) {
-        if (value[i] == '"' || value[i] == '\\') escaped[j++] = '\\';
-        escaped[j++] = value[i];
-    }
-    escaped[j] = '\0';
-    char extra[512];
-    snprintf(extra, sizeof(extra),
-             "\"name\":\"%s\",\"value\":\"%s\",\"type\":\"string\",\"file\":\"%s\",\"line\":%d",
-             name, escaped, f.c_str(), line);
-    write_json_event("var", nullptr, name, g_depth, extra);
+    if (!tracing_active()) return;
+    if (profiled(file, line)) return;
+    const SymbolId sym = intern(name);
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_VAR_STR, nullptr, sym, ts.depth);
+    if (!rec) return;
+    unsigned j = 0;
+    while (value && value[j] && j < 250 && j < TRACE_TEXT_CAPACITY) {
+        rec->text[j] = value[j];
+        ++j;
+    }
+    rec->textLen = (unsigned short)j;
+    rec->s[0] = sym;
+    set_location(rec, file, line);
+    commit_event(rec);
 }
 
 extern "C" void trace_var_int(const char* name, int value) {
@@ -638,197 +3695,809 @@ extern "C" void trace_var_str(const char* name, const char* value) {
 extern "C" void __cyg_profile_func_enter(void* func, void* caller)
     __attribute__((no_instrument_function));
 void __cyg_profile_func_enter(void* func, void* caller) {
-    const char* func_name = "unknown";
+    if (!tracing_active()) return;
 
-#ifndef _WIN32
-    Dl_info dlinfo{};
-    if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
-        func_name = demangle(dlinfo.dli_sname);
-        
-        if (strstr(func_name, "GLOBAL__sub") || 
-            strstr(func_name, "_static_initialization_and_destruction")) {
-            return;
-        }
-        
-        if (dlinfo.dli_fname &&
-            (strstr(dlinfo.dli_fname, "/usr/") ||
-             strstr(dlinfo.dli_fname, "/lib/") ||
-             strstr(dlinfo.dli_fname, "libc") ||
-             strstr(dlinfo.dli_fname, "libstdc++"))) {
-            return;
-        }
+    const FunctionInfo info = lookup_function(func);
+    if (info.skip) return;
+
+    const SymbolId fn = info.name;
+    track_function(fn);
+    if (g_profile) {
+        profile_call(fn);
+        return;
     }
-#endif
+    ThreadState& ts = thread_state();
+    ts.currentFunction = fn;
 
-    std::string fn = normalize_function_name(func_name);
-    g_tracked_functions.insert(fn);
-    g_current_function = fn;
-    
     CallFrame frame;
     frame.functionName = fn;
-    
-    if (!g_call_stack.empty()) {
-        frame.pointerAliases = g_call_stack.back().pointerAliases;
-    }
-    
-    g_call_stack.push_back(frame);
-    
-    char extra[256];
-    snprintf(extra, sizeof(extra), "\"caller\":\"%p\"", caller);
-    write_json_event("func_enter", func, func_name, g_depth++, extra);
+    frame.serial = g_frame_serial.fetch_add(1, std::memory_order_relaxed) + 1;
+    frame.aliasBase = ts.aliasStack.size();
+    frame.arrayBase = ts.stackArrays.size();
+
+    const unsigned long parent = ts.callStack.empty() ? 0 : ts.callStack.back().serial;
+    const bool guard = t_in_tracer;
+    t_in_tracer = true;
+    ts.callStack.push_back(frame);
+    t_in_tracer = guard;
+
+    // Counted even when the record is dropped, so frame ids stay the real
+    // call numbers under sampling and the budget.  Shared by all threads.
+    const unsigned invocation = __atomic_fetch_add(&symbol(fn).calls, 1, __ATOMIC_RELAXED);
+
+    EventRecord* rec = begin_event(EV_FUNC_ENTER, func, fn, ts.depth++);
+    if (!rec) return;
+    rec->p = caller;
+    rec->i[0] = invocation;
+    rec->i[1] = (long long)frame.serial;
+    rec->i[2] = (long long)parent;
+    commit_event(rec);
 }
 
 extern "C" void __cyg_profile_func_exit(void* func, void* caller)
     __attribute__((no_instrument_function));
 void __cyg_profile_func_exit(void* func, void* caller) {
-    const char* func_name = "unknown";
+    if (!tracing_active()) return;
 
-#ifndef _WIN32
-    Dl_info dlinfo{};
-    if (dladdr(func, &dlinfo) && dlinfo.dli_sname) {
-        func_name = demangle(dlinfo.dli_sname);
-        
-        if (strstr(func_name, "GLOBAL__sub") || 
-            strstr(func_name, "_static_initialization_and_destruction")) {
-            return;
-        }
-        
-        if (dlinfo.dli_fname &&
-            (strstr(dlinfo.dli_fname, "/usr/") ||
-             strstr(dlinfo.dli_fname, "/lib/"))) {
-            return;
-        }
+    const FunctionInfo info = lookup_function(func);
+    if (info.skip) return;
+    if (g_profile) {
+        profile_return();
+        return;
     }
-#endif
 
-    fflush(stdout);
-    fflush(stderr);
+    if (!g_output) {
+        fflush(stdout);
+        fflush(stderr);
+    }
 
-    if (!g_call_stack.empty()) {
-        auto& activeLoops = g_call_stack.back().activeLoops;
+    ThreadState& ts = thread_state();
+    if (ts.callStack.empty()) track_function(info.name);
+    const SymbolId fn = ts.callStack.empty() ? info.name : ts.callStack.back().functionName;
+
+    // What the frame's open scopes still hold goes out with its func_exit.
+    unsigned long serial = 0;
+    ArenaVector<Scope> scopes;
+    if (!ts.callStack.empty()) {
+        auto& activeLoops = ts.callStack.back().activeLoops;
         while (!activeLoops.empty()) {
-            int loopId = activeLoops.back();
+            const int loopId = activeLoops.back().loopId;
+            finish_loop_sampling(ts, ts.callStack.size() - 1, activeLoops.back());
             activeLoops.pop_back();
-            
-            char extra[128];
-            snprintf(extra, sizeof(extra), "\"loopId\":%d,\"file\":\"unknown\",\"line\":0", loopId);
-            write_json_event("loop_end", nullptr, g_current_function.c_str(), g_depth, extra);
+
+            EventRecord* rec = begin_event(EV_LOOP_END, nullptr, ts.currentFunction, ts.depth);
+            if (!rec) continue;
+            rec->i[0] = loopId;
+            set_location(rec, "unknown", 0);
+            commit_event(rec);
         }
-        
-        g_call_stack.pop_back();
+
+        unwind_pointer_aliases(ts, ts.callStack.back().aliasBase);
+        release_stack_arrays(ts, ts.callStack.back().arrayBase);
+        serial = ts.callStack.back().serial;
+        scopes.swap(ts.callStack.back().scopes);
+        ts.callStack.pop_back();
     }
-    
-    if (!g_call_stack.empty()) {
-        g_current_function = g_call_stack.back().functionName;
+
+    if (!ts.callStack.empty()) {
+        ts.currentFunction = ts.callStack.back().functionName;
     } else {
-        g_current_function = "main";
+        ts.currentFunction = SYM_MAIN;
     }
 
-    write_json_event("func_exit", func, func_name, --g_depth);
+    EventRecord* rec = begin_event(EV_FUNC_EXIT, func, fn, --ts.depth);
+    if (!rec) return;
+    rec->i[0] = (long long)serial;
+    set_destroyed(rec, scopes.data(), scopes.size());
+    commit_event(rec);
 }
 
-void* operator new(std::size_t size) {
-    void* ptr = std::malloc(size);
-    if (ptr && g_trace_file) {
-        char extra[128];
-        snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-        write_json_event("heap_alloc", ptr, "operator new", g_depth, extra);
+// ---------------------------------------------------------------------------
+// Heap tracking
+//
+// Every block allocated while tracing is entered in an open-addressed table
+// (linear probing, tombstones on removal) keyed by address, holding its size
+// and the function that allocated it.  The table lives in raw pages so the
+// hooks never allocate through themselves; frees of blocks the table never
+// saw (allocated before tracing started, or by the tracer) are not reported.
+// finish_tracer writes a heap_summary plus one heap_leak per live block.
+// ---------------------------------------------------------------------------
+
+struct HeapBlock {
+    uintptr_t address;      // HEAP_EMPTY / HEAP_TOMBSTONE mark free slots
+    std::size_t size;
+    SymbolId frame;
+};
+
+static const uintptr_t HEAP_EMPTY = 0;
+static const uintptr_t HEAP_TOMBSTONE = 1;
+static const std::size_t HEAP_TABLE_INITIAL = 1 << 12;
+static const std::size_t MAX_LEAK_RECORDS = 256;
+
+struct HeapTable {
+    HeapBlock* slots = nullptr;
+    std::size_t capacity = 0;
+    std::size_t used = 0;           // live entries plus tombstones
+    std::size_t live = 0;
+    unsigned long long liveBytes = 0;
+    unsigned long long peakBytes = 0;
+    unsigned long long allocations = 0;
+    unsigned long long allocatedBytes = 0;
+};
+
+static HeapTable g_heap;
+static std::atomic_flag g_heap_lock = ATOMIC_FLAG_INIT;
+
+static void lock_heap() {
+    while (g_heap_lock.test_and_set(std::memory_order_acquire)) cpu_relax();
+}
+
+static void unlock_heap() {
+    g_heap_lock.clear(std::memory_order_release);
+}
+
+static inline std::size_t heap_hash(uintptr_t address, std::size_t capacity) {
+    return (std::size_t)((address >> 4) * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+}
+
+static HeapBlock* heap_probe(HeapBlock* slots, std::size_t capacity, uintptr_t address, bool inserting) {
+    HeapBlock* reuse = nullptr;
+    for (std::size_t i = heap_hash(address, capacity);; i = (i + 1) & (capacity - 1)) {
+        HeapBlock* slot = &slots[i];
+        if (slot->address == address) return slot;
+        if (slot->address == HEAP_TOMBSTONE) {
+            if (inserting && !reuse) reuse = slot;
+        } else if (slot->address == HEAP_EMPTY) {
+            return inserting ? (reuse ? reuse : slot) : nullptr;
+        }
     }
-    return ptr;
 }
 
-void* operator new[](std::size_t size) {
-    void* ptr = std::malloc(size);
-    if (ptr && g_trace_file) {
-        char extra[128];
-        snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-        write_json_event("heap_alloc", ptr, "operator new[]", g_depth, extra);
+// Rehashes at 70% occupancy (tombstones included); doubles only when the
+// live entries need it, otherwise just sweeps the tombstones out.
+static bool heap_reserve() {
+    if (g_heap.slots && (g_heap.used + 1) * 10 < g_heap.capacity * 7) return true;
+
+    std::size_t capacity = g_heap.capacity ? g_heap.capacity : HEAP_TABLE_INITIAL;
+    while ((g_heap.live + 1) * 2 > capacity) capacity *= 2;
+    HeapBlock* slots = static_cast<HeapBlock*>(alloc_pages(capacity * sizeof(HeapBlock)));
+    if (!slots) return false;
+
+    for (std::size_t i = 0; i < g_heap.capacity; i++) {
+        const HeapBlock& block = g_heap.slots[i];
+        if (block.address > HEAP_TOMBSTONE) *heap_probe(slots, capacity, block.address, true) = block;
     }
-    return ptr;
+    if (g_heap.slots) free_pages(g_heap.slots, g_heap.capacity * sizeof(HeapBlock));
+    g_heap.slots = slots;
+    g_heap.capacity = capacity;
+    g_heap.used = g_heap.live;
+    return true;
 }
 
-void operator delete(void* ptr) noexcept {
-    if (ptr && g_trace_file) {
-        write_json_event("heap_free", ptr, "operator delete", g_depth);
+static void heap_insert(void* ptr, std::size_t size, SymbolId frame) {
+    lock_heap();
+    if (heap_reserve()) {
+        HeapBlock* slot = heap_probe(g_heap.slots, g_heap.capacity, (uintptr_t)ptr, true);
+        if (slot->address == (uintptr_t)ptr) {
+            g_heap.liveBytes -= slot->size;     // reused without a tracked free
+        } else {
+            if (slot->address == HEAP_EMPTY) g_heap.used++;
+            g_heap.live++;
+        }
+        *slot = HeapBlock{(uintptr_t)ptr, size, frame};
+        g_heap.liveBytes += size;
+        g_heap.peakBytes = std::max(g_heap.peakBytes, g_heap.liveBytes);
+        g_heap.allocations++;
+        g_heap.allocatedBytes += size;
     }
-    std::free(ptr);
+    unlock_heap();
 }
 
-void operator delete[](void* ptr) noexcept {
-    if (ptr && g_trace_file) {
-        write_json_event("heap_free", ptr, "operator delete[]", g_depth);
+// False when the block was never tracked.
+static bool heap_remove(void* ptr) {
+    bool found = false;
+    lock_heap();
+    if (g_heap.slots) {
+        if (HeapBlock* slot = heap_probe(g_heap.slots, g_heap.capacity, (uintptr_t)ptr, false)) {
+            g_heap.liveBytes -= slot->size;
+            g_heap.live--;
+            slot->address = HEAP_TOMBSTONE;
+            found = true;
+        }
+    }
+    unlock_heap();
+    return found;
+}
+
+static void emit_heap_alloc(void* ptr, std::size_t size, const char* source) {
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_HEAP_ALLOC, ptr, intern(source), ts.depth);
+    if (!rec) return;
+    rec->i[0] = (long long)size;
+    commit_event(rec);
+}
+
+static void emit_heap_free(void* ptr, const char* source) {
+    const ThreadState& ts = thread_state();
+    EventRecord* rec = begin_event(EV_HEAP_FREE, ptr, intern(source), ts.depth);
+    if (!rec) return;
+    commit_event(rec);
+}
+
+// The hooks run t_in_tracer for the bookkeeping, so whatever interning or
+// capture allocates underneath is neither tracked nor re-enters them.
+static void* track_alloc(void* ptr, std::size_t size, const char* source) {
+    if (!ptr || !tracing_active()) return ptr;
+    t_in_tracer = true;
+    heap_insert(ptr, size, thread_state().currentFunction);
+    if (!g_profile) emit_heap_alloc(ptr, size, source);
+    t_in_tracer = false;
+    return ptr;
+}
+
+static void track_free(void* ptr, const char* source) {
+    if (!ptr || !tracing_active()) return;
+    t_in_tracer = true;
+    if (heap_remove(ptr) && !g_profile) emit_heap_free(ptr, source);
+    t_in_tracer = false;
+}
+
+static void emit_heap_summary() {
+    std::size_t leaks = 0;
+    for (std::size_t i = 0; i < g_heap.capacity && leaks < MAX_LEAK_RECORDS; i++) {
+        const HeapBlock& block = g_heap.slots[i];
+        if (block.address <= HEAP_TOMBSTONE) continue;
+        EventRecord* rec = begin_ring_event(EV_HEAP_LEAK, (void*)block.address, block.frame, 0);
+        if (!rec) break;
+        rec->i[0] = (long long)block.size;
+        commit_ring_event(rec);
+        leaks++;
+    }
+
+    // Written past the event budget, like trace_truncated.
+    if (EventRecord* rec = reserve_slot(EV_HEAP_SUMMARY, nullptr, SYM_MAIN, 0)) {
+        rec->i[0] = (long long)g_heap.live;
+        rec->i[1] = (long long)g_heap.liveBytes;
+        rec->i[2] = (long long)g_heap.peakBytes;
+        rec->i[3] = (long long)g_heap.allocations;
+        rec->i[4] = (long long)g_heap.allocatedBytes;
+        commit_ring_event(rec);
     }
-    std::free(ptr);
 }
 
 #if !defined(_WIN32)
 extern "C" {
     static void* (*real_malloc)(std::size_t) = nullptr;
+    static void* (*real_calloc)(std::size_t, std::size_t) = nullptr;
+    static void* (*real_realloc)(void*, std::size_t) = nullptr;
     static void (*real_free)(void*) = nullptr;
+    static int (*real_posix_memalign)(void**, std::size_t, std::size_t) = nullptr;
+    static void* (*real_aligned_alloc)(std::size_t, std::size_t) = nullptr;
+
+    // dlsym itself may calloc before real_calloc is known; those few
+    // allocations come from here and are never freed.
+    alignas(16) static char g_bootstrap_heap[4096];
+    static std::size_t g_bootstrap_used = 0;
+    static bool g_resolving_hooks = false;
+
+    static void* bootstrap_alloc(std::size_t size) {
+        size = (size + 15) & ~(std::size_t)15;
+        if (g_bootstrap_used + size > sizeof(g_bootstrap_heap)) return nullptr;
+        void* p = g_bootstrap_heap + g_bootstrap_used;
+        g_bootstrap_used += size;
+        return p;
+    }
+
+    static inline bool is_bootstrap(void* p) {
+        return p >= (void*)g_bootstrap_heap && p < (void*)(g_bootstrap_heap + sizeof(g_bootstrap_heap));
+    }
 
     static void init_malloc_hooks() __attribute__((constructor));
     static void init_malloc_hooks() {
-        real_malloc = (void*(*)(std::size_t))dlsym(RTLD_NEXT, "malloc");
+        if (real_malloc || g_resolving_hooks) return;
+        g_resolving_hooks = true;
+        real_calloc = (void*(*)(std::size_t, std::size_t))dlsym(RTLD_NEXT, "calloc");
+        real_realloc = (void*(*)(void*, std::size_t))dlsym(RTLD_NEXT, "realloc");
         real_free   = (void(*)(void*))dlsym(RTLD_NEXT, "free");
+        real_posix_memalign = (int(*)(void**, std::size_t, std::size_t))dlsym(RTLD_NEXT, "posix_memalign");
+        real_aligned_alloc = (void*(*)(std::size_t, std::size_t))dlsym(RTLD_NEXT, "aligned_alloc");
+        real_malloc = (void*(*)(std::size_t))dlsym(RTLD_NEXT, "malloc");
+        g_resolving_hooks = false;
     }
 
     void* malloc(std::size_t size) __attribute__((no_instrument_function));
     void* malloc(std::size_t size) {
-        if (!real_malloc) init_malloc_hooks();
-        void* ptr = real_malloc(size);
-        if (ptr && g_trace_file) {
-            char extra[128];
-            snprintf(extra, sizeof(extra), "\"size\":%zu,\"isHeap\":true", size);
-            write_json_event("heap_alloc", ptr, "malloc", g_depth, extra);
+        if (!real_malloc) {
+            if (g_resolving_hooks) return bootstrap_alloc(size);
+            init_malloc_hooks();
+        }
+        return track_alloc(real_malloc(size), size, "malloc");
+    }
+
+    void* calloc(std::size_t count, std::size_t size) __attribute__((no_instrument_function));
+    void* calloc(std::size_t count, std::size_t size) {
+        if (!real_calloc) {
+            if (g_resolving_hooks) return bootstrap_alloc(count * size);  // static storage is zeroed
+            init_malloc_hooks();
         }
-        return ptr;
+        return track_alloc(real_calloc(count, size), count * size, "calloc");
+    }
+
+    void* realloc(void* ptr, std::size_t size) __attribute__((no_instrument_function));
+    void* realloc(void* ptr, std::size_t size) {
+        if (!real_realloc) init_malloc_hooks();
+        if (is_bootstrap(ptr)) {
+            void* moved = malloc(size);
+            if (moved) std::memcpy(moved, ptr, std::min(size, (std::size_t)(g_bootstrap_heap + sizeof(g_bootstrap_heap) - (char*)ptr)));
+            return moved;
+        }
+        void* moved = real_realloc(ptr, size);
+        if (ptr && (moved || size == 0)) track_free(ptr, "realloc");
+        return track_alloc(moved, size, "realloc");
+    }
+
+    int posix_memalign(void** out, std::size_t alignment, std::size_t size) __attribute__((no_instrument_function));
+    int posix_memalign(void** out, std::size_t alignment, std::size_t size) {
+        if (!real_posix_memalign) init_malloc_hooks();
+        const int rc = real_posix_memalign(out, alignment, size);
+        if (rc == 0) track_alloc(*out, size, "posix_memalign");
+        return rc;
+    }
+
+    void* aligned_alloc(std::size_t alignment, std::size_t size) __attribute__((no_instrument_function));
+    void* aligned_alloc(std::size_t alignment, std::size_t size) {
+        if (!real_aligned_alloc) init_malloc_hooks();
+        return track_alloc(real_aligned_alloc(alignment, size), size, "aligned_alloc");
     }
 
     void free(void* ptr) __attribute__((no_instrument_function));
     void free(void* ptr) {
+        if (!ptr || is_bootstrap(ptr)) return;
         if (!real_free) init_malloc_hooks();
-        if (ptr && g_trace_file) {
-            write_json_event("heap_free", ptr, "free", g_depth);
-        }
+        track_free(ptr, "free");
         real_free(ptr);
     }
 }
+
+static inline void* raw_malloc(std::size_t size) {
+    if (!real_malloc) init_malloc_hooks();
+    return real_malloc(size);
+}
+
+static inline void raw_free(void* ptr) {
+    if (!real_free) init_malloc_hooks();
+    real_free(ptr);
+}
+#else
+static inline void* raw_malloc(std::size_t size) { return std::malloc(size); }
+static inline void raw_free(void* ptr) { std::free(ptr); }
+#endif
+
+// operator new/delete go to the real allocator directly so a C++ allocation
+// is reported once, under its own name, rather than again as a malloc.
+void* operator new(std::size_t size) {
+    return track_alloc(raw_malloc(size), size, "operator new");
+}
+
+void* operator new[](std::size_t size) {
+    return track_alloc(raw_malloc(size), size, "operator new[]");
+}
+
+void operator delete(void* ptr) noexcept {
+    track_free(ptr, "operator delete");
+    raw_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    track_free(ptr, "operator delete[]");
+    raw_free(ptr);
+}
+
+// ---------------------------------------------------------------------------
+// Fatal signals
+//
+// A program that crashes or is terminated still leaves a finished trace.  A
+// fault is handled where it happens: a crash record notes the signal and the
+// trace is finished as at exit, then the signal is raised again.  Handlers
+// run on an alternate stack so a stack overflow is caught too.  A fault
+// inside the tracer's own bookkeeping, whose locks may be held, leaves only
+// what the drain thread has published.  SIGTERM (the execution timeout) can
+// land anywhere, so its handler only asks the drain thread to finish once
+// the producers have stopped.  Handlers the program installs replace these.
+// ---------------------------------------------------------------------------
+
+extern "C" void finish_tracer() __attribute__((no_instrument_function));
+static void finish_trace(bool flushOutput) __attribute__((no_instrument_function));
+
+#if !defined(_WIN32)
+static const int k_fault_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static const std::size_t CRASH_STACK_SIZE = 1 << 16;
+static std::atomic_flag g_crash_handled = ATOMIC_FLAG_INIT;
+
+static void install_crash_stack() {
+    stack_t stack{};
+    stack.ss_sp = arena_alloc(CRASH_STACK_SIZE);
+    if (!stack.ss_sp) return;
+    stack.ss_size = CRASH_STACK_SIZE;
+    sigaltstack(&stack, nullptr);
+}
+
+static void reraise(int sig) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void on_fault(int sig) {
+    if (g_crash_handled.test_and_set(std::memory_order_acq_rel)) {
+        // Another thread is finishing the trace and will end the process.
+        for (;;) pause();
+    }
+    if (tracing_active()) {
+        const ThreadState& ts = thread_state();
+        if (EventRecord* rec = begin_event(EV_CRASH, nullptr, ts.currentFunction, ts.depth)) {
+            rec->i[0] = sig;
+            commit_event(rec);
+        }
+        finish_tracer();
+    }
+    reraise(sig);
+}
+
+static void on_terminate(int sig) {
+    g_terminate_signal.store(sig, std::memory_order_release);
+}
+
+// On the drain thread.  The hooks check tracing_active() on entry, so once
+// it is off and the in-flight ones have returned nothing else touches the
+// rings, the registries or the heap table.
+static void seal_terminated() {
+    const int sig = g_terminate_signal.load(std::memory_order_acquire);
+    if (!g_crash_handled.test_and_set(std::memory_order_acq_rel)) {
+        set_tracing(false);
+        for (int i = 0; i < 10; i++) drain_sleep();
+        finish_tracer();
+    }
+    // Blocked on this thread since it started.
+    sigset_t term;
+    sigemptyset(&term);
+    sigaddset(&term, sig);
+    signal(sig, SIG_DFL);
+    pthread_sigmask(SIG_UNBLOCK, &term, nullptr);
+    raise(sig);
+}
+
+static void install_crash_handlers() {
+    install_crash_stack();
+    struct sigaction action{};
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_ONSTACK;
+    for (int sig : k_fault_signals) {
+        struct sigaction previous{};
+        if (sigaction(sig, nullptr, &previous) != 0 || previous.sa_handler != SIG_DFL) continue;
+        action.sa_handler = on_fault;
+        sigaction(sig, &action, nullptr);
+    }
+    struct sigaction previous{};
+    if (sigaction(SIGTERM, nullptr, &previous) == 0 && previous.sa_handler == SIG_DFL) {
+        action.sa_handler = on_terminate;
+        sigaction(SIGTERM, &action, nullptr);
+    }
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Thread hooks
+//
+// pthread_create and pthread_join are interposed like the allocator.  A
+// thread created while tracing starts in thread_main, which gives it the id
+// its thread_create record announced and records a thread_exit when the start
+// routine returns.  The new thread waits until that record is committed, so
+// it precedes all of the thread's own.  Threads started any other way are
+// numbered at their first event and have no create or join records.  In
+// profile mode threads are numbered the same way but none of the three
+// records is written.
+//
+// _exit and _Exit skip the destructors, so they finish the trace themselves
+// before the process goes: tracing stops, other threads get the time the
+// SIGTERM path gives them to leave their hooks, and the rings are drained
+// and the file sealed on the calling thread.
+// ---------------------------------------------------------------------------
+
+#if !defined(_WIN32)
+struct ThreadLaunch {
+    void* (*start)(void*);
+    void* arg;
+    unsigned tid;
+    std::atomic<bool> announced;
+};
+
+static ArenaMap<pthread_t, unsigned> g_thread_ids;      // joinable threads, under RegistryLock
+
+static int (*real_pthread_create)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*) = nullptr;
+static int (*real_pthread_join)(pthread_t, void**) = nullptr;
+static void (*real_exit)(int) = nullptr;
+static void (*real_Exit)(int) = nullptr;
+
+static void init_thread_hooks() {
+    real_pthread_create = (int(*)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*))
+        dlsym(RTLD_NEXT, "pthread_create");
+    real_pthread_join = (int(*)(pthread_t, void**))dlsym(RTLD_NEXT, "pthread_join");
+    real_exit = (void(*)(int))dlsym(RTLD_NEXT, "_exit");
+    real_Exit = (void(*)(int))dlsym(RTLD_NEXT, "_Exit");
+}
+
+static void seal_exited() __attribute__((no_instrument_function));
+static void seal_exited() {
+    if (!tracing_active()) return;
+    if (g_crash_handled.test_and_set(std::memory_order_acq_rel)) {
+        // A fault on another thread is finishing the trace and will end the process.
+        for (;;) pause();
+    }
+    set_tracing(false);
+    if (g_threaded.load(std::memory_order_acquire)) {
+        for (int i = 0; i < 10; i++) drain_sleep();
+    }
+    finish_trace(false);
+}
+
+static void* thread_main(void* p) __attribute__((no_instrument_function));
+static void* thread_main(void* p) {
+    ThreadLaunch* launch = static_cast<ThreadLaunch*>(p);
+    while (!launch->announced.load(std::memory_order_acquire)) cpu_relax();
+    void* (*start)(void*) = launch->start;
+    void* arg = launch->arg;
+    start_thread_state(launch->tid);
+    arena_delete(launch);
+    install_crash_stack();
+
+    void* result = start(arg);
+
+    if (tracing_active() && !g_profile) {
+        const ThreadState& ts = thread_state();
+        EventRecord* rec = begin_event(EV_THREAD_EXIT, (void*)start, lookup_function((void*)start).name, ts.depth);
+        if (rec) commit_event(rec);
+    }
+    return result;
+}
+
+extern "C" {
+    int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start)(void*), void* arg)
+        __attribute__((no_instrument_function));
+    int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start)(void*), void* arg) {
+        if (!real_pthread_create) init_thread_hooks();
+        if (!real_pthread_create) return EAGAIN;
+        if (!tracing_active()) return real_pthread_create(thread, attr, start, arg);
+
+        g_threaded.store(true, std::memory_order_release);
+        const ThreadState& ts = thread_state();
+        const unsigned tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+
+        // What libc allocates for the thread is not the program's.
+        t_in_tracer = true;
+        ThreadLaunch* launch = arena_new<ThreadLaunch>(start, arg, tid, false);
+        if (!launch) {
+            t_in_tracer = false;
+            return EAGAIN;
+        }
+        const int rc = real_pthread_create(thread, attr, thread_main, launch);
+        if (rc != 0) {
+            arena_delete(launch);
+            t_in_tracer = false;
+            return rc;
+        }
+        int detach = PTHREAD_CREATE_JOINABLE;
+        if (attr) pthread_attr_getdetachstate(attr, &detach);
+        if (detach == PTHREAD_CREATE_JOINABLE) {
+            RegistryLock lock;
+            g_thread_ids[*thread] = tid;
+        }
+        t_in_tracer = false;
+
+        EventRecord* rec = g_profile ? nullptr
+            : begin_event(EV_THREAD_CREATE, (void*)start, ts.currentFunction, ts.depth);
+        if (rec) {
+            rec->i[0] = tid;
+            rec->p = (const void*)start;
+            commit_event(rec);
+        }
+        launch->announced.store(true, std::memory_order_release);
+        return 0;
+    }
+
+    int pthread_join(pthread_t thread, void** result) __attribute__((no_instrument_function));
+    int pthread_join(pthread_t thread, void** result) {
+        if (!real_pthread_join) init_thread_hooks();
+        if (!real_pthread_join) return ENOSYS;
+        const int rc = real_pthread_join(thread, result);
+        if (rc != 0 || !tracing_active()) return rc;
+
+        bool known = false;
+        unsigned tid = 0;
+        t_in_tracer = true;
+        {
+            RegistryLock lock;
+            auto it = g_thread_ids.find(thread);
+            if (it != g_thread_ids.end()) {
+                tid = it->second;
+                g_thread_ids.erase(it);
+                known = true;
+            }
+        }
+        t_in_tracer = false;
+        if (!known) return rc;
+
+        const ThreadState& ts = thread_state();
+        EventRecord* rec = g_profile ? nullptr : begin_event(EV_THREAD_JOIN, nullptr, ts.currentFunction, ts.depth);
+        if (rec) {
+            rec->i[0] = tid;
+            commit_event(rec);
+        }
+        return rc;
+    }
+
+    void _exit(int status) __attribute__((no_instrument_function));
+    void _exit(int status) {
+        seal_exited();
+        if (!real_exit) init_thread_hooks();
+        if (real_exit) real_exit(status);
+        std::abort();
+    }
+
+    void _Exit(int status) __attribute__((no_instrument_function));
+    void _Exit(int status) {
+        seal_exited();
+        if (!real_Exit) init_thread_hooks();
+        if (real_Exit) real_Exit(status);
+        std::abort();
+    }
+}
 #endif
 
 extern "C" void __attribute__((constructor)) init_tracer()
     __attribute__((no_instrument_function));
 void init_tracer() {
-    setvbuf(stdout, NULL, _IONBF, 0);
     setvbuf(stderr, NULL, _IONBF, 0);
 
     const char* trace_path = std::getenv("TRACE_OUTPUT");
     if (!trace_path) trace_path = "trace.json";
 
-    g_trace_file = std::fopen(trace_path, "w");
+    const char* format = std::getenv("TRACE_FORMAT");
+    if (format && std::strcmp(format, "bin") == 0) g_trace_format = TRACE_FORMAT_BINARY;
+
+    const char* trace_mode = std::getenv("TRACE_MODE");
+    g_profile = trace_mode && std::strcmp(trace_mode, "profile") == 0;
+
+#ifndef _WIN32
+    // TRACE_FD hands the runtime an inherited pipe to stream into instead of
+    // a file; only the binary format can be decoded while it is written.
+    if (const char* fd_env = std::getenv("TRACE_FD")) {
+        const int fd = std::atoi(fd_env);
+        if (fd > 2 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0) {
+            g_trace_file = fdopen(fd, "wb");
+            g_trace_format = TRACE_FORMAT_BINARY;
+            g_trace_streaming = g_trace_file != nullptr;
+        }
+    }
+#endif
+
+    if (!g_trace_file) {
+        const char* mode = g_trace_format == TRACE_FORMAT_BINARY ? "wb" : "w";
+        g_trace_file = open_mapped_trace(trace_path, mode);
+        if (!g_trace_file) g_trace_file = std::fopen(trace_path, mode);
+    }
     if (g_trace_file) {
-        setvbuf(g_trace_file, NULL, _IONBF, 0);
-        std::fprintf(g_trace_file,
-                     "{\"version\":\"1.0\",\"functions\":[],\"events\":[\n");
+        // The buffer is the arena's; stdio would otherwise malloc it on the first write.
+        const std::size_t buffer_size = g_trace_streaming ? 1 << 16 : 1 << 20;
+        setvbuf(g_trace_file, static_cast<char*>(arena_alloc(buffer_size)), _IOFBF, buffer_size);
+        if (g_trace_format == TRACE_FORMAT_BINARY) {
+            write_binary_header(g_trace_file);
+        } else {
+            std::fprintf(g_trace_file,
+                         "{\"version\":\"1.0\",\"functions\":[],\"events\":[\n");
+        }
         std::fflush(g_trace_file);
+        mapped_publish();
+
+        t_in_tracer = true;
+#ifndef _WIN32
+        pthread_atfork(drain_prepare_fork, drain_parent_fork, drain_child_fork);
+        install_crash_handlers();
+#endif
+        init_function_cache();
+        read_budget();
+        init_clock();
+        capture_output();
+        if (!g_output) setvbuf(stdout, NULL, _IONBF, 0);
+
+        // Lets the reader symbolize the addresses of events without a
+        // location (func_enter/func_exit) against the executable file, and
+        // anchor the relative timestamps to wall-clock time (microseconds).
+        if (EventRecord* rec = begin_event(EV_TRACE_START, nullptr, SYM_MAIN, 0)) {
+            rec->p = reinterpret_cast<const void*>(g_executable_bias);
+            rec->s[0] = intern(g_clock == TRACE_CLOCK_TSC ? "tsc" : "monotonic");
+            rec->i[0] = static_cast<long long>(wall_clock_us());
+            commit_event(rec);
+        }
+        start_drain_thread();
+        t_in_tracer = false;
+
+        set_tracing(true);
     }
 }
 
-extern "C" void __attribute__((destructor)) finish_tracer()
-    __attribute__((no_instrument_function));
+// bytesWritten counts the trace up to the stats themselves; a JSON trace is
+// never streamed, so its file position is exact.  arenaBytes is the most the
+// arena ever had mapped.
+static void collect_stats(TraceStat (&stats)[k_trace_stat_count]) {
+    RingStats rings{};
+    for (EventRing* r = g_rings.load(std::memory_order_acquire); r; r = r->next) {
+        rings.internHits += r->stats.internHits;
+        rings.functionHits += r->stats.functionHits;
+        rings.stalls += r->stats.stalls;
+    }
+    unsigned long deduped = 0;
+    for (ThreadState* s = g_threads.load(std::memory_order_acquire); s; s = s->next) deduped += s->deduped;
+    const long position = g_trace_format == TRACE_FORMAT_JSON ? std::ftell(g_trace_file) : -1;
+
+    unsigned n = 0;
+    stats[n++] = {"bytesWritten", position >= 0 ? (unsigned long long)position : g_binary_bytes};
+    stats[n++] = {"writerNs", g_writer_ns};
+    stats[n++] = {"internHits", rings.internHits};
+    stats[n++] = {"internMisses", g_intern_misses};
+    stats[n++] = {"functionHits", rings.functionHits};
+    stats[n++] = {"functionMisses", g_function_misses.load(std::memory_order_relaxed)};
+    stats[n++] = {"ringStalls", rings.stalls};
+    stats[n++] = {"budgetDropped", g_dropped_events.load(std::memory_order_relaxed)};
+    stats[n++] = {"sampledOut", sampled_out()};
+    stats[n++] = {"deduped", deduped};
+    stats[n++] = {"threads", g_next_tid.load(std::memory_order_relaxed)};
+    stats[n++] = {"arenaBytes", __atomic_load_n(&g_arena.peakBytes, __ATOMIC_RELAXED)};
+}
+
+extern "C" void __attribute__((destructor)) finish_tracer();
 void finish_tracer() {
-    fflush(stdout);
-    fflush(stderr);
-    
+    finish_trace(true);
+}
+
+// _exit throws away what the program left in its stdio buffers, so the trace
+// is finished without flushing them.
+static void finish_trace(bool flushOutput) {
+    if (flushOutput) {
+        if (g_output && tracing_active() && output_pending()) emit_output();
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    set_tracing(false);
+    t_in_tracer = true;
+    if (ThreadState* owner = g_capture_owner.load(std::memory_order_acquire)) flush_capture(*owner);
+    if (g_profile) emit_profile();
+    emit_heap_summary();
+    stop_drain_thread();
+
     if (g_trace_file) {
-        std::fprintf(g_trace_file, "\n],\"tracked_functions\":[");
-        bool first = true;
-        for (const auto& fn : g_tracked_functions) {
-            if (!first) std::fprintf(g_trace_file, ",");
-            std::fprintf(g_trace_file, "\"%s\"", fn.c_str());
-            first = false;
+        lock_drain();
+        drain_rings(true);
+        unlock_drain();
+
+        if (g_trace_format == TRACE_FORMAT_BINARY) {
+            write_binary_footer(g_trace_file);
+        } else {
+            std::fprintf(g_trace_file, "\n],\"tracked_functions\":[");
+            bool first = true;
+            for (const auto& fn : tracked_functions()) {
+                if (!first) std::fprintf(g_trace_file, ",");
+                std::fputc('"', g_trace_file);
+                json_write_string(g_trace_file, fn.data(), fn.size());
+                std::fputc('"', g_trace_file);
+                first = false;
+            }
+            std::fprintf(g_trace_file, "],\"total_events\":%lu,\"dropped_events\":%lu",
+                         g_event_counter.load(), dropped_events());
+            write_json_stats(g_trace_file);
+            std::fputs("}\n", g_trace_file);
         }
-        std::fprintf(g_trace_file, "],\"total_events\":%lu}\n", g_event_counter);
         std::fclose(g_trace_file);
         g_trace_file = nullptr;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,447 @@
+import { createReadStream } from 'fs';
+import { open, readFile } from 'fs/promises';
+
+// Reader for the tracer runtime output (backend/src/cpp/tracer.cpp).
+//
+// TRACE_FORMAT=json produces a single JSON document; TRACE_FORMAT=bin produces
+// a self-describing varint stream that is decoded here incrementally, so large
+// traces never have to be held in memory as text.  Both paths yield the same
+// event objects.
+//
+// A trace file is written into a preallocated mapping, so a run that was
+// killed before the runtime finished leaves its published records followed by
+// zero bytes and no footer.  Both readers stop at the zeros and keep every
+// complete record.
+
+export const BINARY_MAGIC = 'VTRB';
+// The only layout read; the runtime and this reader change together.
+export const BINARY_VERSION = 6;
+
+const TAG_PADDING = 0;
+const TAG_SCHEMA = 1;
+const TAG_STRING = 2;
+const TAG_EVENT = 3;
+const TAG_FOOTER = 4;
+
+// Must match FieldType in tracer.cpp.
+const F_INT = 1;
+const F_BOOL = 2;
+const F_STR = 3;
+const F_OPT_STR = 4;
+const F_PATH = 5;
+const F_LINE = 6;
+const F_PTR = 7;
+const F_DIMS = 8;
+const F_INDICES = 9;
+const F_CHAR = 10;
+const F_DOUBLE = 11;
+const F_TEXT = 12;
+const F_NULL = 13;
+const F_TRUE = 14;
+const F_CONST = 15;
+const F_BYTES = 16;
+const F_UINT = 17;
+
+// Thrown when a record straddles a chunk boundary; the decoder rewinds and
+// waits for more input.
+const NEED_MORE = Symbol('need-more');
+
+// Distinct addresses remembered per decoder; code addresses and stack slots
+// repeat on almost every event.
+const POINTER_CACHE_SIZE = 1 << 16;
+
+function formatPointer(value) {
+    return value === 0 ? '(nil)' : `0x${value.toString(16)}`;
+}
+
+export class BinaryTraceDecoder {
+    constructor() {
+        this.buffer = Buffer.alloc(0);
+        this.pos = 0;
+        this.headerRead = false;
+        this.version = null;
+        this.schemas = new Map();
+        this.strings = new Map([[0, '']]);
+        this.prevId = 0;
+        this.prevTs = 0;
+        this.footer = null;
+        this.pointers = new Map();
+        this.padded = false;
+    }
+
+    /**
+     * Feeds a chunk of the trace and returns the events completed by it.
+     */
+    push(chunk) {
+        if (this.padded) return [];
+        this.buffer = this.buffer.length === this.pos
+            ? chunk
+            : Buffer.concat([this.buffer.subarray(this.pos), chunk]);
+        this.pos = 0;
+
+        const events = [];
+        if (!this.headerRead && !this.readHeader()) return events;
+
+        while (this.pos < this.buffer.length) {
+            const start = this.pos;
+            try {
+                const event = this.readRecord();
+                if (event) events.push(event);
+            } catch (e) {
+                if (e !== NEED_MORE) throw e;
+                this.pos = start;
+                break;
+            }
+        }
+        return events;
+    }
+
+    /**
+     * Called once the input is exhausted; a partial trailing record means the
+     * runtime did not finish writing.
+     */
+    end() {
+        if (this.pos < this.buffer.length) {
+            throw new Error(`Truncated binary trace (${this.buffer.length - this.pos} trailing bytes)`);
+        }
+        return this.footer;
+    }
+
+    readHeader() {
+        if (this.buffer.length < BINARY_MAGIC.length + 1) return false;
+        if (this.buffer.toString('latin1', 0, BINARY_MAGIC.length) !== BINARY_MAGIC) {
+            throw new Error('Not a binary trace: bad magic');
+        }
+        this.pos = BINARY_MAGIC.length;
+        try {
+            this.version = this.readVarint();
+        } catch (e) {
+            if (e !== NEED_MORE) throw e;
+            this.pos = 0;
+            return false;
+        }
+        if (this.version !== BINARY_VERSION) {
+            throw new Error(`Unsupported binary trace version ${this.version}`);
+        }
+        this.headerRead = true;
+        return true;
+    }
+
+    readRecord() {
+        const tag = this.readVarint();
+        switch (tag) {
+            case TAG_PADDING:
+                // The unwritten tail of an unfinished trace file.
+                this.padded = true;
+                this.buffer = Buffer.alloc(0);
+                this.pos = 0;
+                return null;
+            case TAG_SCHEMA:
+                this.readSchema();
+                return null;
+            case TAG_STRING: {
+                const id = this.readVarint();
+                this.strings.set(id, this.readBytes().toString('utf-8'));
+                return null;
+            }
+            case TAG_EVENT:
+                return this.readEvent();
+            case TAG_FOOTER: {
+                const totalEvents = this.readVarint();
+                const droppedEvents = this.readVarint();
+                const count = this.readVarint();
+                const functions = [];
+                for (let i = 0; i < count; i++) functions.push(this.string(this.readVarint()));
+                this.footer = {
+                    total_events: totalEvents, dropped_events: droppedEvents, tracked_functions: functions,
+                    stats: this.readStats()
+                };
+                return null;
+            }
+            default:
+                throw new Error(`Unknown binary trace tag ${tag} at offset ${this.pos}`);
+        }
+    }
+
+    // Same shape as the JSON footer's "stats": written records by event type
+    // plus the named counters.
+    readStats() {
+        const events = {};
+        const kinds = this.readVarint();
+        for (let i = 0; i < kinds; i++) {
+            const type = this.schemas.get(this.readVarint())?.type ?? 'unknown';
+            events[type] = (events[type] ?? 0) + this.readVarint();
+        }
+        const stats = { events };
+        const count = this.readVarint();
+        for (let i = 0; i < count; i++) {
+            const name = this.readBytes().toString('utf-8');
+            stats[name] = this.readVarint();
+        }
+        return stats;
+    }
+
+    readSchema() {
+        const kind = this.readVarint();
+        const type = this.readBytes().toString('utf-8');
+        const count = this.readVarint();
+        const fields = [];
+        for (let i = 0; i < count; i++) {
+            const name = this.readBytes().toString('utf-8');
+            const fieldType = this.readVarint();
+            const constant = this.readBytes().toString('utf-8');
+            fields.push({ name, type: fieldType, constant });
+        }
+        this.schemas.set(kind, { type, fields });
+    }
+
+    readEvent() {
+        const kind = this.readVarint();
+        const schema = this.schemas.get(kind);
+        if (!schema) throw new Error(`Event kind ${kind} has no schema`);
+
+        const id = this.prevId + this.readZigzag();
+        const ts = this.prevTs + this.readZigzag();
+        const addr = this.readVarint();
+        const func = this.string(this.readVarint());
+        const depth = this.readZigzag();
+        const tid = this.readVarint();
+
+        const event = { id, type: schema.type, addr: this.pointer(addr), func, depth, ts, tid };
+        for (const field of schema.fields) {
+            switch (field.type) {
+                case F_INT:
+                case F_LINE:
+                    event[field.name] = this.readZigzag();
+                    break;
+                case F_BOOL:
+                    event[field.name] = this.readVarint() !== 0;
+                    break;
+                case F_STR:
+                case F_PATH:
+                    event[field.name] = this.string(this.readVarint());
+                    break;
+                case F_OPT_STR: {
+                    const value = this.string(this.readVarint());
+                    if (value) event[field.name] = value;
+                    break;
+                }
+                case F_PTR:
+                    event[field.name] = this.pointer(this.readVarint());
+                    break;
+                case F_UINT:
+                    event[field.name] = this.readVarint();
+                    break;
+                case F_DIMS:
+                case F_INDICES: {
+                    const n = this.readVarint();
+                    const values = [];
+                    for (let i = 0; i < n; i++) values.push(this.readZigzag());
+                    event[field.name] = values;
+                    break;
+                }
+                case F_CHAR:
+                    event[field.name] = String.fromCharCode(this.readVarint());
+                    break;
+                case F_DOUBLE:
+                    this.need(8);
+                    event[field.name] = this.buffer.readDoubleLE(this.pos);
+                    this.pos += 8;
+                    break;
+                case F_TEXT:
+                    event[field.name] = this.readBytes().toString('utf-8');
+                    break;
+                case F_BYTES:
+                    event[field.name] = this.readBytes().toString('base64');
+                    break;
+                case F_NULL:
+                    event[field.name] = null;
+                    break;
+                case F_TRUE:
+                    event[field.name] = true;
+                    break;
+                case F_CONST:
+                    event[field.name] = field.constant;
+                    break;
+                default:
+                    throw new Error(`Unknown field type ${field.type} in schema '${schema.type}'`);
+            }
+        }
+
+        // Only advance the delta base once the whole record has been read.
+        this.prevId = id;
+        this.prevTs = ts;
+        return event;
+    }
+
+    pointer(value) {
+        let text = this.pointers.get(value);
+        if (text === undefined) {
+            if (this.pointers.size >= POINTER_CACHE_SIZE) this.pointers.clear();
+            text = formatPointer(value);
+            this.pointers.set(value, text);
+        }
+        return text;
+    }
+
+    string(id) {
+        const value = this.strings.get(id);
+        if (value === undefined) throw new Error(`Undefined string id ${id}`);
+        return value;
+    }
+
+    need(n) {
+        if (this.pos + n > this.buffer.length) throw NEED_MORE;
+    }
+
+    readVarint() {
+        let result = 0;
+        let scale = 1;
+        for (;;) {
+            this.need(1);
+            const byte = this.buffer[this.pos++];
+            result += (byte & 0x7f) * scale;
+            if ((byte & 0x80) === 0) return result;
+            scale *= 128;
+        }
+    }
+
+    readZigzag() {
+        const n = this.readVarint();
+        return n % 2 === 0 ? n / 2 : -(n + 1) / 2;
+    }
+
+    readBytes() {
+        const len = this.readVarint();
+        this.need(len);
+        const bytes = this.buffer.subarray(this.pos, this.pos + len);
+        this.pos += len;
+        return bytes;
+    }
+}
+
+const ELEMENT_READERS = {
+    char: [1, (b, o) => b.readInt8(o)],
+    i8: [1, (b, o) => b.readInt8(o)],
+    u8: [1, (b, o) => b.readUInt8(o)],
+    i16: [2, (b, o) => b.readInt16LE(o)],
+    u16: [2, (b, o) => b.readUInt16LE(o)],
+    i32: [4, (b, o) => b.readInt32LE(o)],
+    u32: [4, (b, o) => b.readUInt32LE(o)],
+    i64: [8, (b, o) => Number(b.readBigInt64LE(o))],
+    u64: [8, (b, o) => Number(b.readBigUInt64LE(o))],
+    f32: [4, (b, o) => b.readFloatLE(o)],
+    f64: [8, (b, o) => b.readDoubleLE(o)],
+};
+
+/**
+ * Unpacks the element values of an array_init_bulk event.  Elements are
+ * little-endian; elemType is one of the ELEMENT_READERS keys.
+ */
+export function decodeArrayInit(event) {
+    const reader = ELEMENT_READERS[event.elemType];
+    if (!reader) throw new Error(`Unknown array element type '${event.elemType}'`);
+    const [size, read] = reader;
+    const bytes = Buffer.from(event.data || '', 'base64');
+    const values = [];
+    for (let offset = 0; offset + size <= bytes.length; offset += size) {
+        values.push(read(bytes, offset));
+    }
+    return values;
+}
+
+/**
+ * Parses a JSON trace.  One the runtime did not finish has no footer and may
+ * end in zeros; its events are recovered line by line (each record is one
+ * line) up to the first incomplete one.
+ */
+export function parseJsonTrace(text) {
+    const end = text.indexOf('\0');
+    if (end >= 0) text = text.slice(0, end);
+    try {
+        return JSON.parse(text);
+    } catch (_) {
+        // Recovered below.
+    }
+
+    const start = text.indexOf('"events":[');
+    if (start < 0) throw new Error('Not a trace: no events');
+    const events = [];
+    for (const line of text.slice(start + '"events":['.length).split('\n')) {
+        const record = line.trim().replace(/,$/, '');
+        if (!record) continue;
+        try {
+            events.push(JSON.parse(record));
+        } catch (_) {
+            break;
+        }
+    }
+    return { events, incomplete: true };
+}
+
+export async function isBinaryTrace(tracePath) {
+    const handle = await open(tracePath, 'r');
+    try {
+        const magic = Buffer.alloc(BINARY_MAGIC.length);
+        const { bytesRead } = await handle.read(magic, 0, magic.length, 0);
+        return bytesRead === magic.length && magic.toString('latin1') === BINARY_MAGIC;
+    } finally {
+        await handle.close();
+    }
+}
+
+/**
+ * Streams events out of a binary trace file.  The footer, when present, is
+ * returned as the generator's completion value.
+ */
+export async function* streamBinaryTrace(tracePath) {
+    const decoder = new BinaryTraceDecoder();
+    for await (const chunk of createReadStream(tracePath, { highWaterMark: 1 << 16 })) {
+        yield* decoder.push(chunk);
+    }
+    return decoder.end();
+}
+
+/**
+ * Reads a trace in either format into
+ * { events, functions, totalEvents, droppedEvents, stats }, plus
+ * `incomplete: true` when the runtime never wrote the footer.
+ */
+export async function readTrace(tracePath) {
+    if (await isBinaryTrace(tracePath)) {
+        const events = [];
+        let footer = null;
+        try {
+            const stream = streamBinaryTrace(tracePath);
+            let next = await stream.next();
+            while (!next.done) {
+                events.push(next.value);
+                next = await stream.next();
+            }
+            footer = next.value;
+        } catch (_) {
+            // A trace cut off mid-record still has every complete one.
+        }
+        return {
+            events,
+            functions: footer?.tracked_functions || [],
+            totalEvents: footer?.total_events ?? events.length,
+            droppedEvents: footer?.dropped_events ?? 0,
+            stats: footer?.stats ?? null,
+            ...(!footer && { incomplete: true })
+        };
+    }
+
+    const parsed = parseJsonTrace(await readFile(tracePath, 'utf-8'));
+    const events = parsed.events || [];
+    return {
+        events,
+        functions: parsed.tracked_functions || [],
+        totalEvents: parsed.total_events ?? events.length,
+        droppedEvents: parsed.dropped_events ?? 0,
+        stats: parsed.stats ?? null,
+        ...(parsed.incomplete && { incomplete: true })
+    };
+}
+
+export default { BinaryTraceDecoder, decodeArrayInit, parseJsonTrace, isBinaryTrace, streamBinaryTrace, readTrace };
@@ -1,15 +1,21 @@
 import express from 'express';
 import compilerRoutes from './compiler.routes.js';
 import analyzeRoutes from './analyze.routes.js';
+import dockerConfig from '../config/docker.config.js';
 
 const router = express.Router();
 
 // Health check
-router.get('/health', (req, res) => {
+router.get('/health', async (req, res) => {
+  // The pool (and dockerode) is only loaded in Docker mode
+  const workers = dockerConfig.enabled
+    ? (await import('../services/worker-pool.service.js')).default.stats()
+    : null;
   res.json({
     status: 'ok',
     timestamp: new Date().toISOString(),
-    uptime: process.uptime()
+    uptime: process.uptime(),
+    workers
   });
 });
 
@@ -59,6 +59,10 @@ async function startServer() {
     } else {
       logger.info('✅ Docker mode disabled - using direct execution (development mode)');
     }
+
+    // Build the tracer runtime in the background so the first trace does not pay for it
+    const tracerRuntime = (await import('./services/tracer-runtime.service.js')).default;
+    tracerRuntime.ensureBuilt();
     
     httpServer.listen(PORT, () => {
       logger.info(`✅ Server running on port ${PORT}`);
@@ -37,8 +37,9 @@ class ChunkStreamerService extends EventEmitter {
     if (this.stepBuffer.length === 0) return;
 
     const chunkId = this.chunkIdCounter++;
-    const chunkData = [...this.stepBuffer];
-    this.stepBuffer = []; // Clear the buffer
+    // Hand the buffer over instead of copying it
+    const chunkData = this.stepBuffer;
+    this.stepBuffer = [];
 
     try {
       logger.info({ sessionId: this.sessionId, chunkId, steps: chunkData.length }, 'Processing new chunk.');
@@ -8,6 +8,19 @@ let loopIdCounter = 0;
 let blockDepthCounter = 0;
 let conditionIdCounter = 0;
 
+// Hook categories, mirroring TRACE_CAT_* in trace.h.
+export const TRACE_CATEGORIES = {
+  variables: 0x01,
+  arrays: 0x02,
+  pointers: 0x04,
+  control: 0x08,
+  loops: 0x10,
+  blocks: 0x20,
+  functions: 0x40,
+  output: 0x80
+};
+const ALL_CATEGORIES = 0xff;
+
 class CodeInstrumenter {
   constructor() {
     this.tempDir = path.join(process.cwd(), 'temp');
@@ -32,6 +45,21 @@ class CodeInstrumenter {
     }
   }
 
+  /**
+   * Compiler flags selecting which hook categories trace.h keeps; hooks of the
+   * other categories compile to nothing.  No flags when every category is on,
+   * so the default build keeps using the precompiled trace.h.
+   */
+  categoryFlags(categories) {
+    if (!categories) return [];
+    let mask = 0;
+    for (const name of categories) {
+      if (!(name in TRACE_CATEGORIES)) throw new Error(`Unknown trace category: ${name}`);
+      mask |= TRACE_CATEGORIES[name];
+    }
+    return mask === ALL_CATEGORIES ? [] : [`-DTRACE_CATEGORIES=0x${mask.toString(16)}`];
+  }
+
   addTraceHeader(code) {
     if (code.includes('trace.h')) return code;
     const lines = code.split('\n');
@@ -393,7 +421,7 @@ class CodeInstrumenter {
                   const totalSize = dimensions.reduce((a, b) => a * (parseInt(b) || 1), 1);
                   const initList = initValues.split(',').map(v => v.trim()).filter(Boolean);
                   const paddedInit = [...initList, ...Array(totalSize - initList.length).fill('0')].join(',');
-                  out.push(`${indent}{ int __temp_${name}[] = {${paddedInit}}; __trace_array_init(${name}, __temp_${name}, ${totalSize}, ${i + 1}); }`);
+                  out.push(`${indent}{ ${type} __temp_${name}[] = {${paddedInit}}; __trace_array_init(${name}, __temp_${name}, ${totalSize}, ${i + 1}); }`);
                 }
               }
             }
@@ -1,15 +1,41 @@
 // backend/src/services/instrumentation-tracer.service.js
 import { spawn } from 'child_process';
-import { writeFile, readFile, unlink, mkdir, copyFile } from 'fs/promises';
+import { writeFile, unlink, mkdir, copyFile } from 'fs/promises';
 import { existsSync } from 'fs';
 import path from 'path';
+import os from 'os';
 import { v4 as uuid } from 'uuid';
 import { fileURLToPath } from 'url';
 import codeInstrumenter from './code-instrumenter.service.js';
+import tracerRuntime, { USER_COMPILE_FLAGS } from './tracer-runtime.service.js';
+import traceCache from './trace-cache.service.js';
+import { summarizeProfile } from './profile.service.js';
+import config from '../config/index.js';
+import { readTrace, decodeArrayInit, BinaryTraceDecoder } from '../parsers/trace-reader.js';
 
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = path.dirname(__filename);
 
+// How long a timed-out program gets to finish its trace after SIGTERM.
+const TERMINATE_GRACE_MS = 1000;
+
+// 'SIGSEGV' for 11.
+const signalName = (number) =>
+    Object.keys(os.constants.signals).find(name => os.constants.signals[name] === number) ?? null;
+
+// Whether `setarch -R` works here: it turns address randomization off for
+// the program it runs, unless a seccomp filter forbids that (Docker's default
+// profile does).  Probed once.
+let fixedAddresses = null;
+const canFixAddresses = () => {
+    fixedAddresses ??= process.platform !== 'linux' ? Promise.resolve(false) : new Promise(resolve => {
+        const p = spawn('setarch', ['-R', 'true'], { stdio: 'ignore' });
+        p.on('close', code => resolve(code === 0));
+        p.on('error', () => resolve(false));
+    });
+    return fixedAddresses;
+};
+
 class InstrumentationTracer {
     constructor() {
         this.tempDir = path.join(process.cwd(), 'temp');
@@ -23,11 +49,13 @@ class InstrumentationTracer {
         this.callStack = [];
 
         this.frameStack = [];
+        // The runtime's frame numbers (func_enter `frame`) to their frames;
+        // a filtered function's number maps to the frame of its nearest
+        // shown caller.
+        this.frames = new Map();
+        this.threadId = undefined;
         this.globalCallIndex = 0;
-        this.frameCounts = new Map();
         this.loopIterationCounts = new Map();
-        this.addressToName = new Map();
-        this.addressToFrame = new Map();
     }
 
     async ensureTempDir() {
@@ -35,11 +63,6 @@ class InstrumentationTracer {
             await mkdir(this.tempDir, { recursive: true });
         }
     }
-    generateFrameId(functionName) {
-        const count = this.frameCounts.get(functionName) || 0;
-        this.frameCounts.set(functionName, count + 1);
-        return `${functionName}-${count}`;
-    }
 
     getCurrentFrameMetadata() {
         if (this.frameStack.length === 0) {
@@ -47,7 +70,8 @@ class InstrumentationTracer {
                 frameId: 'main-0',
                 callDepth: 0,
                 callIndex: this.globalCallIndex++,
-                parentFrameId: undefined
+                parentFrameId: undefined,
+                threadId: this.threadId
             };
         }
 
@@ -56,130 +80,74 @@ class InstrumentationTracer {
             frameId: current.frameId,
             callDepth: current.callDepth,
             callIndex: this.globalCallIndex++,
-            parentFrameId: current.parentFrameId
+            parentFrameId: current.parentFrameId,
+            threadId: this.threadId
         };
     }
 
-    pushCallFrame(functionName) {
-        const parentFrame = this.frameStack.length > 0
-            ? this.frameStack[this.frameStack.length - 1]
-            : null;
-
-        const frameId = this.generateFrameId(functionName);
-        const callDepth = this.frameStack.length;
-
+    // Frame ids and parents come from the runtime, which numbers each
+    // function's calls and every frame.
+    pushCallFrame(functionName, ev) {
         const frame = {
-            frameId,
+            frameId: `${functionName}-${ev.invocation}`,
             functionName,
-            callDepth,
-            parentFrameId: parentFrame ? parentFrame.frameId : undefined,
+            callDepth: this.frameStack.length,
+            parentFrameId: this.frames.get(ev.parentFrame)?.frameId,
             entryCallIndex: this.globalCallIndex++,
             activeLoops: new Map(),
-            declaredVariables: new Map(),
-            pointerAliases: new Map(),
-            blockScopes: [],
-            scopeStack: []
+            declaredVariables: new Map()
         };
 
-        if (parentFrame && parentFrame.pointerAliases) {
-            for (const [key, value] of parentFrame.pointerAliases.entries()) {
-                frame.pointerAliases.set(key, { ...value });
-            }
-        }
-
+        this.frames.set(ev.frame, frame);
         this.frameStack.push(frame);
         return frame;
     }
 
-    popCallFrame() {
-        return this.frameStack.pop();
+    // Also drops the frames of callees whose func_exit never came (longjmp).
+    popCallFrame(ev) {
+        const frame = this.frames.get(ev.frame);
+        this.frames.delete(ev.frame);
+        const at = this.frameStack.lastIndexOf(frame);
+        if (at < 0) return undefined;
+        this.frameStack.length = at;
+        return frame;
     }
 
-    resolveAliasByValue(pointerName, startFrame) {
-        if (!startFrame) return null;
-
-        let currentPointerName = pointerName;
-        const visited = new Set();
-
-        while (currentPointerName && !visited.has(currentPointerName)) {
-            visited.add(currentPointerName);
-
-            let aliasInfo = null;
-            let frameIdx = this.frameStack.indexOf(startFrame);
-            while (frameIdx >= 0) {
-                const frame = this.frameStack[frameIdx];
-                if (frame.pointerAliases.has(currentPointerName)) {
-                    aliasInfo = frame.pointerAliases.get(currentPointerName);
-                    break;
-                }
-                frameIdx--;
-            }
-
-            if (!aliasInfo || !aliasInfo.aliasedAddress) {
-                return null;
-            }
-
-            const { aliasedAddress } = aliasInfo;
-
-            if (this.addressToName.has(aliasedAddress)) {
-                const targetName = this.addressToName.get(aliasedAddress);
-
-                let isTargetPointer = false;
-                let targetFrameIdx = this.frameStack.length - 1;
-                while (targetFrameIdx >= 0) {
-                    if (this.frameStack[targetFrameIdx].pointerAliases.has(targetName)) {
-                        isTargetPointer = true;
-                        break;
-                    }
-                    targetFrameIdx--;
-                }
-
-                if (isTargetPointer) {
-                    currentPointerName = targetName;
-                } else {
-                    return {
-                        targetName: targetName,
-                        address: aliasedAddress,
-                        isHeap: aliasInfo.isHeap || false,
-                        region: aliasInfo.isHeap ? 'heap' : 'stack'
-                    };
-                }
-            } else {
-                return {
-                    targetName: 'unknown',
-                    address: aliasedAddress,
-                    isHeap: aliasInfo.isHeap || true,
-                    region: 'unknown'
-                };
-            }
-        }
-        return null;
-    }
+    /**
+     * Resolves code addresses to { function, file, line } with a single
+     * addr2line run for the whole trace.  `loadBias` comes from the runtime's
+     * trace_start event and maps addresses of a position-independent
+     * executable back to the file.
+     */
+    async symbolizeAddresses(executable, addresses, loadBias = 0n) {
+        const resolved = new Map();
+        const unique = [...new Set(addresses)].filter(a => a && a !== '(nil)');
+        if (unique.length === 0) return resolved;
+
+        const input = unique.map(a => `0x${(BigInt(a) - loadBias).toString(16)}`).join('\n') + '\n';
+        const output = await new Promise((resolve) => {
+            const proc = spawn('addr2line', ['-e', executable, '-f', '-C']);
+            let out = '';
+            proc.stdout.on('data', d => out += d.toString());
+            proc.stdin.on('error', () => { });
+            proc.on('close', () => resolve(out));
+            proc.on('error', () => resolve(''));
+            proc.stdin.end(input);
+        });
 
-    async getLineInfo(executable, address) {
-        return new Promise((resolve) => {
-            const proc = spawn('addr2line', ['-e', executable, '-f', '-C', '-i', address]);
-            let output = '';
-            proc.stdout.on('data', d => output += d.toString());
-            proc.on('close', () => {
-                const lines = output.trim().split('\n');
-                if (lines.length >= 2) {
-                    const fn = lines[0];
-                    const loc = lines[1];
-                    const m = loc.match(/^(.+):(\d+)$/);
-                    if (m) {
-                        resolve({
-                            function: fn !== '??' ? fn : 'unknown',
-                            file: m[1],
-                            line: parseInt(m[2], 10) || 0
-                        });
-                        return;
-                    }
-                }
-                resolve({ function: 'unknown', file: 'unknown', line: 0 });
+        // Without -i addr2line prints exactly two lines per address.
+        const lines = output.split('\n');
+        unique.forEach((address, k) => {
+            const fn = lines[2 * k];
+            const m = (lines[2 * k + 1] || '').match(/^(.+):(\d+)/);
+            if (fn === undefined || !m) return;
+            resolved.set(address, {
+                function: fn !== '??' ? fn : 'unknown',
+                file: m[1],
+                line: parseInt(m[2], 10) || 0
             });
-            proc.on('error', () => resolve({ function: 'unknown', file: 'unknown', line: 0 }));
         });
+        return resolved;
     }
 
     shouldFilterEvent(info, event, userSourceFile) {
@@ -236,26 +204,36 @@ class InstrumentationTracer {
         return { rendered, escapes };
     }
 
-    async compile(code, language = 'cpp') {
+    async compile(code, language = 'cpp', { categories } = {}) {
         const sessionId = uuid();
         const ext = language === 'c' ? 'c' : 'cpp';
         const compiler = 'g++';
         const stdFlag = '-std=c++17';
+        const defines = codeInstrumenter.categoryFlags(categories);
 
-        const instrumented = await codeInstrumenter.instrumentCode(code, language);
+        const [instrumented, runtime] = await Promise.all([
+            codeInstrumenter.instrumentCode(code, language),
+            tracerRuntime.ensureBuilt()
+        ]);
         const sourceFile = path.join(this.tempDir, `src_${sessionId}.${ext}`);
         const userObj = path.join(this.tempDir, `src_${sessionId}.o`);
         const tracerObj = path.join(this.tempDir, `tracer_${sessionId}.o`);
-        const executable = path.join(this.tempDir, `exec_${sessionId}${process.platform === 'win32' ? '.exe' : ''}`);
-        const traceOutput = path.join(this.tempDir, `trace_${sessionId}.json`);
-        const headerCopy = path.join(this.tempDir, 'trace.h');
+        const { executable, traceOutput } = this.runPaths(sessionId);
+        // With a prebuilt runtime, trace.h (and its PCH, or the program's
+        // precompiled include prelude) comes from the runtime directory and
+        // only the user's code is compiled here.
+        const headerCopy = runtime ? null : path.join(this.tempDir, 'trace.h');
+        const prelude = runtime && await tracerRuntime.prelude(runtime, instrumented, defines);
 
         await writeFile(sourceFile, instrumented, 'utf-8');
-        await copyFile(this.traceHeader, headerCopy);
+        if (headerCopy) await copyFile(this.traceHeader, headerCopy);
 
         const compileUser = new Promise((resolve, reject) => {
-            const args = ['-c', '-g', '-O0', stdFlag, '-fno-omit-frame-pointer',
-                '-finstrument-functions', sourceFile, '-o', userObj];
+            const args = runtime
+                ? ['-c', ...USER_COMPILE_FLAGS, ...defines, '-I', runtime.dir, '-include', prelude ?? runtime.header,
+                    sourceFile, '-o', userObj]
+                : ['-c', '-g', '-O0', stdFlag, '-fno-omit-frame-pointer',
+                    '-finstrument-functions', ...defines, sourceFile, '-o', userObj];
             const p = spawn(compiler, args);
             let err = '';
             p.stderr.on('data', d => err += d.toString());
@@ -263,7 +241,7 @@ class InstrumentationTracer {
             p.on('error', e => reject(e));
         });
 
-        const compileTracer = new Promise((resolve, reject) => {
+        const compileTracer = runtime ? Promise.resolve() : new Promise((resolve, reject) => {
             const args = ['-c', '-g', '-O0', stdFlag, '-fno-omit-frame-pointer',
                 this.tracerCpp, '-o', tracerObj];
             const p = spawn(compiler, args);
@@ -275,14 +253,24 @@ class InstrumentationTracer {
 
         await Promise.all([compileUser, compileTracer]);
 
-        const linkArgs = [userObj, tracerObj, '-o', executable];
+        const linkArgs = [userObj];
+        if (!runtime) {
+            linkArgs.push(tracerObj);
+        } else if (config.tracerRuntimeLink === 'shared' && runtime.sharedLib) {
+            linkArgs.push(runtime.sharedLib, `-Wl,-rpath,${runtime.dir}`);
+        } else {
+            linkArgs.push(runtime.staticLib);
+        }
+        linkArgs.push('-o', executable);
         if (process.platform !== 'win32') linkArgs.unshift('-pthread', '-ldl');
 
         return new Promise((resolve, reject) => {
             const link = spawn(compiler, linkArgs);
             let err = '';
             link.stderr.on('data', d => err += d.toString());
-            link.on('close', code => {
+            link.on('close', async code => {
+                // The objects are only needed for the link.
+                await this.cleanup([userObj, tracerObj]);
                 if (code === 0) {
                     resolve({ executable, sourceFile, traceOutput, headerCopy });
                 } else {
@@ -293,61 +281,198 @@ class InstrumentationTracer {
         });
     }
 
-    async executeInstrumented(executable, traceOutput) {
+    runPaths(sessionId) {
+        return {
+            executable: path.join(this.tempDir, `exec_${sessionId}${process.platform === 'win32' ? '.exe' : ''}`),
+            traceOutput: path.join(this.tempDir, `trace_${sessionId}.${config.traceFormat === 'bin' ? 'bin' : 'json'}`)
+        };
+    }
+
+    /**
+     * compile() behind the binary tier of the trace cache.  On a hit the
+     * executable is linked out under a fresh session name; `cached` marks
+     * the source file as shared with the cache, so it is not cleaned up.
+     */
+    async build(code, language, { categories, binaryKey } = {}) {
+        const hit = binaryKey && await traceCache.getBinary(binaryKey);
+        if (hit) {
+            const { executable, traceOutput } = this.runPaths(uuid());
+            await traceCache.checkout(hit.executable, executable);
+            return { executable, sourceFile: hit.sourceFile, traceOutput, headerCopy: null, cached: true };
+        }
+
+        const built = await this.compile(code, language, { categories });
+        if (binaryKey) await traceCache.setBinary(binaryKey, built);
+        return { ...built, cached: false };
+    }
+
+    /**
+     * Runs the instrumented program.  With the pipe transport the runtime
+     * streams its binary trace over fd 3 and the events are decoded while the
+     * program runs: `onEvents` receives each decoded batch and the result
+     * carries the whole trace, so nothing touches disk.  With the file
+     * transport the trace is left at `traceOutput` for parseTraceFile.
+     * `stdin`, when given, is written to the program's standard input.
+     * `mode` is passed on as TRACE_MODE: 'profile' makes the runtime write
+     * only its summary at exit (see profile.service.js).
+     *
+     * A program killed by a signal resolves like one that exited, with its
+     * `signal`: the runtime finishes the trace on fatal signals.  One still
+     * running at the timeout gets SIGTERM, which makes the runtime finish the
+     * trace and exit, and SIGKILL if it has not gone after a grace period; it
+     * resolves with `timedOut` and whatever trace was written.
+     *
+     * With config.traceFixedAddresses the program runs under `setarch -R`
+     * where that works, so stack and heap addresses repeat between runs and
+     * the traces of two versions of a program differ only where the
+     * program does (see trace-diff.service.js).
+     */
+    async executeInstrumented(executable, traceOutput, { onEvents, stdin = null, mode = 'trace' } = {}) {
+        const fixed = config.traceFixedAddresses && await canFixAddresses();
         return new Promise((resolve, reject) => {
             const cmd = process.platform === 'win32' ? executable : `./${path.basename(executable)}`;
             const cwd = process.platform === 'win32' ? path.dirname(executable) : process.cwd();
+            const streamed = config.traceTransport === 'pipe';
 
-            const proc = spawn(cmd, [], {
+            // setarch execs the program, so signals and exit status are its own.
+            const proc = spawn(fixed ? 'setarch' : cmd, fixed ? ['-R', cmd] : [], {
                 cwd,
-                env: { ...process.env, TRACE_OUTPUT: traceOutput },
-                stdio: ['ignore', 'pipe', 'pipe'],
-                timeout: 10000
+                env: {
+                    ...process.env,
+                    TRACE_OUTPUT: traceOutput,
+                    TRACE_FORMAT: config.traceFormat,
+                    ...(streamed ? { TRACE_FD: '3' } : {}),
+                    TRACE_MAX_EVENTS: String(config.traceBudget.maxEvents),
+                    TRACE_LOOP_HEAD: String(config.traceBudget.loopHead),
+                    TRACE_LOOP_TAIL: String(config.traceBudget.loopTail),
+                    TRACE_LOOP_STRIDE: String(config.traceBudget.loopStride),
+                    TRACE_DEDUP: config.traceBudget.dedup ? '1' : '0',
+                    TRACE_KEYFRAME_INTERVAL: String(config.traceBudget.keyframeInterval),
+                    TRACE_CLOCK: config.traceClock,
+                    TRACE_MODE: mode
+                },
+                stdio: [stdin === null ? 'ignore' : 'pipe', 'pipe', 'pipe', ...(streamed ? ['pipe'] : [])]
             });
+            if (stdin !== null) {
+                // A program that exits without reading everything closes the pipe.
+                proc.stdin.on('error', () => { });
+                proc.stdin.end(stdin);
+            }
 
-            let stdout = '', stderr = '';
+            const events = [];
+            const decoder = streamed ? new BinaryTraceDecoder() : null;
+            let decodeError = null;
+            if (streamed) {
+                proc.stdio[3].on('data', chunk => {
+                    if (decodeError) return;
+                    try {
+                        const batch = decoder.push(chunk);
+                        if (batch.length === 0) return;
+                        for (const ev of batch) events.push(ev);
+                        onEvents?.(batch);
+                    } catch (e) {
+                        decodeError = e;
+                    }
+                });
+            }
+
+            const streamedTrace = () => {
+                let footer = null;
+                try {
+                    footer = decodeError ? null : decoder.end();
+                } catch (e) {
+                    decodeError = e;
+                }
+                // A crash mid-record still leaves every complete event usable.
+                if (decodeError) console.warn('⚠️  Trace stream incomplete:', decodeError.message);
+                return {
+                    events,
+                    functions: footer?.tracked_functions || [],
+                    totalEvents: footer?.total_events ?? events.length,
+                    droppedEvents: footer?.dropped_events ?? 0,
+                    stats: footer?.stats ?? null,
+                    ...(!footer && { incomplete: true })
+                };
+            };
+
+            // Kept as bytes: output events address stdout by byte offset.
             const stdoutChunks = [];
-            const stdoutTimestamps = [];
+            let stderr = '';
 
-            proc.stdout.on('data', d => {
-                const chunk = d.toString();
-                stdout += chunk;
-                stdoutChunks.push(chunk);
-                stdoutTimestamps.push(Date.now() * 1000);
-            });
+            proc.stdout.on('data', d => stdoutChunks.push(d));
             proc.stderr.on('data', d => stderr += d.toString());
 
+            let timedOut = false;
+            let kill = null;
             const timeout = setTimeout(() => {
-                proc.kill('SIGKILL');
-                reject(new Error('Execution timeout (10 s)'));
-            }, 10000);
+                timedOut = true;
+                proc.kill('SIGTERM');
+                kill = setTimeout(() => proc.kill('SIGKILL'), TERMINATE_GRACE_MS);
+            }, config.traceTimeoutMs);
 
-            proc.on('close', code => {
+            proc.on('close', (code, signal) => {
                 clearTimeout(timeout);
-                if (code === 0 || code === null) {
-                    resolve({ stdout, stderr, stdoutChunks, stdoutTimestamps });
+                clearTimeout(kill);
+                if (code === 0 || code === null || timedOut) {
+                    const stdoutBytes = Buffer.concat(stdoutChunks);
+                    resolve({
+                        stdout: stdoutBytes.toString('utf-8'), stdoutBytes, stderr,
+                        signal: signal ?? null,
+                        timedOut,
+                        // No header means the runtime fell back to TRACE_OUTPUT.
+                        trace: streamed && decoder.headerRead ? streamedTrace() : null
+                    });
                 } else {
                     reject(new Error(`Execution failed (code ${code})`));
                 }
             });
             proc.on('error', e => {
                 clearTimeout(timeout);
+                clearTimeout(kill);
                 reject(new Error(`Failed to execute: ${e.message}`));
             });
         });
     }
 
+    // The runtime writes records in id order; only a trace finished while a
+    // hook was interrupted mid-record (a crash) can hold one out of place.
+    orderEvents(events) {
+        for (let i = 1; i < events.length; i++) {
+            if (events[i].id < events[i - 1].id) {
+                events.sort((a, b) => a.id - b.id);
+                break;
+            }
+        }
+        return events;
+    }
+
     async parseTraceFile(tracePath) {
         try {
-            const txt = await readFile(tracePath, 'utf-8');
-            const parsed = JSON.parse(txt);
-            return { events: parsed.events || [], functions: parsed.tracked_functions || [] };
+            const { events, functions, droppedEvents, stats, incomplete } = await readTrace(tracePath);
+            if (incomplete) console.warn('⚠️  Trace file incomplete: the runtime did not finish it');
+            return { events: this.orderEvents(events), functions, droppedEvents, stats };
         } catch (e) {
             console.error('Failed to read/parse trace file:', e.message);
-            return { events: [], functions: [] };
+            return { events: [], functions: [], droppedEvents: 0, stats: null };
         }
     }
 
+    /**
+     * The runtime's footer counters plus the ratios worth alerting on.
+     */
+    summarizeTracerStats(stats) {
+        if (!stats) return null;
+        const ratio = (hits, misses) => hits + misses ? hits / (hits + misses) : null;
+        const written = Object.values(stats.events ?? {}).reduce((n, count) => n + count, 0);
+        return {
+            ...stats,
+            internHitRate: ratio(stats.internHits, stats.internMisses),
+            functionHitRate: ratio(stats.functionHits, stats.functionMisses),
+            writerNsPerEvent: written ? stats.writerNs / written : null,
+            bytesPerEvent: written ? stats.bytesWritten / written : null
+        };
+    }
+
     async convertToSteps(events, executable, sourceFile, programOutput, trackedFunctions, inputLinesMap = null) {
         console.log(`📊 Converting ${events.length} events to beginner-correct steps...`);
 
@@ -360,25 +485,161 @@ class InstrumentationTracer {
         const inputLines = inputLinesMap || this.scanForInputOperations(sourceFile);
 
         this.frameStack = [];
+        this.frames.clear();
         this.globalCallIndex = 0;
-        this.frameCounts = new Map();
         this.loopIterationCounts = new Map();
-        this.addressToName.clear();
-        this.addressToFrame.clear();
 
-        const outputLines = programOutput.stdout.split('\n').filter(line => line.length > 0 || line === '\n');
+        // One pass for everything needed up front: the events are as many
+        // shapes as there are kinds, so each extra scan is costly on big traces.
+        let traceStart = null;
+        let attributedOutput = false;
+        let threaded = false;
+        const codeAddresses = [];
+        for (const ev of events) {
+            if (ev.tid > 0) threaded = true;
+            if (ev.type === 'func_enter' || ev.type === 'func_exit') {
+                // Only function entry/exit carry a code address instead of a location.
+                if (!(ev.file && ev.line)) codeAddresses.push(ev.addr);
+            } else if (ev.type === 'output') {
+                attributedOutput = true;
+            } else if (ev.type === 'trace_start') {
+                traceStart ??= ev;
+            }
+        }
+
+        // The runtime records output events carrying the byte range of
+        // stdout produced since the previous event; without them (the runtime
+        // could not capture stdout) everything printed so far is shown at the
+        // next function exit.
+        const stdoutBytes = programOutput.stdoutBytes ?? Buffer.from(programOutput.stdout);
+        let outputOffset = 0;
+        const outputLines = attributedOutput
+            ? []
+            : programOutput.stdout.split('\n').filter(line => line.length > 0 || line === '\n');
         let outputIndex = 0;
 
+        // Ranges only grow, and an output record dropped by sampling is
+        // covered by the next one, so each slice starts where the last ended.
+        const takeOutput = (end) => {
+            const text = stdoutBytes.toString('utf-8', outputOffset, Math.min(end, stdoutBytes.length));
+            outputOffset = Math.max(outputOffset, Math.min(end, stdoutBytes.length));
+            return text.split('\n').filter(line => line.length > 0);
+        };
+
+        const outputStep = (line, timestamp) => {
+            const { rendered, escapes } = this.parseEscapeSequences(line);
+            return {
+                stepIndex: stepIndex++,
+                eventType: 'output',
+                line: 0,
+                function: 'output',
+                scope: 'global',
+                file: 'stdout',
+                timestamp,
+                text: rendered,
+                rawText: line,
+                escapeInfo: escapes,
+                explanation: `📤 Output: "${rendered}"`,
+                internalEvents: [],
+                ...this.getCurrentFrameMetadata()
+            };
+        };
+
         // NEW: Loop Buffering Stack
-        const loopStack = [];
+        let loopStack = [];
+
+        // Each thread has its own call stack and loop buffer; steps of a
+        // threaded trace carry the thread that recorded them.
+        const threads = new Map();
+        this.threadId = threaded ? 0 : undefined;
+        const switchThread = (tid) => {
+            threads.set(this.threadId, { frameStack: this.frameStack, currentFunction, loopStack });
+            const next = threads.get(tid) ?? { frameStack: [], currentFunction: 'main', loopStack: [] };
+            ({ frameStack: this.frameStack, currentFunction, loopStack } = next);
+            this.threadId = tid;
+        };
+
+        // A run that ended inside a loop (a crash, the timeout) never reaches
+        // its loop_end; what the loop buffered is still shown.
+        let crashed = false;
+        const flushOpenLoop = (stack) => {
+            if (stack.length === 0) return;
+            const { loopId, buffer } = stack[0];
+            stack.length = 0;
+            if (buffer.length === 0) return;
+            const first = buffer[0];
+            steps.push({
+                stepIndex: stepIndex++,
+                eventType: 'loop_body_summary',
+                line: first.line,
+                function: first.function,
+                scope: 'block',
+                file: first.file,
+                timestamp: null,
+                loopId,
+                explanation: `... Loop execution summary ...`,
+                internalEvents: [],
+                events: buffer,
+                frameId: first.frameId,
+                callDepth: first.callDepth,
+                callIndex: this.globalCallIndex++,
+                parentFrameId: first.parentFrameId,
+                threadId: first.threadId
+            });
+        };
+
+        const threadStep = (ev) => {
+            const explanation = ev.type === 'thread_create' ? `🧵 Started thread ${ev.thread}`
+                : ev.type === 'thread_join' ? `🧵 Joined thread ${ev.thread}`
+                : `🧵 Thread ${ev.tid} finished`;
+            return {
+                stepIndex: stepIndex++,
+                eventType: ev.type,
+                line: 0,
+                function: ev.type === 'thread_exit' ? normalizeFunctionName(ev.func) : currentFunction,
+                scope: 'block',
+                file: path.basename(sourceFile),
+                timestamp: ev.ts || null,
+                thread: ev.thread ?? ev.tid,
+                explanation,
+                internalEvents: [],
+                ...this.getCurrentFrameMetadata()
+            };
+        };
+
+        // The names a closing scope destroys, listed by the runtime
+        const destroyedBy = (ev) => ev.destroyed ? ev.destroyed.split(',') : [];
 
         const normalizeFunctionName = (name) => {
             if (!name) return 'unknown';
             return name.replace(/[\r\n]/g, '');
         };
 
+        // shouldFilterEvent only looks at the file and function, and a trace
+        // has few distinct pairs of them.
+        const filtered = new Map();
+        const isFiltered = (info) => {
+            let byFunction = filtered.get(info.file);
+            if (!byFunction) filtered.set(info.file, byFunction = new Map());
+            let result = byFunction.get(info.function);
+            if (result === undefined) {
+                result = this.shouldFilterEvent(info, null, sourceFile);
+                byFunction.set(info.function, result);
+            }
+            return result;
+        };
+
+        const loadBias = traceStart && traceStart.loadBias !== '(nil)' ? BigInt(traceStart.loadBias) : 0n;
+        const lineInfo = await this.symbolizeAddresses(executable, codeAddresses, loadBias);
+
+        // Step timestamps are the runtime's nanoseconds since trace start;
+        // steps after the last event take the last one seen.
+        let lastTimestamp = null;
+
         for (let i = 0; i < events.length; i++) {
             const ev = events[i];
+            if (threaded && ev.tid !== this.threadId) switchThread(ev.tid);
+            if (ev.ts) lastTimestamp = ev.ts;
 
             let info;
             if (ev.file && ev.line) {
@@ -388,7 +649,7 @@ class InstrumentationTracer {
                     line: ev.line
                 };
             } else {
-                info = await this.getLineInfo(executable, ev.addr);
+                info = { function: 'unknown', file: 'unknown', line: 0, ...lineInfo.get(ev.addr) };
                 info.function = normalizeFunctionName(info.function);
             }
 
@@ -402,7 +663,7 @@ class InstrumentationTracer {
             };
 
             if (!mainStarted && info.function === 'main' && ev.type === 'func_enter') {
-                const mainFrame = this.pushCallFrame('main');
+                const mainFrame = this.pushCallFrame('main', ev);
 
                 pushStep({
                     stepIndex: stepIndex++,
@@ -418,6 +679,7 @@ class InstrumentationTracer {
                     callDepth: mainFrame.callDepth,
                     callIndex: mainFrame.entryCallIndex,
                     parentFrameId: mainFrame.parentFrameId,
+                    threadId: this.threadId,
                     isFunctionEntry: true
                 });
                 mainStarted = true;
@@ -425,8 +687,41 @@ class InstrumentationTracer {
                 continue;
             }
 
-            if (this.shouldFilterEvent(info, ev, sourceFile)) continue;
-            if (!info.file || info.line === 0) continue;
+            if (ev.type === 'output') {
+                for (const line of takeOutput(ev.end)) pushStep(outputStep(line, ev.ts || null));
+                continue;
+            }
+
+            if (ev.type === 'thread_create' || ev.type === 'thread_join' || ev.type === 'thread_exit') {
+                pushStep(threadStep(ev));
+                continue;
+            }
+
+            if (ev.type === 'crash') {
+                flushOpenLoop(loopStack);
+                crashed = true;
+                const signal = signalName(ev.signal) ?? `signal ${ev.signal}`;
+                steps.push({
+                    stepIndex: stepIndex++,
+                    eventType: 'crash',
+                    line: 0,
+                    function: currentFunction,
+                    scope: 'block',
+                    file: path.basename(sourceFile),
+                    timestamp: ev.ts || null,
+                    signal,
+                    explanation: `💥 Program crashed (${signal}) in ${currentFunction}`,
+                    internalEvents: [],
+                    ...this.getCurrentFrameMetadata()
+                });
+                continue;
+            }
+
+            if (!info.file || info.line === 0 || isFiltered(info)) {
+                if (ev.type === 'func_enter') this.frames.set(ev.frame, this.frames.get(ev.parentFrame));
+                else if (ev.type === 'func_exit') this.frames.delete(ev.frame);
+                continue;
+            }
 
             // ===================================================================
             // Check if current line has an input operation and inject input_request
@@ -462,7 +757,7 @@ class InstrumentationTracer {
             }
 
             if (ev.type === 'func_enter' && info.function !== 'main') {
-                const newFrame = this.pushCallFrame(info.function);
+                const newFrame = this.pushCallFrame(info.function, ev);
                 currentFunction = info.function;
 
                 pushStep({
@@ -479,6 +774,7 @@ class InstrumentationTracer {
                     callDepth: newFrame.callDepth,
                     callIndex: newFrame.entryCallIndex,
                     parentFrameId: newFrame.parentFrameId,
+                    threadId: this.threadId,
                     isFunctionEntry: true
                 });
                 continue;
@@ -486,59 +782,32 @@ class InstrumentationTracer {
 
             if (ev.type === 'func_exit') {
                 while (outputIndex < outputLines.length) {
-                    const line = outputLines[outputIndex++];
-                    const { rendered, escapes } = this.parseEscapeSequences(line);
-                    const frameMetadata = this.getCurrentFrameMetadata();
-
-                    pushStep({
-                        stepIndex: stepIndex++,
-                        eventType: 'output',
-                        line: 0,
-                        function: 'output',
-                        scope: 'global',
-                        file: 'stdout',
-                        timestamp: ev.ts || Date.now(),
-                        text: rendered,
-                        rawText: line,
-                        escapeInfo: escapes,
-                        explanation: `📤 Output: "${rendered}"`,
-                        internalEvents: [],
-                        ...frameMetadata
-                    });
+                    pushStep(outputStep(outputLines[outputIndex++], ev.ts || null));
                 }
 
-                const exitingFrame = this.popCallFrame();
+                const exitingFrame = this.popCallFrame(ev);
 
                 if (exitingFrame) {
-                    if (exitingFrame.scopeStack.length > 0) {
-                        const allDestroyedSymbols = new Set();
-                        for (const scope of exitingFrame.scopeStack) {
-                            for (const varName of scope.variables) {
-                                allDestroyedSymbols.add(varName);
-                            }
-                        }
-
-                        if (allDestroyedSymbols.size > 0) {
-                            pushStep({
-                                stepIndex: stepIndex++,
-                                eventType: 'scope_exit',
-                                line: info.line,
-                                function: info.function,
-                                scope: 'function',
-                                file: path.basename(info.file),
-                                timestamp: ev.ts || null,
-                                scopeType: 'function',
-                                destroyedSymbols: Array.from(allDestroyedSymbols),
-                                explanation: `} Function scope exit - destroying: ${Array.from(allDestroyedSymbols).join(', ')}`,
-                                internalEvents: [],
-                                frameId: exitingFrame.frameId,
-                                callDepth: exitingFrame.callDepth,
-                                callIndex: this.globalCallIndex++,
-                                parentFrameId: exitingFrame.parentFrameId
-                            });
-                        }
-
-                        exitingFrame.scopeStack = [];
+                    const destroyedSymbols = destroyedBy(ev);
+                    if (destroyedSymbols.length > 0) {
+                        pushStep({
+                            stepIndex: stepIndex++,
+                            eventType: 'scope_exit',
+                            line: info.line,
+                            function: info.function,
+                            scope: 'function',
+                            file: path.basename(info.file),
+                            timestamp: ev.ts || null,
+                            scopeType: 'function',
+                            destroyedSymbols,
+                            explanation: `} Function scope exit - destroying: ${destroyedSymbols.join(', ')}`,
+                            internalEvents: [],
+                            frameId: exitingFrame.frameId,
+                            callDepth: exitingFrame.callDepth,
+                            callIndex: this.globalCallIndex++,
+                            parentFrameId: exitingFrame.parentFrameId,
+                            threadId: this.threadId
+                        });
                     }
 
                     pushStep({
@@ -555,6 +824,7 @@ class InstrumentationTracer {
                         callDepth: exitingFrame.callDepth,
                         callIndex: this.globalCallIndex++,
                         parentFrameId: exitingFrame.parentFrameId,
+                        threadId: this.threadId,
                         isFunctionExit: true
                     });
                 }
@@ -672,7 +942,7 @@ class InstrumentationTracer {
                         function: currentFunction,
                         scope: 'block',
                         file: path.basename(info.file),
-                        timestamp: Date.now(),
+                        timestamp: ev.ts || null,
                         loopId: loopId,
                         explanation: `... Loop execution summary ...`,
                         internalEvents: [],
@@ -706,17 +976,9 @@ class InstrumentationTracer {
 
             } else if (ev.type === 'loop_body_start') {
                 const loopId = ev.loopId;
-                const iterCount = this.loopIterationCounts.get(loopId) || 0;
-                this.loopIterationCounts.set(loopId, iterCount + 1);
-
-                if (currentFrame) {
-                    currentFrame.scopeStack.push({
-                        type: 'loop_iteration',
-                        loopId: loopId,
-                        iteration: iterCount + 1,
-                        variables: new Set()
-                    });
-                }
+                // The runtime numbers iterations itself; sampled loops skip some.
+                const iteration = ev.iteration ?? (this.loopIterationCounts.get(loopId) || 0) + 1;
+                this.loopIterationCounts.set(loopId, iteration);
 
                 pushStep({
                     stepIndex: stepIndex++,
@@ -727,8 +989,29 @@ class InstrumentationTracer {
                     file: path.basename(info.file),
                     timestamp: ev.ts || null,
                     loopId: ev.loopId,
-                    iteration: iterCount + 1,
-                    explanation: `🔁 Loop iteration ${iterCount + 1} begins`,
+                    iteration: iteration,
+                    explanation: `🔁 Loop iteration ${iteration} begins`,
+                    internalEvents: [],
+                    ...frameMetadata
+                });
+
+            } else if (ev.type === 'loop_skipped') {
+                this.loopIterationCounts.set(ev.loopId, ev.lastIteration);
+                pushStep({
+                    stepIndex: stepIndex++,
+                    eventType: 'loop_iterations_skipped',
+                    line: info.line,
+                    function: currentFunction,
+                    scope: 'block',
+                    file: path.basename(info.file),
+                    timestamp: ev.ts || null,
+                    loopId: ev.loopId,
+                    firstIteration: ev.firstIteration,
+                    lastIteration: ev.lastIteration,
+                    skippedIterations: ev.skippedIterations,
+                    explanation: ev.skippedIterations === 1
+                        ? `⏩ Iteration ${ev.firstIteration} skipped`
+                        : `⏩ ${ev.skippedIterations} iterations skipped (${ev.firstIteration}–${ev.lastIteration})`,
                     internalEvents: [],
                     ...frameMetadata
                 });
@@ -737,32 +1020,24 @@ class InstrumentationTracer {
                 const loopId = ev.loopId;
                 const iterCount = this.loopIterationCounts.get(loopId) || 0;
 
-                if (currentFrame && currentFrame.scopeStack.length > 0) {
-                    const topScope = currentFrame.scopeStack[currentFrame.scopeStack.length - 1];
-                    if (topScope.type === 'loop_iteration' && topScope.loopId === loopId) {
-                        const destroyedSymbols = Array.from(topScope.variables);
-
-                        if (destroyedSymbols.length > 0) {
-                            pushStep({
-                                stepIndex: stepIndex++,
-                                eventType: 'scope_exit',
-                                line: info.line,
-                                function: currentFunction,
-                                scope: 'block',
-                                file: path.basename(info.file),
-                                timestamp: ev.ts || null,
-                                scopeType: 'loop_iteration',
-                                loopId: loopId,
-                                iteration: iterCount,
-                                destroyedSymbols: destroyedSymbols,
-                                explanation: `} Iteration ${iterCount} scope exit - destroying: ${destroyedSymbols.join(', ')}`,
-                                internalEvents: [],
-                                ...frameMetadata
-                            });
-                        }
-
-                        currentFrame.scopeStack.pop();
-                    }
+                const destroyedSymbols = destroyedBy(ev);
+                if (destroyedSymbols.length > 0) {
+                    pushStep({
+                        stepIndex: stepIndex++,
+                        eventType: 'scope_exit',
+                        line: info.line,
+                        function: currentFunction,
+                        scope: 'block',
+                        file: path.basename(info.file),
+                        timestamp: ev.ts || null,
+                        scopeType: 'loop_iteration',
+                        loopId: loopId,
+                        iteration: iterCount,
+                        destroyedSymbols: destroyedSymbols,
+                        explanation: `} Iteration ${iterCount} scope exit - destroying: ${destroyedSymbols.join(', ')}`,
+                        internalEvents: [],
+                        ...frameMetadata
+                    });
                 }
 
                 pushStep({
@@ -811,14 +1086,6 @@ class InstrumentationTracer {
                 }
 
             } else if (ev.type === 'block_enter') {
-                if (currentFrame) {
-                    currentFrame.blockScopes.push({ depth: ev.blockDepth || 0 });
-                    currentFrame.scopeStack.push({
-                        type: 'block',
-                        depth: ev.blockDepth || 0,
-                        variables: new Set()
-                    });
-                }
                 pushStep({
                     stepIndex: stepIndex++,
                     eventType: 'block_enter',
@@ -834,35 +1101,23 @@ class InstrumentationTracer {
                 });
 
             } else if (ev.type === 'block_exit') {
-                if (currentFrame && currentFrame.scopeStack.length > 0) {
-                    const topScope = currentFrame.scopeStack[currentFrame.scopeStack.length - 1];
-                    if (topScope.type === 'block') {
-                        const destroyedSymbols = Array.from(topScope.variables);
-
-                        if (destroyedSymbols.length > 0) {
-                            steps.push({
-                                stepIndex: stepIndex++,
-                                eventType: 'scope_exit',
-                                line: info.line,
-                                function: currentFunction,
-                                scope: 'block',
-                                file: path.basename(info.file),
-                                timestamp: ev.ts || null,
-                                scopeType: 'block',
-                                blockDepth: ev.blockDepth || 0,
-                                destroyedSymbols: destroyedSymbols,
-                                explanation: `} Block scope exit - destroying: ${destroyedSymbols.join(', ')}`,
-                                internalEvents: [],
-                                ...frameMetadata
-                            });
-                        }
-
-                        currentFrame.scopeStack.pop();
-                    }
-                }
-
-                if (currentFrame && currentFrame.blockScopes.length > 0) {
-                    currentFrame.blockScopes.pop();
+                const destroyedSymbols = destroyedBy(ev);
+                if (destroyedSymbols.length > 0) {
+                    pushStep({
+                        stepIndex: stepIndex++,
+                        eventType: 'scope_exit',
+                        line: info.line,
+                        function: currentFunction,
+                        scope: 'block',
+                        file: path.basename(info.file),
+                        timestamp: ev.ts || null,
+                        scopeType: 'block',
+                        blockDepth: ev.blockDepth || 0,
+                        destroyedSymbols: destroyedSymbols,
+                        explanation: `} Block scope exit - destroying: ${destroyedSymbols.join(', ')}`,
+                        internalEvents: [],
+                        ...frameMetadata
+                    });
                 }
 
                 pushStep({
@@ -880,10 +1135,6 @@ class InstrumentationTracer {
                 });
 
             } else if (ev.type === 'array_create') {
-                if (ev.addr) {
-                    this.addressToName.set(ev.addr, ev.name);
-                    if (currentFrame) this.addressToFrame.set(ev.addr, currentFrame.frameId);
-                }
                 step = {
                     stepIndex: stepIndex++,
                     eventType: 'array_create',
@@ -910,10 +1161,31 @@ class InstrumentationTracer {
                     isStack: ev.isStack !== false
                 });
 
-                if (currentFrame && currentFrame.scopeStack.length > 0) {
-                    const topScope = currentFrame.scopeStack[currentFrame.scopeStack.length - 1];
-                    topScope.variables.add(ev.name);
-                }
+            } else if (ev.type === 'array_init_bulk') {
+                // Initializers arrive packed; expand them into the per-element
+                // steps the frontend animates.
+                const isChar = ev.elemType === 'char';
+                decodeArrayInit(ev).forEach((value, k) => {
+                    const indices = [ev.offset + k];
+                    const charInfo = isChar ? ` ('${String.fromCharCode(value)}')` : '';
+                    steps.push({
+                        stepIndex: stepIndex++,
+                        eventType: 'array_index_assign',
+                        line: info.line,
+                        function: currentFunction,
+                        scope: 'block',
+                        symbol: ev.name,
+                        file: path.basename(info.file),
+                        timestamp: ev.ts || null,
+                        name: ev.name,
+                        indices,
+                        value,
+                        memoryRegion: 'stack',
+                        explanation: `${ev.name}${JSON.stringify(indices)} = ${value}${charInfo}`,
+                        internalEvents: [],
+                        ...frameMetadata
+                    });
+                });
 
             } else if (ev.type === 'array_index_assign') {
                 const charInfo = ev.char ? ` ('${String.fromCharCode(ev.value)}')` : '';
@@ -936,17 +1208,6 @@ class InstrumentationTracer {
                 };
 
             } else if (ev.type === 'pointer_alias') {
-                if (currentFrame) {
-                    currentFrame.pointerAliases.set(ev.name, {
-                        pointerName: ev.name,
-                        aliasOf: ev.aliasOf,
-                        aliasedAddress: ev.aliasedAddress,
-                        decayedFromArray: ev.decayedFromArray || false,
-                        memoryRegion: ev.isHeap ? 'heap' : 'stack',
-                        isHeap: ev.isHeap || false
-                    });
-                }
-
                 step = {
                     stepIndex: stepIndex++,
                     eventType: 'pointer_alias',
@@ -976,16 +1237,10 @@ class InstrumentationTracer {
                     isHeap: false
                 });
 
-                if (currentFrame && currentFrame.scopeStack.length > 0) {
-                    const topScope = currentFrame.scopeStack[currentFrame.scopeStack.length - 1];
-                    topScope.variables.add(ev.name);
-                }
-
             } else if (ev.type === 'pointer_deref_write') {
-                const resolved = this.resolveAliasByValue(ev.pointerName, currentFrame);
-
-                let targetName = resolved ? resolved.targetName : 'unknown';
-                let isHeap = resolved ? resolved.isHeap : false;
+                // The runtime names what the pointer held when it wrote
+                const targetName = ev.targetName || 'unknown';
+                const isHeap = ev.isHeap || false;
 
                 steps.push({
                     stepIndex: stepIndex++,
@@ -1053,16 +1308,6 @@ class InstrumentationTracer {
                     if (!currentFrame.declaredVariables.has(varKey)) {
                         currentFrame.declaredVariables.set(varKey, true);
 
-                        if (ev.address) {
-                            this.addressToName.set(ev.address, ev.name);
-                            this.addressToFrame.set(ev.address, currentFrame.frameId);
-                        }
-
-                        if (currentFrame.scopeStack.length > 0) {
-                            const topScope = currentFrame.scopeStack[currentFrame.scopeStack.length - 1];
-                            topScope.variables.add(ev.name);
-                        }
-
                         step = {
                             stepIndex: stepIndex++,
                             eventType: 'var_declare',
@@ -1074,6 +1319,7 @@ class InstrumentationTracer {
                             timestamp: ev.ts || null,
                             name: ev.name,
                             varType: ev.varType,
+                            valueKind: ev.valueKind ?? null,
                             explanation: `${ev.varType} ${ev.name} declared`,
                             internalEvents: [],
                             ...frameMetadata
@@ -1159,6 +1405,15 @@ class InstrumentationTracer {
             }
         }
 
+        for (const stack of new Set([loopStack, ...[...threads.values()].map(t => t.loopStack)])) {
+            flushOpenLoop(stack);
+        }
+
+        // Written after the last event (exit handlers, or fd 1 directly).
+        if (attributedOutput) {
+            for (const line of takeOutput(stdoutBytes.length)) steps.push(outputStep(line, lastTimestamp));
+        }
+
         const lastStepIndex = steps.at(-1)?.stepIndex ?? 0;
         const finalFrameMetadata = this.getCurrentFrameMetadata();
 
@@ -1169,8 +1424,10 @@ class InstrumentationTracer {
             function: 'main',
             scope: 'global',
             file: path.basename(sourceFile),
-            timestamp: Date.now(),
-            explanation: '✅ Program completed',
+            timestamp: lastTimestamp,
+            explanation: crashed ? '💥 Program terminated'
+                : programOutput.timedOut ? '⏱️ Program stopped at the time limit'
+                : '✅ Program completed',
             internalEvents: [],
             ...finalFrameMetadata
         });
@@ -1181,14 +1438,17 @@ class InstrumentationTracer {
     }
 
     extractGlobals(steps) {
-        return steps
-            .filter(s => s.scope === 'global' && (s.eventType === 'var_assign' || s.eventType === 'array_create'))
-            .map(s => ({
+        const globals = [];
+        for (const s of steps) {
+            if (s.scope !== 'global' || (s.eventType !== 'var_assign' && s.eventType !== 'array_create')) continue;
+            globals.push({
                 name: s.symbol || s.name,
                 type: s.baseType || 'int',
                 value: s.value,
                 scope: 'global'
-            }));
+            });
+        }
+        return globals;
     }
 
     extractFunctions(steps, trackedFunctions) {
@@ -1210,40 +1470,89 @@ class InstrumentationTracer {
         return Array.from(map.values());
     }
 
-    async generateTrace(code, language = 'cpp') {
+    /**
+     * `onEvents`, when given, is called with raw event batches while the
+     * program is still running (pipe transport only).  `stdin` is fed to the
+     * program.  Results of deterministic programs come from the trace cache
+     * when present, and metadata.cache says which tier was hit.
+     *
+     * With `mode` 'profile' the program runs at close to its own speed and
+     * the result has no steps: `profile` holds its per-line, per-loop,
+     * per-condition and per-function summary instead.
+     */
+    async generateTrace(code, language = 'cpp', { onEvents, categories, stdin = null, mode = 'trace' } = {}) {
         console.log('🚀 Starting trace generation...');
 
+        const runtime = config.traceCache.enabled ? await tracerRuntime.ensureBuilt() : null;
+        const cacheKeys = runtime ? {
+            binary: await traceCache.binaryKey(code, language, { runtimeKey: runtime.key, categories }),
+            result: traceCache.isDeterministic(code)
+                ? await traceCache.resultKey(code, language, { runtimeKey: runtime.key, categories, stdin, mode })
+                : null
+        } : {};
+        if (cacheKeys.result) {
+            const hit = await traceCache.getResult(cacheKeys.result);
+            if (hit) {
+                console.log(`⚡ Trace served from cache (${hit.totalSteps} steps)`);
+                return { ...hit, metadata: { ...hit.metadata, cache: 'result' } };
+            }
+        }
+
         this.arrayRegistry.clear();
         this.pointerRegistry.clear();
         this.functionRegistry.clear();
         this.callStack = [];
 
         this.frameStack = [];
+        this.frames.clear();
         this.globalCallIndex = 0;
-        this.frameCounts = new Map();
         this.loopIterationCounts = new Map();
 
         // Scan ORIGINAL code for input operations BEFORE instrumentation
         const inputLinesMap = this.scanForInputOperations(code);
 
-        let exe, src, traceOut, hdr;
+        let exe, src, traceOut, hdr, cached = false;
         try {
-            ({ executable: exe, sourceFile: src, traceOutput: traceOut, headerCopy: hdr } =
-                await this.compile(code, language));
-
-            const { stdout, stderr } = await this.executeInstrumented(exe, traceOut);
-            const { events, functions } = await this.parseTraceFile(traceOut);
+            // Wall-clock milestones for metadata.timings
+            const started = performance.now();
+            ({ executable: exe, sourceFile: src, traceOutput: traceOut, headerCopy: hdr, cached } =
+                await this.build(code, language, { categories, binaryKey: cacheKeys.binary }));
+            const compiled = performance.now();
+
+            const { stdout, stdoutBytes, stderr, signal, timedOut, trace } =
+                await this.executeInstrumented(exe, traceOut, { onEvents, stdin, mode });
+            const ran = performance.now();
+            const { events, functions, droppedEvents, stats } = trace
+                ? { ...trace, events: this.orderEvents(trace.events) }
+                : await this.parseTraceFile(traceOut);
+            const parsed = performance.now();
+            let truncated = false, traceStart = null, heapSummary = null, crash = null;
+            const leaks = [];
+            for (const ev of events) {
+                if (ev.type === 'trace_truncated') truncated = true;
+                else if (ev.type === 'crash') crash ??= ev;
+                else if (ev.type === 'trace_start') traceStart ??= ev;
+                else if (ev.type === 'heap_summary') heapSummary ??= ev;
+                else if (ev.type === 'heap_leak') leaks.push({ address: ev.addr, size: ev.size, function: ev.func });
+            }
 
-            console.log(`📋 Captured ${events.length} raw events, ${functions.length} functions`);
+            console.log(`📋 Captured ${events.length} raw events, ${functions.length} functions` +
+                (droppedEvents ? `, ${droppedEvents} dropped${truncated ? ' (budget exhausted)' : ''}` : ''));
 
-            const steps = await this.convertToSteps(events, exe, src, { stdout, stderr }, functions, inputLinesMap);
+            const profile = mode === 'profile' ? summarizeProfile(events) : null;
+            const steps = profile
+                ? []
+                : await this.convertToSteps(events, exe, src, { stdout, stdoutBytes, stderr, timedOut }, functions, inputLinesMap);
+            const converted = performance.now();
 
             const result = {
                 steps,
                 totalSteps: steps.length,
                 globals: this.extractGlobals(steps),
                 functions: this.extractFunctions(steps, functions),
+                ...(profile && { profile }),
                 metadata: {
+                    mode,
                     debugger: 'gcc-instrumentation-semantic-correct',
                     version: '10.0',
                     hasRealMemory: true,
@@ -1256,18 +1565,57 @@ class InstrumentationTracer {
                     hasLoopIterationScope: true,
                     deterministicStepCount: true,
                     capturedEvents: events.length,
+                    droppedEvents,
+                    truncated,
+                    // How the program ended when it did not exit: the signal
+                    // that killed it and, for a fault, the function it was in
+                    termination: signal || timedOut ? {
+                        signal: crash ? signalName(crash.signal) : signal,
+                        timedOut,
+                        function: crash?.func ?? null
+                    } : null,
+                    // Hook categories compiled in; null when all of them were
+                    categories: categories ?? null,
+                    // Step timestamps are nanoseconds since traceStartTime (µs since the epoch)
+                    clock: traceStart?.clock ?? null,
+                    traceStartTime: traceStart?.startTime ?? null,
+                    // Written by the runtime at exit; leaks lists at most 256 blocks
+                    heap: heapSummary ? {
+                        liveBlocks: heapSummary.liveBlocks,
+                        liveBytes: heapSummary.liveBytes,
+                        peakBytes: heapSummary.peakBytes,
+                        totalAllocations: heapSummary.totalAllocations,
+                        totalBytes: heapSummary.totalBytes,
+                        leaks
+                    } : null,
                     emittedSteps: steps.length,
+                    // Self-profiling counters from the trace footer
+                    tracerStats: this.summarizeTracerStats(stats),
+                    // With the pipe transport decoding overlaps the run, so parseMs
+                    // only covers ordering the decoded events
+                    timings: {
+                        compileMs: compiled - started,
+                        runMs: ran - compiled,
+                        parseMs: parsed - ran,
+                        convertMs: converted - parsed
+                    },
                     programOutput: stdout,
+                    // Trace cache tier that served this trace: 'result', 'binary' or null
+                    cache: cached ? 'binary' : null,
                     timestamp: Date.now()
                 }
             };
 
+            // Not awaited: storing compresses every step.  How far a
+            // timed-out run got depends on the machine.
+            if (cacheKeys.result && !timedOut) traceCache.setResult(cacheKeys.result, result);
+
             console.log('✅ Trace complete', {
                 steps: result.totalSteps,
                 functions: result.functions.length,
                 arrays: this.arrayRegistry.size,
                 pointers: this.pointerRegistry.size,
-                maxCallDepth: Math.max(...steps.map(s => s.callDepth || 0))
+                maxCallDepth: steps.reduce((max, s) => Math.max(max, s.callDepth || 0), 0)
             });
 
             return result;
@@ -1275,7 +1623,7 @@ class InstrumentationTracer {
             console.error('❌ Trace failed:', e.message);
             throw e;
         } finally {
-            await this.cleanup([exe, src, traceOut, hdr]);
+            await this.cleanup([exe, cached ? null : src, traceOut, hdr]);
         }
     }
 
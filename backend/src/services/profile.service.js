@@ -0,0 +1,62 @@
+// backend/src/services/profile.service.js
+
+const byLine = (a, b) => a.line - b.line;
+
+/**
+ * The summary a TRACE_MODE=profile run writes at exit, from its profile_*
+ * and heap_summary events:
+ *
+ *   lines      - { line, hits }: times control reached the line
+ *   loops      - { loopId, line, entries, iterations, timeNs }
+ *   branches   - { conditionId, line, expression, evaluations, taken, takenRatio }
+ *   functions  - { name, calls, inclusiveNs, exclusiveNs }, slowest first
+ *   heap       - { peakBytes, totalAllocations, totalBytes } or null
+ *
+ * Times are nanoseconds of wall time; a recursive function's inclusive time
+ * counts its outermost calls only, as does a loop's.  Lines carry the
+ * original source line numbers the instrumenter passed to the hooks.
+ */
+export function summarizeProfile(events) {
+    const lines = [], loops = [], branches = [], functions = [];
+    let heap = null;
+
+    for (const ev of events) {
+        switch (ev.type) {
+            case 'profile_line':
+                lines.push({ line: ev.line, hits: ev.hits });
+                break;
+            case 'profile_loop':
+                loops.push({
+                    loopId: ev.loopId, line: ev.line,
+                    entries: ev.entries, iterations: ev.iterations, timeNs: ev.timeNs
+                });
+                break;
+            case 'profile_branch':
+                branches.push({
+                    conditionId: ev.conditionId, line: ev.line, expression: ev.expression,
+                    evaluations: ev.evaluations, taken: ev.taken,
+                    takenRatio: ev.evaluations ? ev.taken / ev.evaluations : 0
+                });
+                break;
+            case 'profile_function':
+                functions.push({
+                    name: ev.func, calls: ev.calls,
+                    inclusiveNs: ev.inclusiveNs, exclusiveNs: ev.exclusiveNs
+                });
+                break;
+            case 'heap_summary':
+                heap ??= { peakBytes: ev.peakBytes, totalAllocations: ev.totalAllocations, totalBytes: ev.totalBytes };
+                break;
+        }
+    }
+
+    return {
+        lines: lines.sort(byLine),
+        loops: loops.sort((a, b) => a.loopId - b.loopId),
+        branches: branches.sort((a, b) => a.conditionId - b.conditionId),
+        functions: functions.sort((a, b) => b.inclusiveNs - a.inclusiveNs),
+        heap
+    };
+}
+
+export default { summarizeProfile };
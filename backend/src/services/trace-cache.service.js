@@ -0,0 +1,223 @@
+// backend/src/services/trace-cache.service.js
+import { createHash } from 'crypto';
+import { readFile, writeFile, mkdir, readdir, rename, rm, stat, utimes, link, copyFile } from 'fs/promises';
+import { existsSync } from 'fs';
+import path from 'path';
+import { promisify } from 'util';
+import { gzip, gunzip } from 'zlib';
+import config from '../config/index.js';
+import { stepChunks, adoptStepChunks, decodeStepChunks } from './trace-chunks.service.js';
+
+const gzipAsync = promisify(gzip);
+const gunzipAsync = promisify(gunzip);
+
+// Bumped when the cached result layout changes.
+const RESULT_FORMAT = 2;
+
+// Everything that turns source code into steps; a change to any of them
+// invalidates both tiers.
+const PIPELINE_SOURCES = [
+    new URL('./code-instrumenter.service.js', import.meta.url),
+    new URL('./instrumentation-tracer.service.js', import.meta.url),
+    new URL('./profile.service.js', import.meta.url),
+    new URL('../parsers/trace-reader.js', import.meta.url)
+];
+
+// Calls whose result differs between runs of the same binary with the same
+// stdin.  Programs using any of them are compiled from the binary tier but
+// always re-run.
+const NONDETERMINISTIC = /\b(?:time|clock|clock_gettime|gettimeofday|getpid|getenv|srand|random_device|chrono|thread|pthread_create|fopen|ifstream|fstream|rdtsc)\b|\/dev\/u?random/;
+
+const hash = (...parts) => {
+    const h = createHash('sha256');
+    for (const p of parts) h.update(typeof p === 'string' ? p : JSON.stringify(p)).update('\0');
+    return h.digest('hex');
+};
+
+/**
+ * Content-addressed cache in front of generateTrace, in two tiers:
+ *
+ *   result  - the finished trace in Redis as its gzip'd step chunks, the
+ *             same buffers the socket sends (trace-chunks.service.js).
+ *             Keyed by code, language, stdin, tracer runtime, pipeline
+ *             version and trace settings.  A hit skips instrumenting,
+ *             compiling, running and converting.  Only deterministic
+ *             programs are stored.
+ *   binary  - the linked executable and its instrumented source on local
+ *             disk (temp/cache/bin/<key>/), keyed the same way minus stdin
+ *             and the runtime-only settings.  A hit skips the compile and
+ *             link; the program still runs.  Executables embed host paths
+ *             (the shared runtime's rpath), so this tier is never shared
+ *             through Redis.
+ *
+ * Redis being down only disables the result tier.
+ */
+class TraceCache {
+    constructor({ redis, binaryDir } = {}) {
+        this.redis = redis ?? null;
+        this.connecting = null;
+        this.binaryDir = binaryDir ?? path.join(process.cwd(), 'temp', 'cache', 'bin');
+        this.pipelineHash = null;
+    }
+
+    async client() {
+        if (this.redis) return this.redis.status === undefined || this.redis.status === 'ready' ? this.redis : null;
+        if (!this.connecting) {
+            this.connecting = import('../config/redis.config.js')
+                .then(({ createRedis }) => { this.redis = createRedis(); })
+                .catch(e => console.warn('⚠️  Trace result cache unavailable:', e.message));
+        }
+        await this.connecting;
+        return this.redis?.status === 'ready' ? this.redis : null;
+    }
+
+    async pipelineVersion() {
+        if (!this.pipelineHash) {
+            const sources = await Promise.all(PIPELINE_SOURCES.map(f => readFile(f)));
+            this.pipelineHash = createHash('sha256');
+            for (const s of sources) this.pipelineHash.update(s);
+            this.pipelineHash = this.pipelineHash.digest('hex');
+        }
+        return this.pipelineHash;
+    }
+
+    isDeterministic(code) {
+        return !NONDETERMINISTIC.test(code);
+    }
+
+    /**
+     * Key of the executable built from `code`.  `runtimeKey` identifies the
+     * prebuilt tracer runtime (compiler, flags, tracer.cpp and trace.h).
+     */
+    async binaryKey(code, language, { runtimeKey, categories = null }) {
+        return hash('bin', await this.pipelineVersion(), runtimeKey, config.tracerRuntimeLink,
+            language, categories ? [...categories].sort() : null, code).slice(0, 32);
+    }
+
+    async resultKey(code, language, { runtimeKey, categories = null, stdin = null, mode = 'trace' }) {
+        return hash('result', RESULT_FORMAT, await this.binaryKey(code, language, { runtimeKey, categories }),
+            stdin ?? '', mode, config.traceFormat, config.traceTransport, config.traceClock, config.traceFixedAddresses,
+            config.traceBudget);
+    }
+
+    // --- result tier ---
+
+    async getResult(key) {
+        const redis = await this.client();
+        if (!redis) return null;
+        try {
+            const fields = await redis.hgetallBuffer(`trace:result:${key}`);
+            if (!fields?.meta) return null;
+            const { chunkSteps, ...result } = JSON.parse(await gunzipAsync(fields.meta));
+            const chunks = chunkSteps.map((steps, i) => {
+                if (!fields[i]) throw new Error(`missing chunk ${i}`);
+                return { steps, data: fields[i] };
+            });
+            // The chunks go back out to the socket as they are.
+            return adoptStepChunks({ ...result, steps: await decodeStepChunks(chunks) }, chunks);
+        } catch (e) {
+            console.warn('⚠️  Trace result cache read failed:', e.message);
+            return null;
+        }
+    }
+
+    async setResult(key, result) {
+        const redis = await this.client();
+        if (!redis) return false;
+        try {
+            const chunks = await stepChunks(result);
+            if (chunks.reduce((n, c) => n + c.data.length, 0) > config.traceCache.maxResultBytes) return false;
+
+            const { steps, ...rest } = result;
+            const fields = {};
+            chunks.forEach((c, i) => { fields[i] = c.data; });
+            fields.meta = await gzipAsync(JSON.stringify({ ...rest, chunkSteps: chunks.map(c => c.steps) }));
+
+            const redisKey = `trace:result:${key}`;
+            await redis.hset(redisKey, fields);
+            await redis.expire(redisKey, config.traceCache.ttl);
+            return true;
+        } catch (e) {
+            console.warn('⚠️  Trace result cache write failed:', e.message);
+            return false;
+        }
+    }
+
+    // --- binary tier ---
+
+    entry(key) {
+        const dir = path.join(this.binaryDir, key);
+        return { dir, manifest: path.join(dir, 'manifest.json') };
+    }
+
+    /**
+     * Resolves to { executable, sourceFile } inside the cache, or null.  The
+     * caller must not delete them; link them out with `checkout`.
+     */
+    async getBinary(key) {
+        const { dir, manifest } = this.entry(key);
+        try {
+            const { executable, sourceFile } = JSON.parse(await readFile(manifest, 'utf-8'));
+            const now = new Date();
+            await utimes(dir, now, now);
+            return { executable: path.join(dir, executable), sourceFile: path.join(dir, sourceFile) };
+        } catch (_) {
+            return null;
+        }
+    }
+
+    /**
+     * Copies a freshly linked executable and its source into the cache.  The
+     * source keeps its basename: debug info names it and the step filter
+     * matches on it.
+     */
+    async setBinary(key, { executable, sourceFile }) {
+        const { dir } = this.entry(key);
+        if (existsSync(dir)) return;
+
+        // Staged and renamed into place, like the tracer runtime build.
+        const staging = `${dir}.${process.pid}.tmp`;
+        try {
+            await rm(staging, { recursive: true, force: true });
+            await mkdir(staging, { recursive: true });
+            const names = { executable: path.basename(executable), sourceFile: path.basename(sourceFile) };
+            await this.checkout(executable, path.join(staging, names.executable));
+            await this.checkout(sourceFile, path.join(staging, names.sourceFile));
+            await writeFile(path.join(staging, 'manifest.json'), JSON.stringify(names));
+            await rename(staging, dir).catch(() => rm(staging, { recursive: true, force: true }));
+            await this.evictBinaries();
+        } catch (e) {
+            await rm(staging, { recursive: true, force: true });
+            console.warn('⚠️  Binary cache write failed:', e.message);
+        }
+    }
+
+    // Hard link when possible: cached executables are never written to.
+    async checkout(from, to) {
+        try {
+            await link(from, to);
+        } catch (_) {
+            await copyFile(from, to);
+        }
+    }
+
+    // Least recently used entries beyond the configured count go first.
+    async evictBinaries() {
+        const names = (await readdir(this.binaryDir)).filter(n => !n.endsWith('.tmp'));
+        const excess = names.length - config.traceCache.maxBinaries;
+        if (excess <= 0) return;
+        const entries = await Promise.all(names.map(async name => {
+            const { mtimeMs } = await stat(path.join(this.binaryDir, name)).catch(() => ({ mtimeMs: 0 }));
+            return { name, mtimeMs };
+        }));
+        entries.sort((a, b) => a.mtimeMs - b.mtimeMs);
+        for (const { name } of entries.slice(0, excess)) {
+            await rm(path.join(this.binaryDir, name), { recursive: true, force: true });
+        }
+    }
+}
+
+const traceCache = new TraceCache();
+
+export { TraceCache };
+export default traceCache;
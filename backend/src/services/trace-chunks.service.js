@@ -0,0 +1,54 @@
+// backend/src/services/trace-chunks.service.js
+import { promisify } from 'util';
+import { gzip, gunzip } from 'zlib';
+import securityConfig from '../config/security.config.js';
+import { LIMITS } from '../constants/limits.js';
+
+const gzipAsync = promisify(gzip);
+const gunzipAsync = promisify(gunzip);
+
+// Encoded chunks per trace result, so the socket and the trace cache share
+// one serialization.
+const encoded = new WeakMap();
+
+/**
+ * Serializes steps into gzip'd JSON chunks: [{ steps, data }] where `steps`
+ * is the chunk's step count and `data` the compressed JSON array.  Each
+ * chunk is stringified and compressed exactly once.
+ */
+export async function encodeStepChunks(steps, chunkSize = LIMITS.TRACE_COMPRESSED_CHUNK_SIZE) {
+    const jobs = [];
+    for (let i = 0; i < steps.length; i += chunkSize) {
+        const slice = steps.slice(i, i + chunkSize);
+        jobs.push(gzipAsync(JSON.stringify(slice), { level: securityConfig.compressionLevel })
+            .then(data => ({ steps: slice.length, data })));
+    }
+    return Promise.all(jobs);
+}
+
+export async function decodeStepChunks(chunks) {
+    const decoded = await Promise.all(chunks.map(c => gunzipAsync(c.data)));
+    const steps = [];
+    for (const json of decoded) {
+        for (const s of JSON.parse(json)) steps.push(s);
+    }
+    return steps;
+}
+
+/**
+ * The encoded chunks of a generateTrace result, encoding them on first use.
+ */
+export function stepChunks(result) {
+    let chunks = encoded.get(result);
+    if (!chunks) {
+        chunks = encodeStepChunks(result.steps);
+        encoded.set(result, chunks);
+    }
+    return chunks;
+}
+
+// For results rebuilt from already encoded chunks (the trace cache).
+export function adoptStepChunks(result, chunks) {
+    encoded.set(result, Promise.resolve(chunks));
+    return result;
+}
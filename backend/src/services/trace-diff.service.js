@@ -0,0 +1,47 @@
+// backend/src/services/trace-diff.service.js
+
+// Step fields that differ between two runs of the same program: event
+// timestamps, and the per-build name of the instrumented source file.
+const RUN_FIELDS = new Set(['timestamp', 'file']);
+
+function same(a, b) {
+    if (a === b) return true;
+    if (typeof a !== 'object' || typeof b !== 'object' || a === null || b === null) return false;
+    if (Array.isArray(a)) {
+        if (!Array.isArray(b) || a.length !== b.length) return false;
+        for (let i = 0; i < a.length; i++) {
+            if (!same(a[i], b[i])) return false;
+        }
+        return true;
+    }
+    if (Array.isArray(b)) return false;
+    // An undefined field is a missing one, as after a JSON round trip.
+    const fields = (o) => Object.keys(o).filter(k => o[k] !== undefined && !RUN_FIELDS.has(k));
+    const keys = fields(a);
+    if (keys.length !== fields(b).length) return false;
+    for (const k of keys) {
+        if (!same(a[k], b[k])) return false;
+    }
+    return true;
+}
+
+/**
+ * Index of the first step of `steps` that differs from `previous`, the
+ * trace of an earlier version of the same program, or the shorter length
+ * when one is a prefix of the other.  Everything before it is what the
+ * client already shows, apart from the run fields above, and need not be
+ * sent again.
+ *
+ * Steps carry source lines, so an edit that shifts lines diverges at the
+ * first step after it; so does anything that observes a stack or heap
+ * address under ASLR.
+ */
+export function divergence(previous, steps) {
+    const n = Math.min(previous.length, steps.length);
+    for (let i = 0; i < n; i++) {
+        if (!same(previous[i], steps[i])) return i;
+    }
+    return n;
+}
+
+export default { divergence };
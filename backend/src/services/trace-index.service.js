@@ -0,0 +1,314 @@
+// backend/src/services/trace-index.service.js
+import { LIMITS } from '../constants/limits.js';
+
+const MAIN_FRAME_ID = 'main-0';
+
+// Array elements are kept in pages of this many values, so a keyframe
+// shares every page its interval did not write.
+const ARRAY_PAGE = 256;
+
+// scopeOf() result for a name that lives in the globals
+const GLOBALS = 'globals';
+
+/**
+ * Memory/stack state replayed over a step list.
+ *
+ * snapshot() hands out the state as it is, without copying it.  The first
+ * change after a snapshot copies only the containers on the way to what
+ * changed: the root, the call stack, one frame and its locals, an array's
+ * page table and one page, the heap table.  A keyframe therefore costs what
+ * its interval changed rather than the size of the state, and keyframes
+ * share everything else.  Variables and heap blocks are never changed in
+ * place; a write replaces them.
+ */
+export class ReplayState {
+    constructor(root = null) {
+        // Containers created since the last snapshot: safe to change in place
+        this.owned = new Set();
+        this.root = root ?? this.own({
+            callStack: this.own([this.newFrame(MAIN_FRAME_ID, 'main', 0)]),
+            globals: this.own({}),
+            arrays: this.own({}),
+            heap: this.own({})
+        });
+    }
+
+    own(container) {
+        this.owned.add(container);
+        return container;
+    }
+
+    writable(container) {
+        if (this.owned.has(container)) return container;
+        return this.own(Array.isArray(container) ? container.slice() : { ...container });
+    }
+
+    newFrame(frameId, functionName, callDepth) {
+        return this.own({ frameId, function: functionName, callDepth, locals: this.own({}) });
+    }
+
+    /**
+     * The current state, to be kept unchanged: later steps copy what they
+     * change.
+     */
+    snapshot() {
+        this.owned = new Set();
+        return this.root;
+    }
+
+    // Writable root[key]: the call stack, globals, arrays or heap
+    field(key) {
+        this.root = this.writable(this.root);
+        return this.root[key] = this.writable(this.root[key]);
+    }
+
+    // Writable locals of the frame at `at` in the call stack
+    locals(at) {
+        const stack = this.field('callStack');
+        const frame = stack[at] = this.writable(stack[at]);
+        return frame.locals = this.writable(frame.locals);
+    }
+
+    frameIndex(frameId) {
+        const stack = this.root.callStack;
+        for (let i = stack.length - 1; i >= 0; i--) {
+            if (stack[i].frameId === frameId) return i;
+        }
+        return -1;
+    }
+
+    // The step's frame, or the innermost one when it is not on the stack
+    frameOf(step) {
+        const at = this.frameIndex(step.frameId);
+        return at >= 0 ? at : this.root.callStack.length - 1;
+    }
+
+    // Where the innermost visible variable called `name` lives: a call
+    // stack index or GLOBALS, falling back to any frame; -1 when nowhere.
+    scopeOf(step, name) {
+        const stack = this.root.callStack;
+        const at = this.frameOf(step);
+        if (at >= 0 && name in stack[at].locals) return at;
+        if (name in this.root.globals) return GLOBALS;
+        for (let i = stack.length - 1; i >= 0; i--) {
+            if (name in stack[i].locals) return i;
+        }
+        return -1;
+    }
+
+    setValue(scope, name, value) {
+        const variables = scope === GLOBALS ? this.field('globals') : this.locals(scope);
+        variables[name] = { ...variables[name], value };
+    }
+
+    apply(step) {
+        switch (step.eventType) {
+            case 'func_enter':
+                if (this.frameIndex(step.frameId) < 0) {
+                    this.field('callStack').push(this.newFrame(step.frameId, step.function, step.callDepth));
+                }
+                break;
+
+            case 'func_exit': {
+                const at = this.frameIndex(step.frameId);
+                if (at <= 0) break;
+                const gone = new Set(this.field('callStack').splice(at).map(frame => frame.frameId));
+                const dead = Object.keys(this.root.arrays).filter(name => gone.has(this.root.arrays[name].frameId));
+                if (dead.length > 0) {
+                    const arrays = this.field('arrays');
+                    for (const name of dead) delete arrays[name];
+                }
+                break;
+            }
+
+            case 'var_declare':
+                this.locals(this.frameOf(step))[step.name] = { type: step.varType, value: null, address: step.address ?? null };
+                break;
+
+            case 'var_assign': {
+                const scope = this.scopeOf(step, step.name);
+                if (scope !== -1) this.setValue(scope, step.name, step.value);
+                else this.locals(this.frameOf(step))[step.name] = { type: step.varType ?? 'int', value: step.value, address: null };
+                break;
+            }
+
+            case 'pointer_alias':
+                this.locals(this.frameOf(step))[step.name] = {
+                    type: 'pointer',
+                    value: step.pointsTo?.address ?? null,
+                    address: null,
+                    pointsTo: step.pointsTo ?? null
+                };
+                break;
+
+            case 'pointer_deref_write': {
+                const scope = step.targetName ? this.scopeOf(step, step.targetName) : -1;
+                if (scope !== -1) this.setValue(scope, step.targetName, step.value);
+                break;
+            }
+
+            case 'array_create':
+                this.field('arrays')[step.name] = this.own({
+                    frameId: step.frameId,
+                    baseType: step.baseType,
+                    dimensions: step.dimensions,
+                    length: step.dimensions.reduce((n, d) => n * Math.max(1, d), 1),
+                    pages: this.own([])
+                });
+                break;
+
+            case 'array_index_assign': {
+                const current = this.root.arrays[step.name];
+                if (!current) break;
+                const flat = TraceIndex.flatIndex(current.dimensions, step.indices);
+                if (!(flat >= 0 && flat < current.length)) break;
+                const arrays = this.field('arrays');
+                const array = arrays[step.name] = this.writable(current);
+                const pages = array.pages = this.writable(array.pages);
+                const p = Math.floor(flat / ARRAY_PAGE);
+                const page = pages[p] = pages[p] ? this.writable(pages[p]) : this.own(new Array(ARRAY_PAGE).fill(null));
+                page[flat % ARRAY_PAGE] = step.value;
+                break;
+            }
+
+            case 'heap_alloc':
+                this.field('heap')[step.address] = { size: step.size, value: null };
+                break;
+
+            case 'heap_write': {
+                const block = this.root.heap[step.address];
+                if (block) this.field('heap')[step.address] = { ...block, value: step.value };
+                break;
+            }
+
+            case 'heap_free':
+                if (step.address in this.root.heap) delete this.field('heap')[step.address];
+                break;
+
+            case 'scope_exit': {
+                const at = this.frameOf(step);
+                const names = (step.destroyedSymbols ?? []).filter(name => name in this.root.callStack[at].locals);
+                if (names.length === 0) break;
+                const locals = this.locals(at);
+                for (const name of names) delete locals[name];
+                break;
+            }
+        }
+    }
+
+    /**
+     * A standalone copy of the state, arrays unpacked to one value per
+     * element.
+     */
+    plain() {
+        const { callStack, globals, arrays, heap } = this.root;
+        const copy = (entries) => Object.fromEntries(Object.entries(entries).map(([key, value]) => [key, { ...value }]));
+        return {
+            callStack: callStack.map(frame => ({
+                frameId: frame.frameId,
+                function: frame.function,
+                callDepth: frame.callDepth,
+                locals: copy(frame.locals)
+            })),
+            globals: copy(globals),
+            arrays: Object.fromEntries(Object.entries(arrays).map(([name, array]) => {
+                const values = new Array(array.length).fill(null);
+                array.pages.forEach((page, p) => {
+                    const start = p * ARRAY_PAGE;
+                    for (let k = 0; k < ARRAY_PAGE && start + k < array.length; k++) values[start + k] = page[k];
+                });
+                return [name, { frameId: array.frameId, baseType: array.baseType, dimensions: array.dimensions, values }];
+            })),
+            heap: copy(heap)
+        };
+    }
+}
+
+/**
+ * Random access over a finished step list.
+ *
+ * Rebuilding memory at step N by replaying every step before it costs O(N).
+ * TraceIndex replays the steps once and keeps a keyframe of the state every
+ * `interval` steps; stateAt(n) starts from the nearest keyframe at or before
+ * n and applies at most interval - 1 steps.  Keyframes are copy-on-write
+ * (see ReplayState), so the index grows with what the program changes, not
+ * with steps times the size of its state.
+ *
+ * Step positions are those of the expanded list the frontend navigates
+ * (loop_body_summary steps replaced by the events they carry), not
+ * `stepIndex`, which is not dense.
+ *
+ * The state has the shape RenderRegistry applies from `step.state`:
+ *   callStack - [{ frameId, function, callDepth, locals: { name: Variable } }]
+ *   globals   - { name: Variable }
+ *   arrays    - { name: { frameId, baseType, dimensions, values } }
+ *   heap      - { address: { size, value } }
+ */
+class TraceIndex {
+    constructor(steps, { interval = LIMITS.TRACE_KEYFRAME_INTERVAL } = {}) {
+        this.steps = TraceIndex.expand(steps);
+        this.interval = Math.max(1, interval);
+        this.keyframes = [];
+
+        const state = new ReplayState();
+        for (let i = 0; i < this.steps.length; i++) {
+            TraceIndex.applyStep(state, this.steps[i]);
+            if (i % this.interval === 0) this.keyframes.push(state.snapshot());
+        }
+    }
+
+    get totalSteps() {
+        return this.steps.length;
+    }
+
+    /**
+     * Memory/stack state after step `n` has executed.
+     */
+    stateAt(n) {
+        if (this.steps.length === 0) return new ReplayState().plain();
+        const step = Math.max(0, Math.min(n, this.steps.length - 1));
+        const k = Math.floor(step / this.interval);
+
+        const state = new ReplayState(this.keyframes[k]);
+        for (let i = k * this.interval + 1; i <= step; i++) {
+            TraceIndex.applyStep(state, this.steps[i]);
+        }
+        return state.plain();
+    }
+
+    describe() {
+        return {
+            totalSteps: this.steps.length,
+            keyframeInterval: this.interval,
+            keyframes: this.keyframes.length
+        };
+    }
+
+    /**
+     * Same flattening as the frontend's expandTrace.
+     */
+    static expand(steps, out = []) {
+        for (const step of steps) {
+            if (step.eventType === 'loop_body_summary' && Array.isArray(step.events)) {
+                TraceIndex.expand(step.events, out);
+            } else {
+                out.push(step);
+            }
+        }
+        return out;
+    }
+
+    static flatIndex(dimensions, indices) {
+        let flat = 0;
+        for (let d = 0; d < dimensions.length; d++) {
+            flat = flat * dimensions[d] + (indices[d] ?? 0);
+        }
+        return flat;
+    }
+
+    static applyStep(state, step) {
+        state.apply(step);
+    }
+}
+
+export default TraceIndex;
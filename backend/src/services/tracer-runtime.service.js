@@ -0,0 +1,256 @@
+// backend/src/services/tracer-runtime.service.js
+import { spawn } from 'child_process';
+import { createHash } from 'crypto';
+import { readFile, writeFile, readdir, mkdir, rename, rm, copyFile, stat, utimes } from 'fs/promises';
+import { existsSync } from 'fs';
+import path from 'path';
+import { fileURLToPath } from 'url';
+import config from '../config/index.js';
+
+const __filename = fileURLToPath(import.meta.url);
+
+// Flags shared by the user-code compile and the trace.h precompiled header;
+// GCC silently ignores a PCH built with different code-generation flags.
+export const USER_COMPILE_FLAGS = ['-g', '-O0', '-std=c++17', '-fno-omit-frame-pointer',
+    '-finstrument-functions'];
+
+const RUNTIME_COMPILE_FLAGS = ['-O2', '-g', '-std=c++17', '-fPIC', '-fno-omit-frame-pointer'];
+
+function run(command, args, options = {}) {
+    return new Promise((resolve, reject) => {
+        const p = spawn(command, args, options);
+        let out = '', err = '';
+        p.stdout?.on('data', d => out += d.toString());
+        p.stderr?.on('data', d => err += d.toString());
+        p.on('close', code => code === 0
+            ? resolve(out)
+            : reject(new Error(`${command} ${args.join(' ')} failed:\n${err}`)));
+        p.on('error', e => reject(e));
+    });
+}
+
+// The `#include <...>` lines a program starts with.  Anything else (a
+// #define, a conditional, code) may change what they declare and ends them.
+export function leadingIncludes(source) {
+    const includes = [];
+    let comment = false;
+    for (const raw of source.split('\n')) {
+        const line = raw.trim();
+        if (comment) {
+            comment = !line.includes('*/');
+            if (!comment && !line.endsWith('*/')) break;
+            continue;
+        }
+        if (line === '' || line.startsWith('//')) continue;
+        if (line.startsWith('/*')) {
+            comment = !line.includes('*/');
+            if (!comment && !line.endsWith('*/')) break;
+            continue;
+        }
+        if (/^#\s*include\s*"trace\.h"$/.test(line)) continue;
+        if (!/^#\s*include\s*<[^>]+>$/.test(line)) break;
+        includes.push(line);
+    }
+    return includes;
+}
+
+/**
+ * Builds tracer.cpp once per (compiler, source) pair instead of per session.
+ *
+ * Artifacts live in temp/runtime/<key>/ where key hashes the compiler version,
+ * target, build flags, tracer.cpp and trace.h:
+ *   libtracer.a   - optimized static runtime linked into every executable
+ *   libtracer.so  - shared variant (POSIX only)
+ *   trace.h(.gch) - header plus its precompiled form for the user compile
+ *   prelude/<key>/ - trace.h plus a program's leading system includes,
+ *                    precompiled (see prelude())
+ */
+class TracerRuntime {
+    constructor() {
+        this.compiler = 'g++';
+        this.tracerCpp = path.join(process.cwd(), 'src', 'cpp', 'tracer.cpp');
+        this.traceHeader = path.join(process.cwd(), 'src', 'cpp', 'trace.h');
+        this.cacheRoot = path.join(process.cwd(), 'temp', 'runtime');
+        this.building = null;
+        // Prelude builds by key, kept once settled so a failed one is not retried
+        this.preludes = new Map();
+    }
+
+    /**
+     * Resolves to the runtime artifacts, building them on first use.  Resolves
+     * to null when the runtime cannot be built so callers can fall back to
+     * compiling tracer.cpp themselves.
+     */
+    async ensureBuilt() {
+        if (!this.building) {
+            this.building = this.build().catch(e => {
+                console.error('❌ Tracer runtime build failed:', e.message);
+                this.building = null;
+                return null;
+            });
+        }
+        return this.building;
+    }
+
+    async cacheKey() {
+        const [version, machine, source, header] = await Promise.all([
+            run(this.compiler, ['-dumpfullversion']).catch(() => run(this.compiler, ['-dumpversion'])),
+            run(this.compiler, ['-dumpmachine']),
+            readFile(this.tracerCpp),
+            readFile(this.traceHeader)
+        ]);
+
+        return createHash('sha256')
+            .update(version.trim()).update('\0')
+            .update(machine.trim()).update('\0')
+            .update(RUNTIME_COMPILE_FLAGS.join(' ')).update('\0')
+            .update(USER_COMPILE_FLAGS.join(' ')).update('\0')
+            .update(source).update('\0')
+            .update(header)
+            .digest('hex')
+            .slice(0, 16);
+    }
+
+    artifacts(dir) {
+        return {
+            dir,
+            staticLib: path.join(dir, 'libtracer.a'),
+            sharedLib: process.platform === 'win32' ? null : path.join(dir, 'libtracer.so'),
+            header: path.join(dir, 'trace.h'),
+            pch: path.join(dir, 'trace.h.gch')
+        };
+    }
+
+    async build() {
+        const key = await this.cacheKey();
+        const dir = path.join(this.cacheRoot, key);
+        const runtime = this.artifacts(dir);
+
+        if (existsSync(runtime.staticLib)) {
+            return { key, ...runtime };
+        }
+
+        const started = Date.now();
+        console.log(`🔧 Building tracer runtime ${key}...`);
+
+        // Build into a scratch directory and rename it into place, so a
+        // concurrent build or a crash never leaves a half-written runtime.
+        const staging = path.join(this.cacheRoot, `${key}.${process.pid}.tmp`);
+        await rm(staging, { recursive: true, force: true });
+        await mkdir(staging, { recursive: true });
+
+        try {
+            const scratch = this.artifacts(staging);
+            const object = path.join(staging, 'tracer.o');
+            await copyFile(this.traceHeader, scratch.header);
+
+            const jobs = [
+                run(this.compiler, ['-c', ...RUNTIME_COMPILE_FLAGS, this.tracerCpp, '-o', object])
+                    .then(() => run('ar', ['rcs', scratch.staticLib, object]))
+                    .then(() => rm(object)),
+                run(this.compiler, [...USER_COMPILE_FLAGS, '-x', 'c++-header', scratch.header,
+                    '-o', scratch.pch]).catch(e => {
+                    console.warn('⚠️  trace.h PCH unavailable:', e.message);
+                })
+            ];
+            if (scratch.sharedLib) {
+                jobs.push(run(this.compiler, ['-shared', ...RUNTIME_COMPILE_FLAGS, this.tracerCpp,
+                    '-o', scratch.sharedLib, '-pthread', '-ldl']));
+            }
+            await Promise.all(jobs);
+
+            try {
+                await rename(staging, dir);
+            } catch (e) {
+                // Another process finished the same key first.
+                if (!existsSync(runtime.staticLib)) throw e;
+                await rm(staging, { recursive: true, force: true });
+            }
+        } catch (e) {
+            await rm(staging, { recursive: true, force: true });
+            throw e;
+        }
+
+        console.log(`✅ Tracer runtime ${key} built in ${Date.now() - started}ms`);
+        return { key, ...runtime };
+    }
+
+    /**
+     * Header to force-include instead of trace.h when `source` starts with
+     * system includes: trace.h followed by those includes, precompiled.  An
+     * edit rarely touches them, and they are most of a C++ compile
+     * (<iostream> alone is several hundred milliseconds).  Keyed by the
+     * includes and `defines`, which a PCH must be built with to be used.
+     *
+     * Resolves to null until the prelude exists; the first program with a
+     * given include block compiles without it and starts its build.
+     */
+    async prelude(runtime, source, defines = []) {
+        const includes = leadingIncludes(source);
+        if (includes.length === 0) return null;
+        const key = createHash('sha256')
+            .update(defines.join(' ')).update('\0')
+            .update(includes.join('\n'))
+            .digest('hex')
+            .slice(0, 16);
+        const root = path.join(runtime.dir, 'prelude');
+        const dir = path.join(root, key);
+        const header = path.join(dir, 'prelude.h');
+
+        if (existsSync(dir)) {
+            const now = new Date();
+            utimes(dir, now, now).catch(() => { });
+            return header;
+        }
+        if (!this.preludes.has(key)) {
+            this.preludes.set(key, this.buildPrelude(runtime, key, includes, defines).catch(e => {
+                console.warn('⚠️  Include prelude unavailable:', e.message);
+            }));
+        }
+        return null;
+    }
+
+    async buildPrelude(runtime, key, includes, defines) {
+        const root = path.join(runtime.dir, 'prelude');
+        const dir = path.join(root, key);
+        const staging = `${dir}.${process.pid}.tmp`;
+        await rm(staging, { recursive: true, force: true });
+        await mkdir(staging, { recursive: true });
+        try {
+            const header = path.join(staging, 'prelude.h');
+            await writeFile(header, ['#include "trace.h"', ...includes, ''].join('\n'));
+            await run(this.compiler, [...USER_COMPILE_FLAGS, ...defines, '-I', runtime.dir,
+                '-x', 'c++-header', header, '-o', `${header}.gch`]);
+            await rename(staging, dir).catch(() => rm(staging, { recursive: true, force: true }));
+        } catch (e) {
+            await rm(staging, { recursive: true, force: true });
+            throw e;
+        }
+        await this.evictPreludes(root);
+    }
+
+    // Least recently used first, like the binary tier of the trace cache.
+    async evictPreludes(root) {
+        const names = (await readdir(root)).filter(n => !n.endsWith('.tmp'));
+        const excess = names.length - config.traceCache.maxPreludes;
+        if (excess <= 0) return;
+        const entries = await Promise.all(names.map(async name => {
+            const { mtimeMs } = await stat(path.join(root, name)).catch(() => ({ mtimeMs: 0 }));
+            return { name, mtimeMs };
+        }));
+        entries.sort((a, b) => a.mtimeMs - b.mtimeMs);
+        for (const { name } of entries.slice(0, excess)) {
+            await rm(path.join(root, name), { recursive: true, force: true });
+        }
+    }
+}
+
+const tracerRuntime = new TracerRuntime();
+
+// `node src/services/tracer-runtime.service.js` prebuilds the runtime at
+// install time.
+if (process.argv[1] && path.resolve(process.argv[1]) === __filename) {
+    tracerRuntime.ensureBuilt().then(runtime => process.exit(runtime ? 0 : 1));
+}
+
+export default tracerRuntime;
@@ -5,11 +5,20 @@ import dockerConfig from '../config/docker.config.js';
 import logger from '../utils/logger.js';
 import sessionManager from './session-manager.service.js';
 
+// Worker image working directory; temp/ under it is a tmpfs mount.
+const WORKER_TEMP_DIR = '/app/temp';
+
+// Queue waits kept for the wait-time percentiles in stats().
+const WAIT_SAMPLES = 256;
+
 class WorkerPoolManager {
   constructor() {
     this.pool = [];
+    // Pending getWorker() calls: { resolve, reject, enqueuedAt }
     this.queue = [];
     this.isInitialized = false;
+    this.waits = [];
+    this.counters = { allocated: 0, enqueued: 0, rejected: 0 };
 
     this.dockerEnabled = !!dockerConfig.enabled;
     if (this.dockerEnabled) {
@@ -37,10 +46,9 @@ class WorkerPoolManager {
         await this.cleanupLingeringWorkers();
       }
 
-      for (let i = 0; i < dockerConfig.poolSize; i++) {
-        const worker = await this.createWorker(`worker-${i}`);
-        this.pool.push(worker);
-      }
+      const workers = await Promise.all(
+        Array.from({ length: dockerConfig.poolSize }, (_, i) => this.createWorker(`worker-${i}`)));
+      this.pool.push(...workers);
       this.isInitialized = true;
       logger.info(`Worker pool initialized with ${this.pool.length} workers.`);
 
@@ -59,12 +67,11 @@ class WorkerPoolManager {
       // Local placeholder worker (dev fallback)
       const id = `local-${name}-${Date.now()}`;
       logger.info({ name, id }, 'Created local placeholder worker.');
-      return {
+      return this.trackLoad({
         id,
         name,
-        busy: false,
         local: true,
-      };
+      });
     }
 
     try {
@@ -77,6 +84,9 @@ class WorkerPoolManager {
           Memory: dockerConfig.container.memory * 1024 * 1024,
           SecurityOpt: ['no-new-privileges:true'],
           ReadonlyRootfs: true,
+          Tmpfs: {
+            [WORKER_TEMP_DIR]: `rw,exec,nosuid,size=${dockerConfig.container.tmpfsMb}m`
+          },
         },
         Labels: {
           'com.cpp-visualizer.worker': 'true'
@@ -88,72 +98,126 @@ class WorkerPoolManager {
       const workerIp = containerInfo.NetworkSettings.IPAddress;
 
       logger.info({ name, containerId: container.id, ip: workerIp }, 'Worker container created and started.');
-      return {
+      return this.trackLoad({
         id: container.id,
         name,
         container,
         ip: workerIp,
-        busy: false,
-      };
+      });
     } catch (error) {
       logger.error({ name }, 'Failed to create worker:', error);
       throw error;
     }
   }
 
+  trackLoad(worker) {
+    worker.active = 0;
+    worker.slots = dockerConfig.slotsPerWorker;
+    return worker;
+  }
+
+  leastLoaded() {
+    let best = null;
+    for (const w of this.pool) {
+      if (w.active >= w.slots) continue;
+      if (!best || w.active / w.slots < best.active / best.slots) best = w;
+    }
+    return best;
+  }
+
+  allocate(worker, enqueuedAt = null) {
+    worker.active++;
+    this.counters.allocated++;
+    if (enqueuedAt !== null) {
+      this.waits.push(Date.now() - enqueuedAt);
+      if (this.waits.length > WAIT_SAMPLES) this.waits.shift();
+    }
+    logger.info({ workerId: worker.id, active: worker.active, slots: worker.slots }, 'Allocated worker.');
+    return worker;
+  }
+
+  /**
+   * Resolves to the least loaded worker with a free slot.  With every slot
+   * taken the request waits in the queue; a full queue rejects it so callers
+   * can shed load instead of piling up behind a saturated pool.
+   */
   getWorker() {
     return new Promise((resolve, reject) => {
       if (!this.isInitialized) {
         return reject(new Error('Worker pool is not initialized.'));
       }
-      const freeWorker = this.pool.find(w => !w.busy);
+      const freeWorker = this.leastLoaded();
       if (freeWorker) {
-        freeWorker.busy = true;
-        logger.info({ workerId: freeWorker.id }, 'Allocated worker.');
-        return resolve(freeWorker);
+        return resolve(this.allocate(freeWorker));
+      }
+
+      if (dockerConfig.maxQueue > 0 && this.queue.length >= dockerConfig.maxQueue) {
+        this.counters.rejected++;
+        logger.warn({ queued: this.queue.length }, 'Worker queue full. Rejecting request.');
+        return reject(new Error('All workers are busy, try again shortly.'));
       }
 
+      const entry = { resolve, reject, enqueuedAt: Date.now() };
+      this.counters.enqueued++;
+
       // If no free worker and we can scale up, create a new one
       if (this.pool.length < dockerConfig.maxPoolSize) {
         logger.info('No free workers, scaling up...');
+        this.queue.push(entry);
         this.createWorker(`worker-${this.pool.length}`)
           .then(newWorker => {
-            newWorker.busy = true;
             this.pool.push(newWorker);
-            logger.info({ workerId: newWorker.id }, 'Allocated new worker.');
-            resolve(newWorker);
+            this.drainQueue();
           })
           .catch(err => {
             logger.error('Failed to create new worker on-demand:', err);
-            this.queue.push(resolve);
           });
       } else {
         logger.info('All workers are busy and max pool size reached. Queueing request.');
-        this.queue.push(resolve);
+        this.queue.push(entry);
       }
     });
   }
 
   releaseWorker(worker) {
     if (!worker) return;
-    worker.busy = false;
-    logger.info({ workerId: worker.id }, 'Released worker.');
-
-    if (this.queue.length > 0) {
-      logger.info('Processing queued request.');
-      const nextResolver = this.queue.shift();
-      if (nextResolver) {
-        const freeWorker = this.pool.find(w => !w.busy);
-        if(freeWorker) {
-          freeWorker.busy = true;
-          logger.info({ workerId: freeWorker.id }, 'Allocating worker to queued request.');
-          nextResolver(freeWorker);
-        } else {
-            this.queue.unshift(nextResolver);
-        }
-      }
+    worker.active = Math.max(0, worker.active - 1);
+    logger.info({ workerId: worker.id, active: worker.active }, 'Released worker.');
+    this.drainQueue();
+  }
+
+  // Hands free slots to queued requests in arrival order.
+  drainQueue() {
+    while (this.queue.length > 0) {
+      const freeWorker = this.leastLoaded();
+      if (!freeWorker) return;
+      const { resolve, enqueuedAt } = this.queue.shift();
+      logger.info({ workerId: freeWorker.id }, 'Allocating worker to queued request.');
+      resolve(this.allocate(freeWorker, enqueuedAt));
     }
   }
+
+  /**
+   * Load and backpressure figures for monitoring: slot usage, queue depth,
+   * how long queued requests waited (ms, over the last 256) and lifetime
+   * allocation/queue/rejection counts.
+   */
+  stats() {
+    const slots = this.pool.reduce((n, w) => n + w.slots, 0);
+    const active = this.pool.reduce((n, w) => n + w.active, 0);
+    const sorted = [...this.waits].sort((a, b) => a - b);
+    const percentile = (p) => sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))] : 0;
+    return {
+      workers: this.pool.length,
+      slots,
+      active,
+      utilization: slots ? active / slots : 0,
+      queued: this.queue.length,
+      maxQueue: dockerConfig.maxQueue,
+      waitMs: { p50: percentile(0.5), p95: percentile(0.95), max: sorted[sorted.length - 1] ?? 0 },
+      ...this.counters,
+    };
+  }
   
   async executeInWorker(worker, code, language, sessionId) {
     const eventEmitter = new EventEmitter();
@@ -287,15 +351,15 @@ class WorkerPoolManager {
   }
 
   async scale() {
-    const busyWorkers = this.pool.filter(w => w.busy).length;
-    const utilization = this.pool.length > 0 ? busyWorkers / this.pool.length : 0;
-    logger.debug({ utilization, busyWorkers, poolSize: this.pool.length }, 'Checking pool utilization.');
+    const { utilization, active, queued } = this.stats();
+    logger.debug({ utilization, active, queued, poolSize: this.pool.length }, 'Checking pool utilization.');
 
-    if (utilization > dockerConfig.busyThreshold && this.pool.length < dockerConfig.maxPoolSize) {
+    if ((utilization > dockerConfig.busyThreshold || queued > 0) && this.pool.length < dockerConfig.maxPoolSize) {
       logger.info('High demand detected. Scaling up worker pool...');
       try {
         const newWorker = await this.createWorker(`worker-${this.pool.length}`);
         this.pool.push(newWorker);
+        this.drainQueue();
       } catch (e) {
         logger.error("Could not scale up worker pool", e);
       }
@@ -329,6 +393,9 @@ class WorkerPoolManager {
   async shutdown() {
     logger.info('Shutting down worker pool...');
     this.isInitialized = false;
+    for (const { reject } of this.queue.splice(0)) {
+      reject(new Error('Worker pool is shutting down.'));
+    }
     for (const worker of this.pool) {
       try {
         if (worker && worker.container) {
@@ -1,5 +1,25 @@
 import instrumentationTracer from '../services/instrumentation-tracer.service.js';
+import TraceIndex from '../services/trace-index.service.js';
+import { stepChunks } from '../services/trace-chunks.service.js';
+import { divergence } from '../services/trace-diff.service.js';
+import { v4 as uuid } from 'uuid';
 import { SOCKET_EVENTS } from '../constants/events.js';
+import { LIMITS } from '../constants/limits.js';
+
+/**
+ * A raw event as sent live: what it is and where, without the runtime's
+ * addresses and the server's file paths.
+ */
+function liveEvent(ev) {
+  return {
+    id: ev.id,
+    type: ev.type,
+    tid: ev.tid,
+    line: ev.line ?? null,
+    ...(ev.name !== undefined && { name: ev.name }),
+    ...(ev.value !== undefined && { value: ev.value })
+  };
+}
 
 /**
  * Setup Socket.io event handlers with GCC Instrumentation Tracer
@@ -9,6 +29,12 @@ export function setupSocketHandlers(io) {
   io.on('connection', (socket) => {
     console.log(`🔌 Client connected: ${socket.id}`);
 
+    // This client's most recent trace, the base of an incremental one and
+    // what seeks read: { id, steps }
+    let lastTrace = null;
+    // Seek index over it, built on the first seek
+    let traceIndex = null;
+
     // Send initial status
     socket.emit(SOCKET_EVENTS.COMPILER_STATUS, {
       compiler: 'gcc-instrumentation',
@@ -41,7 +67,7 @@ export function setupSocketHandlers(io) {
      */
     socket.on(SOCKET_EVENTS.CODE_TRACE_GENERATE, async (data) => {
       try {
-        const { code, language = 'cpp' } = data;
+        const { code, language = 'cpp', categories, stdin, encoding, baseTraceId, mode } = data;
 
         if (!code || !code.trim()) {
           socket.emit(SOCKET_EVENTS.CODE_TRACE_ERROR, {
@@ -73,8 +99,44 @@ export function setupSocketHandlers(io) {
           message: 'Analyzing execution trace...'
         });
 
-        // Generate trace
-        const traceResult = await instrumentationTracer.generateTrace(code, language);
+        // Generate trace, forwarding the newest events while the program runs
+        let capturedEvents = 0;
+        let lastProgressAt = 0;
+        let pending = [];
+        const traceResult = await instrumentationTracer.generateTrace(code, language, {
+          categories,
+          stdin: typeof stdin === 'string' ? stdin : null,
+          mode: mode === 'profile' ? 'profile' : 'trace',
+          onEvents: (batch) => {
+            capturedEvents += batch.length;
+            pending = pending.concat(batch.slice(-LIMITS.TRACE_LIVE_EVENTS)).slice(-LIMITS.TRACE_LIVE_EVENTS);
+            const now = Date.now();
+            if (now - lastProgressAt < LIMITS.TRACE_LIVE_INTERVAL_MS) return;
+            lastProgressAt = now;
+            socket.emit(SOCKET_EVENTS.CODE_TRACE_EVENTS, {
+              capturedEvents,
+              events: pending.map(liveEvent)
+            });
+            pending = [];
+            socket.emit(SOCKET_EVENTS.CODE_TRACE_PROGRESS, {
+              stage: 'executing',
+              progress: 60,
+              capturedEvents,
+              message: `Tracing... ${capturedEvents} events captured`
+            });
+          }
+        });
+
+        // A profile is one small summary and leaves the step trace alone.
+        if (traceResult?.profile) {
+          socket.emit(SOCKET_EVENTS.CODE_PROFILE_RESULT, {
+            profile: traceResult.profile,
+            functions: traceResult.functions || [],
+            metadata: { ...traceResult.metadata, socketId: socket.id, timestamp: Date.now() }
+          });
+          console.log(`✅ Generated profile for ${socket.id}`);
+          return;
+        }
 
         if (!traceResult || !traceResult.steps || traceResult.steps.length === 0) {
           throw new Error('No execution steps generated');
@@ -82,6 +144,21 @@ export function setupSocketHandlers(io) {
 
         console.log(`✅ Generated ${traceResult.totalSteps} steps for ${socket.id}`);
 
+        // A client that still shows trace `baseTraceId` (an earlier version of
+        // the program it is editing) is sent the steps from the first one
+        // that differs; before it, it keeps its own.  gzip'd chunks are
+        // reused whole, so the split falls on a chunk boundary.  The last
+        // step is always sent: the first chunk carries the header.
+        const base = baseTraceId && lastTrace?.id === baseTraceId ? lastTrace : null;
+        let reusedSteps = base
+          ? Math.min(divergence(base.steps, traceResult.steps), traceResult.steps.length - 1)
+          : 0;
+        if (encoding === 'gzip') {
+          reusedSteps -= reusedSteps % LIMITS.TRACE_COMPRESSED_CHUNK_SIZE;
+        }
+        lastTrace = { id: uuid(), steps: traceResult.steps };
+        traceIndex = null;
+
         // Progress: Formatting
         socket.emit(SOCKET_EVENTS.CODE_TRACE_PROGRESS, {
           stage: 'formatting',
@@ -89,25 +166,50 @@ export function setupSocketHandlers(io) {
           message: 'Formatting trace data...'
         });
 
-        // Send trace in single chunk (can be split if needed)
-        console.log('Backend traceResult:', JSON.stringify(traceResult, null, 2));
-        socket.emit(SOCKET_EVENTS.CODE_TRACE_CHUNK, {
-          chunkId: 0,
-          totalChunks: 1,
-          steps: traceResult.steps,
+        const header = {
           totalSteps: traceResult.totalSteps,
           globals: traceResult.globals || [],
           functions: traceResult.functions || [],
           metadata: {
             ...traceResult.metadata,
+            seek: { keyframeInterval: LIMITS.TRACE_KEYFRAME_INTERVAL },
+            traceId: lastTrace.id,
+            incremental: base ? { baseTraceId, reusedSteps } : null,
             socketId: socket.id,
             timestamp: Date.now()
           }
-        });
+        };
+
+        // Clients that ask for 'gzip' get the step chunks as compressed
+        // binary attachments: the same buffers the trace cache stores, so
+        // they are serialized once and never re-parsed on the way out.
+        // Everyone else gets the whole trace in one chunk.
+        const chunks = encoding === 'gzip'
+          ? (await stepChunks(traceResult)).slice(reusedSteps / LIMITS.TRACE_COMPRESSED_CHUNK_SIZE)
+          : null;
+        if (chunks) {
+          chunks.forEach((chunk, chunkId) => {
+            socket.emit(SOCKET_EVENTS.CODE_TRACE_CHUNK, {
+              chunkId,
+              totalChunks: chunks.length,
+              encoding: 'gzip',
+              stepCount: chunk.steps,
+              data: chunk.data,
+              ...(chunkId === 0 && header)
+            });
+          });
+        } else {
+          socket.emit(SOCKET_EVENTS.CODE_TRACE_CHUNK, {
+            chunkId: 0,
+            totalChunks: 1,
+            steps: reusedSteps ? traceResult.steps.slice(reusedSteps) : traceResult.steps,
+            ...header
+          });
+        }
 
         // Send completion
         socket.emit(SOCKET_EVENTS.CODE_TRACE_COMPLETE, {
-          totalChunks: 1,
+          totalChunks: chunks ? chunks.length : 1,
           totalSteps: traceResult.totalSteps,
           success: true,
           message: 'Trace generation complete'
@@ -125,10 +227,30 @@ export function setupSocketHandlers(io) {
       }
     });
 
+    /**
+     * Memory/stack state at a step of the last trace, without replaying it
+     * from the start.  Most traces are never sought, so the index is built
+     * by the first seek.  A seek into an older trace than the last one
+     * (`traceId`) is refused.
+     */
+    socket.on(SOCKET_EVENTS.CODE_TRACE_SEEK, ({ step, traceId } = {}) => {
+      const current = lastTrace && (!traceId || traceId === lastTrace.id);
+      if (!current || !Number.isInteger(step)) {
+        socket.emit(SOCKET_EVENTS.CODE_TRACE_ERROR, {
+          message: current ? 'Invalid step' : 'No trace to seek'
+        });
+        return;
+      }
+      traceIndex ??= new TraceIndex(lastTrace.steps);
+      socket.emit(SOCKET_EVENTS.CODE_TRACE_STATE, { step, traceId: lastTrace.id, state: traceIndex.stateAt(step) });
+    });
+
     /**
      * Disconnect handler
      */
     socket.on('disconnect', () => {
+      lastTrace = null;
+      traceIndex = null;
       console.log(`🔌 Client disconnected: ${socket.id}`);
     });
   });
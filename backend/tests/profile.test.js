@@ -0,0 +1,39 @@
+// backend/tests/profile.test.js
+import { summarizeProfile } from '../src/services/profile.service.js';
+
+const at = (line) => ({ func: 'main', file: '/tmp/src_1.cpp', line });
+
+describe('summarizeProfile', () => {
+  it('should collect the summary records of a profile run', () => {
+    const events = [
+      { type: 'trace_start', func: 'main', clock: 'monotonic' },
+      { type: 'profile_line', hits: 10, ...at(7) },
+      { type: 'profile_line', hits: 1, ...at(3) },
+      { type: 'profile_loop', loopId: 0, entries: 1, iterations: 10, timeNs: 5000, ...at(7) },
+      { type: 'profile_branch', conditionId: 0, expression: 'i % 2 == 0', evaluations: 10, taken: 5, ...at(8) },
+      { type: 'profile_branch', conditionId: 1, expression: 'x', evaluations: 0, taken: 0, ...at(9) },
+      { type: 'profile_function', func: 'main', calls: 1, inclusiveNs: 9000, exclusiveNs: 4000 },
+      { type: 'profile_function', func: 'square(int)', calls: 10, inclusiveNs: 5000, exclusiveNs: 5000 },
+      { type: 'heap_summary', func: 'main', liveBlocks: 0, liveBytes: 0, peakBytes: 4000,
+        totalAllocations: 1, totalBytes: 4000 },
+    ];
+
+    expect(summarizeProfile(events)).toEqual({
+      lines: [{ line: 3, hits: 1 }, { line: 7, hits: 10 }],
+      loops: [{ loopId: 0, line: 7, entries: 1, iterations: 10, timeNs: 5000 }],
+      branches: [
+        { conditionId: 0, line: 8, expression: 'i % 2 == 0', evaluations: 10, taken: 5, takenRatio: 0.5 },
+        { conditionId: 1, line: 9, expression: 'x', evaluations: 0, taken: 0, takenRatio: 0 },
+      ],
+      functions: [
+        { name: 'main', calls: 1, inclusiveNs: 9000, exclusiveNs: 4000 },
+        { name: 'square(int)', calls: 10, inclusiveNs: 5000, exclusiveNs: 5000 },
+      ],
+      heap: { peakBytes: 4000, totalAllocations: 1, totalBytes: 4000 },
+    });
+  });
+
+  it('should leave the heap out when the runtime wrote no summary', () => {
+    expect(summarizeProfile([])).toEqual({ lines: [], loops: [], branches: [], functions: [], heap: null });
+  });
+});
@@ -0,0 +1,119 @@
+// backend/tests/trace-cache.test.js
+import { mkdtemp, writeFile, readFile, readdir, rm } from 'fs/promises';
+import os from 'os';
+import path from 'path';
+import { TraceCache } from '../src/services/trace-cache.service.js';
+import { stepChunks } from '../src/services/trace-chunks.service.js';
+import config from '../src/config/index.js';
+
+// The subset of ioredis the cache uses.
+const fakeRedis = () => {
+  const store = new Map();
+  return {
+    store,
+    status: 'ready',
+    hset: async (key, fields) => { store.set(key, { ...fields }); return Object.keys(fields).length; },
+    expire: async () => 1,
+    hgetallBuffer: async (key) => store.get(key) ?? {},
+  };
+};
+
+const result = (n) => ({
+  steps: Array.from({ length: n }, (_, id) => ({ id, eventType: 'var_assign', name: 'x', value: id })),
+  totalSteps: n,
+  globals: [],
+  functions: [{ name: 'main' }],
+  metadata: { capturedEvents: n, cache: null },
+});
+
+describe('TraceCache', () => {
+  let dir;
+  beforeEach(async () => {
+    dir = await mkdtemp(path.join(os.tmpdir(), 'trace-cache-'));
+  });
+  afterEach(async () => {
+    await rm(dir, { recursive: true, force: true });
+  });
+
+  it('should round-trip a result split across compressed chunks', async () => {
+    const redis = fakeRedis();
+    const cache = new TraceCache({ redis, binaryDir: dir });
+    const trace = result(12000);
+
+    expect(await cache.setResult('k', trace)).toBe(true);
+    const fields = redis.store.get('trace:result:k');
+    expect(Object.keys(fields).sort()).toEqual(['0', '1', '2', 'meta']);
+    const hit = await cache.getResult('k');
+    expect(hit).toEqual(trace);
+    // The stored buffers are what gets sent, without re-encoding.
+    expect((await stepChunks(hit)).map(c => c.data)).toEqual([fields[0], fields[1], fields[2]]);
+    expect(await cache.getResult('other')).toBeNull();
+  });
+
+  it('should key results on stdin and settings but binaries only on the build', async () => {
+    const cache = new TraceCache({ redis: fakeRedis(), binaryDir: dir });
+    const key = (opts) => cache.resultKey('int main(){}', 'c', { runtimeKey: 'r1', ...opts });
+    const binary = (opts) => cache.binaryKey('int main(){}', 'c', { runtimeKey: 'r1', ...opts });
+
+    expect(await key({ stdin: '1' })).toBe(await key({ stdin: '1' }));
+    expect(await key({ stdin: '1' })).not.toBe(await key({ stdin: '2' }));
+    expect(await key({ runtimeKey: 'r2' })).not.toBe(await key({}));
+    expect(await key({ mode: 'profile' })).not.toBe(await key({}));
+    expect(await binary({ categories: ['loops', 'heap'] })).toBe(await binary({ categories: ['heap', 'loops'] }));
+    expect(await binary({ categories: ['heap'] })).not.toBe(await binary({}));
+
+    const loopHead = config.traceBudget.loopHead;
+    const before = await key({});
+    config.traceBudget.loopHead = loopHead + 1;
+    try {
+      expect(await key({})).not.toBe(before);
+    } finally {
+      config.traceBudget.loopHead = loopHead;
+    }
+  });
+
+  it('should only treat programs without clocks, randomness or files as deterministic', () => {
+    const cache = new TraceCache({ redis: fakeRedis(), binaryDir: dir });
+
+    expect(cache.isDeterministic('int main(){ int x = rand(); printf("%d", x); }')).toBe(true);
+    expect(cache.isDeterministic('int main(){ srand(time(NULL)); }')).toBe(false);
+    expect(cache.isDeterministic('FILE *f = fopen("data.txt", "r");')).toBe(false);
+    expect(cache.isDeterministic('auto t = std::chrono::steady_clock::now();')).toBe(false);
+    expect(cache.isDeterministic('pthread_create(&t, NULL, worker, NULL);')).toBe(false);
+  });
+
+  it('should skip the result tier while Redis is down', async () => {
+    const redis = { ...fakeRedis(), status: 'reconnecting' };
+    const cache = new TraceCache({ redis, binaryDir: dir });
+
+    expect(await cache.setResult('k', result(3))).toBe(false);
+    expect(await cache.getResult('k')).toBeNull();
+  });
+
+  it('should store binaries under their original names and evict the oldest', async () => {
+    const cache = new TraceCache({ binaryDir: path.join(dir, 'bin') });
+    const executable = path.join(dir, 'exec_1');
+    const sourceFile = path.join(dir, 'src_1.c');
+    await writeFile(executable, 'ELF');
+    await writeFile(sourceFile, 'int main(){}');
+
+    expect(await cache.getBinary('a')).toBeNull();
+    await cache.setBinary('a', { executable, sourceFile });
+    const hit = await cache.getBinary('a');
+    expect(path.basename(hit.sourceFile)).toBe('src_1.c');
+    expect(await readFile(hit.executable, 'utf-8')).toBe('ELF');
+
+    const maxBinaries = config.traceCache.maxBinaries;
+    config.traceCache.maxBinaries = 2;
+    try {
+      await cache.setBinary('b', { executable, sourceFile });
+      // Recency is the directory mtime, set with millisecond precision.
+      await new Promise(resolve => setTimeout(resolve, 10));
+      await cache.getBinary('a');
+      await cache.setBinary('c', { executable, sourceFile });
+    } finally {
+      config.traceCache.maxBinaries = maxBinaries;
+    }
+    expect((await readdir(path.join(dir, 'bin'))).sort()).toEqual(['a', 'c']);
+  });
+});
@@ -0,0 +1,25 @@
+// backend/tests/trace-chunks.test.js
+import { gunzipSync } from 'zlib';
+import { encodeStepChunks, decodeStepChunks, stepChunks, adoptStepChunks } from '../src/services/trace-chunks.service.js';
+
+const steps = (n) => Array.from({ length: n }, (_, id) => ({ id, eventType: 'var_assign', name: 'x', value: id }));
+
+describe('trace chunks', () => {
+  it('should split steps into gzip\'d JSON chunks and back', async () => {
+    const chunks = await encodeStepChunks(steps(250), 100);
+
+    expect(chunks.map(c => c.steps)).toEqual([100, 100, 50]);
+    expect(JSON.parse(gunzipSync(chunks[2].data))[0]).toEqual({ id: 200, eventType: 'var_assign', name: 'x', value: 200 });
+    expect(await decodeStepChunks(chunks)).toEqual(steps(250));
+    expect(await encodeStepChunks([])).toEqual([]);
+  });
+
+  it('should encode a result once and reuse adopted chunks', async () => {
+    const result = { steps: steps(10) };
+    const first = await stepChunks(result);
+    expect(await stepChunks(result)).toBe(first);
+
+    const rebuilt = adoptStepChunks({ steps: steps(10) }, first);
+    expect(await stepChunks(rebuilt)).toBe(first);
+  });
+});
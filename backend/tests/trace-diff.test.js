@@ -0,0 +1,40 @@
+// backend/tests/trace-diff.test.js
+import { divergence } from '../src/services/trace-diff.service.js';
+
+const step = (stepIndex, fields = {}) => ({
+  stepIndex, eventType: 'var_assign', line: 4 + stepIndex, file: 'src_a.c', timestamp: stepIndex * 10,
+  name: 'x', value: stepIndex, internalEvents: [], ...fields,
+});
+const trace = (n, fields) => Array.from({ length: n }, (_, i) => step(i, fields?.(i)));
+
+describe('divergence', () => {
+  it('should ignore timestamps and the source file name', () => {
+    const previous = trace(5);
+    const steps = trace(5, i => ({ file: 'src_b.c', timestamp: i * 7 + 1 }));
+
+    expect(divergence(previous, steps)).toBe(5);
+  });
+
+  it('should stop at the first step that differs, nested events included', () => {
+    const previous = trace(6, i => i === 3 ? { events: [step(0), step(1)] } : {});
+    const changedValue = trace(6, i => i === 2 ? { value: 99 } : {});
+    const changedNested = trace(6, i => i === 3 ? { events: [step(0), step(1, { value: 7 })] } : {});
+    const movedLine = trace(6, i => i >= 4 ? { line: 20 + i } : i === 3 ? { events: [step(0), step(1)] } : {});
+
+    expect(divergence(previous, changedValue)).toBe(2);
+    expect(divergence(previous, changedNested)).toBe(3);
+    expect(divergence(previous, movedLine)).toBe(4);
+  });
+
+  it('should treat added or missing fields as a change', () => {
+    expect(divergence(trace(3), trace(3, i => i === 1 ? { pointsTo: null } : {}))).toBe(1);
+    expect(divergence(trace(3, i => i === 0 ? { events: [] } : {}), trace(3))).toBe(0);
+    expect(divergence(trace(3, i => i === 1 ? { pointsTo: undefined } : {}), trace(3))).toBe(3);
+  });
+
+  it('should stop at the shorter trace when one is a prefix of the other', () => {
+    expect(divergence(trace(4), trace(7))).toBe(4);
+    expect(divergence(trace(7), trace(4))).toBe(4);
+    expect(divergence([], trace(2))).toBe(0);
+  });
+});
@@ -0,0 +1,117 @@
+// backend/tests/trace-index.test.js
+import TraceIndex, { ReplayState } from '../src/services/trace-index.service.js';
+
+const step = (eventType, fields = {}) => ({ eventType, frameId: 'main-0', callDepth: 0, ...fields });
+
+// main declares x and a 3-element array, loops calling f(n) which assigns a
+// local, and frees a heap block at the end.
+const buildSteps = () => {
+  const steps = [
+    step('program_start'),
+    step('var_declare', { name: 'x', varType: 'int' }),
+    step('array_create', { name: 'arr', baseType: 'int', dimensions: [3] }),
+    step('heap_alloc', { address: '0x1000', size: 16 }),
+  ];
+  for (let n = 0; n < 40; n++) {
+    const frameId = `f-${n}`;
+    steps.push(step('var_assign', { name: 'x', value: n }));
+    steps.push(step('array_index_assign', { name: 'arr', indices: [n % 3], value: n }));
+    steps.push({
+      eventType: 'loop_body_summary', frameId: 'main-0',
+      events: [
+        step('func_enter', { frameId, function: 'f', callDepth: 1 }),
+        step('var_declare', { frameId, name: 'y', varType: 'int' }),
+        step('var_assign', { frameId, name: 'y', value: n * 2 }),
+        step('func_exit', { frameId, function: 'f', callDepth: 1 }),
+      ],
+    });
+  }
+  steps.push(step('heap_free', { address: '0x1000' }));
+  steps.push(step('program_end'));
+  return steps;
+};
+
+const replay = (steps, n) => {
+  const state = new ReplayState();
+  for (let i = 0; i <= n; i++) TraceIndex.applyStep(state, steps[i]);
+  return state.plain();
+};
+
+describe('TraceIndex', () => {
+  it('should number steps like the frontend after expanding loop summaries', () => {
+    const index = new TraceIndex(buildSteps(), { interval: 8 });
+
+    expect(index.totalSteps).toBe(4 + 40 * 6 + 2);
+    expect(index.steps[6].eventType).toBe('func_enter');
+    expect(index.describe()).toEqual({ totalSteps: 246, keyframeInterval: 8, keyframes: 31 });
+  });
+
+  it('should match a full replay at every step', () => {
+    const index = new TraceIndex(buildSteps(), { interval: 7 });
+
+    for (let n = 0; n < index.totalSteps; n++) {
+      expect(index.stateAt(n)).toEqual(replay(index.steps, n));
+    }
+  });
+
+  it('should track frames, arrays and the heap', () => {
+    const index = new TraceIndex(buildSteps(), { interval: 16 });
+
+    const inCall = index.stateAt(4 + 6 * 5 + 4);
+    expect(inCall.callStack.map(f => f.frameId)).toEqual(['main-0', 'f-5']);
+    expect(inCall.callStack[1].locals.y.value).toBe(10);
+    expect(inCall.callStack[0].locals.x.value).toBe(5);
+    expect(inCall.arrays.arr.values).toEqual([3, 4, 5]);
+    expect(inCall.heap).toEqual({ '0x1000': { size: 16, value: null } });
+
+    const end = index.stateAt(index.totalSteps - 1);
+    expect(end.callStack).toHaveLength(1);
+    expect(end.heap).toEqual({});
+  });
+
+  it('should replay fewer than one interval of steps per seek', () => {
+    const index = new TraceIndex(buildSteps(), { interval: 10 });
+    const applyStep = TraceIndex.applyStep;
+    let applied = 0;
+    TraceIndex.applyStep = (...args) => { applied++; return applyStep(...args); };
+    try {
+      index.stateAt(239);
+    } finally {
+      TraceIndex.applyStep = applyStep;
+    }
+
+    expect(applied).toBeLessThan(10);
+  });
+
+  it('should clamp out-of-range steps', () => {
+    const index = new TraceIndex(buildSteps());
+
+    expect(index.stateAt(-5)).toEqual(replay(index.steps, 0));
+    expect(index.stateAt(1e9)).toEqual(replay(index.steps, index.totalSteps - 1));
+  });
+
+  it('should leave keyframes unchanged when seeking', () => {
+    const index = new TraceIndex(buildSteps(), { interval: 16 });
+    const before = index.stateAt(100);
+
+    index.stateAt(110).callStack[0].locals.x.value = 'changed';
+    expect(index.stateAt(100)).toEqual(before);
+    expect(index.stateAt(110)).toEqual(replay(index.steps, 110));
+  });
+
+  it('should share the parts of the state an interval did not change', () => {
+    const steps = [step('program_start'), step('array_create', { name: 'grid', baseType: 'int', dimensions: [100, 100] })];
+    for (let n = 0; n < 10000; n++) steps.push(step('array_index_assign', { name: 'grid', indices: [Math.floor(n / 100), n % 100], value: n }));
+    const index = new TraceIndex(steps, { interval: 100 });
+
+    // Each interval writes 100 elements: at most two pages of the keyframe
+    // before it are copied, the other pages are the same objects.
+    const before = index.keyframes[40].arrays.grid.pages;
+    const after = index.keyframes[41].arrays.grid.pages;
+    expect(after.filter((page, p) => page !== before[p]).length).toBeLessThanOrEqual(2);
+    expect(index.keyframes[0].callStack).toBe(index.keyframes[99].callStack);
+
+    const last = index.stateAt(index.totalSteps - 1).arrays.grid.values;
+    expect(last).toEqual(Array.from({ length: 10000 }, (_, n) => n));
+  });
+});
@@ -0,0 +1,225 @@
+// backend/tests/trace-reader.test.js
+import { BinaryTraceDecoder, decodeArrayInit, parseJsonTrace } from '../src/parsers/trace-reader.js';
+
+// Minimal encoder mirroring the layout written by tracer.cpp.
+const varint = (v) => {
+  const out = [];
+  while (v >= 0x80) {
+    out.push((v % 128) | 0x80);
+    v = Math.floor(v / 128);
+  }
+  out.push(v);
+  return out;
+};
+const zigzag = (v) => varint(v >= 0 ? v * 2 : -v * 2 - 1);
+const str = (s) => {
+  const bytes = [...Buffer.from(s, 'utf-8')];
+  return [...varint(bytes.length), ...bytes];
+};
+
+const F_INT = 1, F_STR = 3, F_PATH = 5, F_LINE = 6, F_PTR = 7, F_INDICES = 9, F_DOUBLE = 11, F_CONST = 15,
+  F_UINT = 17;
+
+const header = (version = 6) => [...Buffer.from('VTRB'), ...varint(version)];
+
+// Event header: kind, id and ts deltas, addr, func string id, depth, tid.
+const event = (kind, { id = 1, ts = 0, addr = 0, func = 1, depth = 0, tid = 0 } = {}) => [
+  ...varint(3), ...varint(kind), ...zigzag(id), ...zigzag(ts), ...varint(addr), ...varint(func), ...zigzag(depth),
+  ...varint(tid),
+];
+
+// `written` is [kind, count] pairs, `counters` [name, value] pairs.
+const footer = (total, { dropped = 0, functions = [1], written = [], counters = [] } = {}) => [
+  ...varint(4), ...varint(total), ...varint(dropped),
+  ...varint(functions.length), ...functions.flatMap(id => varint(id)),
+  ...varint(written.length), ...written.flatMap(([kind, n]) => [...varint(kind), ...varint(n)]),
+  ...varint(counters.length), ...counters.flatMap(([name, value]) => [...str(name), ...varint(value)]),
+];
+
+const buildRecords = () => [
+  ...header(),
+  // kind 0: assign
+  ...varint(1), ...varint(0), ...str('assign'), ...varint(4),
+  ...str('name'), ...varint(F_STR), ...str(''),
+  ...str('value'), ...varint(F_INT), ...str(''),
+  ...str('file'), ...varint(F_PATH), ...str(''),
+  ...str('line'), ...varint(F_LINE), ...str(''),
+  // kind 1: var (constant type overrides the event type)
+  ...varint(1), ...varint(1), ...str('var'), ...varint(3),
+  ...str('name'), ...varint(F_STR), ...str(''),
+  ...str('value'), ...varint(F_PTR), ...str(''),
+  ...str('type'), ...varint(F_CONST), ...str('pointer'),
+  // kind 2: array_index_assign
+  ...varint(1), ...varint(2), ...str('array_index_assign'), ...varint(2),
+  ...str('name'), ...varint(F_STR), ...str(''),
+  ...str('indices'), ...varint(F_INDICES), ...str(''),
+  // strings
+  ...varint(2), ...varint(1), ...str('main'),
+  ...varint(2), ...varint(2), ...str('x'),
+  ...varint(2), ...varint(3), ...str('/tmp/src.c'),
+  // events
+  ...event(0, { ts: 1000, addr: 0x401000, depth: 1 }),
+  ...varint(2), ...zigzag(-42), ...varint(3), ...zigzag(7),
+  ...event(1, { ts: 5, depth: 1 }),
+  ...varint(2), ...varint(0),
+  ...event(2, { addr: 0x401000, depth: 1 }),
+  ...varint(2), ...varint(2), ...zigzag(1), ...zigzag(3),
+];
+
+const buildTrace = (options) => Buffer.from([...buildRecords(), ...footer(3, options)]);
+
+describe('BinaryTraceDecoder', () => {
+  it('should decode events into the same shape as the JSON trace', () => {
+    const decoder = new BinaryTraceDecoder();
+    const events = decoder.push(buildTrace());
+    const trailer = decoder.end();
+
+    expect(events).toEqual([
+      { id: 1, type: 'assign', addr: '0x401000', func: 'main', depth: 1, ts: 1000, tid: 0,
+        name: 'x', value: -42, file: '/tmp/src.c', line: 7 },
+      { id: 2, type: 'pointer', addr: '(nil)', func: 'main', depth: 1, ts: 1005, tid: 0,
+        name: 'x', value: '(nil)' },
+      { id: 3, type: 'array_index_assign', addr: '0x401000', func: 'main', depth: 1, ts: 1005, tid: 0,
+        name: 'x', indices: [1, 3] },
+    ]);
+    expect(trailer).toEqual({
+      total_events: 3, dropped_events: 0, tracked_functions: ['main'], stats: { events: {} },
+    });
+  });
+
+  it('should resume records split across chunk boundaries', () => {
+    const trace = buildTrace();
+    const decoder = new BinaryTraceDecoder();
+    const events = [];
+    for (let i = 0; i < trace.length; i++) {
+      events.push(...decoder.push(trace.subarray(i, i + 1)));
+    }
+
+    expect(events.map(e => e.id)).toEqual([1, 2, 3]);
+    expect(decoder.end().total_events).toBe(3);
+  });
+
+  it('should read the dropped event count and runtime stats from the footer', () => {
+    const decoder = new BinaryTraceDecoder();
+    decoder.push(buildTrace({
+      dropped: 1200,
+      written: [[0, 1], [1, 1], [2, 1]],
+      counters: [['writerNs', 1500], ['internMisses', 2]],
+    }));
+
+    expect(decoder.end()).toEqual({
+      total_events: 3,
+      dropped_events: 1200,
+      tracked_functions: ['main'],
+      stats: { events: { assign: 1, var: 1, array_index_assign: 1 }, writerNs: 1500, internMisses: 2 },
+    });
+  });
+
+  it('should reject any other binary version', () => {
+    for (const version of [1, 5, 7]) {
+      const trace = Buffer.from([...header(version), ...footer(0, { functions: [] })]);
+      expect(() => new BinaryTraceDecoder().push(trace)).toThrow(`Unsupported binary trace version ${version}`);
+    }
+  });
+
+  it('should decode unsigned and double values', () => {
+    const half = Buffer.alloc(8);
+    half.writeDoubleLE(0.5, 0);
+    const trace = Buffer.from([
+      ...header(),
+      ...varint(1), ...varint(0), ...str('assign'), ...varint(1),
+      ...str('value'), ...varint(F_UINT), ...str(''),
+      ...varint(1), ...varint(1), ...str('assign'), ...varint(1),
+      ...str('value'), ...varint(F_DOUBLE), ...str(''),
+      ...varint(2), ...varint(1), ...str('main'),
+      ...event(0), ...varint(4000000000),
+      ...event(1), ...half,
+      ...footer(2, { functions: [] }),
+    ]);
+    const decoder = new BinaryTraceDecoder();
+    const events = decoder.push(trace);
+    decoder.end();
+
+    expect(events.map(e => e.value)).toEqual([4000000000, 0.5]);
+  });
+
+  it('should read the recording thread of each event', () => {
+    const trace = Buffer.from([
+      ...header(),
+      ...varint(1), ...varint(0), ...str('thread_create'), ...varint(1),
+      ...str('thread'), ...varint(F_UINT), ...str(''),
+      ...varint(1), ...varint(1), ...str('func_exit'), ...varint(0),
+      ...varint(2), ...varint(1), ...str('main'),
+      ...event(0, { depth: 1 }), ...varint(1),
+      ...event(1, { ts: 9, tid: 1 }),
+      ...footer(2, { functions: [] }),
+    ]);
+    const decoder = new BinaryTraceDecoder();
+    const events = decoder.push(trace);
+    decoder.end();
+
+    expect(events).toEqual([
+      { id: 1, type: 'thread_create', addr: '(nil)', func: 'main', depth: 1, ts: 0, tid: 0, thread: 1 },
+      { id: 2, type: 'func_exit', addr: '(nil)', func: 'main', depth: 0, ts: 9, tid: 1 },
+    ]);
+  });
+
+  it('should reject a truncated trace', () => {
+    const trace = buildTrace();
+    const decoder = new BinaryTraceDecoder();
+    decoder.push(trace.subarray(0, trace.length - 2));
+
+    expect(() => decoder.end()).toThrow(/Truncated/);
+  });
+
+  it('should stop at the zero tail of an unfinished mapped trace', () => {
+    const decoder = new BinaryTraceDecoder();
+    const events = decoder.push(Buffer.concat([Buffer.from(buildRecords()), Buffer.alloc(64)]));
+
+    expect(events.map(e => e.id)).toEqual([1, 2, 3]);
+    expect(decoder.push(Buffer.from([3, 0, 2]))).toEqual([]);
+  });
+
+  it('should reject input without the magic header', () => {
+    const decoder = new BinaryTraceDecoder();
+    expect(() => decoder.push(Buffer.from('{"version":"1.0"}'))).toThrow(/magic/);
+  });
+});
+
+describe('parseJsonTrace', () => {
+  it('should parse a finished trace unchanged', () => {
+    const trace = { version: '1.0', events: [{ id: 1, type: 'func_enter' }], total_events: 1 };
+    expect(parseJsonTrace(JSON.stringify(trace))).toEqual(trace);
+  });
+
+  it('should keep the whole events of a trace cut off mid-write', () => {
+    const text = '{"version":"1.0","events":[\n' +
+      '{"id":1,"type":"func_enter"},\n' +
+      '{"id":2,"type":"assign","value":3},\n' +
+      '{"id":3,"type":"ass';
+
+    expect(parseJsonTrace(text + '\0'.repeat(16))).toEqual({
+      events: [{ id: 1, type: 'func_enter' }, { id: 2, type: 'assign', value: 3 }],
+      incomplete: true,
+    });
+  });
+});
+
+describe('decodeArrayInit', () => {
+  it('should unpack little-endian elements by element type', () => {
+    const ints = Buffer.alloc(12);
+    [1, -2, 300].forEach((v, i) => ints.writeInt32LE(v, i * 4));
+    const doubles = Buffer.alloc(16);
+    doubles.writeDoubleLE(1.5, 0);
+    doubles.writeDoubleLE(-0.25, 8);
+
+    expect(decodeArrayInit({ elemType: 'i32', data: ints.toString('base64') })).toEqual([1, -2, 300]);
+    expect(decodeArrayInit({ elemType: 'f64', data: doubles.toString('base64') })).toEqual([1.5, -0.25]);
+    expect(decodeArrayInit({ elemType: 'char', data: Buffer.from('hi\0').toString('base64') }))
+      .toEqual([104, 105, 0]);
+  });
+
+  it('should reject unknown element types', () => {
+    expect(() => decodeArrayInit({ elemType: 'f128', data: '' })).toThrow(/f128/);
+  });
+});
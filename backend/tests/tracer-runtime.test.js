@@ -0,0 +1,29 @@
+// backend/tests/tracer-runtime.test.js
+import { leadingIncludes } from '../src/services/tracer-runtime.service.js';
+
+describe('leadingIncludes', () => {
+  it('should collect the system includes a program starts with', () => {
+    const source = [
+      '// Sum of squares',
+      '/* multi',
+      '   line */',
+      '#include <iostream>',
+      '',
+      '#include "trace.h"',
+      '#  include <vector>',
+      'using namespace std;',
+      '#include <map>',
+    ].join('\n');
+
+    expect(leadingIncludes(source)).toEqual(['#include <iostream>', '#  include <vector>']);
+  });
+
+  it('should stop at anything that can change what an include declares', () => {
+    expect(leadingIncludes('#define _GNU_SOURCE\n#include <stdio.h>\n')).toEqual([]);
+    expect(leadingIncludes('#include <stdio.h>\n#ifdef DEBUG\n#include <assert.h>\n#endif\n'))
+      .toEqual(['#include <stdio.h>']);
+    expect(leadingIncludes('#include <stdio.h>\n#include "util.h"\n#include <stdlib.h>\n'))
+      .toEqual(['#include <stdio.h>']);
+    expect(leadingIncludes('/* header */ int x;\n#include <stdio.h>\n')).toEqual([]);
+  });
+});
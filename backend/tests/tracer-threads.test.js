@@ -0,0 +1,93 @@
+// backend/tests/tracer-threads.test.js
+import tracer from '../src/services/instrumentation-tracer.service.js';
+
+const THREADED = `#include <pthread.h>
+#include <stdio.h>
+int work_sum(int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        s += i;
+    }
+    return s;
+}
+void* work(void* arg) {
+    return (void*)(long)work_sum(20000);
+}
+int main() {
+    pthread_t t[8];
+    for (int k = 0; k < 8; k++) pthread_create(&t[k], NULL, work, NULL);
+    for (int m = 0; m < 8; m++) pthread_join(t[m], NULL);
+    printf("done\\n");
+    return 0;
+}
+`;
+
+const EXITS_RUNNING = `#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+void* idle(void* arg) {
+    int n = 0;
+    for (int k = 0; k < 10; k++) {
+        n += k;
+    }
+    sleep(30);
+    return NULL;
+}
+int main() {
+    pthread_t t;
+    pthread_create(&t, NULL, idle, NULL);
+    int total = 0;
+    for (int i = 0; i < 200; i++) {
+        total += i;
+    }
+    printf("%d\\n", total);
+    fflush(stdout);
+    _exit(0);
+}
+`;
+
+describe('threaded traces', () => {
+  // The program is started as ./exec_<id> from the working directory.
+  const cwd = process.cwd();
+  beforeAll(async () => {
+    await tracer.ensureTempDir();
+    process.chdir(tracer.tempDir);
+  });
+  afterAll(() => process.chdir(cwd));
+
+  it('should stream events in strictly increasing id order', async () => {
+    const { executable, sourceFile, traceOutput, headerCopy } = await tracer.compile(THREADED, 'c');
+    try {
+      const ids = [];
+      const { trace } = await tracer.executeInstrumented(executable, traceOutput, {
+        onEvents: batch => { for (const ev of batch) ids.push(ev.id); }
+      });
+
+      expect(trace).not.toBeNull();
+      expect(new Set(trace.events.map(ev => ev.tid)).size).toBeGreaterThan(1);
+      let outOfOrder = 0;
+      for (let i = 1; i < ids.length; i++) {
+        if (ids[i] <= ids[i - 1]) outOfOrder++;
+      }
+      expect(outOfOrder).toBe(0);
+      expect(ids.length).toBe(trace.events.length);
+    } finally {
+      await tracer.cleanup([executable, sourceFile, traceOutput, headerCopy]);
+    }
+  }, 60000);
+
+  it('should finish the trace when _exit ends a process with threads running', async () => {
+    const { executable, sourceFile, traceOutput, headerCopy } = await tracer.compile(EXITS_RUNNING, 'c');
+    try {
+      const { stdout, trace } = await tracer.executeInstrumented(executable, traceOutput);
+
+      expect(stdout).toBe('19900\n');
+      expect(trace.incomplete).toBeUndefined();
+      expect(trace.totalEvents).toBe(trace.events.length);
+      expect(trace.events.some(ev => ev.type === 'loop_end' && ev.tid === 0)).toBe(true);
+      expect(trace.events.some(ev => ev.type === 'heap_summary')).toBe(true);
+    } finally {
+      await tracer.cleanup([executable, sourceFile, traceOutput, headerCopy]);
+    }
+  }, 60000);
+});
@@ -0,0 +1,77 @@
+// backend/tests/worker-pool.test.js
+import workerPool from '../src/services/worker-pool.service.js';
+import dockerConfig from '../src/config/docker.config.js';
+
+jest.mock('dockerode', () => jest.fn());
+jest.mock('../src/utils/logger.js', () => ({
+  __esModule: true,
+  default: { info: jest.fn(), warn: jest.fn(), error: jest.fn(), debug: jest.fn() },
+}));
+jest.mock('../src/services/session-manager.service.js', () => ({
+  __esModule: true,
+  default: { handleWorkerFailure: jest.fn() },
+}));
+
+describe('WorkerPoolManager', () => {
+  const saved = { ...dockerConfig };
+
+  // Two local workers with two slots each; no on-demand scale-up.
+  beforeEach(() => {
+    Object.assign(dockerConfig, { slotsPerWorker: 2, maxPoolSize: 2, maxQueue: 2 });
+    workerPool.pool = ['a', 'b'].map(id => workerPool.trackLoad({ id, name: id, local: true }));
+    workerPool.queue = [];
+    workerPool.waits = [];
+    workerPool.counters = { allocated: 0, enqueued: 0, rejected: 0 };
+    workerPool.isInitialized = true;
+  });
+  afterEach(() => {
+    Object.assign(dockerConfig, saved);
+  });
+
+  it('should spread jobs over the least loaded workers', async () => {
+    const first = await workerPool.getWorker();
+    const second = await workerPool.getWorker();
+    await workerPool.getWorker();
+
+    expect(first.id).not.toBe(second.id);
+    expect(workerPool.pool.map(w => w.active).sort()).toEqual([1, 2]);
+    expect(workerPool.stats()).toMatchObject({ slots: 4, active: 3, utilization: 0.75, queued: 0 });
+  });
+
+  it('should hand a released slot to the oldest queued request', async () => {
+    const held = [];
+    for (let i = 0; i < 4; i++) held.push(await workerPool.getWorker());
+
+    const order = [];
+    const waiting = [workerPool.getWorker(), workerPool.getWorker()].map((p, i) => p.then(w => {
+      order.push(i);
+      return w;
+    }));
+    expect(workerPool.stats().queued).toBe(2);
+
+    workerPool.releaseWorker(held[1]);
+    expect((await waiting[0]).id).toBe(held[1].id);
+    workerPool.releaseWorker(held[2]);
+    await waiting[1];
+
+    expect(order).toEqual([0, 1]);
+    expect(workerPool.stats()).toMatchObject({ active: 4, queued: 0, allocated: 6 });
+    expect(workerPool.waits).toHaveLength(2);
+  });
+
+  it('should reject requests once the queue is full', async () => {
+    for (let i = 0; i < 4 + dockerConfig.maxQueue; i++) workerPool.getWorker();
+
+    await expect(workerPool.getWorker()).rejects.toThrow(/busy/);
+    expect(workerPool.stats()).toMatchObject({ queued: 2, rejected: 1 });
+  });
+
+  it('should fail queued requests on shutdown', async () => {
+    for (let i = 0; i < 4; i++) await workerPool.getWorker();
+    const waiting = workerPool.getWorker();
+
+    await workerPool.shutdown();
+
+    await expect(waiting).rejects.toThrow(/shutting down/);
+  });
+});
@@ -16,6 +16,8 @@ class SocketService {
   private maxReconnectAttempts = 5;
   private eventListeners: Map<string, SocketEventCallback[]> = new Map();
   private isConnectedFlag = false;
+  // Raw steps of the last trace received, the base of the next request
+  private lastTrace: { id: string; steps: any[] } | null = null;
 
   /**
    * Connect to Socket.io server
@@ -113,9 +115,12 @@ class SocketService {
       SOCKET_EVENTS.CODE_SYNTAX_RESULT,
       SOCKET_EVENTS.CODE_SYNTAX_ERROR,
       SOCKET_EVENTS.CODE_TRACE_PROGRESS,
+      SOCKET_EVENTS.CODE_TRACE_EVENTS,
       SOCKET_EVENTS.CODE_TRACE_CHUNK,
       SOCKET_EVENTS.CODE_TRACE_COMPLETE,
       SOCKET_EVENTS.CODE_TRACE_ERROR,
+      SOCKET_EVENTS.CODE_TRACE_STATE,
+      SOCKET_EVENTS.CODE_PROFILE_RESULT,
       'execution:input_required', // Forward input required event
     ];
 
@@ -181,10 +186,44 @@ class SocketService {
   }
 
   /**
-   * Generate execution trace
+   * Generate execution trace; `categories` limits the hooks compiled into the
+   * program (variables, arrays, pointers, control, loops, blocks, functions,
+   * output), all of them when omitted.  Steps arrive as gzip'd chunks that
+   * useSocket inflates.  The server sends only the steps from the first one
+   * that differs from the last trace (see completeTrace).
    */
-  generateTrace(code: string, language: string) {
-    this.emit(SOCKET_EVENTS.CODE_TRACE_GENERATE, { code, language });
+  generateTrace(code: string, language: string, categories?: string[]) {
+    this.emit(SOCKET_EVENTS.CODE_TRACE_GENERATE, {
+      code, language, categories, encoding: 'gzip', baseTraceId: this.lastTrace?.id,
+    });
+  }
+
+  /**
+   * The raw steps of a received trace: the first `reusedSteps` of the last
+   * one followed by those sent, when the server answered incrementally.
+   */
+  completeTrace(metadata: any, steps: any[]): any[] {
+    const reused = metadata?.incremental?.reusedSteps ?? 0;
+    const all = reused && this.lastTrace ? [...this.lastTrace.steps.slice(0, reused), ...steps] : steps;
+    this.lastTrace = metadata?.traceId ? { id: metadata.traceId, steps: all } : null;
+    return all;
+  }
+
+  /**
+   * Run the program in profile mode: no steps, just per-line hit counts,
+   * loop, condition and function timings and the heap peak, answered with
+   * CODE_PROFILE_RESULT
+   */
+  generateProfile(code: string, language: string) {
+    this.emit(SOCKET_EVENTS.CODE_TRACE_GENERATE, { code, language, mode: 'profile' });
+  }
+
+  /**
+   * Request the memory/stack state at a step of the last received trace;
+   * answered with CODE_TRACE_STATE { step, traceId, state }
+   */
+  seekTrace(step: number) {
+    this.emit(SOCKET_EVENTS.CODE_TRACE_SEEK, { step, traceId: this.lastTrace?.id });
   }
 
   /**
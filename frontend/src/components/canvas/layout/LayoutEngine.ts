@@ -1377,6 +1377,22 @@ export class LayoutEngine {
       return;
     }
 
+    // ITERATIONS DROPPED BY LOOP SAMPLING
+    if (stepType === "loop_iterations_skipped") {
+      const { loopId, lastIteration } = step as any;
+      const loopState = this.activeLoops.get(loopId);
+
+      if (loopState) {
+        loopState.totalIterations = Math.max(loopState.totalIterations, lastIteration);
+
+        const loopElement = this.elementHistory.get(loopState.elementId!);
+        if (loopElement && loopElement.data) {
+          loopElement.data.totalIterations = loopState.totalIterations;
+        }
+      }
+      return;
+    }
+
     // LOOP END
     if (stepType === "loop_end") {
       const { loopId } = step as any;
@@ -38,9 +38,16 @@ export default function StepInfo() {
         return COLORS.memory.heap.DEFAULT;
       case 'loop_start':
       case 'loop_iteration':
+      case 'loop_iterations_skipped':
         return COLORS.flow.control.DEFAULT;
+      case 'thread_create':
+      case 'thread_join':
+      case 'thread_exit':
+        return COLORS.state.info;
       case 'input_request':
         return COLORS.state.warning;
+      case 'crash':
+        return COLORS.state.error;
       default:
         return COLORS.brand.primary;
     }
@@ -57,9 +64,12 @@ export default function StepInfo() {
           {currentStep.type.replace(/_/g, ' ')}
         </div>
         
-        <span className="text-xs text-[#5a6a7a] dark:text-slate-500">
-          Line {currentStep.line}
-        </span>
+        {/* Thread and crash steps have no source line */}
+        {currentStep.line > 0 && (
+          <span className="text-xs text-[#5a6a7a] dark:text-slate-500">
+            Line {currentStep.line}
+          </span>
+        )}
       </div>
 
       {/* Explanation */}
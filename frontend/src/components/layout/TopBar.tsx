@@ -9,7 +9,9 @@ import { APP_CONFIG } from '@config/app.config';
 
 export default function TopBar() {
   const { isSidebarOpen, toggleSidebar } = useUIStore();
-  const { isAnalyzing } = useExecutionStore();
+  const { isAnalyzing, liveEvents, capturedEvents } = useExecutionStore();
+  // Line the traced program last reported, while it runs
+  const liveLine = [...liveEvents].reverse().find((ev) => ev.line !== null)?.line;
   const { code } = useEditorStore();
   const { theme, toggleTheme } = useThemeStore();
   const { generateTrace, isConnected } = useSocket();
@@ -61,7 +63,11 @@ export default function TopBar() {
           className="flex items-center gap-2 rounded-lg bg-green-600 px-4 py-1.5 text-sm font-medium text-white hover:bg-green-700 disabled:opacity-50 disabled:cursor-not-allowed transition-colors"
         >
           <Play className="h-4 w-4" />
-          {isAnalyzing ? 'Analyzing...' : 'Run'}
+          {isAnalyzing
+            ? liveLine !== undefined
+              ? `Line ${liveLine} · ${capturedEvents} events`
+              : 'Analyzing...'
+            : 'Run'}
         </button>
 
         {/* File Loader */}
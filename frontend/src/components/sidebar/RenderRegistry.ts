@@ -31,95 +31,96 @@ export class RenderRegistry {
     const globals: Record<string, any> = {};
     const stack: { name: string; variables: Record<string, any> }[] = [];
 
-    // 1. Reconstruct Memory State
-    for (let i = 0; i <= currentStep && i < trace.length; i++) {
-      const step = trace[i];
+    // 1. Reconstruct Memory State from the last snapshot at or before the
+    // current step (steps of long traces get theirs from the seek index)
+    let snapshotStep = Math.min(currentStep, trace.length - 1);
+    while (snapshotStep >= 0 && !trace[snapshotStep].state) snapshotStep--;
+    const step = snapshotStep >= 0 ? trace[snapshotStep] : null;
 
-      // Always apply the full state snapshot if available
-      if (step.state) {
-        // Clear globals and stack to rebuild from snapshot
-        // This is important for ensuring the state at 'currentStep' is accurately reflected,
-        // rather than cumulatively adding from previous steps which might be incorrect
-        // if variables go out of scope or are re-declared.
-        Object.keys(globals).forEach(key => delete globals[key]); // Clear globals
-        stack.length = 0; // Clear stack
+    // Always apply the full state snapshot if available
+    if (step?.state) {
+      // Clear globals and stack to rebuild from snapshot
+      // This is important for ensuring the state at 'currentStep' is accurately reflected,
+      // rather than cumulatively adding from previous steps which might be incorrect
+      // if variables go out of scope or are re-declared.
+      Object.keys(globals).forEach(key => delete globals[key]); // Clear globals
+      stack.length = 0; // Clear stack
 
-        // Handle globals - can be Record<string, Variable> or array
-        if (step.state.globals) {
-          if (Array.isArray(step.state.globals)) {
-            // Old format: array
-            step.state.globals.forEach((globalVar: any) => {
-              globals[globalVar.name] = { 
-                type: globalVar.type, 
-                value: globalVar.value, 
-                address: globalVar.address 
+      // Handle globals - can be Record<string, Variable> or array
+      if (step.state.globals) {
+        if (Array.isArray(step.state.globals)) {
+          // Old format: array
+          step.state.globals.forEach((globalVar: any) => {
+            globals[globalVar.name] = { 
+              type: globalVar.type, 
+              value: globalVar.value, 
+              address: globalVar.address 
+            };
+          });
+        } else {
+          // New format: Record<string, Variable>
+          Object.entries(step.state.globals).forEach(([name, globalVar]: [string, any]) => {
+            globals[name] = { 
+              type: globalVar.type || globalVar.primitive, 
+              value: globalVar.value, 
+              address: globalVar.address 
+            };
+          });
+        }
+      }
+
+      // Handle stack frames - prefer callStack, fallback to stack
+      const frames = step.state.callStack || step.state.stack || [];
+      frames.forEach((frame: any) => {
+        const frameVariables: Record<string, any> = {};
+        
+        // Handle locals - can be Record<string, Variable> or array
+        if (frame.locals) {
+          if (Array.isArray(frame.locals)) {
+            frame.locals.forEach((localVar: any) => {
+              frameVariables[localVar.name] = { 
+                type: localVar.type || localVar.primitive, 
+                value: localVar.value, 
+                address: localVar.address 
               };
             });
           } else {
-            // New format: Record<string, Variable>
-            Object.entries(step.state.globals).forEach(([name, globalVar]: [string, any]) => {
-              globals[name] = { 
-                type: globalVar.type || globalVar.primitive, 
-                value: globalVar.value, 
-                address: globalVar.address 
+            Object.entries(frame.locals).forEach(([name, localVar]: [string, any]) => {
+              frameVariables[name] = { 
+                type: localVar.type || localVar.primitive, 
+                value: localVar.value, 
+                address: localVar.address 
               };
             });
           }
         }
-
-        // Handle stack frames - prefer callStack, fallback to stack
-        const frames = step.state.callStack || step.state.stack || [];
-        frames.forEach((frame: any) => {
-          const frameVariables: Record<string, any> = {};
-          
-          // Handle locals - can be Record<string, Variable> or array
-          if (frame.locals) {
-            if (Array.isArray(frame.locals)) {
-              frame.locals.forEach((localVar: any) => {
-                frameVariables[localVar.name] = { 
-                  type: localVar.type || localVar.primitive, 
-                  value: localVar.value, 
-                  address: localVar.address 
-                };
-              });
-            } else {
-              Object.entries(frame.locals).forEach(([name, localVar]: [string, any]) => {
-                frameVariables[name] = { 
-                  type: localVar.type || localVar.primitive, 
-                  value: localVar.value, 
-                  address: localVar.address 
-                };
-              });
-            }
-          }
-          
-          // Handle params if they exist
-          if (frame.params) {
-            if (Array.isArray(frame.params)) {
-              frame.params.forEach((paramVar: any) => {
-                frameVariables[paramVar.name] = { 
-                  type: paramVar.type || paramVar.primitive, 
-                  value: paramVar.value, 
-                  address: paramVar.address 
-                };
-              });
-            } else {
-              Object.entries(frame.params).forEach(([name, paramVar]: [string, any]) => {
-                frameVariables[name] = { 
-                  type: paramVar.type || paramVar.primitive, 
-                  value: paramVar.value, 
-                  address: paramVar.address 
-                };
-              });
-            }
+        
+        // Handle params if they exist
+        if (frame.params) {
+          if (Array.isArray(frame.params)) {
+            frame.params.forEach((paramVar: any) => {
+              frameVariables[paramVar.name] = { 
+                type: paramVar.type || paramVar.primitive, 
+                value: paramVar.value, 
+                address: paramVar.address 
+              };
+            });
+          } else {
+            Object.entries(frame.params).forEach(([name, paramVar]: [string, any]) => {
+              frameVariables[name] = { 
+                type: paramVar.type || paramVar.primitive, 
+                value: paramVar.value, 
+                address: paramVar.address 
+              };
+            });
           }
-          
-          stack.push({ 
-            name: frame.function || frame.name || 'unknown', 
-            variables: frameVariables 
-          });
+        }
+        
+        stack.push({ 
+          name: frame.function || frame.name || 'unknown', 
+          variables: frameVariables 
         });
-      }
+      });
     }
 
     // 2. Calculate Layout & Generate Elements
@@ -9,6 +9,7 @@ export const SOCKET_EVENTS = {
   CODE_ANALYZE_SYNTAX: 'code:analyze:syntax',
   CODE_ANALYZE_CHUNK: 'code:analyze:chunk',
   CODE_TRACE_GENERATE: 'code:trace:generate',
+  CODE_TRACE_SEEK: 'code:trace:seek',
   
   EXECUTION_INPUT_PROVIDE: 'execution:input:provide',
   EXECUTION_PAUSE: 'execution:pause',
@@ -20,9 +21,12 @@ export const SOCKET_EVENTS = {
   CODE_SYNTAX_ERROR: 'code:syntax:error',
   
   CODE_TRACE_PROGRESS: 'code:trace:progress',
+  CODE_TRACE_EVENTS: 'code:trace:events',
   CODE_TRACE_CHUNK: 'code:trace:chunk',
   CODE_TRACE_COMPLETE: 'code:trace:complete',
   CODE_TRACE_ERROR: 'code:trace:error',
+  CODE_TRACE_STATE: 'code:trace:state',
+  CODE_PROFILE_RESULT: 'code:profile:result',
   
   EXECUTION_INPUT_RECEIVED: 'execution:input:received',
   EXECUTION_PAUSED: 'execution:paused',
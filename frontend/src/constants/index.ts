@@ -99,6 +99,7 @@ export const SOCKET_EVENTS = {
   CODE_ANALYZE_SYNTAX: 'code:analyze:syntax',
   CODE_ANALYZE_CHUNK: 'code:analyze:chunk',
   CODE_TRACE_GENERATE: 'code:trace:generate',
+  CODE_TRACE_SEEK: 'code:trace:seek',
   EXECUTION_INPUT_PROVIDE: 'execution:input:provide',
   EXECUTION_PAUSE: 'execution:pause',
   EXECUTION_RESUME: 'execution:resume',
@@ -108,9 +109,12 @@ export const SOCKET_EVENTS = {
   CODE_SYNTAX_RESULT: 'code:syntax:result',
   CODE_SYNTAX_ERROR: 'code:syntax:error',
   CODE_TRACE_PROGRESS: 'code:trace:progress',
+  CODE_TRACE_EVENTS: 'code:trace:events',
   CODE_TRACE_CHUNK: 'code:trace:chunk',
   CODE_TRACE_COMPLETE: 'code:trace:complete',
   CODE_TRACE_ERROR: 'code:trace:error',
+  CODE_TRACE_STATE: 'code:trace:state',
+  CODE_PROFILE_RESULT: 'code:profile:result',
   EXECUTION_INPUT_RECEIVED: 'execution:input:received',
   EXECUTION_PAUSED: 'execution:paused',
   EXECUTION_RESUMED: 'execution:resumed',
@@ -126,6 +130,7 @@ export const LIMITS = {
   MAX_LOOP_ITERATIONS_SHOWN: 10, // Show first/last iterations only
   MAX_ARRAY_SIZE_SHOWN: 100, // Max array elements to visualize
   MAX_STACK_DEPTH: 100, // Max call stack depth
+  SEEK_MIN_STEPS: 2000, // Longer traces take each step's memory state from the server's seek index
 } as const;
 
 // ============================================
@@ -12,7 +12,9 @@ import { socketService, type SocketEventCallback } from '@services/socket.servic
 import { useExecutionStore } from '@store/slices/executionSlice';
 import { useGCCStore } from '@store/slices/gccSlice';
 import toast from 'react-hot-toast';
+import pako from 'pako';
 import { ExecutionTrace, ExecutionStep, Variable } from '@types/index';
+import { LIMITS } from '@constants/index';
 
 // ============================================================================
 // HELPER FUNCTIONS
@@ -98,6 +100,11 @@ const normalizeStepType = (type: string): string => {
     'heap_allocation': 'heap_allocation',
     'output': 'output',
     'input_request': 'input_request',
+    'loop_iterations_skipped': 'loop_iterations_skipped',
+    'thread_create': 'thread_create',
+    'thread_join': 'thread_join',
+    'thread_exit': 'thread_exit',
+    'crash': 'crash',
     
     // Backend primitive types
     'int': 'var',
@@ -181,7 +188,7 @@ export function useSocket() {
   const [isConnected, setIsConnected] = useState(false);
   const [isConnecting, setIsConnecting] = useState(false);
 
-  const { setTrace, setAnalysisProgress, setAnalyzing } = useExecutionStore();
+  const { setTrace, setAnalysisProgress, setLiveEvents, setAnalyzing, applySeekState } = useExecutionStore();
   const { setGCCStatus } = useGCCStore();
 
   const connect = useCallback(async () => {
@@ -227,9 +234,19 @@ export function useSocket() {
       setAnalysisProgress(data.progress, data.stage);
     };
 
+    // Newest events of the running program, until its trace arrives
+    const handleTraceEvents: SocketEventCallback = (data) => {
+      setLiveEvents(data.events, data.capturedEvents);
+    };
+
     let receivedChunks: any[] = [];
     
     const handleTraceChunk: SocketEventCallback = (chunk) => {
+      // gzip'd chunks carry their steps as a compressed JSON array
+      if (chunk.encoding === 'gzip') {
+        chunk.steps = JSON.parse(pako.ungzip(new Uint8Array(chunk.data), { to: 'string' }));
+        delete chunk.data;
+      }
       console.log(`📦 Chunk ${chunk.chunkId + 1}/${chunk.totalChunks}: ${chunk.steps?.length || 0} steps`);
       receivedChunks.push(chunk);
     };
@@ -250,7 +267,8 @@ export function useSocket() {
           }
         }
 
-        const allRawSteps: any[] = receivedChunks.flatMap(chunk => chunk.steps || []);
+        const allRawSteps: any[] = socketService.completeTrace(
+          receivedChunks[0]?.metadata, receivedChunks.flatMap(chunk => chunk.steps || []));
 
         // Expand internal events
         const expandedSteps: any[] = [];
@@ -285,6 +303,11 @@ export function useSocket() {
             stdout: ""
         };
         
+        // Copying the memory state into every step costs steps × state size;
+        // steps of long traces get theirs from the server's seek index when
+        // shown instead (see applySeekState).
+        const seekStates = expandedSteps.length >= LIMITS.SEEK_MIN_STEPS && !!receivedChunks[0]?.metadata?.seek;
+
         // Track arrays separately
         const arrayRegistry = new Map<string, ArrayState>();
         const variableBirthStepMap = new Map<string, number>();
@@ -292,7 +315,9 @@ export function useSocket() {
 
         expandedSteps.forEach((originalStep: any, index: number) => {
           const step = cloneStep(originalStep);
-          const nextMemoryState: MemoryState = JSON.parse(JSON.stringify(currentMemoryState));
+          const nextMemoryState: MemoryState = seekStates
+            ? currentMemoryState
+            : JSON.parse(JSON.stringify(currentMemoryState));
           
           const originalType = step.type;
           step.type = normalizeStepType(step.type);
@@ -466,7 +491,7 @@ export function useSocket() {
           // Attach current array states to step
           (step as any).arrays = Array.from(arrayRegistry.values());
           
-          step.state = nextMemoryState;
+          if (!seekStates) step.state = nextMemoryState;
           step.id = index;
           if (!step.explanation) {
             step.explanation = `Executing ${step.type} at line ${step.line}`;
@@ -497,7 +522,8 @@ export function useSocket() {
             debugger: 'instrumentation',
             hasSemanticInfo: true,
             hasArraySupport: true,
-            arrayCount: arrayRegistry.size
+            arrayCount: arrayRegistry.size,
+            seekStates
           },
         };
 
@@ -521,6 +547,11 @@ export function useSocket() {
       setAnalyzing(false);
     };
 
+    // Memory state of a step of a long trace, from the seek index
+    const handleTraceState: SocketEventCallback = (data) => {
+      applySeekState(data.traceId, data.step, data.state);
+    };
+
     const handleInputRequired: SocketEventCallback = (data) => {
       console.log('📥 Input required:', data);
     };
@@ -530,9 +561,11 @@ export function useSocket() {
     socketService.on('compiler:status', handleGCCStatus);
     socketService.on('code:syntax:error', handleSyntaxError);
     socketService.on('code:trace:progress', handleTraceProgress);
+    socketService.on('code:trace:events', handleTraceEvents);
     socketService.on('code:trace:chunk', handleTraceChunk);
     socketService.on('code:trace:complete', handleTraceComplete);
     socketService.on('code:trace:error', handleTraceError);
+    socketService.on('code:trace:state', handleTraceState);
     socketService.on('execution:input_required', handleInputRequired);
 
     return () => {
@@ -540,12 +573,14 @@ export function useSocket() {
       socketService.off('compiler:status', handleGCCStatus);
       socketService.off('code:syntax:error', handleSyntaxError);
       socketService.off('code:trace:progress', handleTraceProgress);
+      socketService.off('code:trace:events', handleTraceEvents);
       socketService.off('code:trace:chunk', handleTraceChunk);
       socketService.off('code:trace:complete', handleTraceComplete);
       socketService.off('code:trace:error', handleTraceError);
+      socketService.off('code:trace:state', handleTraceState);
       socketService.off('execution:input_required', handleInputRequired);
     };
-  }, [setTrace, setAnalyzing, setAnalysisProgress, setGCCStatus]);
+  }, [setTrace, setAnalyzing, setAnalysisProgress, setLiveEvents, setGCCStatus, applySeekState]);
 
   const generateTrace = useCallback((code: string, language: string) => {
     if (!isConnected) {
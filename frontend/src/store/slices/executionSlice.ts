@@ -3,6 +3,16 @@ import { immer } from 'zustand/middleware/immer';
 import type { ExecutionStep, ExecutionTrace, MemoryState } from '@types/index';
 import { DEFAULTS } from '@constants/index';
 import AnimationEngine from '../../animations/AnimationEngine';
+import { socketService } from '../../api/socket.service';
+
+export interface LiveTraceEvent {
+  id: number;
+  type: string;
+  tid: number;
+  line: number | null;
+  name?: string;
+  value?: any;
+}
 
 export interface ExecutionState {
   // Trace data
@@ -22,6 +32,9 @@ export interface ExecutionState {
   // Analysis progress
   analysisProgress: number;
   analysisStage: string;
+  // Newest events of the program being traced, while it runs (see useSocket)
+  liveEvents: LiveTraceEvent[];
+  capturedEvents: number;
   
   // Playback interval
   playbackInterval: NodeJS.Timeout | null;
@@ -42,8 +55,10 @@ export interface ExecutionState {
   setSpeed: (speed: number) => void;
   setAnalyzing: (isAnalyzing: boolean) => void;
   setAnalysisProgress: (progress: number, stage: string) => void;
+  setLiveEvents: (events: LiveTraceEvent[], capturedEvents: number) => void;
   startAnalysis: () => void;
   markCanvasRebuildComplete: () => void;
+  applySeekState: (traceId: string, step: number, state: any) => void;
   
   // Computed
   getCurrentStep: () => ExecutionStep | null;
@@ -65,6 +80,28 @@ const expandTrace = (steps: ExecutionStep[]): ExecutionStep[] => {
   return expanded;
 };
 
+// The seek index's state in the shape steps carry: named variables, the
+// innermost frame active.  Arrays stay on the steps' own `arrays`.
+const toMemoryState = (seek: any): MemoryState => {
+  const named = (variables: Record<string, any> = {}, scope: string) => Object.fromEntries(
+    Object.entries(variables).map(([name, v]: [string, any]) => [name, {
+      ...v, name, primitive: v.type, scope, isInitialized: v.value !== null, isAlive: true,
+    }]));
+  const frames: any[] = seek.callStack ?? [];
+  return {
+    globals: named(seek.globals, 'global'),
+    stack: [],
+    heap: seek.heap ?? {},
+    callStack: frames.map((frame, i) => ({
+      function: frame.function,
+      frameId: frame.frameId,
+      locals: named(frame.locals, 'local'),
+      isActive: i === frames.length - 1,
+    })),
+    stdout: '',
+  } as MemoryState;
+};
+
 export const useExecutionStore = create<ExecutionState>()(
   immer((set, get) => ({
     // Initial state
@@ -78,6 +115,8 @@ export const useExecutionStore = create<ExecutionState>()(
     currentState: null,
     analysisProgress: 0,
     analysisStage: 'idle',
+    liveEvents: [],
+    capturedEvents: 0,
     playbackInterval: null,
     needsCanvasRebuild: false,
 
@@ -100,6 +139,7 @@ export const useExecutionStore = create<ExecutionState>()(
         state.isAnalyzing = false;
         state.analysisProgress = 100;
         state.analysisStage = 'complete';
+        state.liveEvents = [];
         state.needsCanvasRebuild = true;
         
         if (state.playbackInterval) {
@@ -280,6 +320,8 @@ export const useExecutionStore = create<ExecutionState>()(
         if (isAnalyzing) {
           state.analysisProgress = 0;
           state.analysisStage = 'starting';
+          state.liveEvents = [];
+          state.capturedEvents = 0;
         }
       }),
 
@@ -289,11 +331,19 @@ export const useExecutionStore = create<ExecutionState>()(
         state.analysisStage = stage;
       }),
 
+    setLiveEvents: (events: LiveTraceEvent[], capturedEvents: number) =>
+      set((state) => {
+        state.liveEvents = events;
+        state.capturedEvents = capturedEvents;
+      }),
+
     startAnalysis: () =>
       set((state) => {
         state.isAnalyzing = true;
         state.analysisProgress = 0;
         state.analysisStage = 'parsing';
+        state.liveEvents = [];
+        state.capturedEvents = 0;
         state.executionTrace = null;
         state.totalSteps = 0;
         state.currentStep = 0;
@@ -321,5 +371,25 @@ export const useExecutionStore = create<ExecutionState>()(
       set((state) => {
         state.needsCanvasRebuild = false;
       }),
+
+    applySeekState: (traceId: string, step: number, seekState: any) =>
+      set((state) => {
+        const trace = state.executionTrace;
+        if (!trace || (trace.metadata as any)?.traceId !== traceId || !trace.steps[step]) return;
+        const memory = toMemoryState(seekState);
+        trace.steps[step].state = memory;
+        if (step === state.currentStep) state.currentState = memory;
+      }),
   }))
-);
\ No newline at end of file
+);
+
+// Steps of long traces carry no memory state (see useSocket): whenever the
+// step shown has none, the server's seek index is asked for it and the
+// answer lands in applySeekState.
+useExecutionStore.subscribe((state, previous) => {
+  if (state.currentStep === previous.currentStep && state.executionTrace === previous.executionTrace) return;
+  const step = state.executionTrace?.steps[state.currentStep];
+  if ((state.executionTrace?.metadata as any)?.seekStates && step && !step.state) {
+    socketService.seekTrace(state.currentStep);
+  }
+});
\ No newline at end of file
@@ -18,7 +18,12 @@ export type StepType =
   | 'output'
   | 'input_request'
   | 'program_end'
-  | 'loop_body_summary';
+  | 'loop_body_summary'
+  | 'loop_iterations_skipped'
+  | 'thread_create'
+  | 'thread_join'
+  | 'thread_exit'
+  | 'crash';
 
 export interface ClassInfo {
   members: Array<{ name: string; type: string; isField: boolean }>;
@@ -88,6 +93,8 @@ export interface ExecutionStep {
   isFunctionExit?: boolean;
   scopeDepth?: number;
   varType?: string;
+  // How the runtime encodes this variable's values, from its declaration
+  valueKind?: 'signed' | 'unsigned' | 'float' | 'char' | 'pointer' | 'other' | null;
   symbol?: string;
   returnValue?: any;
 }